@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "addrmap.h"
+
+// Mapping between IP addresses and link layer node ids.
+//
+// Frames only carry 1 byte node ids. Which node an IPv4 or IPv6
+// address belongs to is learned from the source addresses of received
+// packets, which includes the routing protocol's hellos, so a node is
+// usually known before anything is sent to it. A node that routes
+// forwards packets of hosts behind it, so their addresses map to it
+// too, but only addresses seen in packets the node sent itself are
+// marked as owned by it.
+//
+// The table is a fixed size open addressing hash table with linear
+// probing so lookups don't allocate and take a probe or two. When it
+// is full the least recently seen address is evicted.
+//
+// The addresses of this node are kept apart. They are learned from
+// packets read from the TUN interface and, if an interface name was
+// given, from the interface itself. The TCP header compressor uses
+// them to leave out the destination address of packets sent to the
+// node that owns it.
+
+struct addrmap_stats addrmap_stats;
+
+static struct addrmap_entry addrmap[ADDRMAP_SLOTS];
+static int addrmap_count = 0;
+
+struct addrmap_local_addr {
+  uint8_t addr_len;
+  uint8_t addr[ADDRMAP_MAX_ADDR_LEN];
+};
+
+static struct addrmap_local_addr addrmap_locals[ADDRMAP_MAX_LOCAL];
+static int addrmap_local_count = 0;
+
+static char addrmap_iface[IFNAMSIZ];
+
+static uint32_t addrmap_hash(const uint8_t* addr, int addr_len) {
+  uint32_t hash = 2166136261u;
+  int i;
+
+  for(i=0; i < addr_len; i++) {
+    hash = (hash ^ addr[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// iface is the interface to read our own addresses from, or NULL
+void addrmap_init(const char* iface) {
+  memset(addrmap, 0, sizeof(addrmap));
+  memset(addrmap_locals, 0, sizeof(addrmap_locals));
+  memset(&addrmap_stats, 0, sizeof(addrmap_stats));
+  addrmap_count = 0;
+  addrmap_local_count = 0;
+
+  addrmap_iface[0] = '\0';
+  if(iface) {
+    strncpy(addrmap_iface, iface, IFNAMSIZ - 1);
+    addrmap_iface[IFNAMSIZ - 1] = '\0';
+  }
+}
+
+// short hash of an address, used to tell our own addresses apart
+uint8_t addrmap_check(const uint8_t* addr, int addr_len) {
+  return addrmap_hash(addr, addr_len) >> 24;
+}
+
+// returns the slot holding addr, or the empty slot where it would go
+static int addrmap_find(const uint8_t* addr, int addr_len, uint32_t hash) {
+  struct addrmap_entry* e;
+  int i = hash & (ADDRMAP_SLOTS - 1);
+
+  while(1) {
+    e = &addrmap[i];
+    if(!e->used) {
+      return i;
+    }
+    if(e->hash == hash && e->addr_len == addr_len && !memcmp(e->addr, addr, addr_len)) {
+      return i;
+    }
+    i = (i + 1) & (ADDRMAP_SLOTS - 1);
+  }
+}
+
+// empty slot i, moving later entries of the same probe sequence back
+// so lookups never stop early at the hole
+static void addrmap_remove(int i) {
+  int j = i;
+  int home;
+
+  addrmap[i].used = 0;
+  addrmap_count--;
+
+  while(1) {
+    j = (j + 1) & (ADDRMAP_SLOTS - 1);
+    if(!addrmap[j].used) {
+      return;
+    }
+    home = addrmap[j].hash & (ADDRMAP_SLOTS - 1);
+
+    // leave it if its home slot is cyclically in (i, j]
+    if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+      continue;
+    }
+    addrmap[i] = addrmap[j];
+    addrmap[j].used = 0;
+    i = j;
+  }
+}
+
+static void addrmap_evict() {
+  int oldest = -1;
+  int i;
+
+  for(i=0; i < ADDRMAP_SLOTS; i++) {
+    if(addrmap[i].used && (oldest < 0 || addrmap[i].last_seen < addrmap[oldest].last_seen)) {
+      oldest = i;
+    }
+  }
+  if(oldest >= 0) {
+    addrmap_remove(oldest);
+    addrmap_stats.evicted++;
+  }
+}
+
+// remember that addr is reached through node, and that it is one of
+// the node's own addresses if owned
+void addrmap_learn(const uint8_t* addr, int addr_len, uint8_t node, int owned, uint64_t now) {
+  struct addrmap_entry* e;
+  uint32_t hash;
+  int i;
+
+  if(addr_len <= 0 || addr_len > ADDRMAP_MAX_ADDR_LEN) {
+    return;
+  }
+
+  hash = addrmap_hash(addr, addr_len);
+  i = addrmap_find(addr, addr_len, hash);
+  e = &addrmap[i];
+
+  if(!e->used) {
+    if(addrmap_count >= ADDRMAP_MAX_ENTRIES) {
+      addrmap_evict();
+      i = addrmap_find(addr, addr_len, hash);
+      e = &addrmap[i];
+    }
+    e->used = 1;
+    e->hash = hash;
+    e->addr_len = addr_len;
+    memcpy(e->addr, addr, addr_len);
+    addrmap_count++;
+    addrmap_stats.learned++;
+  } else if(e->node != node) {
+    e->owned = 0;
+  }
+  e->node = node;
+  e->owned |= (owned != 0);
+  e->last_seen = now;
+}
+
+// returns the node addr belongs to or -1 if unknown
+int addrmap_lookup(const uint8_t* addr, int addr_len) {
+  struct addrmap_entry* e;
+  uint32_t hash;
+
+  addrmap_stats.lookups++;
+  if(addr_len <= 0 || addr_len > ADDRMAP_MAX_ADDR_LEN) {
+    return -1;
+  }
+
+  hash = addrmap_hash(addr, addr_len);
+  e = &addrmap[addrmap_find(addr, addr_len, hash)];
+  if(!e->used) {
+    return -1;
+  }
+  addrmap_stats.hits++;
+  return e->node;
+}
+
+// returns the node that owns addr, or -1 if it isn't known to own it
+// or owns another address with the same check byte
+int addrmap_owner(const uint8_t* addr, int addr_len) {
+  struct addrmap_entry* e;
+  struct addrmap_entry* o;
+  uint8_t check;
+  int i;
+
+  if(addr_len <= 0 || addr_len > ADDRMAP_MAX_ADDR_LEN) {
+    return -1;
+  }
+
+  e = &addrmap[addrmap_find(addr, addr_len, addrmap_hash(addr, addr_len))];
+  if(!e->used || !e->owned) {
+    return -1;
+  }
+
+  check = addrmap_check(addr, addr_len);
+  for(i=0; i < ADDRMAP_SLOTS; i++) {
+    o = &addrmap[i];
+    if(o != e && o->used && o->owned && o->node == e->node && o->addr_len == addr_len
+       && addrmap_check(o->addr, addr_len) == check) {
+      return -1;
+    }
+  }
+  return e->node;
+}
+
+void addrmap_learn_local(const uint8_t* addr, int addr_len) {
+  struct addrmap_local_addr* l;
+  int i;
+
+  if(addr_len <= 0 || addr_len > ADDRMAP_MAX_ADDR_LEN) {
+    return;
+  }
+
+  for(i=0; i < addrmap_local_count; i++) {
+    l = &addrmap_locals[i];
+    if(l->addr_len == addr_len && !memcmp(l->addr, addr, addr_len)) {
+      return;
+    }
+  }
+  if(addrmap_local_count >= ADDRMAP_MAX_LOCAL) {
+    return;
+  }
+
+  l = &addrmap_locals[addrmap_local_count++];
+  l->addr_len = addr_len;
+  memcpy(l->addr, addr, addr_len);
+}
+
+// read the addresses configured on our interface
+static void addrmap_refresh_local() {
+  struct ifaddrs* ifa_list;
+  struct ifaddrs* ifa;
+  struct sockaddr* sa;
+
+  if(!addrmap_iface[0] || getifaddrs(&ifa_list) < 0) {
+    return;
+  }
+
+  for(ifa = ifa_list; ifa; ifa = ifa->ifa_next) {
+    sa = ifa->ifa_addr;
+    if(!sa || strcmp(ifa->ifa_name, addrmap_iface)) {
+      continue;
+    }
+    if(sa->sa_family == AF_INET) {
+      addrmap_learn_local((uint8_t*) &((struct sockaddr_in*) sa)->sin_addr, 4);
+    } else if(sa->sa_family == AF_INET6) {
+      addrmap_learn_local((uint8_t*) &((struct sockaddr_in6*) sa)->sin6_addr, 16);
+    }
+  }
+  freeifaddrs(ifa_list);
+}
+
+static const uint8_t* addrmap_find_local(int addr_len, uint8_t check) {
+  struct addrmap_local_addr* l;
+  const uint8_t* found = NULL;
+  int i;
+
+  for(i=0; i < addrmap_local_count; i++) {
+    l = &addrmap_locals[i];
+    if(l->addr_len == addr_len && addrmap_check(l->addr, addr_len) == check) {
+      if(found) {
+        return NULL; // can't tell which
+      }
+      found = l->addr;
+    }
+  }
+  return found;
+}
+
+// find our own address of this length with this check byte.
+// returns NULL if there is none or more than one
+const uint8_t* addrmap_local(int addr_len, uint8_t check) {
+  const uint8_t* addr;
+
+  addr = addrmap_find_local(addr_len, check);
+  if(!addr) {
+    // maybe it was only just configured
+    addrmap_refresh_local();
+    addr = addrmap_find_local(addr_len, check);
+  }
+  return addr;
+}
+
+static const char* addrmap_ntop(const uint8_t* addr, int addr_len, char* str, size_t size) {
+  if(!inet_ntop(addr_len == 4 ? AF_INET : AF_INET6, addr, str, size)) {
+    return "?";
+  }
+  return str;
+}
+
+// write the table as text, one address per line.
+// returns the length written, whole lines only
+size_t addrmap_dump(char* buf, size_t size, uint64_t now) {
+  struct addrmap_entry* e;
+  char str[INET6_ADDRSTRLEN];
+  char line[128];
+  size_t len = 0;
+  int n;
+  int i;
+
+  if(!size) {
+    return 0;
+  }
+  buf[0] = '\0';
+
+  for(i=0; i < addrmap_local_count + ADDRMAP_SLOTS; i++) {
+    if(i < addrmap_local_count) {
+      n = snprintf(line, sizeof(line), "%-40s local\n",
+                   addrmap_ntop(addrmap_locals[i].addr, addrmap_locals[i].addr_len, str, sizeof(str)));
+    } else {
+      e = &addrmap[i - addrmap_local_count];
+      if(!e->used) {
+        continue;
+      }
+      n = snprintf(line, sizeof(line), "%-40s node %3u  seen %lus ago%s\n",
+                   addrmap_ntop(e->addr, e->addr_len, str, sizeof(str)), e->node,
+                   (unsigned long) ((now - e->last_seen) / 1000000), e->owned ? "" : "  routed");
+    }
+    if(n < 0 || len + n >= size) {
+      break;
+    }
+    memcpy(buf + len, line, n + 1);
+    len += n;
+  }
+  return len;
+}
@@ -0,0 +1,45 @@
+#ifndef ADDRMAP_H
+#define ADDRMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// open addressing hash table, must be a power of two
+#define ADDRMAP_SLOTS (512)
+// keep the load factor at 3/4 so probe sequences stay short
+#define ADDRMAP_MAX_ENTRIES (ADDRMAP_SLOTS / 4 * 3)
+// addresses of this node
+#define ADDRMAP_MAX_LOCAL (8)
+
+#define ADDRMAP_MAX_ADDR_LEN (16)
+
+struct addrmap_entry {
+  uint8_t used;
+  uint8_t node;
+  uint8_t owned; // the node's own address, not one it routes for
+  uint8_t addr_len;
+  uint8_t addr[ADDRMAP_MAX_ADDR_LEN];
+  uint32_t hash;
+  uint64_t last_seen; // us
+};
+
+struct addrmap_stats {
+  unsigned long lookups;
+  unsigned long hits;
+  unsigned long learned;
+  unsigned long evicted;
+};
+
+extern struct addrmap_stats addrmap_stats;
+
+void addrmap_init(const char* iface);
+uint8_t addrmap_check(const uint8_t* addr, int addr_len);
+void addrmap_learn(const uint8_t* addr, int addr_len, uint8_t node, int owned, uint64_t now);
+int addrmap_lookup(const uint8_t* addr, int addr_len);
+int addrmap_owner(const uint8_t* addr, int addr_len);
+void addrmap_learn_local(const uint8_t* addr, int addr_len);
+const uint8_t* addrmap_local(int addr_len, uint8_t check);
+size_t addrmap_dump(char* buf, size_t size, uint64_t now);
+
+#endif
@@ -0,0 +1,579 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define AEAD_HAVE_AESNI
+#endif
+
+#include "aead.h"
+#include "link.h"
+
+// Link layer encryption (see aead.h for the frame format).
+//
+// AES-128 in CCM mode (RFC 3610) with 2 length bytes and a 13 byte
+// nonce. CCM only needs the forward cipher and keeps its strength with
+// short tags, where GCM doesn't. The CBC-MAC of one block and the
+// keystream of the next are independent, so they are computed in one
+// go: with AES-NI both run interleaved in the pipeline. Without it
+// there is a table based AES.
+//
+// Each sender node has its own window of the counters accepted from
+// it, a frame is only acted on once its tag checks out and its counter
+// hasn't been seen before.
+
+extern int debug;
+
+struct aead_stats aead_stats;
+uint64_t (*aead_clock)() = NULL;  // time of day in ms, for tests
+
+struct aead_window {
+  uint8_t valid;
+  uint64_t top;    // highest counter accepted
+  uint64_t seen;   // bit i set means top - i was accepted
+};
+
+static int aead_on = 0;
+static int aead_tag_len = AEAD_DEFAULT_TAG;
+static uint64_t aead_counter = 0;
+static unsigned long aead_sent = 0;
+static int aead_ctr_fd = -1;
+static uint64_t aead_ctr_mark = 0;  // counters from here on aren't reserved
+static struct aead_window aead_windows[LINK_BROADCAST];
+
+static uint8_t aead_rk[176];   // round keys as bytes for AES-NI
+static uint32_t aead_rk32[44]; // and as big endian words
+static uint8_t aead_sbox[256];
+static uint32_t aead_te[256];  // sbox times the MixColumns column
+
+static uint8_t aead_plain[LINK_MAX_FRAME];
+
+static void aead_block2_table(uint8_t* a, uint8_t* b);
+static void (*aead_block2)(uint8_t* a, uint8_t* b) = aead_block2_table;
+
+#define AEAD_CTR_MASK ((1ull << 47) - 1)
+#define AEAD_CTR_SHORT_MASK (0x7fff)
+
+static uint8_t aead_xtime(uint8_t x) {
+  return (x << 1) ^ ((x >> 7) * 0x1b);
+}
+
+static uint8_t aead_rotl8(uint8_t x, int n) {
+  return (x << n) | (x >> (8 - n));
+}
+
+static uint32_t aead_ror32(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static uint32_t aead_get32(const uint8_t* p) {
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void aead_put32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// the S-box from the multiplicative inverses in GF(2^8), walked as
+// powers of 3 (a generator) and its inverse
+static void aead_tables() {
+  uint8_t p = 1;
+  uint8_t q = 1;
+  uint8_t s;
+  int i;
+
+  do {
+    p = p ^ (uint8_t) (p << 1) ^ ((p & 0x80) ? 0x1b : 0);
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    if(q & 0x80) {
+      q ^= 0x09;
+    }
+    aead_sbox[p] = q ^ aead_rotl8(q, 1) ^ aead_rotl8(q, 2) ^ aead_rotl8(q, 3) ^ aead_rotl8(q, 4) ^ 0x63;
+  } while(p != 1);
+  aead_sbox[0] = 0x63;
+
+  for(i=0; i < 256; i++) {
+    s = aead_sbox[i];
+    aead_te[i] = ((uint32_t) aead_xtime(s) << 24) | (s << 16) | (s << 8) | (aead_xtime(s) ^ s);
+  }
+}
+
+static void aead_expand_key(const uint8_t* key) {
+  uint8_t rcon = 1;
+  uint8_t t[4];
+  uint8_t tmp;
+  int i, j;
+
+  memcpy(aead_rk, key, AEAD_KEY_LEN);
+  for(i=AEAD_KEY_LEN; i < (int) sizeof(aead_rk); i += 4) {
+    memcpy(t, aead_rk + i - 4, 4);
+    if(i % AEAD_KEY_LEN == 0) {
+      tmp = t[0];
+      t[0] = aead_sbox[t[1]] ^ rcon;
+      t[1] = aead_sbox[t[2]];
+      t[2] = aead_sbox[t[3]];
+      t[3] = aead_sbox[tmp];
+      rcon = aead_xtime(rcon);
+    }
+    for(j=0; j < 4; j++) {
+      aead_rk[i + j] = aead_rk[i - AEAD_KEY_LEN + j] ^ t[j];
+    }
+  }
+  for(i=0; i < 44; i++) {
+    aead_rk32[i] = aead_get32(aead_rk + i * 4);
+  }
+}
+
+static void aead_block_table(uint8_t* b) {
+  const uint32_t* rk = aead_rk32;
+  uint32_t s0, s1, s2, s3;
+  uint32_t t0, t1, t2, t3;
+  int r;
+
+  s0 = aead_get32(b) ^ rk[0];
+  s1 = aead_get32(b + 4) ^ rk[1];
+  s2 = aead_get32(b + 8) ^ rk[2];
+  s3 = aead_get32(b + 12) ^ rk[3];
+
+  for(r=1; r < 10; r++) {
+    rk += 4;
+    t0 = aead_te[s0 >> 24] ^ aead_ror32(aead_te[(s1 >> 16) & 0xff], 8)
+      ^ aead_ror32(aead_te[(s2 >> 8) & 0xff], 16) ^ aead_ror32(aead_te[s3 & 0xff], 24) ^ rk[0];
+    t1 = aead_te[s1 >> 24] ^ aead_ror32(aead_te[(s2 >> 16) & 0xff], 8)
+      ^ aead_ror32(aead_te[(s3 >> 8) & 0xff], 16) ^ aead_ror32(aead_te[s0 & 0xff], 24) ^ rk[1];
+    t2 = aead_te[s2 >> 24] ^ aead_ror32(aead_te[(s3 >> 16) & 0xff], 8)
+      ^ aead_ror32(aead_te[(s0 >> 8) & 0xff], 16) ^ aead_ror32(aead_te[s1 & 0xff], 24) ^ rk[2];
+    t3 = aead_te[s3 >> 24] ^ aead_ror32(aead_te[(s0 >> 16) & 0xff], 8)
+      ^ aead_ror32(aead_te[(s1 >> 8) & 0xff], 16) ^ aead_ror32(aead_te[s2 & 0xff], 24) ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  // last round without MixColumns
+  rk += 4;
+  aead_put32(b, (((uint32_t) aead_sbox[s0 >> 24] << 24) | (aead_sbox[(s1 >> 16) & 0xff] << 16)
+                 | (aead_sbox[(s2 >> 8) & 0xff] << 8) | aead_sbox[s3 & 0xff]) ^ rk[0]);
+  aead_put32(b + 4, (((uint32_t) aead_sbox[s1 >> 24] << 24) | (aead_sbox[(s2 >> 16) & 0xff] << 16)
+                     | (aead_sbox[(s3 >> 8) & 0xff] << 8) | aead_sbox[s0 & 0xff]) ^ rk[1]);
+  aead_put32(b + 8, (((uint32_t) aead_sbox[s2 >> 24] << 24) | (aead_sbox[(s3 >> 16) & 0xff] << 16)
+                     | (aead_sbox[(s0 >> 8) & 0xff] << 8) | aead_sbox[s1 & 0xff]) ^ rk[2]);
+  aead_put32(b + 12, (((uint32_t) aead_sbox[s3 >> 24] << 24) | (aead_sbox[(s0 >> 16) & 0xff] << 16)
+                      | (aead_sbox[(s1 >> 8) & 0xff] << 8) | aead_sbox[s2 & 0xff]) ^ rk[3]);
+}
+
+// encrypt the blocks a and b in place, b may be NULL
+static void aead_block2_table(uint8_t* a, uint8_t* b) {
+  aead_block_table(a);
+  if(b) {
+    aead_block_table(b);
+  }
+}
+
+#ifdef AEAD_HAVE_AESNI
+__attribute__((target("aes,sse2")))
+static void aead_block2_aesni(uint8_t* a, uint8_t* b) {
+  __m128i k = _mm_loadu_si128((const __m128i*) aead_rk);
+  __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*) a), k);
+  __m128i y = b ? _mm_xor_si128(_mm_loadu_si128((const __m128i*) b), k) : x;
+  int r;
+
+  for(r=1; r < 10; r++) {
+    k = _mm_loadu_si128((const __m128i*) (aead_rk + r * 16));
+    x = _mm_aesenc_si128(x, k);
+    y = _mm_aesenc_si128(y, k);
+  }
+  k = _mm_loadu_si128((const __m128i*) (aead_rk + 160));
+  _mm_storeu_si128((__m128i*) a, _mm_aesenclast_si128(x, k));
+  if(b) {
+    _mm_storeu_si128((__m128i*) b, _mm_aesenclast_si128(y, k));
+  }
+}
+#endif
+
+// switch between AES-NI and the tables.
+// returns 1 if AES-NI is used now
+int aead_use_aesni(int on) {
+  aead_block2 = aead_block2_table;
+#ifdef AEAD_HAVE_AESNI
+  if(on && __builtin_cpu_supports("aes")) {
+    aead_block2 = aead_block2_aesni;
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+// CCM block with the flags byte, the nonce and a 2 byte count
+static void aead_ccm_block(uint8_t* block, uint8_t flags, const uint8_t* nonce, size_t count) {
+  block[0] = flags;
+  memcpy(block + 1, nonce, AEAD_NONCE_LEN);
+  block[14] = count >> 8;
+  block[15] = count;
+}
+
+// CCM with the CBC-MAC one block behind the keystream, encrypt tells
+// which of in and out is the plaintext. writes len bytes to out and the
+// tag to tag
+static void aead_ccm(int encrypt, const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                     const uint8_t* in, size_t len, uint8_t* out, uint8_t* tag) {
+  uint8_t mac[16];
+  uint8_t s0[16];
+  uint8_t ks[16];
+  size_t off, n, i;
+  int pending = 0; // mac has absorbed a block but isn't encrypted yet
+
+  aead_ccm_block(mac, (aad_len ? 0x40 : 0) | (((aead_tag_len - 2) / 2) << 3) | 1, nonce, len);
+  aead_ccm_block(s0, 1, nonce, 0);
+  aead_block2(mac, s0);
+
+  // aad with its 2 byte length in front, zero padded
+  if(aad_len) {
+    mac[0] ^= aad_len >> 8;
+    mac[1] ^= aad_len;
+    for(i=0, off=2; i < aad_len; i++, off++) {
+      if(off == 16) {
+        aead_block2(mac, NULL);
+        off = 0;
+      }
+      mac[off] ^= aad[i];
+    }
+    pending = 1;
+  }
+
+  for(off=0; off < len; off += 16) {
+    n = (len - off < 16) ? len - off : 16;
+    aead_ccm_block(ks, 1, nonce, off / 16 + 1);
+    if(pending) {
+      aead_block2(mac, ks);
+    } else {
+      aead_block2(ks, NULL);
+    }
+    for(i=0; i < n; i++) {
+      out[off + i] = in[off + i] ^ ks[i];
+      mac[i] ^= encrypt ? in[off + i] : out[off + i];
+    }
+    pending = 1;
+  }
+  if(pending) {
+    aead_block2(mac, NULL);
+  }
+
+  for(i=0; i < (size_t) aead_tag_len; i++) {
+    tag[i] = mac[i] ^ s0[i];
+  }
+}
+
+// key and tag length to seal and open frames with, counter is the
+// first frame counter to use
+int aead_set_key(const uint8_t* key, int tag_len, uint64_t counter) {
+  if(tag_len < AEAD_MIN_TAG || tag_len > AEAD_MAX_TAG || tag_len % 2) {
+    fprintf(stderr, "Tag length must be %d, 6 or %d bytes\n", AEAD_MIN_TAG, AEAD_MAX_TAG);
+    return -1;
+  }
+
+  aead_tables();
+  aead_expand_key(key);
+  aead_use_aesni(1);
+  aead_tag_len = tag_len;
+  aead_counter = counter & AEAD_CTR_MASK;
+  if(aead_ctr_fd >= 0) {
+    close(aead_ctr_fd);
+    aead_ctr_fd = -1;
+  }
+  aead_sent = 0;
+  memset(aead_windows, 0, sizeof(aead_windows));
+  memset(&aead_stats, 0, sizeof(aead_stats));
+  aead_on = 1;
+  return 0;
+}
+
+static uint64_t aead_time_ms() {
+  struct timespec ts;
+
+  if(aead_clock) {
+    return aead_clock();
+  }
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// write the counter file so that the counters up to mark can be used,
+// it has to be on disk before the first of them is
+static int aead_reserve(uint64_t mark) {
+  char buf[32];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "%" PRIu64 "\n", mark);
+  if(pwrite(aead_ctr_fd, buf, len, 0) != len || ftruncate(aead_ctr_fd, len) < 0 || fsync(aead_ctr_fd) < 0) {
+    perror("Failed to save the frame counter");
+    return -1;
+  }
+  aead_ctr_mark = mark;
+  return 0;
+}
+
+// open the counter file at path, creating it if needed, and start the
+// counter at the mark saved in it or the time of day, whichever is ahead
+static int aead_open_counter(const char* path) {
+  char buf[32];
+  uint64_t saved = 0;
+  uint64_t now;
+  ssize_t len;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open frame counter %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  len = read(fd, buf, sizeof(buf) - 1);
+  if(len > 0) {
+    buf[len] = '\0';
+    if(sscanf(buf, "%" SCNu64, &saved) != 1) {
+      fprintf(stderr, "Frame counter %s isn't valid\n", path);
+      close(fd);
+      return -1;
+    }
+  }
+
+  now = aead_time_ms();
+  aead_counter = ((saved > now) ? saved : now) & AEAD_CTR_MASK;
+  aead_ctr_fd = fd;
+  if(aead_reserve(aead_counter + AEAD_CTR_RESERVE) < 0) {
+    close(fd);
+    aead_ctr_fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+// read a key of 32 hex digits, e.g. from
+//   head -c 16 /dev/urandom | od -An -tx1 | tr -d ' \n'
+// the frame counter is kept in a file named after it with
+// AEAD_CTR_SUFFIX, which stays open to be written after root
+// privileges are dropped
+int aead_load_key(const char* path, int tag_len) {
+  char ctr_path[4096];
+  uint8_t key[AEAD_KEY_LEN];
+  char buf[128];
+  ssize_t len;
+  int digits = 0;
+  int fd;
+  int i;
+  int v;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open key file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  len = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(len < 0) {
+    fprintf(stderr, "Failed to read key file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  memset(key, 0, sizeof(key));
+  for(i=0; i < len; i++) {
+    if(buf[i] >= '0' && buf[i] <= '9') {
+      v = buf[i] - '0';
+    } else if(buf[i] >= 'a' && buf[i] <= 'f') {
+      v = buf[i] - 'a' + 10;
+    } else if(buf[i] >= 'A' && buf[i] <= 'F') {
+      v = buf[i] - 'A' + 10;
+    } else if(buf[i] == ' ' || buf[i] == '\n' || buf[i] == '\r' || buf[i] == '\t') {
+      continue;
+    } else {
+      break;
+    }
+    if(digits == AEAD_KEY_LEN * 2) {
+      break;
+    }
+    key[digits / 2] |= v << ((digits % 2) ? 0 : 4);
+    digits++;
+  }
+  memset(buf, 0, sizeof(buf));
+  if(i < len || digits != AEAD_KEY_LEN * 2) {
+    fprintf(stderr, "Key file %s must hold %d hex digits\n", path, AEAD_KEY_LEN * 2);
+    return -1;
+  }
+
+  if(aead_set_key(key, tag_len, 0) < 0) {
+    return -1;
+  }
+  memset(key, 0, sizeof(key));
+  snprintf(ctr_path, sizeof(ctr_path), "%s%s", path, AEAD_CTR_SUFFIX);
+  if(aead_open_counter(ctr_path) < 0) {
+    aead_on = 0;
+    return -1;
+  }
+  return 0;
+}
+
+int aead_enabled() {
+  return aead_on;
+}
+
+// bytes a sealed frame can take beyond its header and payload
+size_t aead_overhead() {
+  return aead_on ? AEAD_CTR_FULL + aead_tag_len : 0;
+}
+
+static void aead_nonce(uint8_t* nonce, uint8_t src, uint64_t counter) {
+  int i;
+
+  memset(nonce, 0, AEAD_NONCE_LEN);
+  nonce[0] = src;
+  for(i=0; i < 6; i++) {
+    nonce[1 + i] = counter >> (40 - 8 * i);
+  }
+}
+
+// seal a frame with the encoded link header hdr (LINK_F_SEC set).
+// writes the counter, ciphertext and tag to out and returns their
+// length or -1 if they don't fit or the counter file can't be written
+ssize_t aead_seal(const uint8_t* hdr, size_t hdr_len, const uint8_t* in, size_t len, uint8_t* out, size_t size) {
+  uint8_t nonce[AEAD_NONCE_LEN];
+  uint64_t counter;
+  size_t ctr_len;
+  int i;
+
+  ctr_len = (aead_sent < AEAD_SYNC_INTERVAL || aead_sent % AEAD_SYNC_INTERVAL == 0)
+    ? AEAD_CTR_FULL : AEAD_CTR_SHORT;
+  if(ctr_len + len + aead_tag_len > size) {
+    return -1;
+  }
+
+  // never seal with a counter that isn't saved as used
+  if(aead_ctr_fd >= 0 && aead_counter >= aead_ctr_mark && aead_reserve(aead_counter + AEAD_CTR_RESERVE) < 0) {
+    return -1;
+  }
+
+  counter = aead_counter;
+  aead_counter = (aead_counter + 1) & AEAD_CTR_MASK;
+  aead_sent++;
+
+  if(ctr_len == AEAD_CTR_FULL) {
+    for(i=0; i < 6; i++) {
+      out[i] = counter >> (40 - 8 * i);
+    }
+    out[0] |= 0x80;
+    aead_stats.tx_sync++;
+  } else {
+    out[0] = (counter >> 8) & 0x7f;
+    out[1] = counter;
+  }
+
+  aead_nonce(nonce, hdr[1], counter);
+  aead_ccm(1, nonce, hdr, hdr_len, in, len, out + ctr_len, out + ctr_len + len);
+  aead_stats.tx_sealed++;
+  return ctr_len + len + aead_tag_len;
+}
+
+// the counter closest to the highest one accepted with these low bits
+static uint64_t aead_expand_counter(uint64_t top, uint64_t low) {
+  uint64_t counter;
+
+  counter = (top & ~(uint64_t) AEAD_CTR_SHORT_MASK) | low;
+  if(counter > top + AEAD_CTR_SHORT_MASK / 2 && counter > AEAD_CTR_SHORT_MASK) {
+    counter -= AEAD_CTR_SHORT_MASK + 1;
+  } else if(counter + AEAD_CTR_SHORT_MASK / 2 < top) {
+    counter += AEAD_CTR_SHORT_MASK + 1;
+  }
+  return counter & AEAD_CTR_MASK;
+}
+
+static int aead_replayed(const struct aead_window* w, uint64_t counter) {
+  if(!w->valid || counter > w->top) {
+    return 0;
+  }
+  return (w->top - counter >= AEAD_WINDOW) || ((w->seen >> (w->top - counter)) & 1);
+}
+
+static void aead_accept(struct aead_window* w, uint64_t counter) {
+  if(!w->valid) {
+    w->valid = 1;
+    w->top = counter;
+    w->seen = 1;
+  } else if(counter > w->top) {
+    w->seen = (counter - w->top >= AEAD_WINDOW) ? 0 : w->seen << (counter - w->top);
+    w->seen |= 1;
+    w->top = counter;
+  } else {
+    w->seen |= 1ull << (w->top - counter);
+  }
+}
+
+// open a frame with the encoded link header hdr, in is what follows the
+// header. points out at the payload and returns its length, or returns
+// -1 if it isn't sealed, doesn't check out or was seen before
+ssize_t aead_open(const uint8_t* hdr, size_t hdr_len, const uint8_t* in, size_t len, const uint8_t** out) {
+  struct aead_window* w;
+  uint8_t nonce[AEAD_NONCE_LEN];
+  uint8_t tag[AEAD_MAX_TAG];
+  uint64_t counter = 0;
+  size_t ctr_len;
+  uint8_t diff = 0;
+  int i;
+
+  if(!aead_on || !(hdr[0] & LINK_F_SEC)) {
+    aead_stats.rx_unsealed++;
+    return -1;
+  }
+  w = &aead_windows[hdr[1]];
+
+  ctr_len = (len && (in[0] & 0x80)) ? AEAD_CTR_FULL : AEAD_CTR_SHORT;
+  if(len < ctr_len + aead_tag_len) {
+    aead_stats.rx_auth_failed++;
+    return -1;
+  }
+  for(i=0; i < (int) ctr_len; i++) {
+    counter = (counter << 8) | in[i];
+  }
+  if(ctr_len == AEAD_CTR_FULL) {
+    counter &= AEAD_CTR_MASK;
+  } else if(!w->valid) {
+    aead_stats.rx_no_sync++;
+    return -1;
+  } else {
+    counter = aead_expand_counter(w->top, counter);
+  }
+
+  if(aead_replayed(w, counter)) {
+    aead_stats.rx_replayed++;
+    return -1;
+  }
+
+  len -= ctr_len + aead_tag_len;
+  aead_nonce(nonce, hdr[1], counter);
+  aead_ccm(0, nonce, hdr, hdr_len, in + ctr_len, len, aead_plain, tag);
+  for(i=0; i < aead_tag_len; i++) {
+    diff |= tag[i] ^ in[ctr_len + len + i];
+  }
+  if(diff) {
+    aead_stats.rx_auth_failed++;
+    if(debug) {
+      printf("Dropping frame from %d that failed authentication\n", hdr[1]);
+    }
+    return -1;
+  }
+
+  aead_accept(w, counter);
+  aead_stats.rx_opened++;
+  *out = aead_plain;
+  return len;
+}
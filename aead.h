@@ -0,0 +1,64 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Sealed frames (LINK_F_SEC) carry a frame counter, the payload
+// encrypted with AES-128-CCM and a truncated tag:
+//
+//   link header | counter | ciphertext | tag
+//
+// The link header is authenticated as it is. The nonce is the source
+// node id and the sender's frame counter, which counts frames. It
+// starts at the time of day in ms or, if that is behind, at the mark
+// saved in the counter file next to the key. The mark is always
+// AEAD_CTR_RESERVE ahead of the counters used, so a node that is
+// restarted never uses a counter again, even if its clock went back.
+// Only the low 15 bits of the counter are sent unless the top bit of
+// the first byte is set, then it is 6 bytes with all 47 bits. Senders
+// send the full counter for their first frames and every
+// AEAD_SYNC_INTERVAL frames after that, receivers fill in the high bits
+// from the highest counter accepted from that node.
+
+#define AEAD_KEY_LEN (16)
+#define AEAD_NONCE_LEN (13)
+#define AEAD_MIN_TAG (4)
+#define AEAD_MAX_TAG (8)
+#define AEAD_DEFAULT_TAG (4)
+
+#define AEAD_CTR_SHORT (2)
+#define AEAD_CTR_FULL (6)
+#define AEAD_MAX_OVERHEAD (AEAD_CTR_FULL + AEAD_MAX_TAG)
+
+#define AEAD_SYNC_INTERVAL (16)
+// counters written to the counter file ahead of use at a time
+#define AEAD_CTR_RESERVE (1 << 16)
+#define AEAD_CTR_SUFFIX ".counter"
+// counters this far behind the highest one are still accepted once
+#define AEAD_WINDOW (64)
+
+struct aead_stats {
+  unsigned long tx_sealed;
+  unsigned long tx_sync;        // with the full counter
+  unsigned long rx_opened;
+  unsigned long rx_unsealed;    // frames in the clear
+  unsigned long rx_no_sync;     // short counter from a node we have no counter for
+  unsigned long rx_replayed;    // counter seen before or too old
+  unsigned long rx_auth_failed;
+};
+
+extern struct aead_stats aead_stats;
+extern uint64_t (*aead_clock)();
+
+int aead_load_key(const char* path, int tag_len);
+int aead_set_key(const uint8_t* key, int tag_len, uint64_t counter);
+int aead_enabled();
+int aead_use_aesni(int on);
+size_t aead_overhead();
+
+ssize_t aead_seal(const uint8_t* hdr, size_t hdr_len, const uint8_t* in, size_t len, uint8_t* out, size_t size);
+ssize_t aead_open(const uint8_t* hdr, size_t hdr_len, const uint8_t* in, size_t len, const uint8_t** out);
+
+#endif
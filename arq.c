@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arq.h"
+
+// Selective-repeat ARQ for unicast frames.
+//
+// Each peer gets a window of ARQ_WINDOW sequence numbers.
+// Receivers answer with the next sequence number they expect
+// plus a bitmap of what they got beyond that, either piggybacked
+// on a frame going the other way or in a header-only ack frame.
+// Frames are handed to the TUN interface as they arrive since IP
+// does not need in-order delivery, so a lost frame never holds up
+// the ones behind it on the receiving side.
+// On the sending side a frame is dropped once it has used up its
+// tries, which bounds how long it can occupy the window.
+
+extern int debug;
+
+struct arq_stats arq_stats;
+
+static struct arq_peer arq_peers[ARQ_MAX_PEERS];
+static int arq_max_tries = 0; // 0 means ARQ is disabled
+static uint64_t arq_turnaround_us = ARQ_DEFAULT_TURNAROUND_US;
+static uint64_t arq_us_per_byte = ARQ_DEFAULT_US_PER_BYTE;
+
+// the frame currently handed to the radio, if it came from us
+static struct arq_slot* arq_inflight_slot = NULL;
+
+static uint64_t arq_clock = 0; // only used for peer LRU ordering
+
+void arq_init(int max_tries, uint64_t turnaround_us) {
+  memset(arq_peers, 0, sizeof(arq_peers));
+  memset(&arq_stats, 0, sizeof(arq_stats));
+  arq_max_tries = max_tries;
+  arq_turnaround_us = turnaround_us;
+  arq_us_per_byte = ARQ_DEFAULT_US_PER_BYTE;
+  arq_inflight_slot = NULL;
+}
+
+int arq_enabled() {
+  return (arq_max_tries > 0);
+}
+
+static struct arq_peer* arq_find_peer(uint8_t node) {
+  int i;
+
+  for(i=0; i < ARQ_MAX_PEERS; i++) {
+    if(arq_peers[i].used && arq_peers[i].node == node) {
+      arq_peers[i].last_used = ++arq_clock;
+      return &arq_peers[i];
+    }
+  }
+  return NULL;
+}
+
+static int arq_peer_idle(struct arq_peer* peer) {
+  return (peer->tx_base == peer->tx_next && !peer->ack_pending);
+}
+
+// find or create peer state, evicting the least recently used idle peer
+static struct arq_peer* arq_get_peer(uint8_t node) {
+  struct arq_peer* peer;
+  struct arq_peer* victim = NULL;
+  int i;
+
+  peer = arq_find_peer(node);
+  if(peer) {
+    return peer;
+  }
+
+  for(i=0; i < ARQ_MAX_PEERS; i++) {
+    if(!arq_peers[i].used) {
+      victim = &arq_peers[i];
+      break;
+    }
+    if(!arq_peer_idle(&arq_peers[i])) {
+      continue;
+    }
+    if(!victim || arq_peers[i].last_used < victim->last_used) {
+      victim = &arq_peers[i];
+    }
+  }
+  if(!victim) {
+    return NULL;
+  }
+
+  memset(victim, 0, sizeof(struct arq_peer));
+  victim->used = 1;
+  victim->node = node;
+  victim->last_used = ++arq_clock;
+  return victim;
+}
+
+static uint8_t arq_in_flight(struct arq_peer* peer) {
+  return (uint8_t)(peer->tx_next - peer->tx_base);
+}
+
+// move tx_base past slots that have been acked or dropped
+static void arq_advance(struct arq_peer* peer) {
+  while(peer->tx_base != peer->tx_next) {
+    if(peer->slots[peer->tx_base % ARQ_WINDOW].state != ARQ_SLOT_FREE) {
+      break;
+    }
+    peer->tx_base++;
+  }
+}
+
+static void arq_free_slot(struct arq_peer* peer, struct arq_slot* slot) {
+  if(slot == arq_inflight_slot) {
+    // the radio is still sending it, forget that it was ours
+    arq_inflight_slot = NULL;
+  }
+  slot->state = ARQ_SLOT_FREE;
+}
+
+int arq_window_full(uint8_t node) {
+  struct arq_peer* peer = arq_find_peer(node);
+
+  if(!peer) {
+    return 0;
+  }
+  return (arq_in_flight(peer) >= ARQ_WINDOW);
+}
+
+// frames in the windows of all peers, sent or not
+int arq_pending() {
+  int count = 0;
+  int i;
+
+  for(i=0; i < ARQ_MAX_PEERS; i++) {
+    if(arq_peers[i].used) {
+      count += arq_in_flight(&arq_peers[i]);
+    }
+  }
+  return count;
+}
+
+// tag (may be NULL) is the packet's trace timestamps
+int arq_enqueue(uint8_t node, uint8_t flags, const uint8_t* data, size_t len, const struct trace_tag* tag) {
+  struct arq_peer* peer;
+  struct arq_slot* slot;
+
+  if(len > LINK_MAX_FRAME) {
+    return -1;
+  }
+
+  peer = arq_get_peer(node);
+  if(!peer) {
+    return 1; // every peer is busy
+  }
+  if(arq_in_flight(peer) >= ARQ_WINDOW) {
+    return 1;
+  }
+
+  slot = &peer->slots[peer->tx_next % ARQ_WINDOW];
+  slot->state = ARQ_SLOT_QUEUED;
+  slot->flags = flags;
+  slot->seq = peer->tx_next;
+  slot->tries = 0;
+  slot->deadline = 0;
+  slot->len = len;
+  memcpy(slot->data, data, len);
+  if(tag) {
+    slot->tag = *tag;
+  } else {
+    memset(&slot->tag, 0, sizeof(slot->tag));
+  }
+  peer->tx_next++;
+
+  return 0;
+}
+
+uint64_t arq_airtime_us(size_t frame_len) {
+  return arq_us_per_byte * (frame_len + ARQ_PHY_OVERHEAD);
+}
+
+// the ack can only come after the peer's rx window closes
+// and it may be busy sending a full frame of its own first
+uint64_t arq_rto_us(int tries) {
+  uint64_t rto;
+
+  rto = arq_turnaround_us
+    + arq_airtime_us(LINK_HDR_MAX_LEN)
+    + arq_airtime_us(LINK_MAX_FRAME);
+
+  while(--tries > 0 && rto < ARQ_MAX_RTO_US) {
+    rto *= 2;
+  }
+  if(rto > ARQ_MAX_RTO_US) {
+    rto = ARQ_MAX_RTO_US;
+  }
+  return rto;
+}
+
+void arq_fill_ack(struct link_hdr* hdr) {
+  struct arq_peer* peer;
+
+  if(hdr->dst == LINK_BROADCAST) {
+    return;
+  }
+
+  peer = arq_find_peer(hdr->dst);
+  if(!peer || !peer->rx_active) {
+    return;
+  }
+
+  hdr->flags |= LINK_F_ACK;
+  hdr->ack = peer->rx_next;
+  hdr->sack = peer->rx_bitmap;
+  peer->ack_pending = 0;
+}
+
+// pick the next frame to send:
+// the oldest due (re)transmission, otherwise a bare ack.
+// acks are sent even when our own sending side is disabled.
+// returns 1 if hdr/data/len were filled in, 0 if there is nothing to send
+int arq_next_frame(uint64_t now, struct link_hdr* hdr, const uint8_t** data, size_t* len) {
+  struct arq_peer* peer;
+  struct arq_slot* slot;
+  uint8_t seq;
+  int i;
+
+  for(i=0; i < ARQ_MAX_PEERS; i++) {
+    peer = &arq_peers[i];
+    if(!peer->used) {
+      continue;
+    }
+
+    for(seq = peer->tx_base; seq != peer->tx_next; seq++) {
+      slot = &peer->slots[seq % ARQ_WINDOW];
+
+      if(slot->state == ARQ_SLOT_WAITING && slot->deadline > now) {
+        continue;
+      }
+      if(slot->state != ARQ_SLOT_QUEUED && slot->state != ARQ_SLOT_WAITING) {
+        continue;
+      }
+
+      if(slot->tries >= arq_max_tries) {
+        if(debug) {
+          printf("ARQ: giving up on seq %u to node %u\n", slot->seq, peer->node);
+        }
+        arq_stats.dropped++;
+        arq_free_slot(peer, slot);
+        continue;
+      }
+
+      if(slot->tries) {
+        arq_stats.retransmits++;
+      } else {
+        arq_stats.tx_new++;
+      }
+      slot->tries++;
+      slot->state = ARQ_SLOT_INFLIGHT;
+      arq_inflight_slot = slot;
+
+      memset(hdr, 0, sizeof(struct link_hdr));
+      hdr->flags = LINK_F_ARQ | slot->flags;
+      hdr->dst = peer->node;
+      hdr->seq = slot->seq;
+      arq_fill_ack(hdr);
+      *data = slot->data;
+      *len = slot->len;
+      return 1;
+    }
+    arq_advance(peer);
+  }
+
+  for(i=0; i < ARQ_MAX_PEERS; i++) {
+    peer = &arq_peers[i];
+    if(!peer->used || !peer->ack_pending) {
+      continue;
+    }
+    memset(hdr, 0, sizeof(struct link_hdr));
+    hdr->dst = peer->node;
+    arq_fill_ack(hdr);
+    arq_stats.acks_sent++;
+    *data = NULL;
+    *len = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+// trace timestamps of the frame handed to the radio,
+// NULL if it is a retransmission or a bare ack
+const struct trace_tag* arq_inflight_tag() {
+  if(!arq_inflight_slot || arq_inflight_slot->tries != 1) {
+    return NULL;
+  }
+  return &arq_inflight_slot->tag;
+}
+
+void arq_tx_done(int ok, size_t frame_len, uint64_t airtime_us, uint64_t now) {
+  uint64_t per_byte;
+
+  if(ok && airtime_us > 0) {
+    // EWMA with a weight of 1/8 for the new sample
+    per_byte = airtime_us / (frame_len + ARQ_PHY_OVERHEAD);
+    arq_us_per_byte = (arq_us_per_byte * 7 + per_byte) / 8;
+  }
+
+  if(!arq_inflight_slot) {
+    return;
+  }
+
+  arq_inflight_slot->state = ARQ_SLOT_WAITING;
+  if(ok) {
+    arq_inflight_slot->deadline = now + arq_rto_us(arq_inflight_slot->tries);
+  } else {
+    arq_inflight_slot->deadline = now; // never made it on air
+  }
+
+  arq_inflight_slot = NULL;
+}
+
+void arq_handle_ack(uint8_t node, uint8_t ack, uint8_t sack) {
+  struct arq_peer* peer;
+  struct arq_slot* slot;
+  uint8_t seq;
+  int i;
+
+  peer = arq_find_peer(node);
+  if(!peer) {
+    return;
+  }
+
+  // ignore acks that don't refer to the current window
+  if((uint8_t)(ack - peer->tx_base) > arq_in_flight(peer)) {
+    return;
+  }
+
+  for(seq = peer->tx_base; seq != ack; seq++) {
+    slot = &peer->slots[seq % ARQ_WINDOW];
+    if(slot->state != ARQ_SLOT_FREE) {
+      arq_stats.acked++;
+      arq_free_slot(peer, slot);
+    }
+  }
+
+  for(i=0; i < 8; i++) {
+    if(!(sack & (1 << i))) {
+      continue;
+    }
+    seq = ack + 1 + i;
+    if((uint8_t)(seq - peer->tx_base) >= arq_in_flight(peer)) {
+      break;
+    }
+    slot = &peer->slots[seq % ARQ_WINDOW];
+    if(slot->state != ARQ_SLOT_FREE) {
+      arq_stats.acked++;
+      arq_free_slot(peer, slot);
+    }
+  }
+
+  arq_advance(peer);
+}
+
+// move the receive window on by one sequence number,
+// skipping over anything already received beyond it
+static void arq_rx_slide(struct arq_peer* peer) {
+  peer->rx_next++;
+  while(peer->rx_bitmap & 1) {
+    peer->rx_bitmap >>= 1;
+    peer->rx_next++;
+  }
+  peer->rx_bitmap >>= 1;
+}
+
+// record reception of an ARQ frame from node.
+// returns 1 if the frame is new and should be delivered, 0 if duplicate
+int arq_receive(uint8_t node, uint8_t seq) {
+  struct arq_peer* peer;
+  uint8_t offset;
+
+  peer = arq_get_peer(node);
+  if(!peer) {
+    return 1; // can't track it, deliver anyway
+  }
+  peer->ack_pending = 1;
+
+  if(!peer->rx_active) {
+    peer->rx_active = 1;
+    peer->rx_next = seq;
+    peer->rx_bitmap = 0;
+  }
+
+  offset = (uint8_t)(seq - peer->rx_next);
+
+  // a retransmission of something we already have
+  if(offset >= (uint8_t)(256 - ARQ_WINDOW)) {
+    arq_stats.rx_dups++;
+    return 0;
+  }
+
+  // further back than any sender window allows: the peer restarted
+  if(offset >= 128) {
+    arq_stats.rx_resync++;
+    peer->rx_next = seq;
+    peer->rx_bitmap = 0;
+    offset = 0;
+  }
+
+  // beyond the bitmap: the sender gave up on the frames in between
+  while(offset > 8) {
+    arq_rx_slide(peer);
+    offset = (uint8_t)(seq - peer->rx_next);
+  }
+
+  if(offset == 0) {
+    arq_rx_slide(peer);
+    arq_stats.rx_new++;
+    return 1;
+  }
+
+  if(peer->rx_bitmap & (1 << (offset - 1))) {
+    arq_stats.rx_dups++;
+    return 0;
+  }
+  peer->rx_bitmap |= (1 << (offset - 1));
+  arq_stats.rx_new++;
+  return 1;
+}
@@ -0,0 +1,88 @@
+#ifndef ARQ_H
+#define ARQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "link.h"
+#include "trace.h"
+
+// frames in flight per peer. must fit the 8 bit sack bitmap
+#define ARQ_WINDOW (8)
+#define ARQ_MAX_PEERS (16)
+#define ARQ_DEFAULT_RETRIES (4)
+
+// time from end of our transmission until the peer can answer:
+// rest of its rx window plus serial transfer of the ack command
+#define ARQ_DEFAULT_TURNAROUND_US (250000)
+
+// preamble, phy header and crc expressed in payload bytes
+// for the purpose of airtime estimation
+#define ARQ_PHY_OVERHEAD (8)
+
+// ~SF12/125kHz until the first transmission has been measured
+#define ARQ_DEFAULT_US_PER_BYTE (27000)
+
+#define ARQ_MAX_RTO_US (60000000)
+
+#define ARQ_SLOT_FREE (0)
+#define ARQ_SLOT_QUEUED (1)   // never sent
+#define ARQ_SLOT_INFLIGHT (2) // handed to the radio
+#define ARQ_SLOT_WAITING (3)  // sent, waiting for ack or timeout
+
+struct arq_slot {
+  uint8_t state;
+  uint8_t flags; // link flags of the payload
+  uint8_t seq;
+  uint8_t tries;
+  uint64_t deadline;
+  struct trace_tag tag;
+  size_t len;
+  uint8_t data[LINK_MAX_FRAME];
+};
+
+struct arq_peer {
+  uint8_t used;
+  uint8_t node;
+  uint64_t last_used;
+
+  // sending side
+  uint8_t tx_base; // oldest unacknowledged sequence number
+  uint8_t tx_next; // next sequence number to assign
+  struct arq_slot slots[ARQ_WINDOW]; // indexed by seq % ARQ_WINDOW
+
+  // receiving side
+  uint8_t rx_active;
+  uint8_t rx_next;   // next sequence number expected
+  uint8_t rx_bitmap; // bit i set means rx_next+1+i was received
+  uint8_t ack_pending;
+};
+
+struct arq_stats {
+  unsigned long tx_new;
+  unsigned long retransmits;
+  unsigned long dropped;
+  unsigned long acks_sent;
+  unsigned long acked;
+  unsigned long rx_new;
+  unsigned long rx_dups;
+  unsigned long rx_resync;
+};
+
+extern struct arq_stats arq_stats;
+
+void arq_init(int max_tries, uint64_t turnaround_us);
+int arq_enabled();
+int arq_window_full(uint8_t node);
+int arq_pending();
+int arq_enqueue(uint8_t node, uint8_t flags, const uint8_t* data, size_t len, const struct trace_tag* tag);
+int arq_next_frame(uint64_t now, struct link_hdr* hdr, const uint8_t** data, size_t* len);
+const struct trace_tag* arq_inflight_tag();
+void arq_fill_ack(struct link_hdr* hdr);
+void arq_tx_done(int ok, size_t frame_len, uint64_t airtime_us, uint64_t now);
+void arq_handle_ack(uint8_t node, uint8_t ack, uint8_t sack);
+int arq_receive(uint8_t node, uint8_t seq);
+uint64_t arq_airtime_us(size_t frame_len);
+uint64_t arq_rto_us(int tries);
+
+#endif
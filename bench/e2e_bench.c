@@ -0,0 +1,716 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+
+#include "rnsim.h"
+
+// End-to-end benchmark: two lora_iface processes talking over
+// simulated RN2903 modules (see sim/rnsim.c). Each daemon gets one
+// end of a socketpair instead of a TUN interface (-T) so no root is
+// needed. Traffic is written into node A's and node B's "TUN" and
+// timed until it comes out on the other side.
+//
+// Traffic mixes:
+//   udp:   small IPv4 UDP packets from A to B at a fixed rate
+//   tcp:   IPv4 TCP-like bulk transfer from A to B with a fixed
+//          window, and pure ACKs from B for every second segment
+//   hello: routing hellos (IPv6 link-local multicast) from both nodes
+//   mix:   all of the above
+//
+// The result is printed as one line of JSON.
+
+#define BENCH_MAX_PACKETS (100000)
+#define BENCH_MAX_ARGS (32)
+#define BENCH_MAX_WINDOW (32)
+
+#define BENCH_UDP_PAYLOAD (32)
+#define BENCH_TCP_PAYLOAD (400)
+#define BENCH_HELLO_PAYLOAD (24)
+#define BENCH_HELLO_INTERVAL_US (4000000)
+#define BENCH_TCP_RTO_US (20000000)  // give up on a segment after this long
+#define BENCH_WARMUP_US (500000)
+#define BENCH_MAX_DRAIN_US (30000000)
+
+#define BENCH_MAGIC (0x4c42454e) // "LBEN", starts every payload
+
+#define BENCH_A (0)
+#define BENCH_B (1)
+
+int debug = 0;
+
+struct bench_node {
+  pid_t pid;
+  int tun;      // our end of the daemon's "TUN" socketpair
+  int tun_peer; // the daemon's end
+  int slave;    // PTY slave, kept open
+  char pty[64];
+  char sock[64];
+  char stats[64];
+  uint8_t ip4[4];
+  uint8_t ip6[16];
+};
+
+struct bench_tcp_slot {
+  int active;
+  uint32_t id;
+  uint64_t sent;
+};
+
+static struct bench_node nodes[2];
+
+// per packet id
+static uint64_t sent_at[BENCH_MAX_PACKETS];
+static uint8_t delivered[BENCH_MAX_PACKETS];
+static uint64_t latencies[BENCH_MAX_PACKETS];
+static uint32_t packet_count = 0;
+
+static unsigned long delivered_count = 0;
+static unsigned long duplicates = 0;
+static unsigned long send_failed = 0;
+static unsigned long tcp_lost = 0;
+static unsigned long tcp_acks = 0;
+static uint64_t payload_bytes = 0;
+
+static struct bench_tcp_slot tcp_window[BENCH_MAX_WINDOW];
+static int tcp_window_size = 4;
+static uint32_t tcp_seq = 1;
+static uint32_t tcp_rcv_segments = 0;
+
+static uint64_t now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint16_t ip_checksum(const uint8_t* p, size_t len) {
+  uint32_t sum = 0;
+  size_t i;
+
+  for(i=0; i + 1 < len; i += 2) {
+    sum += (p[i] << 8) | p[i+1];
+  }
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+// tagged payload: magic, packet id, then something sensor-like
+static void fill_payload(uint8_t* p, size_t len, uint32_t id) {
+  static const char text[] = "{\"node\":\"bench\",\"temperature\":21.5,\"humidity\":40}";
+  size_t i;
+
+  put32(p, BENCH_MAGIC);
+  put32(p + 4, id);
+  for(i=8; i < len; i++) {
+    p[i] = text[(i - 8) % (sizeof(text) - 1)];
+  }
+}
+
+static size_t ipv4_hdr(uint8_t* p, const struct bench_node* src, const struct bench_node* dst,
+                       uint8_t proto, size_t len) {
+  static uint16_t ip_id = 0;
+
+  memset(p, 0, 20);
+  p[0] = 0x45;
+  put16(p + 2, len);
+  put16(p + 4, ip_id++);
+  p[6] = 0x40;
+  p[8] = 64;
+  p[9] = proto;
+  memcpy(p + 12, src->ip4, 4);
+  memcpy(p + 16, dst->ip4, 4);
+  put16(p + 10, ip_checksum(p, 20));
+  return 20;
+}
+
+static size_t build_udp(uint8_t* p, const struct bench_node* src, const struct bench_node* dst,
+                        uint32_t id) {
+  size_t len = 20 + 8 + BENCH_UDP_PAYLOAD;
+
+  ipv4_hdr(p, src, dst, 17, len);
+  put16(p + 20, 5000);
+  put16(p + 22, 5000);
+  put16(p + 24, 8 + BENCH_UDP_PAYLOAD);
+  put16(p + 26, 0);
+  fill_payload(p + 28, BENCH_UDP_PAYLOAD, id);
+  return len;
+}
+
+// data_len of 0 makes a pure ACK without a tag
+static size_t build_tcp(uint8_t* p, const struct bench_node* src, const struct bench_node* dst,
+                        uint32_t seq, uint32_t ack, size_t data_len, uint32_t id) {
+  size_t len = 20 + 20 + data_len;
+  uint8_t* tcp = p + 20;
+
+  ipv4_hdr(p, src, dst, 6, len);
+  memset(tcp, 0, 20);
+  put16(tcp, 40000);
+  put16(tcp + 2, 80);
+  put32(tcp + 4, seq);
+  put32(tcp + 8, ack);
+  tcp[12] = 5 << 4;
+  tcp[13] = data_len ? 0x18 : 0x10; // PSH ACK or ACK
+  put16(tcp + 14, 29200);
+  put16(tcp + 16, 0x1234);
+  if(data_len) {
+    fill_payload(tcp + 20, data_len, id);
+  }
+  return len;
+}
+
+static size_t build_hello(uint8_t* p, const struct bench_node* src, uint32_t id) {
+  size_t len = 40 + 8 + BENCH_HELLO_PAYLOAD;
+
+  memset(p, 0, 48);
+  p[0] = 0x60;
+  put16(p + 4, 8 + BENCH_HELLO_PAYLOAD);
+  p[6] = 17;
+  p[7] = 1;
+  memcpy(p + 8, src->ip6, 16);
+  p[24] = 0xff; p[25] = 0x02; p[37] = 0x01; p[38] = 0x00; p[39] = 0x06; // ff02::1:6
+  put16(p + 40, 6696);
+  put16(p + 42, 6696);
+  put16(p + 44, 8 + BENCH_HELLO_PAYLOAD);
+  put16(p + 46, 0xffff);
+  fill_payload(p + 48, BENCH_HELLO_PAYLOAD, id);
+  return len;
+}
+
+static int new_packet_id(uint32_t* id) {
+  if(packet_count >= BENCH_MAX_PACKETS) {
+    return -1;
+  }
+  *id = packet_count++;
+  sent_at[*id] = now_us();
+  return 0;
+}
+
+static void send_packet(struct bench_node* n, const uint8_t* pkt, size_t len) {
+  if(send(n->tun, pkt, len, MSG_DONTWAIT) < 0) {
+    send_failed++;
+  }
+}
+
+static void send_udp() {
+  uint8_t pkt[200];
+  uint32_t id;
+
+  if(new_packet_id(&id) == 0) {
+    send_packet(&nodes[BENCH_A], pkt, build_udp(pkt, &nodes[BENCH_A], &nodes[BENCH_B], id));
+  }
+}
+
+static void send_hello(int from) {
+  uint8_t pkt[200];
+  uint32_t id;
+
+  if(new_packet_id(&id) == 0) {
+    send_packet(&nodes[from], pkt, build_hello(pkt, &nodes[from], id));
+  }
+}
+
+// keep the TCP window full
+static void send_tcp(uint64_t now) {
+  struct bench_tcp_slot* s;
+  uint8_t pkt[600];
+  int i;
+
+  for(i=0; i < tcp_window_size; i++) {
+    s = &tcp_window[i];
+    if(s->active && now - s->sent > BENCH_TCP_RTO_US) {
+      s->active = 0;
+      tcp_lost++;
+    }
+    if(s->active) {
+      continue;
+    }
+    if(new_packet_id(&s->id) < 0) {
+      return;
+    }
+    s->active = 1;
+    s->sent = now;
+    send_packet(&nodes[BENCH_A], pkt, build_tcp(pkt, &nodes[BENCH_A], &nodes[BENCH_B],
+                                                tcp_seq, 1, BENCH_TCP_PAYLOAD, s->id));
+    tcp_seq += BENCH_TCP_PAYLOAD;
+  }
+}
+
+static void tcp_segment_arrived(uint32_t id) {
+  uint8_t pkt[100];
+  int i;
+
+  for(i=0; i < tcp_window_size; i++) {
+    if(tcp_window[i].active && tcp_window[i].id == id) {
+      tcp_window[i].active = 0;
+    }
+  }
+
+  // delayed ACK style: every second segment
+  if(++tcp_rcv_segments % 2 == 0) {
+    tcp_acks++;
+    send_packet(&nodes[BENCH_B], pkt, build_tcp(pkt, &nodes[BENCH_B], &nodes[BENCH_A],
+                                                1, 1 + tcp_rcv_segments * BENCH_TCP_PAYLOAD, 0, 0));
+  }
+}
+
+// find the tagged payload of a packet that came out of a daemon
+static void handle_packet(const uint8_t* pkt, size_t len, uint64_t now) {
+  const uint8_t* payload = NULL;
+  size_t payload_len = 0;
+  size_t hlen;
+  int tcp = 0;
+  uint32_t id;
+
+  if(len >= 20 && (pkt[0] >> 4) == 4) {
+    hlen = (pkt[0] & 0x0f) * 4;
+    if(pkt[9] == 17 && len >= hlen + 8) {
+      payload = pkt + hlen + 8;
+      payload_len = len - hlen - 8;
+    } else if(pkt[9] == 6 && len >= hlen + 20) {
+      tcp = 1;
+      hlen += (pkt[hlen + 12] >> 4) * 4;
+      if(len >= hlen) {
+        payload = pkt + hlen;
+        payload_len = len - hlen;
+      }
+    }
+  } else if(len >= 48 && (pkt[0] >> 4) == 6 && pkt[6] == 17) {
+    payload = pkt + 48;
+    payload_len = len - 48;
+  }
+
+  if(!payload || payload_len < 8 || get32(payload) != BENCH_MAGIC) {
+    return; // e.g. a TCP ACK
+  }
+  id = get32(payload + 4);
+  if(id >= packet_count) {
+    return;
+  }
+  if(delivered[id]) {
+    duplicates++;
+    return;
+  }
+
+  delivered[id] = 1;
+  latencies[delivered_count++] = now - sent_at[id];
+  payload_bytes += payload_len;
+
+  if(tcp) {
+    tcp_segment_arrived(id);
+  }
+}
+
+static int receive_packets(struct bench_node* n, uint64_t now) {
+  uint8_t pkt[2048];
+  ssize_t len;
+
+  while(1) {
+    len = recv(n->tun, pkt, sizeof(pkt), MSG_DONTWAIT);
+    if(len < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return 0;
+      }
+      return -1;
+    }
+    if(len == 0) {
+      return -1; // daemon is gone
+    }
+    handle_packet(pkt, len, now);
+  }
+}
+
+static pid_t start_daemon(const char* path, struct bench_node* n, int node_id,
+                          char** extra, int extra_count) {
+  char* argv[BENCH_MAX_ARGS + 14];
+  char fd_str[16], id_str[16];
+  int argc = 0;
+  int devnull;
+  pid_t pid;
+  int i;
+
+  snprintf(fd_str, sizeof(fd_str), "%d", n->tun_peer);
+  snprintf(id_str, sizeof(id_str), "%d", node_id);
+
+  argv[argc++] = (char*) path;
+  argv[argc++] = (char*) "-s";
+  argv[argc++] = n->pty;
+  argv[argc++] = (char*) "-T";
+  argv[argc++] = fd_str;
+  argv[argc++] = (char*) "-u";
+  argv[argc++] = n->sock;
+  argv[argc++] = (char*) "-S";
+  argv[argc++] = n->stats;
+  argv[argc++] = (char*) "-n";
+  argv[argc++] = id_str;
+  if(debug) {
+    argv[argc++] = (char*) "-d";
+  }
+  for(i=0; i < extra_count; i++) {
+    argv[argc++] = extra[i];
+  }
+  argv[argc] = NULL;
+
+  pid = fork();
+  if(pid != 0) {
+    return pid;
+  }
+
+  if(!debug) {
+    devnull = open("/dev/null", O_WRONLY);
+    if(devnull >= 0) {
+      dup2(devnull, STDOUT_FILENO);
+    }
+  }
+  execv(path, argv);
+  fprintf(stderr, "Failed to run %s: %s\n", path, strerror(errno));
+  _exit(127);
+}
+
+// only the simulated radios, no traffic
+static void run_sim_for(uint64_t us) {
+  uint64_t now, next, end = now_us() + us;
+  struct timeval timeout;
+  fd_set fdset;
+  int maxfd;
+
+  while((now = now_us()) < end) {
+    FD_ZERO(&fdset);
+    maxfd = rnsim_fd_set(&fdset, -1);
+    next = rnsim_next_event(now);
+    if(next > end) {
+      next = end;
+    }
+    timeout.tv_sec = (next - now) / 1000000;
+    timeout.tv_usec = (next - now) % 1000000;
+    if(select(maxfd + 1, &fdset, NULL, NULL, &timeout) <= 0) {
+      FD_ZERO(&fdset);
+    }
+    rnsim_handle_fds(&fdset, now_us());
+  }
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+
+  return (x > y) - (x < y);
+}
+
+static uint64_t percentile(double p) {
+  size_t i;
+
+  if(!delivered_count) {
+    return 0;
+  }
+  i = p * (delivered_count - 1) + 0.5;
+  return latencies[i];
+}
+
+void usage(FILE* out, char* name) {
+  fprintf(out, "Usage: %s [-v] [-m mix] [-t seconds] [-r pps] [-w window] [-S sf] [-l loss] [-x speedup] [-a daemon_args] [-b lora_iface] [-L label]\n", name);
+  fprintf(out, "\n");
+  fprintf(out, "  -v: show debug output of the simulator and daemons\n");
+  fprintf(out, "  -m: traffic mix: udp, tcp, hello or mix (default: mix)\n");
+  fprintf(out, "  -t: seconds to send traffic for (default: 30)\n");
+  fprintf(out, "  -r: UDP packets per second (default: 1)\n");
+  fprintf(out, "  -w: TCP segments in flight (default: 4, max: %d)\n", BENCH_MAX_WINDOW);
+  fprintf(out, "  -S: spreading factor of the simulated radios (default: 7)\n");
+  fprintf(out, "  -l: frame loss probability (default: 0)\n");
+  fprintf(out, "  -x: run the simulated radios this many times faster (default: 1)\n");
+  fprintf(out, "  -a: extra arguments for lora_iface, e.g. \"-r 4 -t\"\n");
+  fprintf(out, "  -b: lora_iface binary (default: ./lora_iface)\n");
+  fprintf(out, "  -L: label to include in the output\n");
+}
+
+int main(int argc, char* argv[]) {
+  struct rnsim_params params;
+  struct rusage usage_children;
+  struct bench_node* n;
+  char* daemon_path = (char*) "./lora_iface";
+  char* extra[BENCH_MAX_ARGS];
+  int extra_count = 0;
+  const char* mix = "mix";
+  const char* label = "";
+  double duration = 30;
+  double udp_rate = 1;
+  int sf = 7;
+  int do_udp, do_tcp, do_hello;
+  uint64_t start, gen_end, end, now, next, next_udp, next_hello;
+  uint64_t airtime_us = 0;
+  unsigned long tx_frames = 0, rx_frames = 0, rx_lost = 0, rx_collided = 0;
+  double airtime_s, bitrate, cpu_us, elapsed_s;
+  struct timeval timeout;
+  fd_set fdset;
+  int sv[2];
+  int maxfd;
+  int opt;
+  int ret;
+  int i;
+  char* tok;
+
+  memset(&params, 0, sizeof(params));
+  params.baud = 57600;
+  params.speedup = 1;
+
+  while((opt = getopt(argc, argv, "vm:t:r:w:S:l:x:a:b:L:")) > 0) {
+    switch(opt) {
+      case 'v':
+        debug = 1;
+        break;
+      case 'm':
+        mix = optarg;
+        break;
+      case 't':
+        duration = atof(optarg);
+        break;
+      case 'r':
+        udp_rate = atof(optarg);
+        break;
+      case 'w':
+        tcp_window_size = atoi(optarg);
+        if(tcp_window_size < 1 || tcp_window_size > BENCH_MAX_WINDOW) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'S':
+        sf = atoi(optarg);
+        break;
+      case 'l':
+        params.loss = atof(optarg);
+        break;
+      case 'x':
+        params.speedup = atof(optarg);
+        break;
+      case 'a':
+        for(tok = strtok(optarg, " "); tok && extra_count < BENCH_MAX_ARGS; tok = strtok(NULL, " ")) {
+          extra[extra_count++] = tok;
+        }
+        break;
+      case 'b':
+        daemon_path = optarg;
+        break;
+      case 'L':
+        label = optarg;
+        break;
+      default:
+        usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+
+  do_udp = !strcmp(mix, "udp") || !strcmp(mix, "mix");
+  do_tcp = !strcmp(mix, "tcp") || !strcmp(mix, "mix");
+  do_hello = !strcmp(mix, "hello") || !strcmp(mix, "mix");
+  if(!do_udp && !do_tcp && !do_hello) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+  if(sf < 7 || sf > 12 || udp_rate <= 0) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  rnsim_init(&params, 1);
+
+  for(i=0; i < 2; i++) {
+    n = &nodes[i];
+
+    memset(n->ip4, 0, 4);
+    n->ip4[0] = 10; n->ip4[3] = i + 1;
+    memset(n->ip6, 0, 16);
+    n->ip6[0] = 0xfe; n->ip6[1] = 0x80; n->ip6[15] = i + 1;
+
+    ret = rnsim_open_pty(n->pty, sizeof(n->pty), &n->slave);
+    if(ret < 0) {
+      fprintf(stderr, "Failed to open a PTY: %s\n", strerror(errno));
+      return 1;
+    }
+    rnsim_add_node(ret);
+    rnsim_nodes[i].sf = sf;
+
+    // SOCK_SEQPACKET keeps packet boundaries like a TUN device
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+      fprintf(stderr, "socketpair failed: %s\n", strerror(errno));
+      return 1;
+    }
+    n->tun = sv[0];
+    n->tun_peer = sv[1];
+    fcntl(n->tun, F_SETFD, FD_CLOEXEC);
+    snprintf(n->sock, sizeof(n->sock), "/tmp/e2e_bench.%d.%d.sock", (int) getpid(), i);
+    snprintf(n->stats, sizeof(n->stats), "/dev/shm/e2e_bench.%d.%d.stats", (int) getpid(), i);
+  }
+
+  for(i=0; i < 2; i++) {
+    if(i > 0) {
+      // started together, both daemons would open and close their rx
+      // windows in lockstep and never hear each other's frames start
+      run_sim_for(50 * rnsim_symbol_us(&rnsim_nodes[0]) / params.speedup);
+    }
+    nodes[i].pid = start_daemon(daemon_path, &nodes[i], i + 1, extra, extra_count);
+    if(nodes[i].pid < 0) {
+      fprintf(stderr, "fork failed: %s\n", strerror(errno));
+      return 1;
+    }
+    close(nodes[i].tun_peer);
+  }
+
+  start = now_us();
+  gen_end = start + BENCH_WARMUP_US + duration * 1000000;
+  end = gen_end + BENCH_MAX_DRAIN_US;
+  next_udp = start + BENCH_WARMUP_US;
+  next_hello = start + BENCH_WARMUP_US;
+
+  while(1) {
+    now = now_us();
+
+    if(now >= start + BENCH_WARMUP_US && now < gen_end) {
+      if(do_udp) {
+        while(next_udp <= now) {
+          send_udp();
+          next_udp += 1000000 / udp_rate;
+        }
+      }
+      if(do_hello && next_hello <= now) {
+        send_hello(BENCH_A);
+        send_hello(BENCH_B);
+        next_hello += BENCH_HELLO_INTERVAL_US;
+      }
+      if(do_tcp) {
+        send_tcp(now);
+      }
+    }
+
+    if(now >= end || (now >= gen_end && delivered_count + duplicates >= packet_count)) {
+      break;
+    }
+
+    FD_ZERO(&fdset);
+    maxfd = rnsim_fd_set(&fdset, -1);
+    for(i=0; i < 2; i++) {
+      FD_SET(nodes[i].tun, &fdset);
+      maxfd = (nodes[i].tun > maxfd) ? nodes[i].tun : maxfd;
+    }
+
+    next = rnsim_next_event(now);
+    if(now < gen_end) {
+      if(do_udp && next_udp < next) {
+        next = next_udp;
+      }
+      if(do_hello && next_hello < next) {
+        next = next_hello;
+      }
+      if(do_tcp && now + 100000 < next) {
+        next = now + 100000; // for segment timeouts
+      }
+    }
+    if(next > end) {
+      next = end;
+    }
+    if(next < now) {
+      next = now;
+    }
+    timeout.tv_sec = (next - now) / 1000000;
+    timeout.tv_usec = (next - now) % 1000000;
+
+    ret = select(maxfd + 1, &fdset, NULL, NULL, &timeout);
+    if(ret < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "select failed: %s\n", strerror(errno));
+      break;
+    }
+    if(ret == 0) {
+      FD_ZERO(&fdset);
+    }
+
+    now = now_us();
+    if(rnsim_handle_fds(&fdset, now) < 0) {
+      fprintf(stderr, "Serial line error\n");
+      break;
+    }
+    for(i=0; i < 2; i++) {
+      if(FD_ISSET(nodes[i].tun, &fdset) && receive_packets(&nodes[i], now) < 0) {
+        fprintf(stderr, "lora_iface for node %d exited\n", i);
+        end = now;
+      }
+    }
+  }
+
+  elapsed_s = (now_us() - start - BENCH_WARMUP_US) / 1e6;
+
+  for(i=0; i < 2; i++) {
+    kill(nodes[i].pid, SIGTERM);
+    waitpid(nodes[i].pid, NULL, 0);
+    unlink(nodes[i].sock);
+    unlink(nodes[i].stats);
+    airtime_us += rnsim_nodes[i].airtime_us;
+    tx_frames += rnsim_nodes[i].tx_frames;
+    rx_frames += rnsim_nodes[i].rx_frames;
+    rx_lost += rnsim_nodes[i].rx_lost;
+    rx_collided += rnsim_nodes[i].rx_collided;
+  }
+  getrusage(RUSAGE_CHILDREN, &usage_children);
+  cpu_us = usage_children.ru_utime.tv_sec * 1e6 + usage_children.ru_utime.tv_usec
+    + usage_children.ru_stime.tv_sec * 1e6 + usage_children.ru_stime.tv_usec;
+
+  qsort(latencies, delivered_count, sizeof(uint64_t), compare_u64);
+
+  // back to real radio time, then how much of it carried payload
+  airtime_s = airtime_us * params.speedup / 1e6;
+  bitrate = sf * 125000.0 / (1 << sf) * 4.0 / 5.0;
+
+  printf("{\"label\":\"%s\",\"mix\":\"%s\",\"sf\":%d,\"loss\":%.3f,\"speedup\":%.1f,"
+         "\"seconds\":%.2f,\"sent\":%u,\"delivered\":%lu,\"duplicates\":%lu,"
+         "\"send_failed\":%lu,\"tcp_lost\":%lu,\"tcp_acks\":%lu,"
+         "\"frames\":{\"tx\":%lu,\"rx\":%lu,\"lost\":%lu,\"collided\":%lu,\"unheard\":%lu},"
+         "\"pps\":%.3f,\"goodput_bps\":%.1f,\"airtime_s\":%.3f,\"airtime_efficiency\":%.4f,"
+         "\"latency_us\":{\"p50\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu},"
+         "\"cpu_us_per_packet\":%.1f}\n",
+         label, mix, sf, params.loss, params.speedup,
+         elapsed_s, packet_count, delivered_count, duplicates,
+         send_failed, tcp_lost, tcp_acks,
+         tx_frames, rx_frames, rx_lost, rx_collided,
+         // with two nodes every frame has one receiver, the rest went
+         // out while it was transmitting or between receive windows
+         tx_frames - rx_frames - rx_lost - rx_collided,
+         delivered_count / elapsed_s, payload_bytes * 8 / elapsed_s, airtime_s,
+         airtime_s > 0 ? payload_bytes * 8 / (airtime_s * bitrate) : 0.0,
+         (unsigned long) percentile(0.5), (unsigned long) percentile(0.99),
+         (unsigned long) percentile(0.999),
+         (unsigned long) (delivered_count ? latencies[delivered_count - 1] : 0),
+         delivered_count ? cpu_us / delivered_count : 0.0);
+
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "frag.h"
+#include "fec.h"
+
+// Benchmark for the FEC erasure code:
+// raw encode/decode speed of fec.c and packet delivery and goodput
+// through frag.c at simulated frame loss rates.
+
+#define ROUNDS (20000)
+#define PACKETS (20000)
+#define PACKET_LEN (500)
+
+int debug = 0;
+
+static double now_s() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_codec(int k, int r, size_t len) {
+  uint8_t data[FEC_MAX_BLOCKS][FRAG_MAX_CHUNK];
+  uint8_t* blocks[FEC_MAX_BLOCKS];
+  uint8_t present[FEC_MAX_BLOCKS];
+  double start, enc, dec;
+  int i, j;
+
+  for(i=0; i < k + r; i++) {
+    blocks[i] = data[i];
+    for(j=0; j < (int) len; j++) {
+      data[i][j] = rand();
+    }
+  }
+
+  start = now_s();
+  for(i=0; i < ROUNDS; i++) {
+    fec_encode(blocks, k, r, len);
+  }
+  enc = now_s() - start;
+
+  // worst case: the first r data blocks are lost
+  start = now_s();
+  for(i=0; i < ROUNDS; i++) {
+    for(j=0; j < k + r; j++) {
+      present[j] = (j >= r);
+    }
+    fec_decode(blocks, present, k, r, len);
+  }
+  dec = now_s() - start;
+
+  printf("codec k=%d r=%d block=%u: encode %.1f MB/s, decode %.1f MB/s\n",
+         k, r, (unsigned int) len,
+         (double) ROUNDS * k * len / enc / 1e6,
+         (double) ROUNDS * k * len / dec / 1e6);
+}
+
+static void bench_loss(int r, int loss_pct) {
+  uint8_t frags[FRAG_MAX_FRAGMENTS][LINK_MAX_FRAME];
+  uint8_t pkt[PACKET_LEN];
+  const uint8_t* out;
+  size_t frag_len;
+  unsigned long sent_bytes = 0;
+  unsigned long delivered = 0;
+  uint64_t t = 0;
+  ssize_t ret;
+  int n, i, j;
+
+  frag_init(r);
+
+  for(i=0; i < PACKETS; i++) {
+    for(j=0; j < PACKET_LEN; j++) {
+      pkt[j] = i + j;
+    }
+    n = frag_split(pkt, sizeof(pkt), frags, &frag_len);
+
+    for(j=0; j < n; j++) {
+      sent_bytes += frag_len + LINK_HDR_MIN_LEN;
+      if(rand() % 100 < loss_pct) {
+        continue;
+      }
+      ret = frag_reassemble(1, frags[j], frag_len, t, &out);
+      if(ret > 0) {
+        if(ret != PACKET_LEN || memcmp(out, pkt, PACKET_LEN)) {
+          fprintf(stderr, "corrupt packet %d\n", i);
+          exit(1);
+        }
+        delivered++;
+      }
+    }
+    t += 1000;
+  }
+
+  printf("loss=%2d%% r=%d: delivered %5.1f%%, goodput %5.1f%% of airtime bytes\n",
+         loss_pct, r,
+         100.0 * delivered / PACKETS,
+         100.0 * delivered * PACKET_LEN / sent_bytes);
+}
+
+int main(int argc, char* argv[]) {
+  int loss, r;
+
+  srand(1);
+  fec_init();
+
+  bench_codec(3, 1, FRAG_MAX_CHUNK);
+  bench_codec(3, 2, FRAG_MAX_CHUNK);
+  bench_codec(8, 4, FRAG_MAX_CHUNK);
+  bench_codec(12, 4, FRAG_MAX_CHUNK);
+
+  for(loss=0; loss <= 30; loss += 10) {
+    for(r=0; r <= 3; r++) {
+      bench_loss(r, loss);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+
+#include "ipc.h"
+
+// IPC benchmark: a child process runs the daemon's IPC loop (ipc.c,
+// without a radio) and the parent sends it requests as fast as it
+// answers them, from several persistent connections at once or with a
+// new connection per request as with the old protocol.
+//
+// The result is printed as one line of JSON.
+
+#define BENCH_MAX_CONNS (250)
+#define BENCH_MAX_REQUESTS (1000000)
+
+int debug = 0;
+
+struct bench_conn {
+  int fd;
+  uint64_t sent_us;
+  size_t got;
+  size_t want;
+  uint8_t buf[IPC_HDR_LEN + MAX_UCLIENT_RESPONSE_SIZE];
+};
+
+static struct bench_conn conns[BENCH_MAX_CONNS];
+static uint64_t latencies[BENCH_MAX_REQUESTS];
+static unsigned int latency_count = 0;
+
+static uint64_t now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void serve() {
+  fd_set readfds, writefds;
+  int maxfd;
+
+  if(open_ipc_socket() != 0) {
+    exit(1);
+  }
+  while(1) {
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    maxfd = add_uclients_to_fd_set(&readfds, &writefds, -1);
+    if(select(maxfd + 1, &readfds, &writefds, NULL, NULL) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      exit(1);
+    }
+    handle_uclient_connections(&readfds, &writefds);
+  }
+}
+
+static int connect_daemon() {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_LOCAL;
+  strncpy(addr.sun_path, socket_file, sizeof(addr.sun_path) - 1);
+
+  fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int send_request(struct bench_conn* c, char cmd) {
+  uint8_t req[IPC_HDR_LEN] = { 0, 0, (uint8_t) cmd, 0 };
+
+  c->sent_us = now_us();
+  c->got = 0;
+  c->want = IPC_HDR_LEN;
+  return (write(c->fd, req, sizeof(req)) == sizeof(req)) ? 0 : -1;
+}
+
+// returns 1 when the whole response is in, 0 if not yet, -1 on error
+static int read_response(struct bench_conn* c) {
+  ssize_t ret;
+
+  ret = read(c->fd, c->buf + c->got, c->want - c->got);
+  if(ret <= 0) {
+    return -1;
+  }
+  c->got += ret;
+  if(c->got == IPC_HDR_LEN) {
+    if(c->buf[3] != IPC_OK) {
+      fprintf(stderr, "Request failed with status %u\n", c->buf[3]);
+      return -1;
+    }
+    c->want = IPC_HDR_LEN + ((c->buf[0] << 8) | c->buf[1]);
+  }
+  return (c->got == c->want);
+}
+
+// keep one request in flight on every connection
+static int run_persistent(int conn_count, unsigned int requests, char cmd) {
+  struct pollfd pfds[BENCH_MAX_CONNS];
+  unsigned int sent = 0;
+  unsigned int done = 0;
+  int ret;
+  int i;
+
+  for(i=0; i < conn_count; i++) {
+    conns[i].fd = connect_daemon();
+    if(conns[i].fd < 0) {
+      fprintf(stderr, "Connect failed: %s\n", strerror(errno));
+      return -1;
+    }
+    pfds[i].fd = conns[i].fd;
+    pfds[i].events = POLLIN;
+    if(sent < requests) {
+      if(send_request(&conns[i], cmd) < 0) {
+        return -1;
+      }
+      sent++;
+    }
+  }
+
+  while(done < requests) {
+    if(poll(pfds, conn_count, 5000) <= 0) {
+      fprintf(stderr, "No response from the IPC loop\n");
+      return -1;
+    }
+    for(i=0; i < conn_count; i++) {
+      if(!(pfds[i].revents & POLLIN)) {
+        continue;
+      }
+      ret = read_response(&conns[i]);
+      if(ret < 0) {
+        return -1;
+      }
+      if(!ret) {
+        continue;
+      }
+      latencies[latency_count++] = now_us() - conns[i].sent_us;
+      done++;
+      if(sent < requests) {
+        if(send_request(&conns[i], cmd) < 0) {
+          return -1;
+        }
+        sent++;
+      }
+    }
+  }
+
+  for(i=0; i < conn_count; i++) {
+    close(conns[i].fd);
+  }
+  return 0;
+}
+
+// the old way: connect, send the command letter, read until closed
+static int run_oneshot(unsigned int requests, char cmd) {
+  char req[2] = { cmd, '\0' };
+  char buf[MAX_UCLIENT_RESPONSE_SIZE];
+  uint64_t start;
+  unsigned int i;
+  ssize_t ret;
+  int fd;
+
+  for(i=0; i < requests; i++) {
+    start = now_us();
+    fd = connect_daemon();
+    if(fd < 0) {
+      fprintf(stderr, "Connect failed: %s\n", strerror(errno));
+      return -1;
+    }
+    if(write(fd, req, sizeof(req)) != sizeof(req)) {
+      close(fd);
+      return -1;
+    }
+    shutdown(fd, SHUT_WR);
+    while((ret = read(fd, buf, sizeof(buf))) > 0);
+    close(fd);
+    latencies[latency_count++] = now_us() - start;
+  }
+  return 0;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+
+  return (x > y) - (x < y);
+}
+
+static uint64_t percentile(double p) {
+  if(!latency_count) {
+    return 0;
+  }
+  return latencies[(size_t) (p * (latency_count - 1))];
+}
+
+void usage(FILE* out, char* name) {
+  fprintf(out, "Usage: %s [-c connections] [-n requests] [-q cmd] [-o]\n", name);
+  fprintf(out, "\n");
+  fprintf(out, "  -c: persistent connections, one request in flight on each (default: 4, max: %d)\n", BENCH_MAX_CONNS);
+  fprintf(out, "  -n: number of requests (default: 100000, max: %d)\n", BENCH_MAX_REQUESTS);
+  fprintf(out, "  -q: command to send (default: p, ping)\n");
+  fprintf(out, "  -o: one connection per request with the old text protocol\n");
+}
+
+int main(int argc, char* argv[]) {
+  char sock[64];
+  unsigned int requests = 100000;
+  int conn_count = 4;
+  int oneshot = 0;
+  char cmd = 'p';
+  uint64_t start, elapsed;
+  pid_t pid;
+  int opt;
+  int ret;
+
+  while((opt = getopt(argc, argv, "c:n:q:o")) > 0) {
+    switch(opt) {
+      case 'c':
+        conn_count = atoi(optarg);
+        if(conn_count < 1 || conn_count > BENCH_MAX_CONNS) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'n':
+        requests = atoi(optarg);
+        if(requests < 1 || requests > BENCH_MAX_REQUESTS) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'q':
+        cmd = optarg[0];
+        break;
+      case 'o':
+        oneshot = 1;
+        break;
+      default:
+        usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+
+  snprintf(sock, sizeof(sock), "/tmp/ipc_bench.%d.sock", (int) getpid());
+  socket_file = sock;
+  unlink(sock);
+
+  pid = fork();
+  if(pid < 0) {
+    fprintf(stderr, "fork failed: %s\n", strerror(errno));
+    return 1;
+  }
+  if(pid == 0) {
+    serve();
+    _exit(0);
+  }
+
+  // wait for the socket to appear
+  for(ret = 0; ret < 100 && access(sock, F_OK) < 0; ret++) {
+    usleep(10000);
+  }
+
+  start = now_us();
+  if(oneshot) {
+    ret = run_oneshot(requests, cmd);
+  } else {
+    ret = run_persistent(conn_count, requests, cmd);
+  }
+  elapsed = now_us() - start;
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  unlink(sock);
+  if(ret < 0) {
+    return 1;
+  }
+
+  qsort(latencies, latency_count, sizeof(uint64_t), compare_u64);
+
+  printf("{\"mode\":\"%s\",\"cmd\":\"%c\",\"connections\":%d,\"requests\":%u,"
+         "\"seconds\":%.3f,\"requests_per_s\":%.0f,"
+         "\"latency_us\":{\"p50\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}}\n",
+         oneshot ? "oneshot" : "persistent", cmd, oneshot ? 1 : conn_count, latency_count,
+         elapsed / 1e6, latency_count / (elapsed / 1e6),
+         (unsigned long) percentile(0.5), (unsigned long) percentile(0.99),
+         (unsigned long) percentile(0.999), (unsigned long) percentile(1.0));
+  return 0;
+}
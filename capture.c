@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "capture.h"
+
+// Capture of every frame sent and received, in a pcapng file that
+// Wireshark can open while lora_iface is still writing it.
+//
+// The file is created at its full size and mapped once. After the
+// section header and interface description (LoRaTap link type) it is
+// an array of blocks of CAPTURE_SLOT_SIZE bytes that is written round
+// and round, so capturing a frame is a few stores and a memcpy.
+//
+// To keep every block the same size, an enhanced packet block is
+// padded with a custom option. Slots that haven't been written yet are
+// custom blocks, which readers skip. A slot being written is also a
+// custom block until it is complete. Once the file has wrapped, the
+// oldest frames come right after the newest ones; reordercap(1)
+// sorts them.
+
+#define PCAPNG_SHB (0x0a0d0d0a)
+#define PCAPNG_IDB (0x00000001)
+#define PCAPNG_EPB (0x00000006)
+#define PCAPNG_CB (0x40000bad)      // custom block, not to be copied
+#define PCAPNG_OPT_END (0)
+#define PCAPNG_OPT_FLAGS (2)
+#define PCAPNG_OPT_CUSTOM (19373)   // binary, not to be copied
+#define PCAPNG_FLAG_INBOUND (1)
+#define PCAPNG_FLAG_OUTBOUND (2)
+
+#define SHB_LEN (28)
+#define IDB_LEN (20)
+#define CAPTURE_HDR_LEN (SHB_LEN + IDB_LEN)
+
+// epb header, flags option, custom option header and PEN,
+// end of options and the trailing length
+#define EPB_FIXED_LEN (28 + 8 + 8 + 4 + 4)
+
+#define LORATAP_SYNC_WORD (0x34) // RN2903 default
+#define LORATAP_UNKNOWN (0xff)
+
+struct capture_stats capture_stats;
+
+static uint8_t* capture_map = NULL;
+static size_t capture_map_size = 0;
+static size_t capture_nslots = 0;
+static size_t capture_next = 0;
+static int capture_on = 0;
+static char capture_path[256];
+
+static void put32(uint8_t* p, uint32_t v) {
+  memcpy(p, &v, 4);
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+  memcpy(p, &v, 2);
+}
+
+static void put_be32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void capture_init_file() {
+  uint8_t* p = capture_map;
+  uint8_t* slot;
+  uint64_t section_len = (uint64_t) -1;
+  size_t i;
+
+  // section header, byte order as written
+  put32(p, PCAPNG_SHB);
+  put32(p + 4, SHB_LEN);
+  put32(p + 8, 0x1a2b3c4d);
+  put16(p + 12, 1);
+  put16(p + 14, 0);
+  memcpy(p + 16, &section_len, 8);
+  put32(p + 24, SHB_LEN);
+
+  // interface description, microsecond timestamps by default
+  p += SHB_LEN;
+  put32(p, PCAPNG_IDB);
+  put32(p + 4, IDB_LEN);
+  put16(p + 8, CAPTURE_LINKTYPE_LORATAP);
+  put16(p + 10, 0);
+  put32(p + 12, CAPTURE_LORATAP_LEN + 255);
+  put32(p + 16, IDB_LEN);
+
+  for(i=0; i < capture_nslots; i++) {
+    slot = capture_map + CAPTURE_HDR_LEN + i * CAPTURE_SLOT_SIZE;
+    memset(slot, 0, CAPTURE_SLOT_SIZE);
+    put32(slot, PCAPNG_CB);
+    put32(slot + 4, CAPTURE_SLOT_SIZE);
+    put32(slot + CAPTURE_SLOT_SIZE - 4, CAPTURE_SLOT_SIZE);
+  }
+}
+
+// start (or resume) capturing to path, a file of about size bytes.
+// a different path or size starts a new file.
+// returns 0 or -1
+int capture_start(const char* path, size_t size) {
+  size_t nslots;
+  uint8_t* map;
+  int fd;
+
+  if(capture_map && !strcmp(path, capture_path)
+     && (size - CAPTURE_HDR_LEN) / CAPTURE_SLOT_SIZE == capture_nslots) {
+    capture_on = 1;
+    return 0;
+  }
+
+  if(size < CAPTURE_HDR_LEN + CAPTURE_SLOT_SIZE || strlen(path) >= sizeof(capture_path)) {
+    errno = EINVAL;
+    return -1;
+  }
+  nslots = (size - CAPTURE_HDR_LEN) / CAPTURE_SLOT_SIZE;
+  size = CAPTURE_HDR_LEN + nslots * CAPTURE_SLOT_SIZE;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd < 0) {
+    return -1;
+  }
+  // allocate it all now rather than getting SIGBUS when the disk is full
+  if(posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) < 0) {
+    close(fd);
+    return -1;
+  }
+  map = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    return -1;
+  }
+
+  capture_stop();
+  if(capture_map) {
+    munmap(capture_map, capture_map_size);
+  }
+  capture_map = map;
+  capture_map_size = size;
+  capture_nslots = nslots;
+  capture_next = 0;
+  strcpy(capture_path, path);
+  memset(&capture_stats, 0, sizeof(capture_stats));
+
+  capture_init_file();
+  capture_on = 1;
+  return 0;
+}
+
+// the file stays mapped so capture can be turned on again cheaply
+void capture_stop() {
+  capture_on = 0;
+}
+
+int capture_enabled() {
+  return capture_on;
+}
+
+// the current or last file, empty if there was none
+const char* capture_file() {
+  return capture_path;
+}
+
+size_t capture_slots() {
+  return capture_nslots;
+}
+
+void capture_frame(int dir, const uint8_t* frame, size_t len, const struct capture_radio* radio) {
+  struct timespec ts;
+  uint64_t us;
+  uint8_t* slot;
+  uint8_t* p;
+  size_t cap_len;
+  size_t padded;
+  size_t opt_len;
+
+  if(!capture_on) {
+    return;
+  }
+  cap_len = CAPTURE_LORATAP_LEN + len;
+  padded = (cap_len + 3) & ~3;
+  if(EPB_FIXED_LEN + padded > CAPTURE_SLOT_SIZE) {
+    capture_stats.too_big++;
+    return;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  us = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  slot = capture_map + CAPTURE_HDR_LEN + capture_next * CAPTURE_SLOT_SIZE;
+  capture_next = (capture_next + 1) % capture_nslots;
+
+  // a custom block while it is written, the PEN is where the
+  // interface id goes and both are 0
+  __atomic_store_n((uint32_t*) slot, PCAPNG_CB, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  put32(slot + 8, 0);
+  put32(slot + 12, us >> 32);
+  put32(slot + 16, us);
+  put32(slot + 20, cap_len);
+  put32(slot + 24, cap_len);
+
+  // LoRaTap v0, big endian
+  p = slot + 28;
+  p[0] = 0;
+  p[1] = 0;
+  p[2] = 0;
+  p[3] = CAPTURE_LORATAP_LEN;
+  put_be32(p + 4, radio->freq);
+  p[8] = radio->bw / 125;
+  p[9] = radio->sf;
+  p[10] = LORATAP_UNKNOWN; // the RN2903 doesn't report RSSI
+  p[11] = LORATAP_UNKNOWN;
+  p[12] = LORATAP_UNKNOWN;
+  p[13] = (radio->snr == CAPTURE_SNR_UNKNOWN) ? 0 : (uint8_t) (radio->snr * 4);
+  p[14] = LORATAP_SYNC_WORD;
+  memcpy(p + CAPTURE_LORATAP_LEN, frame, len);
+  memset(p + cap_len, 0, padded - cap_len);
+
+  p += padded;
+  put16(p, PCAPNG_OPT_FLAGS);
+  put16(p + 2, 4);
+  put32(p + 4, (dir == CAPTURE_RX) ? PCAPNG_FLAG_INBOUND : PCAPNG_FLAG_OUTBOUND);
+
+  // padding up to the slot size
+  opt_len = CAPTURE_SLOT_SIZE - EPB_FIXED_LEN - padded + 4;
+  p += 8;
+  put16(p, PCAPNG_OPT_CUSTOM);
+  put16(p + 2, opt_len);
+  memset(p + 4, 0, opt_len);
+
+  p += 4 + opt_len;
+  put16(p, PCAPNG_OPT_END);
+  put16(p + 2, 0);
+
+  __atomic_store_n((uint32_t*) slot, PCAPNG_EPB, __ATOMIC_RELEASE);
+  capture_stats.frames++;
+}
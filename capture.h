@@ -0,0 +1,45 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_DEFAULT_FILE "/tmp/lora_iface.pcapng"
+#define CAPTURE_DEFAULT_SIZE (4 * 1024 * 1024)
+
+// every frame takes a block of this size, so a file of
+// CAPTURE_DEFAULT_SIZE holds the last ~12800 frames
+#define CAPTURE_SLOT_SIZE (328)
+
+// pcapng link type of the LoRaTap header in front of every frame
+#define CAPTURE_LINKTYPE_LORATAP (270)
+#define CAPTURE_LORATAP_LEN (15)
+
+#define CAPTURE_TX (0)
+#define CAPTURE_RX (1)
+
+// radio settings of a frame, 0 if not known
+struct capture_radio {
+  uint32_t freq; // Hz
+  uint16_t bw;   // kHz
+  uint8_t sf;
+  int snr;       // dB, CAPTURE_SNR_UNKNOWN for sent frames
+};
+
+#define CAPTURE_SNR_UNKNOWN (-128)
+
+struct capture_stats {
+  unsigned long frames;   // written since capture was turned on
+  unsigned long too_big;  // didn't fit in a slot
+};
+
+extern struct capture_stats capture_stats;
+
+int capture_start(const char* path, size_t size);
+void capture_stop();
+int capture_enabled();
+const char* capture_file();
+size_t capture_slots();
+void capture_frame(int dir, const uint8_t* frame, size_t len, const struct capture_radio* radio);
+
+#endif
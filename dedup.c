@@ -0,0 +1,104 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "dedup.h"
+
+// Duplicate suppression for broadcast floods that reach us by more
+// than one path.
+//
+// A frame is reduced to a 64 bit hash. Its upper half is a fingerprint
+// kept in one of two buckets, the first picked by the lower half and
+// the second by the first xor a hash of the fingerprint, as in a
+// cuckoo filter. Entries expire after the window instead of being
+// moved around: a new one takes a free or expired slot in either
+// bucket, or else the oldest of the eight. Memory is fixed and a
+// lookup touches two cache lines. Different frames are mistaken for
+// each other with a probability of about 8 in 2^32.
+
+struct dedup_entry {
+  uint32_t fp;      // 0 if free
+  uint32_t time_ms; // first seen, wraps after 49 days
+};
+
+struct dedup_stats dedup_stats;
+
+static struct dedup_entry dedup_table[DEDUP_BUCKETS][DEDUP_SLOTS];
+static uint32_t dedup_window_ms = 0;
+
+// 0 turns it off
+void dedup_init(unsigned long window_ms) {
+  memset(dedup_table, 0, sizeof(dedup_table));
+  memset(&dedup_stats, 0, sizeof(dedup_stats));
+  dedup_window_ms = window_ms;
+}
+
+int dedup_enabled() {
+  return dedup_window_ms != 0;
+}
+
+static uint64_t dedup_hash(const uint8_t* key, size_t len) {
+  uint64_t hash = 14695981039346656037ull;
+  size_t i;
+
+  for(i=0; i < len; i++) {
+    hash = (hash ^ key[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static int dedup_live(const struct dedup_entry* e, uint32_t now_ms) {
+  return e->fp && (uint32_t) (now_ms - e->time_ms) < dedup_window_ms;
+}
+
+// a free or expired slot in either bucket, otherwise the oldest entry
+static struct dedup_entry* dedup_victim(struct dedup_entry** buckets, uint32_t now_ms) {
+  struct dedup_entry* victim = NULL;
+  struct dedup_entry* e;
+  int b, i;
+
+  for(b=0; b < 2; b++) {
+    for(i=0; i < DEDUP_SLOTS; i++) {
+      e = &buckets[b][i];
+      if(!dedup_live(e, now_ms)) {
+        return e;
+      }
+      if(!victim || (uint32_t) (now_ms - e->time_ms) > (uint32_t) (now_ms - victim->time_ms)) {
+        victim = e;
+      }
+    }
+  }
+  dedup_stats.evicted++;
+  return victim;
+}
+
+// returns 1 if key was seen within the window, otherwise
+// remembers it and returns 0
+int dedup_seen(const void* key, size_t len, uint64_t now_us) {
+  struct dedup_entry* buckets[2];
+  struct dedup_entry* e;
+  uint32_t now_ms = now_us / 1000;
+  uint64_t hash;
+  uint32_t fp;
+  int b, i;
+
+  dedup_stats.checked++;
+  hash = dedup_hash((const uint8_t*) key, len);
+  fp = (uint32_t) (hash >> 32) | 1;
+  buckets[0] = dedup_table[hash % DEDUP_BUCKETS];
+  buckets[1] = dedup_table[(hash ^ (fp * 0x5bd1e995u >> 8)) % DEDUP_BUCKETS];
+
+  for(b=0; b < 2; b++) {
+    for(i=0; i < DEDUP_SLOTS; i++) {
+      e = &buckets[b][i];
+      if(e->fp == fp && dedup_live(e, now_ms)) {
+        dedup_stats.dropped++;
+        return 1;
+      }
+    }
+  }
+
+  e = dedup_victim(buckets, now_ms);
+  e->fp = fp;
+  e->time_ms = now_ms;
+  return 0;
+}
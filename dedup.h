@@ -0,0 +1,27 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 256 buckets of 4 fingerprints, 8 KiB whatever the traffic
+#define DEDUP_BUCKETS (256)
+#define DEDUP_SLOTS (4)
+
+// below the 1 s ARP and neighbour discovery wait between retries, so
+// those aren't taken for copies
+#define DEDUP_DEFAULT_WINDOW_MS (500)
+
+struct dedup_stats {
+  unsigned long checked;  // frames looked up
+  unsigned long dropped;  // seen before within the window
+  unsigned long evicted;  // entries pushed out before their window ended
+};
+
+extern struct dedup_stats dedup_stats;
+
+void dedup_init(unsigned long window_ms);
+int dedup_enabled();
+int dedup_seen(const void* key, size_t len, uint64_t now_us);
+
+#endif
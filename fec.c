@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define FEC_HAVE_SSSE3
+#endif
+
+#include "fec.h"
+
+// Systematic Reed-Solomon erasure code over GF(2^8).
+//
+// A packet is split into k data blocks of equal length and r repair
+// blocks are computed from them. Repair block j is row j of a Cauchy
+// matrix (1 / ((k+j) ^ i)) times the data blocks. Every square
+// submatrix of a Cauchy matrix is invertible, so the receiver can
+// rebuild the packet from any k of the k + r blocks.
+//
+// Multiplication uses a full 64 kB product table. On x86 with SSSE3
+// whole blocks are multiplied 16 bytes at a time with PSHUFB lookups
+// into the products of the low and high nibble.
+
+#define GF_POLY (0x11d)
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul_table[256][256];
+static int fec_ready = 0;
+
+#ifdef FEC_HAVE_SSSE3
+static int fec_use_ssse3 = 0;
+#endif
+
+void fec_init() {
+  int i, j;
+  int x = 1;
+
+  if(fec_ready) {
+    return;
+  }
+
+  for(i=0; i < 255; i++) {
+    gf_exp[i] = x;
+    gf_log[x] = i;
+    x <<= 1;
+    if(x & 0x100) {
+      x ^= GF_POLY;
+    }
+  }
+  for(i=255; i < 512; i++) {
+    gf_exp[i] = gf_exp[i - 255];
+  }
+
+  for(i=0; i < 256; i++) {
+    for(j=0; j < 256; j++) {
+      if(i == 0 || j == 0) {
+        gf_mul_table[i][j] = 0;
+      } else {
+        gf_mul_table[i][j] = gf_exp[gf_log[i] + gf_log[j]];
+      }
+    }
+  }
+
+#ifdef FEC_HAVE_SSSE3
+  fec_use_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+
+  fec_ready = 1;
+}
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+  return gf_mul_table[a][b];
+}
+
+uint8_t gf_inv(uint8_t a) {
+  if(a == 0) {
+    return 0;
+  }
+  return gf_exp[255 - gf_log[a]];
+}
+
+#ifdef FEC_HAVE_SSSE3
+__attribute__((target("ssse3")))
+static size_t fec_mul_add_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+  uint8_t lo[16], hi[16];
+  __m128i tlo, thi, mask, s, d, l, h;
+  size_t i;
+
+  for(i=0; i < 16; i++) {
+    lo[i] = gf_mul_table[c][i];
+    hi[i] = gf_mul_table[c][i << 4];
+  }
+  tlo = _mm_loadu_si128((const __m128i*) lo);
+  thi = _mm_loadu_si128((const __m128i*) hi);
+  mask = _mm_set1_epi8(0x0f);
+
+  for(i=0; i + 16 <= len; i += 16) {
+    s = _mm_loadu_si128((const __m128i*)(src + i));
+    d = _mm_loadu_si128((const __m128i*)(dst + i));
+    l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+    h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+    d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+    _mm_storeu_si128((__m128i*)(dst + i), d);
+  }
+  return i;
+}
+#endif
+
+// dst += c * src
+void fec_mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+  const uint8_t* row;
+  size_t i = 0;
+
+  if(c == 0) {
+    return;
+  }
+  if(c == 1) {
+    for(i=0; i < len; i++) {
+      dst[i] ^= src[i];
+    }
+    return;
+  }
+
+#ifdef FEC_HAVE_SSSE3
+  if(fec_use_ssse3) {
+    i = fec_mul_add_ssse3(dst, src, c, len);
+  }
+#endif
+
+  row = gf_mul_table[c];
+  for(; i < len; i++) {
+    dst[i] ^= row[src[i]];
+  }
+}
+
+static uint8_t fec_coef(int k, int j, int i) {
+  return gf_inv((uint8_t)((k + j) ^ i));
+}
+
+// blocks[0..k-1] hold the data, blocks[k..k+r-1] receive the repair blocks
+void fec_encode(uint8_t** blocks, int k, int r, size_t len) {
+  int i, j;
+
+  for(j=0; j < r; j++) {
+    memset(blocks[k + j], 0, len);
+    for(i=0; i < k; i++) {
+      fec_mul_add(blocks[k + j], blocks[i], fec_coef(k, j, i), len);
+    }
+  }
+}
+
+// rebuild missing data blocks in place from any k present blocks.
+// returns 0 on success or -1 if too few blocks are present
+int fec_decode(uint8_t** blocks, const uint8_t* present, int k, int r, size_t len) {
+  uint8_t m[FEC_MAX_BLOCKS][FEC_MAX_BLOCKS];
+  uint8_t inv[FEC_MAX_BLOCKS][FEC_MAX_BLOCKS];
+  int rows[FEC_MAX_BLOCKS];
+  int missing[FEC_MAX_BLOCKS];
+  int n_missing = 0;
+  int i, j, col, row, next_repair = k;
+  uint8_t c;
+
+  if(k + r > FEC_MAX_BLOCKS) {
+    return -1;
+  }
+
+  // use present data blocks as they are and fill the gaps with repair blocks
+  for(i=0; i < k; i++) {
+    if(present[i]) {
+      rows[i] = i;
+      continue;
+    }
+    missing[n_missing++] = i;
+    while(next_repair < k + r && !present[next_repair]) {
+      next_repair++;
+    }
+    if(next_repair >= k + r) {
+      return -1;
+    }
+    rows[i] = next_repair++;
+  }
+
+  if(!n_missing) {
+    return 0;
+  }
+
+  for(i=0; i < k; i++) {
+    for(j=0; j < k; j++) {
+      if(rows[i] < k) {
+        m[i][j] = (rows[i] == j);
+      } else {
+        m[i][j] = fec_coef(k, rows[i] - k, j);
+      }
+      inv[i][j] = (i == j);
+    }
+  }
+
+  // Gauss-Jordan elimination
+  for(col=0; col < k; col++) {
+    for(row=col; row < k && !m[row][col]; row++);
+    if(row == k) {
+      return -1; // can't happen with a Cauchy matrix
+    }
+    if(row != col) {
+      for(j=0; j < k; j++) {
+        c = m[row][j]; m[row][j] = m[col][j]; m[col][j] = c;
+        c = inv[row][j]; inv[row][j] = inv[col][j]; inv[col][j] = c;
+      }
+    }
+    c = gf_inv(m[col][col]);
+    for(j=0; j < k; j++) {
+      m[col][j] = gf_mul(m[col][j], c);
+      inv[col][j] = gf_mul(inv[col][j], c);
+    }
+    for(row=0; row < k; row++) {
+      if(row == col || !m[row][col]) {
+        continue;
+      }
+      c = m[row][col];
+      for(j=0; j < k; j++) {
+        m[row][j] ^= gf_mul(m[col][j], c);
+        inv[row][j] ^= gf_mul(inv[col][j], c);
+      }
+    }
+  }
+
+  // missing data block i is row i of the inverse times the chosen blocks,
+  // none of which is a missing block
+  for(i=0; i < n_missing; i++) {
+    row = missing[i];
+    memset(blocks[row], 0, len);
+    for(j=0; j < k; j++) {
+      fec_mul_add(blocks[row], blocks[rows[j]], inv[row][j], len);
+    }
+  }
+
+  return 0;
+}
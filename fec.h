@@ -0,0 +1,17 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// data + repair blocks per packet
+#define FEC_MAX_BLOCKS (16)
+
+void fec_init();
+uint8_t gf_mul(uint8_t a, uint8_t b);
+uint8_t gf_inv(uint8_t a);
+void fec_mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+void fec_encode(uint8_t** blocks, int k, int r, size_t len);
+int fec_decode(uint8_t** blocks, const uint8_t* present, int k, int r, size_t len);
+
+#endif
@@ -0,0 +1,655 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_tun.h>
+
+#include "filter.h"
+
+// Filter for what the kernel routes into the TUN interface (see
+// filter.h for the rules).
+//
+// The rules are compiled to an eBPF socket filter that the TUN driver
+// runs on every packet before queueing it (TUNSETFILTEREBPF), so
+// dropped packets never wake up the event loop. Each rule counts its
+// hits in an array map that is mmap'ed here, reading the counters
+// takes no system call. Without a TUN interface, or if the kernel
+// doesn't take the program, filter_packet() applies the same rules to
+// every packet read.
+
+#define IP4_HDR_LEN (20)
+#define IP6_HDR_LEN (40)
+#define IPPROTO_TCP_ (6)
+#define IPPROTO_UDP_ (17)
+
+#define FILTER_MAX_INSNS (4096)
+
+extern int debug;
+
+static struct filter_rule filter_rules[FILTER_MAX_RULES];
+static int filter_nrules = 0;
+
+// one per rule and one for packets that no rule matched
+static unsigned long filter_hits[FILTER_MAX_RULES + 1];
+static volatile uint64_t* filter_map_hits = NULL; // in the kernel's map
+static size_t filter_map_size = 0;
+static int filter_prog_fd = -1;
+
+// parsing
+
+static int filter_number(const char* s, unsigned long max, unsigned long* out) {
+  char* end;
+
+  if(!s) {
+    return -1;
+  }
+  errno = 0;
+  *out = strtoul(s, &end, 10);
+  return (end == s || *end || errno || *out > max) ? -1 : 0;
+}
+
+static int filter_family(struct filter_rule* r, int family) {
+  if(r->family && r->family != family) {
+    return -1;
+  }
+  r->family = family;
+  return 0;
+}
+
+static int filter_prefix(struct filter_rule* r, const char* s) {
+  char addr[INET6_ADDRSTRLEN];
+  const char* slash;
+  unsigned long bits;
+  int family;
+  size_t len;
+
+  if(!s) {
+    return -1;
+  }
+  slash = strchr(s, '/');
+  len = slash ? (size_t) (slash - s) : strlen(s);
+  if(len >= sizeof(addr)) {
+    return -1;
+  }
+  memcpy(addr, s, len);
+  addr[len] = '\0';
+
+  memset(r->dst, 0, sizeof(r->dst));
+  if(inet_pton(AF_INET, addr, r->dst) == 1) {
+    family = 4;
+  } else if(inet_pton(AF_INET6, addr, r->dst) == 1) {
+    family = 6;
+  } else {
+    return -1;
+  }
+  bits = (family == 4) ? 32 : 128;
+  if(slash && filter_number(slash + 1, bits, &bits) < 0) {
+    return -1;
+  }
+  r->dst_bits = bits;
+  return filter_family(r, family);
+}
+
+// the words of a rule after its action, an empty match matches
+// everything. words is cut up
+int filter_parse_match(char* words, struct filter_rule* r) {
+  unsigned long n;
+  char* save;
+  char* word;
+
+  memset(r, 0, sizeof(*r));
+  r->proto = r->port = r->sport = r->dport = r->dst_bits = -1;
+
+  for(word = strtok_r(words, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+    if(!strcmp(word, "ip4") || !strcmp(word, "ip")) {
+      if(filter_family(r, 4) < 0) return -1;
+    } else if(!strcmp(word, "ip6")) {
+      if(filter_family(r, 6) < 0) return -1;
+    } else if(!strcmp(word, "tcp")) {
+      r->proto = IPPROTO_TCP_;
+    } else if(!strcmp(word, "udp")) {
+      r->proto = IPPROTO_UDP_;
+    } else if(!strcmp(word, "icmp")) {
+      r->proto = 1;
+      if(filter_family(r, 4) < 0) return -1;
+    } else if(!strcmp(word, "icmp6")) {
+      r->proto = 58;
+      if(filter_family(r, 6) < 0) return -1;
+    } else if(!strcmp(word, "proto")) {
+      if(filter_number(strtok_r(NULL, " \t", &save), 255, &n) < 0) return -1;
+      r->proto = n;
+    } else if(!strcmp(word, "port")) {
+      if(filter_number(strtok_r(NULL, " \t", &save), 65535, &n) < 0) return -1;
+      r->port = n;
+    } else if(!strcmp(word, "sport")) {
+      if(filter_number(strtok_r(NULL, " \t", &save), 65535, &n) < 0) return -1;
+      r->sport = n;
+    } else if(!strcmp(word, "dport")) {
+      if(filter_number(strtok_r(NULL, " \t", &save), 65535, &n) < 0) return -1;
+      r->dport = n;
+    } else if(!strcmp(word, "dst")) {
+      if(filter_prefix(r, strtok_r(NULL, " \t", &save)) < 0) return -1;
+    } else if(!strcmp(word, "greater")) {
+      if(filter_number(strtok_r(NULL, " \t", &save), 65535, &r->greater) < 0) return -1;
+    } else if(!strcmp(word, "less")) {
+      if(filter_number(strtok_r(NULL, " \t", &save), 65535, &r->less) < 0) return -1;
+    } else {
+      return -1;
+    }
+  }
+  if((r->port >= 0 || r->sport >= 0 || r->dport >= 0)
+     && r->proto >= 0 && r->proto != IPPROTO_TCP_ && r->proto != IPPROTO_UDP_) {
+    return -1;
+  }
+  return 0;
+}
+
+static int filter_parse_rule(char* line, struct filter_rule* r) {
+  char text[FILTER_RULE_TEXT];
+  size_t n;
+  int ret;
+
+  snprintf(text, sizeof(text), "%s", line);
+  n = strcspn(line, " \t");
+  ret = filter_parse_match(line + n, r);
+  snprintf(r->text, sizeof(r->text), "%s", text);
+
+  if(n == 4 && !strncmp(line, "drop", 4)) {
+    r->action = FILTER_DROP;
+  } else if(n == 4 && !strncmp(line, "pass", 4)) {
+    r->action = FILTER_PASS;
+  } else {
+    return -1;
+  }
+  return ret;
+}
+
+// one rule per line (or separated by ';'), '#' starts a comment.
+// replaces the current rules, returns 0 or -1 if a rule is invalid
+int filter_parse(const char* rules, size_t len) {
+  struct filter_rule parsed[FILTER_MAX_RULES];
+  char line[FILTER_RULE_TEXT];
+  size_t start, end, i;
+  int count = 0;
+  int lineno = 1;
+
+  for(start=0; start < len; start = end + 1) {
+    for(end=start; end < len && rules[end] != '\n' && rules[end] != ';'; end++);
+    for(i=start; i < end && rules[i] != '#'; i++);
+    while(i > start && (rules[i-1] == ' ' || rules[i-1] == '\t' || rules[i-1] == '\r')) {
+      i--;
+    }
+    while(start < i && (rules[start] == ' ' || rules[start] == '\t')) {
+      start++;
+    }
+    if(i > start) {
+      if(i - start >= sizeof(line) || count == FILTER_MAX_RULES) {
+        fprintf(stderr, "Filter rule %d: too long or too many rules\n", lineno);
+        return -1;
+      }
+      memcpy(line, rules + start, i - start);
+      line[i - start] = '\0';
+      if(filter_parse_rule(line, &parsed[count]) < 0) {
+        fprintf(stderr, "Filter rule %d is invalid: %s\n", lineno, parsed[count].text);
+        return -1;
+      }
+      count++;
+    }
+    if(end < len && rules[end] == '\n') {
+      lineno++;
+    }
+  }
+
+  memcpy(filter_rules, parsed, count * sizeof(parsed[0]));
+  filter_nrules = count;
+  memset(filter_hits, 0, sizeof(filter_hits));
+  return 0;
+}
+
+int filter_load(const char* path) {
+  char buf[FILTER_MAX_RULES * FILTER_RULE_TEXT];
+  ssize_t len;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open filter rules %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  len = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(len < 0) {
+    fprintf(stderr, "Failed to read filter rules %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return filter_parse(buf, len);
+}
+
+int filter_rule_count() {
+  return filter_nrules;
+}
+
+// userspace classifier
+
+static uint16_t get16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+static int filter_prefix_match(const uint8_t* addr, const uint8_t* prefix, int bits) {
+  int i;
+
+  for(i=0; bits >= 8; i++, bits -= 8) {
+    if(addr[i] != prefix[i]) {
+      return 0;
+    }
+  }
+  return !bits || !((addr[i] ^ prefix[i]) & (0xff00 >> bits));
+}
+
+// does r match pkt as an IP packet of this version (0 if r doesn't
+// look at anything version specific)
+static int filter_match_family(const struct filter_rule* r, int family, const uint8_t* pkt, size_t len) {
+  size_t hdr_len = (family == 4) ? IP4_HDR_LEN : IP6_HDR_LEN;
+  size_t l4;
+  int proto;
+
+  if(r->greater && len < r->greater) {
+    return 0;
+  }
+  if(r->less && len > r->less) {
+    return 0;
+  }
+  if(!family) {
+    return 1;
+  }
+
+  if(len < 1 || (pkt[0] >> 4) != family) {
+    return 0;
+  }
+  if(r->proto < 0 && r->dst_bits < 0 && r->port < 0 && r->sport < 0 && r->dport < 0) {
+    return 1;
+  }
+  if(len < hdr_len) {
+    return 0;
+  }
+
+  proto = (family == 4) ? pkt[9] : pkt[6];
+  if(r->proto >= 0 && proto != r->proto) {
+    return 0;
+  }
+  if(r->dst_bits >= 0 && !filter_prefix_match(pkt + ((family == 4) ? 16 : 24), r->dst, r->dst_bits)) {
+    return 0;
+  }
+
+  if(r->port >= 0 || r->sport >= 0 || r->dport >= 0) {
+    if(proto != IPPROTO_TCP_ && proto != IPPROTO_UDP_) {
+      return 0;
+    }
+    l4 = IP6_HDR_LEN;
+    if(family == 4) {
+      if(get16(pkt + 6) & 0x1fff) {
+        return 0; // not the first fragment, no ports
+      }
+      l4 = (pkt[0] & 0x0f) * 4;
+    }
+    if(len < l4 + 4) {
+      return 0;
+    }
+    if(r->sport >= 0 && get16(pkt + l4) != r->sport) {
+      return 0;
+    }
+    if(r->dport >= 0 && get16(pkt + l4 + 2) != r->dport) {
+      return 0;
+    }
+    if(r->port >= 0 && get16(pkt + l4) != r->port && get16(pkt + l4 + 2) != r->port) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int filter_version_specific(const struct filter_rule* r) {
+  return r->family || r->proto >= 0 || r->dst_bits >= 0
+    || r->port >= 0 || r->sport >= 0 || r->dport >= 0;
+}
+
+// does the packet match the rule, whatever its action
+int filter_match(const struct filter_rule* r, const uint8_t* pkt, size_t len) {
+  int family = len ? (pkt[0] >> 4) : 0;
+
+  if(filter_version_specific(r)) {
+    if((r->family && r->family != family) || (family != 4 && family != 6)) {
+      return 0;
+    }
+    return filter_match_family(r, family, pkt, len);
+  }
+  return filter_match_family(r, 0, pkt, len);
+}
+
+// returns FILTER_PASS or FILTER_DROP. does nothing if the kernel
+// filters already
+int filter_packet(const uint8_t* pkt, size_t len) {
+  int i;
+
+  if(filter_prog_fd >= 0 || !filter_nrules) {
+    return FILTER_PASS;
+  }
+
+  for(i=0; i < filter_nrules; i++) {
+    if(filter_match(&filter_rules[i], pkt, len)) {
+      filter_hits[i]++;
+      return filter_rules[i].action;
+    }
+  }
+  filter_hits[filter_nrules]++;
+  return FILTER_PASS;
+}
+
+// eBPF code generation. r6 holds the context as LD_ABS wants it, r7 the
+// packet length and r8 the offset of the TCP/UDP header
+
+struct filter_prog {
+  struct bpf_insn insns[FILTER_MAX_INSNS];
+  int len;
+  int next[64]; // jumps to the end of the current rule
+  int nnext;
+  int overflow;
+};
+
+static int emit(struct filter_prog* p, uint8_t code, int dst, int src, int16_t off, int32_t imm) {
+  struct bpf_insn* insn;
+
+  if(p->len == FILTER_MAX_INSNS) {
+    p->overflow = 1;
+    return p->len - 1;
+  }
+  insn = &p->insns[p->len];
+  memset(insn, 0, sizeof(*insn));
+  insn->code = code;
+  insn->dst_reg = dst;
+  insn->src_reg = src;
+  insn->off = off;
+  insn->imm = imm;
+  return p->len++;
+}
+
+// jump to the next rule if the condition holds
+static void emit_next_if(struct filter_prog* p, uint8_t op, int dst, int src, int32_t imm) {
+  int at = emit(p, BPF_JMP32 | op | (src >= 0 ? BPF_X : BPF_K), dst, src >= 0 ? src : 0, 0, imm);
+
+  if(p->nnext == sizeof(p->next) / sizeof(p->next[0])) {
+    p->overflow = 1;
+    return;
+  }
+  p->next[p->nnext++] = at;
+}
+
+static void emit_next_label(struct filter_prog* p) {
+  int i;
+
+  for(i=0; i < p->nnext; i++) {
+    p->insns[p->next[i]].off = p->len - p->next[i] - 1;
+  }
+  p->nnext = 0;
+}
+
+static void emit_load(struct filter_prog* p, int size, int32_t off) {
+  emit(p, BPF_LD | BPF_ABS | size, 0, 0, 0, off);
+}
+
+// the hit counter of rule i, then the verdict
+static void emit_count_and_return(struct filter_prog* p, int map_fd, int i, int action) {
+  emit(p, BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -4, i);
+  emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+  emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4);
+  emit(p, BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+  emit(p, 0, 0, 0, 0, 0);
+  emit(p, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+  emit(p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 2, 0);
+  emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1);
+  emit(p, BPF_STX | BPF_ATOMIC | BPF_DW, BPF_REG_0, BPF_REG_1, 0, BPF_ADD);
+
+  // the return value is how much of the packet to keep
+  if(action == FILTER_PASS) {
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_0, BPF_REG_7, 0, 0);
+  } else {
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0);
+  }
+  emit(p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// same checks as filter_match_family()
+static void emit_rule(struct filter_prog* p, const struct filter_rule* r, int family, int map_fd, int i) {
+  int hdr_len = (family == 4) ? IP4_HDR_LEN : IP6_HDR_LEN;
+  int dst_off = (family == 4) ? 16 : 24;
+  int bits;
+  int w;
+  uint32_t mask;
+  int either;
+
+  if(r->greater) {
+    emit_next_if(p, BPF_JLT, BPF_REG_7, -1, r->greater);
+  }
+  if(r->less) {
+    emit_next_if(p, BPF_JGT, BPF_REG_7, -1, r->less);
+  }
+
+  if(family) {
+    emit_next_if(p, BPF_JLT, BPF_REG_7, -1, 1);
+    emit_load(p, BPF_B, 0);
+    emit(p, BPF_ALU64 | BPF_RSH | BPF_K, BPF_REG_0, 0, 0, 4);
+    emit_next_if(p, BPF_JNE, BPF_REG_0, -1, family);
+  }
+  if(family && (r->proto >= 0 || r->dst_bits >= 0 || r->port >= 0 || r->sport >= 0 || r->dport >= 0)) {
+    emit_next_if(p, BPF_JLT, BPF_REG_7, -1, hdr_len);
+  }
+
+  if(family && r->proto >= 0) {
+    emit_load(p, BPF_B, (family == 4) ? 9 : 6);
+    emit_next_if(p, BPF_JNE, BPF_REG_0, -1, r->proto);
+  }
+
+  if(family && r->dst_bits >= 0) {
+    for(bits = r->dst_bits, w = 0; bits > 0; bits -= 32, w++) {
+      mask = (bits >= 32) ? 0xffffffff : ~(0xffffffffu >> bits);
+      emit_load(p, BPF_W, dst_off + 4 * w);
+      if(mask != 0xffffffff) {
+        emit(p, BPF_ALU | BPF_AND | BPF_K, BPF_REG_0, 0, 0, (int32_t) mask);
+      }
+      emit_next_if(p, BPF_JNE, BPF_REG_0, -1, (int32_t) (get32(r->dst + 4 * w) & mask));
+    }
+  }
+
+  if(family && (r->port >= 0 || r->sport >= 0 || r->dport >= 0)) {
+    // TCP or UDP
+    emit_load(p, BPF_B, (family == 4) ? 9 : 6);
+    emit(p, BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_0, 0, 1, IPPROTO_TCP_);
+    emit_next_if(p, BPF_JNE, BPF_REG_0, -1, IPPROTO_UDP_);
+
+    if(family == 4) {
+      emit_load(p, BPF_H, 6);
+      emit(p, BPF_ALU | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0x1fff);
+      emit_next_if(p, BPF_JNE, BPF_REG_0, -1, 0);
+      emit_load(p, BPF_B, 0);
+      emit(p, BPF_ALU | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0x0f);
+      emit(p, BPF_ALU | BPF_LSH | BPF_K, BPF_REG_0, 0, 0, 2);
+      emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_8, BPF_REG_0, 0, 0);
+    } else {
+      emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_8, 0, 0, IP6_HDR_LEN);
+    }
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_8, 0, 0);
+    emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_1, 0, 0, 4);
+    emit_next_if(p, BPF_JLT, BPF_REG_7, BPF_REG_1, 0);
+
+    if(r->sport >= 0) {
+      emit(p, BPF_LD | BPF_IND | BPF_H, 0, BPF_REG_8, 0, 0);
+      emit_next_if(p, BPF_JNE, BPF_REG_0, -1, r->sport);
+    }
+    if(r->dport >= 0) {
+      emit(p, BPF_LD | BPF_IND | BPF_H, 0, BPF_REG_8, 0, 2);
+      emit_next_if(p, BPF_JNE, BPF_REG_0, -1, r->dport);
+    }
+    if(r->port >= 0) {
+      emit(p, BPF_LD | BPF_IND | BPF_H, 0, BPF_REG_8, 0, 0);
+      either = emit(p, BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, r->port);
+      emit(p, BPF_LD | BPF_IND | BPF_H, 0, BPF_REG_8, 0, 2);
+      emit_next_if(p, BPF_JNE, BPF_REG_0, -1, r->port);
+      p->insns[either].off = p->len - either - 1;
+    }
+  }
+
+  emit_count_and_return(p, map_fd, i, r->action);
+  emit_next_label(p);
+}
+
+static long filter_bpf(int cmd, union bpf_attr* attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static void filter_compile(struct filter_prog* p, int map_fd) {
+  const struct filter_rule* r;
+  int i;
+
+  memset(p, 0, sizeof(*p));
+  emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+  emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_7, BPF_REG_6, offsetof(struct __sk_buff, len), 0);
+
+  for(i=0; i < filter_nrules; i++) {
+    r = &filter_rules[i];
+    if(!filter_version_specific(r)) {
+      emit_rule(p, r, 0, map_fd, i);
+    } else {
+      if(r->family != 6) {
+        emit_rule(p, r, 4, map_fd, i);
+      }
+      if(r->family != 4) {
+        emit_rule(p, r, 6, map_fd, i);
+      }
+    }
+  }
+  emit_count_and_return(p, map_fd, filter_nrules, FILTER_PASS);
+}
+
+static struct filter_prog filter_code;
+static char filter_log[1 << 20];
+
+// compile the rules and load them with a map for the hit counters.
+// returns the program fd or -1 with *map_fd closed
+static int filter_prog_load(int* map_fd) {
+  union bpf_attr attr;
+  int prog_fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_ARRAY;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint64_t);
+  attr.max_entries = filter_nrules + 1;
+  attr.map_flags = BPF_F_MMAPABLE;
+  *map_fd = filter_bpf(BPF_MAP_CREATE, &attr);
+  if(*map_fd < 0) {
+    fprintf(stderr, "Filtering in userspace, no eBPF map: %s\n", strerror(errno));
+    return -1;
+  }
+
+  filter_compile(&filter_code, *map_fd);
+  if(filter_code.overflow) {
+    fprintf(stderr, "Filtering in userspace, too many rules for eBPF\n");
+    close(*map_fd);
+    return -1;
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+  attr.insns = (uint64_t) (uintptr_t) filter_code.insns;
+  attr.insn_cnt = filter_code.len;
+  attr.license = (uint64_t) (uintptr_t) "GPL";
+  prog_fd = filter_bpf(BPF_PROG_LOAD, &attr);
+  if(prog_fd < 0) {
+    fprintf(stderr, "Filtering in userspace, eBPF program refused: %s\n", strerror(errno));
+    if(debug) {
+      // again for the verifier's explanation, the end of it is what matters
+      attr.log_buf = (uint64_t) (uintptr_t) filter_log;
+      attr.log_size = sizeof(filter_log);
+      attr.log_level = 1;
+      filter_log[0] = '\0';
+      filter_bpf(BPF_PROG_LOAD, &attr);
+      fprintf(stderr, "%s\n", filter_log);
+    }
+    close(*map_fd);
+    return -1;
+  }
+  return prog_fd;
+}
+
+// run the rules in the TUN driver. needs CAP_BPF (or root) and
+// CAP_NET_ADMIN, so call it before dropping privileges.
+// returns 0 or -1 if filter_packet() has to do
+int filter_attach(int tun_fd) {
+  void* map;
+  int map_fd;
+  int prog_fd;
+
+  if(!filter_nrules) {
+    return 0;
+  }
+
+  prog_fd = filter_prog_load(&map_fd);
+  if(prog_fd < 0) {
+    return -1;
+  }
+  if(ioctl(tun_fd, TUNSETFILTEREBPF, &prog_fd) < 0) {
+    fprintf(stderr, "Filtering in userspace, can't attach to the TUN interface: %s\n", strerror(errno));
+    close(prog_fd);
+    close(map_fd);
+    return -1;
+  }
+
+  filter_map_size = (filter_nrules + 1) * sizeof(uint64_t);
+  map = mmap(NULL, filter_map_size, PROT_READ, MAP_SHARED, map_fd, 0);
+  close(map_fd);
+  if(map != MAP_FAILED) {
+    filter_map_hits = (volatile uint64_t*) map;
+  }
+  filter_prog_fd = prog_fd;
+  if(debug) {
+    printf("Filter attached to the TUN interface, %d eBPF instructions\n", filter_code.len);
+  }
+  return 0;
+}
+
+int filter_attached() {
+  return filter_prog_fd >= 0;
+}
+
+// the rules with their hit counters
+size_t filter_format(char* buf, size_t size) {
+  unsigned long hits;
+  size_t len;
+  int i;
+
+  len = snprintf(buf, size, "%d rules, filtering %s\n", filter_nrules,
+                 filter_attached() ? "in the kernel (eBPF)" : "in userspace");
+  for(i=0; i <= filter_nrules && len < size; i++) {
+    if(filter_attached()) {
+      hits = filter_map_hits ? filter_map_hits[i] : 0;
+    } else {
+      hits = filter_hits[i];
+    }
+    len += snprintf(buf + len, size - len, "%10lu %s\n", hits,
+                    (i < filter_nrules) ? filter_rules[i].text : "pass (no rule matched)");
+  }
+  return (len < size) ? len : size - 1;
+}
@@ -0,0 +1,53 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Rules for packets the kernel routes into the TUN interface, one per
+// line, first match wins and anything else passes:
+//
+//   drop|pass [ip4|ip6] [tcp|udp|icmp|icmp6|proto N] [port N] [sport N]
+//             [dport N] [dst ADDR/BITS] [greater N] [less N]
+//
+// "port" matches either port. Rules with ports only match TCP and UDP
+// (and not IPv4 fragments after the first), "greater" and "less"
+// compare the packet length inclusively as in pcap. For IPv6 the
+// protocol is the first next header, extension headers aren't
+// followed. A packet too short for a field doesn't match the rule.
+
+#define FILTER_MAX_RULES (32)
+#define FILTER_RULE_TEXT (96)
+
+#define FILTER_DROP (0)
+#define FILTER_PASS (1)
+
+struct filter_rule {
+  int action;       // FILTER_DROP or FILTER_PASS
+  int family;       // 4, 6 or 0 for any
+  int proto;        // -1 for any
+  int port;         // source or destination, -1 for any
+  int sport;
+  int dport;
+  uint8_t dst[16];  // network order
+  int dst_bits;     // prefix length, -1 for any
+  unsigned long greater; // 0 for no limit
+  unsigned long less;
+  char text[FILTER_RULE_TEXT];
+};
+
+int filter_parse(const char* rules, size_t len);
+int filter_load(const char* path);
+int filter_rule_count();
+
+int filter_attach(int tun_fd);
+int filter_attached();
+
+int filter_packet(const uint8_t* pkt, size_t len);
+
+// for matching packets against rules of other modules
+int filter_parse_match(char* words, struct filter_rule* r);
+int filter_match(const struct filter_rule* r, const uint8_t* pkt, size_t len);
+size_t filter_format(char* buf, size_t size);
+
+#endif
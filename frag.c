@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "frag.h"
+
+// Fragmentation of packets that don't fit in one frame.
+//
+// A packet is cut into k equally sized data fragments, the last one
+// zero padded, followed by r repair fragments from the erasure code
+// in fec.c. The receiver rebuilds the packet as soon as it has any k
+// of the k + r fragments so a lost fragment costs no round trip.
+// Packets that fit in one frame are sent as they are.
+
+extern int debug;
+
+struct frag_stats frag_stats;
+
+static int frag_repair = 0;
+static size_t frag_reserved = 0; // of every frame, for sealing
+static uint8_t frag_next_id = 0;
+
+static struct frag_entry frag_entries[FRAG_MAX_REASSEMBLY];
+static uint8_t frag_out[FRAG_MAX_FRAGMENTS * FRAG_MAX_CHUNK];
+
+// repair is the number of repair fragments added to fragmented packets
+void frag_init(int repair) {
+  fec_init();
+  frag_repair = repair;
+  memset(&frag_stats, 0, sizeof(frag_stats));
+  memset(frag_entries, 0, sizeof(frag_entries));
+}
+
+// keep this many bytes of every frame free
+void frag_reserve(size_t bytes) {
+  frag_reserved = bytes;
+}
+
+int frag_needed(size_t len) {
+  return (len > LINK_MAX_FRAME - LINK_HDR_MAX_LEN - frag_reserved);
+}
+
+static void frag_hdr_encode(const struct frag_hdr* hdr, uint8_t* buf) {
+  buf[0] = hdr->id;
+  buf[1] = hdr->idx;
+  buf[2] = (hdr->k << 4) | hdr->r;
+  buf[3] = hdr->pad;
+  buf[4] = 0; // reserved
+}
+
+static void frag_hdr_decode(struct frag_hdr* hdr, const uint8_t* buf) {
+  hdr->id = buf[0];
+  hdr->idx = buf[1];
+  hdr->k = buf[2] >> 4;
+  hdr->r = buf[2] & 0x0f;
+  hdr->pad = buf[3];
+}
+
+// split pkt into fragments ready to be used as frame payloads.
+// returns the number of fragments or -1 if the packet is too big
+int frag_split(const uint8_t* pkt, size_t len, uint8_t frags[][LINK_MAX_FRAME], size_t* frag_len) {
+  struct frag_hdr hdr;
+  uint8_t* blocks[FRAG_MAX_FRAGMENTS];
+  size_t chunk;
+  size_t off;
+  int k, i;
+
+  if(len == 0) {
+    return -1;
+  }
+
+  k = (len + FRAG_MAX_CHUNK - frag_reserved - 1) / (FRAG_MAX_CHUNK - frag_reserved);
+  if(k > FRAG_MAX_DATA || k + frag_repair > FRAG_MAX_FRAGMENTS) {
+    return -1;
+  }
+  chunk = (len + k - 1) / k;
+
+  hdr.id = frag_next_id++;
+  hdr.k = k;
+  hdr.r = frag_repair;
+  hdr.pad = k * chunk - len;
+
+  for(i=0; i < k + frag_repair; i++) {
+    hdr.idx = i;
+    frag_hdr_encode(&hdr, frags[i]);
+    blocks[i] = frags[i] + FRAG_HDR_LEN;
+
+    if(i < k) {
+      off = i * chunk;
+      if(off + chunk <= len) {
+        memcpy(blocks[i], pkt + off, chunk);
+      } else {
+        memcpy(blocks[i], pkt + off, len - off);
+        memset(blocks[i] + (len - off), 0, chunk - (len - off));
+      }
+    }
+  }
+
+  fec_encode(blocks, k, frag_repair, chunk);
+
+  frag_stats.tx_packets++;
+  frag_stats.tx_repair += frag_repair;
+  *frag_len = FRAG_HDR_LEN + chunk;
+  return k + frag_repair;
+}
+
+static struct frag_entry* frag_get_entry(uint8_t src, const struct frag_hdr* hdr, size_t chunk, uint64_t now) {
+  struct frag_entry* e;
+  struct frag_entry* oldest = NULL;
+  int i;
+
+  for(i=0; i < FRAG_MAX_REASSEMBLY; i++) {
+    e = &frag_entries[i];
+
+    if(e->used && now - e->first_seen > FRAG_TIMEOUT_US) {
+      if(!e->done) {
+        frag_stats.rx_expired++;
+      }
+      e->used = 0;
+    }
+
+    if(e->used && e->src == src && e->id == hdr->id) {
+      // a different packet that reuses the id
+      if(e->k != hdr->k || e->r != hdr->r || e->chunk != chunk) {
+        break;
+      }
+      return e;
+    }
+
+    if(!oldest || !e->used || (oldest->used && e->first_seen < oldest->first_seen)) {
+      oldest = e;
+    }
+  }
+
+  if(i < FRAG_MAX_REASSEMBLY) {
+    oldest = e;
+  }
+
+  if(oldest->used && !oldest->done) {
+    frag_stats.rx_expired++;
+  }
+
+  memset(oldest->present, 0, sizeof(oldest->present));
+  oldest->used = 1;
+  oldest->done = 0;
+  oldest->src = src;
+  oldest->id = hdr->id;
+  oldest->k = hdr->k;
+  oldest->r = hdr->r;
+  oldest->pad = hdr->pad;
+  oldest->chunk = chunk;
+  oldest->count = 0;
+  oldest->first_seen = now;
+  return oldest;
+}
+
+// add a received fragment.
+// returns the packet length and sets pkt once the packet is complete,
+// 0 if more fragments are needed or -1 if the fragment is invalid
+ssize_t frag_reassemble(uint8_t src, const uint8_t* frag, size_t len, uint64_t now, const uint8_t** pkt) {
+  struct frag_hdr hdr;
+  struct frag_entry* e;
+  uint8_t* blocks[FRAG_MAX_FRAGMENTS];
+  size_t chunk;
+  int recovered = 0;
+  int i;
+
+  if(len <= FRAG_HDR_LEN) {
+    frag_stats.rx_invalid++;
+    return -1;
+  }
+  frag_hdr_decode(&hdr, frag);
+  chunk = len - FRAG_HDR_LEN;
+
+  if(hdr.k == 0 || hdr.k + hdr.r > FRAG_MAX_FRAGMENTS || hdr.idx >= hdr.k + hdr.r
+     || chunk > FRAG_MAX_CHUNK || hdr.pad >= chunk) {
+    frag_stats.rx_invalid++;
+    return -1;
+  }
+
+  e = frag_get_entry(src, &hdr, chunk, now);
+  if(e->done || e->present[hdr.idx]) {
+    return 0;
+  }
+
+  memcpy(e->data[hdr.idx], frag + FRAG_HDR_LEN, chunk);
+  e->present[hdr.idx] = 1;
+  e->count++;
+
+  if(e->count < e->k) {
+    return 0;
+  }
+
+  for(i=0; i < e->k + e->r; i++) {
+    blocks[i] = e->data[i];
+    if(i < e->k && !e->present[i]) {
+      recovered = 1;
+    }
+  }
+
+  if(fec_decode(blocks, e->present, e->k, e->r, chunk) < 0) {
+    frag_stats.rx_invalid++;
+    e->used = 0;
+    return -1;
+  }
+
+  for(i=0; i < e->k; i++) {
+    memcpy(frag_out + i * chunk, e->data[i], chunk);
+  }
+
+  e->done = 1;
+  frag_stats.rx_packets++;
+  if(recovered) {
+    frag_stats.rx_recovered++;
+  }
+
+  *pkt = frag_out;
+  return e->k * chunk - e->pad;
+}
@@ -0,0 +1,66 @@
+#ifndef FRAG_H
+#define FRAG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "link.h"
+#include "fec.h"
+
+// id | index | k << 4 | r | padding
+#define FRAG_HDR_LEN (5)
+
+#define FRAG_MAX_FRAGMENTS FEC_MAX_BLOCKS
+// k is sent in 4 bits
+#define FRAG_MAX_DATA (15)
+#define FRAG_MAX_REPAIR (8)
+
+// fragment payload available in one frame
+#define FRAG_MAX_CHUNK (LINK_MAX_FRAME - LINK_HDR_MAX_LEN - FRAG_HDR_LEN)
+
+// partially received packets kept around
+#define FRAG_MAX_REASSEMBLY (8)
+#define FRAG_TIMEOUT_US (30000000)
+
+struct frag_hdr {
+  uint8_t id;
+  uint8_t idx;
+  uint8_t k;   // data fragments
+  uint8_t r;   // repair fragments
+  uint8_t pad; // bytes of padding at the end of the last data fragment
+};
+
+struct frag_stats {
+  unsigned long tx_packets;
+  unsigned long tx_repair;
+  unsigned long rx_packets;
+  unsigned long rx_recovered; // needed repair fragments to rebuild
+  unsigned long rx_expired;
+  unsigned long rx_invalid;
+};
+
+extern struct frag_stats frag_stats;
+
+struct frag_entry {
+  uint8_t used;
+  uint8_t done;
+  uint8_t src;
+  uint8_t id;
+  uint8_t k;
+  uint8_t r;
+  uint8_t pad;
+  uint8_t count;
+  size_t chunk;
+  uint64_t first_seen;
+  uint8_t present[FRAG_MAX_FRAGMENTS];
+  uint8_t data[FRAG_MAX_FRAGMENTS][FRAG_MAX_CHUNK];
+};
+
+void frag_init(int repair);
+void frag_reserve(size_t bytes);
+int frag_needed(size_t len);
+int frag_split(const uint8_t* pkt, size_t len, uint8_t frags[][LINK_MAX_FRAME], size_t* frag_len);
+ssize_t frag_reassemble(uint8_t src, const uint8_t* frag, size_t len, uint64_t now, const uint8_t** pkt);
+
+#endif
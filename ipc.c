@@ -8,203 +8,436 @@
 #include <time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
 #include "ipc.h"
+#include "link.h"
+#include "addrmap.h"
+#include "trace.h"
+#include "rn2903.h"
+#include "capture.h"
+#include "filter.h"
+#include "lz.h"
+
+// Control socket of the running daemon.
+//
+// Clients keep their connection open and send any number of requests,
+// each answered in order (see ipc.h for the framing). Clients are
+// looked up by fd and never block the radio loop: a response the
+// socket doesn't take at once is kept and written when the socket is
+// writable, and the client's next request waits until then.
 
 extern int debug;
 
 const char* socket_file = "/tmp/lora_iface.sock";
 
-struct uclient* uclients = NULL;
-int uclient_count = 0;
+static struct uclient* uclients[FD_SETSIZE]; // indexed by fd
+static int uclient_count = 0;
+static int uclient_maxfd = -1;
 
 int usock;
 
-void handle_uclient_msg(struct uclient* ucl) {
-
-  char cmd;
-  char* arg;
+static void ipc_put_hdr(uint8_t* hdr, size_t len, char cmd, uint8_t status) {
+  hdr[0] = len >> 8;
+  hdr[1] = len;
+  hdr[2] = cmd;
+  hdr[3] = status;
+}
 
-  cmd = (ucl->msg)[0];
-  arg = (ucl->msg)+1;
+void handle_uclient_msg(struct uclient* ucl, char cmd, const char* arg, size_t arg_len) {
 
+  static char response[MAX_UCLIENT_RESPONSE_SIZE];
+  struct rn2903_settings settings;
+  char current[128];
+  char requested[128];
+  char path[256];
+  uint64_t down_us;
+  uint64_t recovering_us;
+  int recovering;
+  size_t len;
 
   switch(cmd) {
 
-  case 'a':
-    // TODO
+  case 'a': // add a device
+  case 'x': // remove a device
+    len = snprintf(response, sizeof(response),
+                   "Only one RN2903 per instance, start another lora_iface for more\n");
+    send_uclient_response(ucl, cmd, IPC_E_UNSUPPORTED, response, len);
+    break;
 
+  case 'i': // information about this instance
+    rn2903_format_settings(&rn2903_settings, current, sizeof(current));
+    down_us = rn2903_stats.down_us;
+    recovering = rn2903_recovering(&recovering_us);
+    if(recovering) {
+      down_us += recovering_us;
+    }
+    len = snprintf(response, sizeof(response),
+                   "node %u\n"
+                   "radio %s\n"
+                   "tx %lu packets, %lu frames, %lu bytes, %lu failed\n"
+                   "rx %lu packets, %lu frames, %lu bytes, %lu invalid\n"
+                   "watchdog %lu faults, recovered %lu by rxstop, %lu by sys reset, %lu by reset line, "
+                   "%lu rounds failed, down %lu ms%s\n",
+                   link_node_id, current,
+                   link_stats.tx_packets, link_stats.tx_frames, link_stats.tx_bytes, link_stats.tx_failed,
+                   link_stats.rx_packets, link_stats.rx_frames, link_stats.rx_bytes, link_stats.rx_invalid,
+                   rn2903_stats.faults, rn2903_stats.recovered_rxstop, rn2903_stats.recovered_reset,
+                   rn2903_stats.recovered_hw, rn2903_stats.recover_failed, (unsigned long) (down_us / 1000),
+                   recovering ? ", recovering now" : "");
+    if(lz_enabled() && len < sizeof(response)) {
+      len += snprintf(response + len, sizeof(response) - len,
+                      "lz %lu of %lu packets compressed, %lu bytes to %lu, %lu us compressing, "
+                      "%lu packets decompressed in %lu us\n",
+                      lz_stats.tx_compressed, lz_stats.tx_packets, lz_stats.tx_bytes_in, lz_stats.tx_bytes_out,
+                      lz_stats.tx_cpu_ns / 1000, lz_stats.rx_packets, lz_stats.rx_cpu_ns / 1000);
+    }
+    send_uclient_response(ucl, cmd, IPC_OK, response, MIN(len, sizeof(response) - 1));
     break;
 
-  case 'x':
-    // TODO
+  case 'r': // radio settings, applied between two rx windows
+    if(arg_len) {
+      if(rn2903_parse_settings(arg, arg_len, &settings) < 0) {
+        len = snprintf(response, sizeof(response),
+                       "Expected settings like: freq=915000000 sf=9 bw=125 cr=4/5 pwr=14\n");
+        send_uclient_response(ucl, cmd, IPC_E_INVALID, response, len);
+        break;
+      }
+      rn2903_request_settings(&settings);
+    }
+    rn2903_format_settings(&rn2903_settings, current, sizeof(current));
+    len = snprintf(response, sizeof(response),
+                   "current %s\n"
+                   "%lu sent, %lu already set, %lu refused, last change took %lu us\n",
+                   current, rn2903_stats.settings_sent, rn2903_stats.settings_skipped,
+                   rn2903_stats.settings_failed, (unsigned long) rn2903_stats.settings_us);
+    if(rn2903_settings_pending() && len < sizeof(response)) {
+      settings = rn2903_settings;
+      rn2903_pending_settings(&settings);
+      rn2903_format_settings(&settings, requested, sizeof(requested));
+      len += snprintf(response + len, sizeof(response) - len, "next %s\n", requested);
+    }
+    send_uclient_response(ucl, cmd, IPC_OK, response, MIN(len, sizeof(response) - 1));
+    break;
 
+  case 'm': // address to node id map
+    len = addrmap_dump(response, sizeof(response), link_now_us());
+    send_uclient_response(ucl, cmd, IPC_OK, response, len);
     break;
 
-  case 'i':
-    // TODO
+  case 'l': // latency histograms
+  case 'L': // same, then start over
+    len = trace_dump(response, sizeof(response));
+    send_uclient_response(ucl, cmd, IPC_OK, response, len);
+    if(cmd == 'L') {
+      trace_reset();
+    }
+    break;
 
+  case 'k': // frame capture: "on [file]", "off" or nothing for the state
+    if(arg_len >= 2 && !strncmp(arg, "on", 2) && (arg_len == 2 || arg[2] == ' ')) {
+      len = MIN(arg_len - MIN(arg_len, 3), sizeof(path) - 1);
+      memcpy(path, arg + arg_len - len, len);
+      path[len] = '\0';
+      if(!len) {
+        snprintf(path, sizeof(path), "%s", capture_file()[0] ? capture_file() : CAPTURE_DEFAULT_FILE);
+      }
+      if(capture_start(path, CAPTURE_DEFAULT_SIZE) < 0) {
+        len = snprintf(response, sizeof(response), "Failed to capture to %s: %s\n",
+                       path, strerror(errno));
+        send_uclient_response(ucl, cmd, IPC_E_INVALID, response, MIN(len, sizeof(response) - 1));
+        break;
+      }
+    } else if(arg_len == 3 && !strncmp(arg, "off", 3)) {
+      capture_stop();
+    } else if(arg_len) {
+      len = snprintf(response, sizeof(response), "Expected \"on [file]\" or \"off\"\n");
+      send_uclient_response(ucl, cmd, IPC_E_INVALID, response, len);
+      break;
+    }
+    len = snprintf(response, sizeof(response), "capture %s%s%s, %lu frames in %lu slots\n",
+                   capture_enabled() ? "on" : "off", capture_file()[0] ? " to " : "",
+                   capture_file(), capture_stats.frames, (unsigned long) capture_slots());
+    send_uclient_response(ucl, cmd, IPC_OK, response, MIN(len, sizeof(response) - 1));
+    break;
+
+  case 'f': // TUN filter rules and their hit counters
+    len = filter_format(response, sizeof(response));
+    send_uclient_response(ucl, cmd, IPC_OK, response, len);
+    break;
+
+  case 'p': // ping
+    send_uclient_response(ucl, cmd, IPC_OK, NULL, 0);
     break;
-  }
 
-  remove_uclient(ucl);
+  default:
+    send_uclient_response(ucl, cmd, IPC_E_UNKNOWN, NULL, 0);
+    break;
+  }
 }
 
 
 struct uclient* add_uclient(int fd) {
 
-  struct uclient *cur;
+  struct uclient *ucl;
 
-  struct uclient *ucl = (struct uclient *)malloc(sizeof(struct uclient));
-  if(!ucl) {
-    return NULL;
-  }
-  
-  ucl->fd = fd;
-  ucl->next = NULL;
-  ucl->msg = (char *)malloc(MAX_UCLIENT_MSG_SIZE+1);
-  if(!(ucl->msg)) {
+  if(fd < 0 || fd >= FD_SETSIZE || uclients[fd]) {
     return NULL;
   }
 
-  ucl->msg_len = 0;  
-
-  if(!uclients) {
-    uclients = ucl;
-    uclient_count++;
-    return ucl;
-  }
-  
-  cur = uclients;
-  while(cur->next) {
-    cur = cur->next;
+  ucl = (struct uclient *)calloc(1, sizeof(struct uclient));
+  if(!ucl) {
+    return NULL;
   }
+  ucl->fd = fd;
 
-  cur->next = ucl;
+  uclients[fd] = ucl;
   uclient_count++;
+  uclient_maxfd = MAX(uclient_maxfd, fd);
   return ucl;
 }
 
 int remove_uclient(struct uclient* ucl) {
 
-  struct uclient *cur;
-  struct uclient *prev = NULL;
-
-  if(!ucl || !uclients)
+  if(!ucl || ucl->fd < 0 || ucl->fd >= FD_SETSIZE || uclients[ucl->fd] != ucl) {
     return -1;
-  
-  if(uclients == ucl) {
-    uclients = ucl->next;
-    close(ucl->fd);
-    free(ucl->msg);
-    free(ucl);
-    uclient_count--;
-    return 0;
-  }
-
-  for(cur = uclients; cur->next; cur = cur->next) {
-    if(cur == ucl) {
-      prev->next = cur->next;
-      close(ucl->fd);
-      free(ucl->msg);
-      free(ucl);
-      uclient_count--;
-      return 0;
-    }
-    prev = cur;
   }
-  return -1;
+
+  uclients[ucl->fd] = NULL;
+  uclient_count--;
+  while(uclient_maxfd >= 0 && !uclients[uclient_maxfd]) {
+    uclient_maxfd--;
+  }
+
+  close(ucl->fd);
+  free(ucl->out);
+  free(ucl);
+  return 0;
 }
 
 // check if fd is a uclient fd
 // and return its uclient struct
 struct uclient* is_uclient_fd(int fd) {
 
-  struct uclient *cur;
-
-  if(!uclients)
+  if(fd < 0 || fd >= FD_SETSIZE) {
     return NULL;
-  
-  for(cur = uclients; cur->next; cur = cur->next) {
-    if(cur->fd == fd) {
-      return cur;
+  }
+  return uclients[fd];
+}
+
+// write what we can of the pending output.
+// returns -1 if the client is gone
+static int flush_uclient(struct uclient* ucl) {
+  ssize_t ret;
+
+  while(ucl->out_off < ucl->out_len) {
+    ret = send(ucl->fd, ucl->out + ucl->out_off, ucl->out_len - ucl->out_off,
+               MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(ret < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return 0;
+      }
+      return -1;
     }
+    ucl->out_off += ret;
   }
-  return NULL;
+  ucl->out_off = 0;
+  ucl->out_len = 0;
+  return 0;
 }
 
+// handle the complete requests in the input buffer,
+// as long as the responses are written right away
+static void process_uclient_input(struct uclient* ucl) {
+  size_t len;
+  size_t used;
+
+  while(!ucl->out_len && !ucl->closing && ucl->in_len >= IPC_HDR_LEN) {
+    len = (ucl->in[0] << 8) | ucl->in[1];
+    if(len > MAX_UCLIENT_MSG_SIZE) {
+      send_uclient_response(ucl, ucl->in[2], IPC_E_TOO_LONG, NULL, 0);
+      ucl->closing = 1;
+      return;
+    }
+    used = IPC_HDR_LEN + len;
+    if(ucl->in_len < used) {
+      return;
+    }
 
+    handle_uclient_msg(ucl, ucl->in[2], (char*) ucl->in + IPC_HDR_LEN, len);
+
+    memmove(ucl->in, ucl->in + used, ucl->in_len - used);
+    ucl->in_len -= used;
+  }
+}
+
+// the old protocol: the command letter and its argument, answered
+// when the client is done sending (or at once for queries)
+static void process_legacy_input(struct uclient* ucl, int eof) {
+  char cmd = ucl->in[0];
+
+  if(ucl->closing) {
+    return;
+  }
+  if(cmd == 'i' || cmd == 'm' || cmd == 'l' || cmd == 'L' || eof) {
+    ucl->in[ucl->in_len] = '\0';
+    handle_uclient_msg(ucl, cmd, (char*) ucl->in + 1, ucl->in_len - 1);
+    ucl->closing = 1;
+  }
+}
 
 void receive_uclient_msg(struct uclient* ucl) {
-  int num_bytes = read(ucl->fd, ucl->msg + ucl->msg_len, MAX_UCLIENT_MSG_SIZE - ucl->msg_len);
+  ssize_t num_bytes;
+
+  num_bytes = read(ucl->fd, ucl->in + ucl->in_len, sizeof(ucl->in) - 1 - ucl->in_len);
 
   if(num_bytes < 0) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    }
     fprintf(stderr, "Error reading from socket %s: %s\n", socket_file, strerror(errno));
+    remove_uclient(ucl);
     return;
-  } else if(num_bytes == 0) {
-    ucl->msg[ucl->msg_len] = '\0';
-    handle_uclient_msg(ucl);
+  }
+
+  if(num_bytes == 0) {
+    if(ucl->legacy && ucl->in_len) {
+      process_legacy_input(ucl, 1);
+    }
+    if(!ucl->out_len) {
+      remove_uclient(ucl);
+    } else {
+      ucl->closing = 1; // after the response is out
+    }
     return;
   }
-  // if this is an information request
-  if(ucl->msg[0] == 'i') {
-    handle_uclient_msg(ucl);
-    return;    
+
+  if(!ucl->started) {
+    ucl->started = 1;
+    ucl->legacy = (ucl->in[0] != 0);
+  }
+  ucl->in_len += num_bytes;
+
+  if(ucl->legacy) {
+    process_legacy_input(ucl, ucl->in_len >= sizeof(ucl->in) - 1);
+  } else {
+    process_uclient_input(ucl);
+  }
+
+  if(ucl->closing && !ucl->out_len) {
+    remove_uclient(ucl);
   }
-  
-  ucl->msg_len += num_bytes;
 }
 
 
-void send_uclient_response(struct uclient* ucl, char* data, size_t len) {
-  int sent_data = 0;
+// queue a response, writing as much of it as the socket takes now
+void send_uclient_response(struct uclient* ucl, char cmd, uint8_t status, const char* data, size_t len) {
+  uint8_t hdr[IPC_HDR_LEN];
+  struct iovec iov[2];
+  struct msghdr msg;
+  size_t hdr_len = 0;
+  size_t off = 0;
   ssize_t ret;
-  
-  while(sent_data < len) {
-    ret = send(ucl->fd, data + sent_data, len - sent_data, 0);
+
+  if(len > MAX_UCLIENT_RESPONSE_SIZE) {
+    len = MAX_UCLIENT_RESPONSE_SIZE;
+  }
+  if(!ucl->legacy) {
+    ipc_put_hdr(hdr, len, cmd, status);
+    hdr_len = IPC_HDR_LEN;
+  }
+
+  // nothing else pending, so try to skip the copy
+  if(!ucl->out_len) {
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = hdr_len;
+    iov[1].iov_base = (void*) data;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    ret = sendmsg(ucl->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
     if(ret < 0) {
+      if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        ucl->closing = 1; // gone, dropped after this request
+        return;
+      }
+      ret = 0;
+    }
+    off = ret;
+    if(off == hdr_len + len) {
       return;
     }
-    sent_data += ret;
   }
-  close(ucl->fd);
+
+  if(!ucl->out) {
+    ucl->out = (uint8_t *)malloc(IPC_HDR_LEN + MAX_UCLIENT_RESPONSE_SIZE);
+    if(!ucl->out) {
+      ucl->closing = 1;
+      return;
+    }
+  }
+
+  // at most one response is pending (see process_uclient_input)
+  if(off < hdr_len) {
+    memcpy(ucl->out, hdr + off, hdr_len - off);
+    memcpy(ucl->out + hdr_len - off, data, len);
+    ucl->out_len = hdr_len + len - off;
+  } else {
+    memcpy(ucl->out, data + off - hdr_len, hdr_len + len - off);
+    ucl->out_len = hdr_len + len - off;
+  }
+  ucl->out_off = 0;
 }
 
 
-// if get_response > 1 then response is received and printed
+// read exactly len bytes
+static int read_full(int sock, void* buf, size_t len) {
+  size_t got = 0;
+  ssize_t ret;
+
+  while(got < len) {
+    ret = read(sock, (uint8_t*) buf + got, len - got);
+    if(ret < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if(ret == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    got += ret;
+  }
+  return 0;
+}
+
+// if get_response is set then the response is received and printed
 int send_uclient_msg(char cmd, char* arg, int get_response) {
 
   int sock;
-  size_t cmd_len;
-  int bytes_written;
-  int bytes_received;
+  size_t arg_len;
+  size_t len;
+  size_t bytes_written;
   int ret;
-  char* full_cmd;
+  uint8_t request[IPC_HDR_LEN + MAX_UCLIENT_MSG_SIZE];
+  uint8_t hdr[IPC_HDR_LEN];
   struct sockaddr_un addr;
   char received[MAX_UCLIENT_RESPONSE_SIZE + 1];
-	
-  if(arg) {
-    cmd_len = strlen(arg) + 2; // one for leading cmd and one for trailing \0
-    if(cmd_len > MAX_UCLIENT_MSG_SIZE) {
-      fprintf(stderr, "Command too long (max %d bytes)\n", MAX_UCLIENT_MSG_SIZE);
-      return -1;
-    }
-  } else {
-    cmd_len = 2;
-  }
 
-  full_cmd = (char *)malloc(cmd_len);
-  if(!full_cmd) {
+  arg_len = arg ? strlen(arg) : 0;
+  if(arg_len > MAX_UCLIENT_MSG_SIZE) {
+    fprintf(stderr, "Command too long (max %d bytes)\n", MAX_UCLIENT_MSG_SIZE);
     return -1;
   }
-
-  if(arg) {
-    snprintf(full_cmd, cmd_len, "%c%s", cmd, arg);
-  } else {
-    snprintf(full_cmd, cmd_len, "%c", cmd);
+  ipc_put_hdr(request, arg_len, cmd, 0);
+  if(arg_len) {
+    memcpy(request + IPC_HDR_LEN, arg, arg_len);
   }
 
   memset(&addr, 0, sizeof(struct sockaddr_un));
@@ -212,47 +445,46 @@ int send_uclient_msg(char cmd, char* arg, int get_response) {
   strcpy(addr.sun_path, socket_file);
 
   sock = socket(AF_LOCAL, SOCK_STREAM, 0);
-			
+
   if(connect(sock, (struct sockaddr*) &addr, sizeof(struct sockaddr_un)) < 0) {
     fprintf(stderr, "Connect failed to %s: %s\n", socket_file, strerror(errno));
     fprintf(stderr, "Are you sure you have a running lora_iface instance?\n");
-    free(full_cmd);
     close(sock);
     return -1;
   }
 
   bytes_written = 0;
-			
-  while(bytes_written < cmd_len) {
-    ret = write(sock, full_cmd+bytes_written, cmd_len-bytes_written);
+
+  while(bytes_written < IPC_HDR_LEN + arg_len) {
+    ret = write(sock, request + bytes_written, IPC_HDR_LEN + arg_len - bytes_written);
     if(ret < 0)  {
       fprintf(stderr, "Write failed to %s: %s\n", socket_file, strerror(errno));
-      free(full_cmd);
       close(sock);
       return -1;
     }
     bytes_written += ret;
   }
 
-  free(full_cmd);
-
   if(get_response) {
-    bytes_received = 0;
-    // receive until disconnect, then print received data
-    while(1) {
-      ret = read(sock, received + bytes_received, MAX_UCLIENT_RESPONSE_SIZE - bytes_received);
-
-      if(ret < 0) {
-        fprintf(stderr, "Error reading from socket %s: %s\n", socket_file, strerror(errno));
-        return -1;
-      } else if(ret == 0) {
-        received[bytes_received] = '\0';
-        printf("%s\n", received);
-        break;
-      }
-      bytes_received += ret;
+    if(read_full(sock, hdr, IPC_HDR_LEN) < 0) {
+      fprintf(stderr, "Error reading from socket %s: %s\n", socket_file, strerror(errno));
+      close(sock);
+      return -1;
+    }
+    len = (hdr[0] << 8) | hdr[1];
+    if(len > MAX_UCLIENT_RESPONSE_SIZE || read_full(sock, received, len) < 0) {
+      fprintf(stderr, "Error reading from socket %s: %s\n", socket_file, strerror(errno));
+      close(sock);
+      return -1;
     }
+    received[len] = '\0';
 
+    if(hdr[3] != IPC_OK) {
+      fprintf(stderr, "Command '%c' failed (%u)%s%s", cmd, hdr[3], len ? ": " : "\n", received);
+      close(sock);
+      return -1;
+    }
+    printf("%s\n", received);
   }
 
   close(sock);
@@ -270,7 +502,7 @@ int open_ipc_socket() {
   strcpy(addr.sun_path, socket_file);
 
   usock = socket(AF_LOCAL, SOCK_STREAM, 0);
-			
+
   usock_opts = fcntl(usock, F_GETFL, 0);
   ret = fcntl(usock, F_SETFL, usock_opts | O_NONBLOCK);
   if(ret == -1) {
@@ -308,47 +540,85 @@ void accept_ipc_connection() {
 	socklen_t addr_size = sizeof(struct sockaddr);
   int fd;
 
-  if(uclient_count >= MAX_UCLIENTS) {
-    fprintf(stderr, "Client connection limit reached (%d)\n", MAX_UCLIENTS);
-    return;
-  }
-
 	fd = accept(usock, (struct sockaddr *)&addr, &addr_size);
 
 	if(fd < 0) {
-    fprintf(stderr, "Accept failed on socket %s: %s\n", socket_file, strerror(errno));
+    if(errno != EAGAIN && errno != EWOULDBLOCK) {
+      fprintf(stderr, "Accept failed on socket %s: %s\n", socket_file, strerror(errno));
+    }
     return;
   }
 
-  add_uclient(fd);
+  if(uclient_count >= MAX_UCLIENTS) {
+    fprintf(stderr, "Client connection limit reached (%d)\n", MAX_UCLIENTS);
+    close(fd);
+    return;
+  }
 
-  return;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+  if(!add_uclient(fd)) {
+    close(fd);
+  }
 }
 
 // returns the new maxfd
-int add_uclients_to_fd_set(fd_set* readfds, int maxfd) {
+int add_uclients_to_fd_set(fd_set* readfds, fd_set* writefds, int maxfd) {
   struct uclient* ucl;
+  int fd;
 
   // add unix ipc socket to set
   FD_SET(usock, readfds);
   maxfd = MAX(maxfd, usock);
 
-  FOR_ALL_UCLIENTS(ucl) {
-    FD_SET(ucl->fd, readfds);
-    maxfd = MAX(maxfd, ucl->fd);
+  for(fd=0; fd <= uclient_maxfd; fd++) {
+    ucl = uclients[fd];
+    if(!ucl) {
+      continue;
+    }
+    // requests wait while a response is being written
+    if(ucl->out_len) {
+      FD_SET(fd, writefds);
+    } else {
+      FD_SET(fd, readfds);
+    }
+    maxfd = MAX(maxfd, fd);
   }
   return maxfd;
 }
 
-void handle_uclient_connections(fd_set* readfds) {
+void handle_uclient_connections(fd_set* readfds, fd_set* writefds) {
   struct uclient* ucl;
+  int fd;
 
   if(FD_ISSET(usock, readfds)) {
     accept_ipc_connection();
   }
 
-  FOR_ALL_UCLIENTS(ucl) {
-    if(FD_ISSET(ucl->fd, readfds)) {
+  // handlers may remove the client, so look it up again each time
+  for(fd=0; fd <= uclient_maxfd; fd++) {
+    ucl = uclients[fd];
+    if(!ucl) {
+      continue;
+    }
+
+    if(ucl->out_len && FD_ISSET(fd, writefds)) {
+      if(flush_uclient(ucl) < 0) {
+        remove_uclient(ucl);
+        continue;
+      }
+      if(!ucl->out_len) {
+        if(ucl->closing) {
+          remove_uclient(ucl);
+          continue;
+        }
+        // requests that arrived while we were writing
+        process_uclient_input(ucl);
+        if(ucl->closing && !ucl->out_len) {
+          remove_uclient(ucl);
+        }
+      }
+    } else if(!ucl->out_len && FD_ISSET(fd, readfds)) {
       receive_uclient_msg(ucl);
     }
   }
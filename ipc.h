@@ -1,28 +1,56 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/select.h>
+
+extern const char* socket_file;
 
 #define MAX_UCLIENTS (255)
 #define MAX_UCLIENT_MSG_SIZE (100)
 #define MAX_UCLIENT_RESPONSE_SIZE (32768)
 
+// Every request and response starts with a header:
+//
+//   length (2 bytes, big endian, of what follows) | cmd | status
+//
+// Requests are at most MAX_UCLIENT_MSG_SIZE long, so the first byte of
+// a request is always 0. A connection that starts with anything else
+// speaks the old protocol: one text command, one response, then close.
+#define IPC_HDR_LEN (4)
+
+// response status
+#define IPC_OK (0)
+#define IPC_E_UNKNOWN (1)     // unknown command
+#define IPC_E_UNSUPPORTED (2) // not possible with this instance
+#define IPC_E_TOO_LONG (3)    // request too long, connection is closed
+#define IPC_E_INVALID (4)     // bad argument
+
 #define MAX(x,y) ((x)<=(y)?(y):(x))
 #define MIN(x,y) ((x)<=(y)?(x):(y))
 
 struct uclient {
   int fd;
-  char* msg;
-  unsigned int msg_len;
-  struct uclient* next;
-};
+  int started;  // has sent something
+  int legacy;   // old text protocol
+  int closing;  // close once the output has been written
+
+  size_t in_len;
+  uint8_t in[IPC_HDR_LEN + MAX_UCLIENT_MSG_SIZE + 1];
 
-#define FOR_ALL_UCLIENTS(_ucl) for(_ucl = uclients; _ucl; _ucl = _ucl->next)
+  // what the socket didn't take yet, allocated when first needed.
+  // no more requests are handled until it has been written
+  uint8_t* out;
+  size_t out_off;
+  size_t out_len;
+};
 
 struct uclient* add_uclient(int fd);
 int remove_uclient(struct uclient* ucl);
 struct uclient* is_uclient_fd(int fd);
-void handle_uclient_msg(struct uclient* ucl);
+void handle_uclient_msg(struct uclient* ucl, char cmd, const char* arg, size_t arg_len);
 void receive_uclient_msg(struct uclient* ucl);
 int send_uclient_msg(char cmd, char* arg, int get_response);
 int open_ipc_socket();
 void accept_ipc_connection();
-void handle_uclient_connections(fd_set* readfds);
-int add_uclients_to_fd_set(fd_set* readfds, int maxfd);
-void send_uclient_response(struct uclient* ucl, char* data, size_t len);
+void handle_uclient_connections(fd_set* readfds, fd_set* writefds);
+int add_uclients_to_fd_set(fd_set* readfds, fd_set* writefds, int maxfd);
+void send_uclient_response(struct uclient* ucl, char cmd, uint8_t status, const char* data, size_t len);
@@ -0,0 +1,585 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "link.h"
+#include "arq.h"
+#include "frag.h"
+#include "tcp_stage.h"
+#include "lz.h"
+#include "addrmap.h"
+#include "trace.h"
+#include "aead.h"
+#include "relay.h"
+
+// Link layer framing between the TUN interface and the radio.
+//
+// Every frame starts with a flags byte and the source and
+// destination node ids, followed by the optional ARQ fields:
+//
+//   flags | src | dst | [relay] | [seq] | [ack | sack] | payload
+//
+// TCP/IP headers may be compressed (see tcp_stage.c), payloads
+// may be compressed (see lz.c) and packets too big for one frame
+// are fragmented (see frag.c).
+//
+// The destination is looked up from the IP destination address
+// using what was learned from the source addresses of received frames
+// (see addrmap.c). Unknown destinations, multicast and broadcast go
+// to LINK_BROADCAST.
+//
+// Raw frames from applications (see raw.c) take the same path with
+// their own destination and LINK_F_RAW instead of an IP packet.
+//
+// With a key every frame is sealed as the last step before it goes to
+// the radio and opened before anything in it is acted on (see aead.c).
+//
+// With relaying on, broadcasts we send are flooded over several hops
+// and those of other nodes are relayed right here (see relay.c).
+
+extern int debug;
+
+struct link_stats link_stats;
+uint8_t link_node_id = 0;
+
+void (*link_raw_handler)(uint8_t src, uint8_t dst, const uint8_t* data, size_t len) = NULL;
+uint64_t (*link_clock)() = NULL;
+
+// the fragments of the last packet read from the TUN interface.
+// a packet that fits in one frame is a single unfragmented "fragment"
+static uint8_t link_frags[FRAG_MAX_FRAGMENTS][LINK_MAX_FRAME];
+static size_t link_frag_len = 0;
+static int link_frag_count = 0;
+static int link_frag_next = 0;
+static uint8_t link_frag_flags = 0;
+static uint8_t link_pending_dst = LINK_BROADCAST;
+static int link_pending_arq = 1; // unicast goes through ARQ if enabled
+static struct trace_tag link_pending_tag;
+
+static size_t link_last_frame_len = 0;
+static struct trace_tag link_last_tag;
+
+uint64_t link_now_us() {
+  struct timespec ts;
+
+  if(link_clock) {
+    return link_clock();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int link_hdr_encode(const struct link_hdr* hdr, uint8_t* buf, size_t size) {
+  int i = 0;
+
+  if(size < LINK_HDR_MAX_LEN) {
+    return -1;
+  }
+
+  buf[i++] = hdr->flags;
+  buf[i++] = hdr->src;
+  buf[i++] = hdr->dst;
+  if(hdr->flags & LINK_F_RELAY) {
+    buf[i++] = hdr->relay;
+    buf[i++] = hdr->flood;
+  }
+  if(hdr->flags & LINK_F_ARQ) {
+    buf[i++] = hdr->seq;
+  }
+  if(hdr->flags & LINK_F_ACK) {
+    buf[i++] = hdr->ack;
+    buf[i++] = hdr->sack;
+  }
+  return i;
+}
+
+int link_hdr_decode(struct link_hdr* hdr, const uint8_t* buf, size_t len) {
+  size_t i = 0;
+
+  if(len < LINK_HDR_MIN_LEN) {
+    return -1;
+  }
+
+  memset(hdr, 0, sizeof(struct link_hdr));
+  hdr->flags = buf[i++];
+  hdr->src = buf[i++];
+  hdr->dst = buf[i++];
+
+  if(hdr->flags & ~(LINK_F_ARQ | LINK_F_ACK | LINK_F_FRAG | LINK_F_TCP | LINK_F_LZ | LINK_F_RAW | LINK_F_SEC
+                    | LINK_F_RELAY)) {
+    return -1; // from a newer version of lora_iface
+  }
+
+  if(hdr->flags & LINK_F_RELAY) {
+    if(len < i + 2 || hdr->dst != LINK_BROADCAST || (hdr->flags & (LINK_F_ARQ | LINK_F_ACK))) {
+      return -1;
+    }
+    hdr->relay = buf[i++];
+    hdr->flood = buf[i++];
+    if(RELAY_DONE(hdr->relay) + RELAY_LEFT(hdr->relay) > RELAY_MAX_HOPS) {
+      return -1;
+    }
+  }
+
+  if(hdr->flags & LINK_F_ARQ) {
+    if(len < i + 1) {
+      return -1;
+    }
+    hdr->seq = buf[i++];
+  }
+  if(hdr->flags & LINK_F_ACK) {
+    if(len < i + 2) {
+      return -1;
+    }
+    hdr->ack = buf[i++];
+    hdr->sack = buf[i++];
+  }
+  return i;
+}
+
+// get source (which=0) or destination (which=1) address of an IP packet.
+// returns the address length or 0 if this isn't an IP packet
+static int link_ip_addr(const uint8_t* pkt, size_t len, int which, const uint8_t** addr) {
+
+  if(len < 1) {
+    return 0;
+  }
+
+  switch(pkt[0] >> 4) {
+  case 4:
+    if(len < 20) {
+      return 0;
+    }
+    *addr = pkt + (which ? 16 : 12);
+    return 4;
+  case 6:
+    if(len < 40) {
+      return 0;
+    }
+    *addr = pkt + (which ? 24 : 8);
+    return 16;
+  }
+  return 0;
+}
+
+static int link_is_group_addr(const uint8_t* addr, int addr_len) {
+  if(addr_len == 4) {
+    if((addr[0] & 0xf0) == 0xe0) { // 224.0.0.0/4
+      return 1;
+    }
+    if(addr[0] == 0xff && addr[1] == 0xff && addr[2] == 0xff && addr[3] == 0xff) {
+      return 1;
+    }
+    return 0;
+  }
+  return (addr[0] == 0xff); // ff00::/8
+}
+
+static int link_is_unspecified(const uint8_t* addr, int addr_len) {
+  int i;
+
+  for(i=0; i < addr_len; i++) {
+    if(addr[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// a packet that still has the TTL (hop limit) hosts start with
+// hasn't been routed, so its source address is the sender's own
+static int link_is_originated(const uint8_t* pkt, size_t len) {
+  uint8_t ttl;
+
+  if(len < 20 || ((pkt[0] >> 4) != 4 && (pkt[0] >> 4) != 6)) {
+    return 0;
+  }
+  ttl = ((pkt[0] >> 4) == 4) ? pkt[8] : pkt[7];
+  return (ttl == 64 || ttl == 128 || ttl == 255);
+}
+
+// remember which node a packet with this source address came from
+void link_learn(uint8_t node, const uint8_t* pkt, size_t len) {
+  const uint8_t* addr;
+  int addr_len;
+
+  addr_len = link_ip_addr(pkt, len, 0, &addr);
+  if(!addr_len || node == LINK_BROADCAST || link_is_unspecified(addr, addr_len)) {
+    return;
+  }
+  addrmap_learn(addr, addr_len, node, link_is_originated(pkt, len), link_now_us());
+}
+
+// find the node a packet should be sent to
+uint8_t link_lookup(const uint8_t* pkt, size_t len) {
+  const uint8_t* addr;
+  int addr_len;
+  int node;
+
+  addr_len = link_ip_addr(pkt, len, 1, &addr);
+  if(!addr_len || link_is_group_addr(addr, addr_len)) {
+    return LINK_BROADCAST;
+  }
+
+  node = addrmap_lookup(addr, addr_len);
+  if(node < 0) {
+    return LINK_BROADCAST;
+  }
+  return node;
+}
+
+// arq_retries of 0 disables ARQ for frames we send.
+// fec_repair is the number of repair fragments for fragmented packets
+int link_init(uint8_t node_id, int arq_retries, int fec_repair) {
+  if(node_id == LINK_BROADCAST) {
+    fprintf(stderr, "Node id %d is reserved for broadcast\n", LINK_BROADCAST);
+    return -1;
+  }
+
+  link_node_id = node_id;
+  memset(&link_stats, 0, sizeof(link_stats));
+  link_frag_count = 0;
+  link_frag_next = 0;
+
+  if(fec_repair < 0 || fec_repair > FRAG_MAX_REPAIR) {
+    fprintf(stderr, "Number of repair fragments must be between 0 and %d\n", FRAG_MAX_REPAIR);
+    return -1;
+  }
+
+  arq_init(arq_retries, ARQ_DEFAULT_TURNAROUND_US);
+  frag_init(fec_repair);
+  frag_reserve(aead_overhead());
+  return 0;
+}
+
+// can we take another packet from the TUN interface?
+// if not then it stays in the kernel transmit queue
+int link_tx_ready() {
+  return (link_frag_next >= link_frag_count);
+}
+
+// hand over a packet read from the TUN interface at read_us.
+// returns 0 if it was accepted, 1 if busy and -1 if it was dropped
+int link_tun_packet(const uint8_t* pkt, size_t len, uint64_t read_us) {
+  uint8_t hc[TCP_STAGE_MAX_PACKET + 2];
+  uint8_t lz[LZ_MAX_INPUT + 1];
+  uint8_t flags = 0;
+  ssize_t hc_len;
+  ssize_t lz_len;
+  const uint8_t* addr;
+  int addr_len;
+
+  if(!link_tx_ready()) {
+    return 1;
+  }
+
+  if(len == 0) {
+    return -1;
+  }
+
+  // packets from the TUN interface tell us our own addresses,
+  // unless we are only routing them
+  addr_len = link_ip_addr(pkt, len, 0, &addr);
+  if(addr_len && !link_is_unspecified(addr, addr_len) && link_is_originated(pkt, len)) {
+    addrmap_learn_local(addr, addr_len);
+  }
+
+  link_pending_dst = link_lookup(pkt, len);
+
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  if(hc_len > 0) {
+    pkt = hc;
+    len = hc_len;
+    flags = LINK_F_TCP;
+  }
+
+  lz_len = lz_compress(pkt, len, lz, sizeof(lz));
+  if(lz_len > 0) {
+    pkt = lz;
+    len = lz_len;
+    flags |= LINK_F_LZ;
+  }
+
+  if(frag_needed(len)) {
+    link_frag_count = frag_split(pkt, len, link_frags, &link_frag_len);
+    if(link_frag_count < 0) {
+      if(debug) {
+        printf("Dropping packet of %u bytes, too big to fragment\n", (unsigned int) len);
+      }
+      link_stats.tx_too_big++;
+      link_frag_count = 0;
+      return -1;
+    }
+    link_frag_flags = flags | LINK_F_FRAG;
+  } else {
+    memcpy(link_frags[0], pkt, len);
+    link_frag_len = len;
+    link_frag_count = 1;
+    link_frag_flags = flags;
+  }
+  link_frag_next = 0;
+  link_pending_arq = 1;
+  link_stats.tx_packets++;
+
+  memset(&link_pending_tag, 0, sizeof(link_pending_tag));
+  if(read_us) {
+    link_pending_tag.read = read_us;
+    link_pending_tag.queued = link_now_us();
+    trace_since(TRACE_STAGED, read_us, link_pending_tag.queued);
+  }
+
+  return 0;
+}
+
+// the largest raw frame payload, less with a key
+size_t link_raw_max() {
+  return LINK_MAX_FRAME - LINK_HDR_MAX_LEN - aead_overhead();
+}
+
+// hand over a raw frame from an application, it isn't
+// compressed or fragmented. arq asks for retransmissions
+// if ARQ is enabled and dst isn't LINK_BROADCAST.
+// returns 0 if it was accepted, 1 if busy and -1 if it was dropped
+int link_raw_frame(uint8_t dst, int arq, const uint8_t* data, size_t len) {
+  if(!link_tx_ready()) {
+    return 1;
+  }
+  if(len == 0 || len > link_raw_max()) {
+    link_stats.tx_too_big++;
+    return -1;
+  }
+
+  memcpy(link_frags[0], data, len);
+  link_frag_len = len;
+  link_frag_count = 1;
+  link_frag_next = 0;
+  link_frag_flags = LINK_F_RAW;
+  link_pending_dst = dst;
+  link_pending_arq = arq;
+  link_stats.tx_raw++;
+
+  memset(&link_pending_tag, 0, sizeof(link_pending_tag));
+  return 0;
+}
+
+// trace timestamps of fragment i of the pending packet
+static void link_frag_tag(int i, struct trace_tag* tag) {
+  *tag = link_pending_tag;
+  tag->first = (i == 0);
+  tag->last = (i == link_frag_count - 1);
+}
+
+// build the next frame to hand to the radio.
+// returns the frame length or 0 if there is nothing to send
+ssize_t link_next_frame(uint8_t* buf, size_t size) {
+  struct link_hdr hdr;
+  struct trace_tag tag;
+  const struct trace_tag* arq_tag;
+  const uint8_t* data = NULL;
+  size_t len = 0;
+  int hdr_len;
+  int ret;
+
+  // unicast goes through the ARQ window if enabled
+  if(link_pending_dst != LINK_BROADCAST && arq_enabled() && link_pending_arq) {
+    while(link_frag_next < link_frag_count) {
+      link_frag_tag(link_frag_next, &tag);
+      ret = arq_enqueue(link_pending_dst, link_frag_flags,
+                        link_frags[link_frag_next], link_frag_len, &tag);
+      if(ret != 0) {
+        break;
+      }
+      link_frag_next++;
+    }
+  }
+
+  memset(&link_last_tag, 0, sizeof(link_last_tag));
+
+  // relays go first, they are only worth anything when they are quick.
+  // the frame goes out as it came in, sealed or not
+  ret = relay_next(buf, size, link_now_us());
+  if(ret > 0) {
+    link_last_frame_len = ret;
+    return ret;
+  }
+
+  if(arq_next_frame(link_now_us(), &hdr, &data, &len)) {
+    // got a (re)transmission or an ack
+    arq_tag = arq_inflight_tag();
+    if(arq_tag) {
+      link_last_tag = *arq_tag;
+    }
+  } else if(link_frag_next < link_frag_count
+            && (link_pending_dst == LINK_BROADCAST || !arq_enabled() || !link_pending_arq)) {
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = link_frag_flags;
+    hdr.dst = link_pending_dst;
+    if(hdr.dst == LINK_BROADCAST && relay_hops()) {
+      hdr.flags |= LINK_F_RELAY;
+      hdr.relay = RELAY_BYTE(0, relay_hops());
+      hdr.flood = relay_flood_seq(link_now_us());
+    }
+    arq_fill_ack(&hdr);
+    link_frag_tag(link_frag_next, &link_last_tag);
+    data = link_frags[link_frag_next++];
+    len = link_frag_len;
+  } else {
+    return 0;
+  }
+
+  // the frame is written to the radio right away
+  if(link_last_tag.first) {
+    trace_since(TRACE_QUEUED, link_last_tag.queued, link_now_us());
+  }
+
+  hdr.src = link_node_id;
+  if(aead_enabled()) {
+    hdr.flags |= LINK_F_SEC;
+  }
+  hdr_len = link_hdr_encode(&hdr, buf, size);
+  if(hdr_len < 0 || hdr_len + len > size) {
+    return -1;
+  }
+  if(aead_enabled()) {
+    ret = aead_seal(buf, hdr_len, data, len, buf + hdr_len, size - hdr_len);
+    if(ret < 0) {
+      return -1;
+    }
+    len = ret;
+  } else if(len) {
+    memcpy(buf + hdr_len, data, len);
+  }
+
+  link_last_frame_len = hdr_len + len;
+  return link_last_frame_len;
+}
+
+// called when the radio is done with the frame from link_next_frame()
+void link_tx_done(int ok, uint64_t airtime_us) {
+  if(ok) {
+    link_stats.tx_frames++;
+    link_stats.tx_bytes += link_last_frame_len;
+    if(link_last_tag.last) {
+      trace_since(TRACE_TX_TOTAL, link_last_tag.read, link_now_us());
+    }
+  } else {
+    link_stats.tx_failed++;
+  }
+  arq_tx_done(ok, link_last_frame_len, airtime_us, link_now_us());
+}
+
+// handle a frame received by the radio.
+// returns the length of the payload to deliver to the TUN interface,
+// 0 if there is nothing to deliver and -1 if the frame was invalid
+ssize_t link_rx_frame(const uint8_t* frame, size_t len, const uint8_t** payload) {
+  struct link_hdr hdr;
+  uint8_t aad[LINK_HDR_MAX_LEN];
+  int hdr_len;
+  size_t payload_len;
+  ssize_t ret;
+  uint64_t now = link_now_us();
+
+  hdr_len = link_hdr_decode(&hdr, frame, len);
+  if(hdr_len < 0) {
+    link_stats.rx_invalid++;
+    return -1;
+  }
+  link_stats.rx_frames++;
+  link_stats.rx_bytes += len;
+
+  if(hdr.src == link_node_id && (hdr.flags & LINK_F_RELAY)) {
+    relay_stats.copies++; // ours, relayed back
+    return 0;
+  }
+  if(hdr.src == link_node_id || hdr.src == LINK_BROADCAST) {
+    link_stats.rx_invalid++;
+    return -1;
+  }
+
+  if(hdr.dst != link_node_id && hdr.dst != LINK_BROADCAST) {
+    link_stats.rx_not_for_us++;
+    return 0;
+  }
+
+  // only the node that sent a frame first is a neighbour, and
+  // copies of a flood are dropped before they count as replays
+  if(!(hdr.flags & LINK_F_RELAY) || RELAY_DONE(hdr.relay) == 0) {
+    relay_neighbour(hdr.src, now);
+  }
+  if((hdr.flags & LINK_F_RELAY) && relay_seen(frame, len, LINK_HDR_MIN_LEN, now)) {
+    return 0;
+  }
+
+  payload_len = len - hdr_len;
+  *payload = frame + hdr_len;
+
+  if(aead_enabled() || (hdr.flags & LINK_F_SEC)) {
+    // the header as the origin sealed it
+    memcpy(aad, frame, hdr_len);
+    if(hdr.flags & LINK_F_RELAY) {
+      aad[LINK_HDR_MIN_LEN] = RELAY_ORIGIN(hdr.relay);
+    }
+    ret = aead_open(aad, hdr_len, *payload, payload_len, payload);
+    if(ret < 0) {
+      link_stats.rx_invalid++;
+      return -1;
+    }
+    payload_len = ret;
+  }
+
+  if(hdr.flags & LINK_F_RELAY) {
+    relay_consider(frame, len, LINK_HDR_MIN_LEN, now);
+  }
+
+  if(hdr.flags & LINK_F_ACK) {
+    arq_handle_ack(hdr.src, hdr.ack, hdr.sack);
+  }
+
+  if(hdr.flags & LINK_F_ARQ) {
+    if(!arq_receive(hdr.src, hdr.seq)) {
+      return 0; // duplicate, but it will be acked again
+    }
+  }
+
+  if(hdr.flags & LINK_F_RAW) {
+    if(link_raw_handler) {
+      link_raw_handler(hdr.src, hdr.dst, *payload, payload_len);
+    }
+    link_stats.rx_raw++;
+    return 0;
+  }
+
+  if(hdr.flags & LINK_F_FRAG) {
+    ret = frag_reassemble(hdr.src, *payload, payload_len, now, payload);
+    if(ret <= 0) {
+      return ret;
+    }
+    payload_len = ret;
+  }
+
+  if(hdr.flags & LINK_F_LZ) {
+    ret = lz_decompress(*payload, payload_len, payload);
+    if(ret < 0) {
+      return ret;
+    }
+    payload_len = ret;
+  }
+
+  if(hdr.flags & LINK_F_TCP) {
+    ret = tcp_decompress(hdr.src, *payload, payload_len, payload);
+    if(ret < 0) {
+      return ret;
+    }
+    payload_len = ret;
+  }
+
+  if(payload_len) {
+    // a relayed packet's source isn't in reach
+    if(!(hdr.flags & LINK_F_RELAY) || RELAY_DONE(hdr.relay) == 0) {
+      link_learn(hdr.src, *payload, payload_len);
+    }
+    link_stats.rx_packets++;
+  }
+  return payload_len;
+}
@@ -0,0 +1,80 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// largest payload accepted by "radio tx"
+#define LINK_MAX_FRAME (255)
+
+#define LINK_BROADCAST (0xff)
+
+// frame flags (first byte of every frame)
+#define LINK_F_ARQ (0x01) // frame carries a sequence number and wants an ack
+#define LINK_F_ACK (0x02) // frame carries a cumulative ack and sack bitmap
+#define LINK_F_FRAG (0x04) // payload is a fragment (see frag.h)
+#define LINK_F_TCP (0x08) // payload is a compressed TCP packet (see tcp_stage.h)
+#define LINK_F_LZ (0x10) // payload is compressed (see lz.h)
+#define LINK_F_RAW (0x20) // payload is a raw frame, not IP (see raw.h)
+#define LINK_F_SEC (0x40) // payload is encrypted and authenticated (see aead.h)
+#define LINK_F_RELAY (0x80) // broadcast relayed over several hops (see relay.h)
+
+// flags + src + dst
+#define LINK_HDR_MIN_LEN (3)
+// relayed frames have no ARQ fields, so they are never longer
+#define LINK_HDR_MAX_LEN (6)
+
+struct link_hdr {
+  uint8_t flags;
+  uint8_t src;
+  uint8_t dst;
+  uint8_t relay; // only if LINK_F_RELAY: hops done and left
+  uint8_t flood; // only if LINK_F_RELAY: the origin's flood sequence number
+  uint8_t seq;  // only if LINK_F_ARQ
+  uint8_t ack;  // only if LINK_F_ACK: next sequence number expected
+  uint8_t sack; // only if LINK_F_ACK: bit i set means ack+1+i was received
+};
+
+struct link_stats {
+  unsigned long tx_packets; // taken from the TUN interface
+  unsigned long tx_frames;
+  unsigned long tx_bytes;
+  unsigned long tx_failed;  // frames the radio didn't send
+  unsigned long rx_packets; // delivered to the TUN interface
+  unsigned long rx_frames;
+  unsigned long rx_bytes;
+  unsigned long rx_not_for_us;
+  unsigned long rx_invalid;
+  unsigned long tx_too_big;
+  unsigned long tx_raw;     // raw frames taken from applications
+  unsigned long rx_raw;     // raw frames handed to link_raw_handler
+};
+
+extern struct link_stats link_stats;
+extern uint8_t link_node_id;
+
+// gets raw frames addressed to us, they are dropped if not set
+extern void (*link_raw_handler)(uint8_t src, uint8_t dst, const uint8_t* data, size_t len);
+
+// replaces the monotonic clock behind link_now_us() if set
+extern uint64_t (*link_clock)();
+
+uint64_t link_now_us();
+
+int link_hdr_encode(const struct link_hdr* hdr, uint8_t* buf, size_t size);
+int link_hdr_decode(struct link_hdr* hdr, const uint8_t* buf, size_t len);
+
+void link_learn(uint8_t node, const uint8_t* pkt, size_t len);
+uint8_t link_lookup(const uint8_t* pkt, size_t len);
+
+int link_init(uint8_t node_id, int arq_retries, int fec_repair);
+int link_tx_ready();
+int link_tun_packet(const uint8_t* pkt, size_t len, uint64_t read_us);
+size_t link_raw_max();
+int link_raw_frame(uint8_t dst, int arq, const uint8_t* data, size_t len);
+ssize_t link_next_frame(uint8_t* buf, size_t size);
+void link_tx_done(int ok, uint64_t airtime_us);
+ssize_t link_rx_frame(const uint8_t* frame, size_t len, const uint8_t** payload);
+
+#endif
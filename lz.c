@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "lz.h"
+
+// Payload compression in the LZ4 block format.
+//
+// Static dictionaries (e.g. trained on our JSON/CBOR telemetry) can be
+// loaded at startup. A dictionary acts as history in front of the
+// payload so matches can point into it. Both ends need the same
+// dictionary files: the first byte of a compressed payload is the id
+// of the dictionary used, derived from its contents.
+// Every payload is tried with each dictionary and without one, and the
+// smallest result is used if it is smaller than the original.
+
+#define LZ_MIN_MATCH (4)
+#define LZ_LAST_LITERALS (5) // the block ends with at least this many literals
+#define LZ_MF_LIMIT (12)     // no match starts this close to the end
+#define LZ_MAX_OFFSET (65535)
+
+extern int debug;
+
+struct lz_stats lz_stats;
+
+static int lz_on = 0;
+
+// index 0 is the empty dictionary
+static struct lz_dict lz_dicts[LZ_MAX_DICTS + 1];
+static int lz_dict_count = 0;
+
+static uint8_t lz_out[LZ_MAX_INPUT];
+
+static uint64_t lz_cpu_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t lz_read32(const uint8_t* p) {
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void lz_init(int enabled) {
+  lz_on = enabled;
+  memset(&lz_stats, 0, sizeof(lz_stats));
+  memset(&lz_dicts[0], 0, sizeof(struct lz_dict));
+  lz_dicts[0].id = LZ_NO_DICT;
+  lz_dict_count = 0;
+}
+
+int lz_enabled() {
+  return lz_on;
+}
+
+// load a dictionary file. at most LZ_MAX_DICT_SIZE bytes are used,
+// from the end of the file since recent history is the most useful
+int lz_load_dict(const char* path) {
+  struct lz_dict* d;
+  FILE* f;
+  uint8_t buf[LZ_MAX_DICT_SIZE];
+  uint32_t hash = 2166136261u;
+  size_t len = 0;
+  size_t ret;
+  size_t i;
+  int j;
+
+  if(lz_dict_count >= LZ_MAX_DICTS) {
+    fprintf(stderr, "At most %d dictionaries can be loaded\n", LZ_MAX_DICTS);
+    return -1;
+  }
+
+  f = fopen(path, "rb");
+  if(!f) {
+    fprintf(stderr, "Failed to open dictionary %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  // keep the last LZ_MAX_DICT_SIZE bytes
+  while((ret = fread(buf, 1, sizeof(buf), f)) > 0) {
+    d = &lz_dicts[lz_dict_count + 1];
+    if(ret == sizeof(buf)) {
+      memcpy(d->buf, buf, ret);
+      len = ret;
+    } else {
+      if(len + ret > LZ_MAX_DICT_SIZE) {
+        memmove(d->buf, d->buf + (len + ret - LZ_MAX_DICT_SIZE), LZ_MAX_DICT_SIZE - ret);
+        len = LZ_MAX_DICT_SIZE - ret;
+      }
+      memcpy(d->buf + len, buf, ret);
+      len += ret;
+    }
+  }
+  fclose(f);
+
+  if(len < LZ_MIN_MATCH) {
+    fprintf(stderr, "Dictionary %s is too small\n", path);
+    return -1;
+  }
+
+  d = &lz_dicts[lz_dict_count + 1];
+  d->len = len;
+  for(i=0; i < len; i++) {
+    hash = (hash ^ d->buf[i]) * 16777619u;
+  }
+  d->id = (hash & 0xff) ? (hash & 0xff) : 1;
+
+  for(j=1; j <= lz_dict_count; j++) {
+    if(lz_dicts[j].id == d->id) {
+      fprintf(stderr, "Dictionary %s has the same id as another dictionary\n", path);
+      return -1;
+    }
+  }
+
+  memset(d->hash, 0, sizeof(d->hash));
+  for(i=0; i + LZ_MIN_MATCH <= len; i++) {
+    d->hash[lz_hash(lz_read32(d->buf + i))] = i + 1;
+  }
+
+  lz_dict_count++;
+  lz_on = 1;
+  if(debug) {
+    printf("Loaded dictionary %s (%u bytes, id %u)\n", path, (unsigned int) len, d->id);
+  }
+  return 0;
+}
+
+static int lz_put_len(uint8_t* out, size_t size, size_t* o, size_t len) {
+  while(len >= 255) {
+    if(*o >= size) {
+      return -1;
+    }
+    out[(*o)++] = 255;
+    len -= 255;
+  }
+  if(*o >= size) {
+    return -1;
+  }
+  out[(*o)++] = len;
+  return 0;
+}
+
+static int lz_put_sequence(uint8_t* out, size_t size, size_t* o,
+                           const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len) {
+  uint8_t* token;
+
+  if(*o >= size) {
+    return -1;
+  }
+  token = out + (*o)++;
+  *token = (lit_len < 15 ? lit_len : 15) << 4;
+  if(lit_len >= 15 && lz_put_len(out, size, o, lit_len - 15) < 0) {
+    return -1;
+  }
+  if(*o + lit_len > size) {
+    return -1;
+  }
+  memcpy(out + *o, lit, lit_len);
+  *o += lit_len;
+
+  if(!match_len) {
+    return 0; // last sequence
+  }
+
+  if(*o + 2 > size) {
+    return -1;
+  }
+  out[(*o)++] = offset & 0xff;
+  out[(*o)++] = offset >> 8;
+
+  match_len -= LZ_MIN_MATCH;
+  *token |= (match_len < 15 ? match_len : 15);
+  if(match_len >= 15 && lz_put_len(out, size, o, match_len - 15) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// compress len bytes placed right after the dictionary in d->buf
+static ssize_t lz_block(struct lz_dict* d, size_t len, uint8_t* out, size_t size) {
+  uint16_t table[LZ_HASH_SIZE];
+  const uint8_t* buf = d->buf;
+  size_t start = d->len;
+  size_t end = d->len + len;
+  size_t ip = start;
+  size_t anchor = start;
+  size_t ref;
+  size_t match_len;
+  size_t o = 0;
+  uint32_t h;
+
+  memcpy(table, d->hash, sizeof(table));
+
+  while(len > LZ_MF_LIMIT && ip + LZ_MF_LIMIT < end) {
+    h = lz_hash(lz_read32(buf + ip));
+    ref = table[h];
+    table[h] = ip + 1;
+
+    if(!ref || ip - (ref - 1) > LZ_MAX_OFFSET || lz_read32(buf + ref - 1) != lz_read32(buf + ip)) {
+      ip++;
+      continue;
+    }
+    ref--;
+
+    match_len = LZ_MIN_MATCH;
+    while(ip + match_len < end - LZ_LAST_LITERALS && buf[ref + match_len] == buf[ip + match_len]) {
+      match_len++;
+    }
+
+    if(lz_put_sequence(out, size, &o, buf + anchor, ip - anchor, ip - ref, match_len) < 0) {
+      return -1;
+    }
+    ip += match_len;
+    anchor = ip;
+  }
+
+  if(lz_put_sequence(out, size, &o, buf + anchor, end - anchor, 0, 0) < 0) {
+    return -1;
+  }
+  return o;
+}
+
+// compress a payload with whichever dictionary works best.
+// returns the compressed length or 0 if it doesn't get any smaller
+ssize_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t size) {
+  uint8_t tmp[LZ_MAX_INPUT];
+  struct lz_dict* d;
+  ssize_t best = -1;
+  ssize_t ret;
+  uint64_t start;
+  int i;
+
+  if(!lz_on || len < 2 || len > LZ_MAX_INPUT || size < 2) {
+    return 0;
+  }
+
+  start = lz_cpu_ns();
+
+  for(i=0; i <= lz_dict_count; i++) {
+    d = &lz_dicts[i];
+    memcpy(d->buf + d->len, in, len);
+
+    // only keep results that beat the best so far
+    ret = lz_block(d, len, tmp, (best < 0 ? len : (size_t) best) - 1);
+    if(ret < 0) {
+      continue;
+    }
+    best = ret;
+    out[0] = d->id;
+    memcpy(out + 1, tmp, ret);
+  }
+
+  lz_stats.tx_packets++;
+  lz_stats.tx_bytes_in += len;
+  lz_stats.tx_cpu_ns += lz_cpu_ns() - start;
+
+  if(best < 0 || (size_t) best + 1 >= len || (size_t) best + 1 > size) {
+    lz_stats.tx_bytes_out += len;
+    return 0;
+  }
+
+  lz_stats.tx_compressed++;
+  lz_stats.tx_bytes_out += best + 1;
+  if(debug) {
+    printf("Compressed %u -> %u bytes (%u%%) in %lu ns\n",
+           (unsigned int) len, (unsigned int) best + 1,
+           (unsigned int) ((best + 1) * 100 / len), (unsigned long) (lz_cpu_ns() - start));
+  }
+  return best + 1;
+}
+
+static int lz_get_len(const uint8_t* in, size_t len, size_t* ip, size_t* val) {
+  uint8_t b;
+
+  do {
+    if(*ip >= len) {
+      return -1;
+    }
+    b = in[(*ip)++];
+    *val += b;
+  } while(b == 255);
+  return 0;
+}
+
+// decode an LZ4 block straight into lz_out
+static ssize_t lz_block_decode(const struct lz_dict* d, const uint8_t* in, size_t len) {
+  size_t ip = 0;
+  size_t op = 0;
+  size_t lit_len, match_len, offset, i;
+  uint8_t token;
+
+  while(ip < len) {
+    token = in[ip++];
+
+    lit_len = token >> 4;
+    if(lit_len == 15 && lz_get_len(in, len, &ip, &lit_len) < 0) {
+      return -1;
+    }
+    if(ip + lit_len > len || op + lit_len > sizeof(lz_out)) {
+      return -1;
+    }
+    memcpy(lz_out + op, in + ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    if(ip == len) {
+      return op; // last sequence has no match
+    }
+
+    if(ip + 2 > len) {
+      return -1;
+    }
+    offset = in[ip] | (in[ip+1] << 8);
+    ip += 2;
+
+    match_len = token & 0x0f;
+    if(match_len == 15 && lz_get_len(in, len, &ip, &match_len) < 0) {
+      return -1;
+    }
+    match_len += LZ_MIN_MATCH;
+
+    if(offset == 0 || offset > op + d->len || op + match_len > sizeof(lz_out)) {
+      return -1;
+    }
+
+    // byte by byte since matches may overlap their own output
+    for(i=0; i < match_len; i++, op++) {
+      if(offset <= op) {
+        lz_out[op] = lz_out[op - offset];
+      } else {
+        lz_out[op] = d->buf[d->len - (offset - op)];
+      }
+    }
+  }
+  return -1;
+}
+
+// returns the decompressed length and sets out, or -1 on failure
+ssize_t lz_decompress(const uint8_t* in, size_t len, const uint8_t** out) {
+  struct lz_dict* d = NULL;
+  uint64_t start;
+  ssize_t ret;
+  int i;
+
+  if(len < 2) {
+    lz_stats.rx_invalid++;
+    return -1;
+  }
+
+  for(i=0; i <= lz_dict_count; i++) {
+    if(lz_dicts[i].id == in[0]) {
+      d = &lz_dicts[i];
+      break;
+    }
+  }
+  if(!d) {
+    lz_stats.rx_unknown_dict++;
+    return -1;
+  }
+
+  start = lz_cpu_ns();
+  ret = lz_block_decode(d, in + 1, len - 1);
+  lz_stats.rx_cpu_ns += lz_cpu_ns() - start;
+
+  if(ret < 0) {
+    lz_stats.rx_invalid++;
+    return -1;
+  }
+  lz_stats.rx_packets++;
+  *out = lz_out;
+  return ret;
+}
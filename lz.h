@@ -0,0 +1,45 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LZ_MAX_DICTS (4)
+#define LZ_MAX_DICT_SIZE (4096)
+#define LZ_MAX_INPUT (1536)
+
+#define LZ_HASH_BITS (12)
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+// dictionary id of payloads compressed without a dictionary
+#define LZ_NO_DICT (0)
+
+struct lz_dict {
+  uint8_t id;
+  size_t len;
+  uint16_t hash[LZ_HASH_SIZE]; // positions + 1 in buf, 0 if empty
+  uint8_t buf[LZ_MAX_DICT_SIZE + LZ_MAX_INPUT];
+};
+
+struct lz_stats {
+  unsigned long tx_packets;
+  unsigned long tx_compressed; // packets that got smaller
+  unsigned long tx_bytes_in;
+  unsigned long tx_bytes_out;
+  unsigned long tx_cpu_ns;
+  unsigned long rx_packets;
+  unsigned long rx_unknown_dict;
+  unsigned long rx_invalid;
+  unsigned long rx_cpu_ns;
+};
+
+extern struct lz_stats lz_stats;
+
+void lz_init(int enabled);
+int lz_enabled();
+int lz_load_dict(const char* path);
+ssize_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t size);
+ssize_t lz_decompress(const uint8_t* in, size_t len, const uint8_t** out);
+
+#endif
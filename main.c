@@ -5,30 +5,62 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdarg.h>
-#include <termios.h>
 #include <grp.h>
 #include <pwd.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <linux/capability.h>
+
+#include "ipc.h"
+#include "rn2903.h"
+#include "link.h"
+#include "arq.h"
+#include "tcp_stage.h"
+#include "lz.h"
+#include "addrmap.h"
+#include "trace.h"
+#include "shmstats.h"
+#include "frag.h"
+#include "raw.h"
+#include "capture.h"
+#include "transcript.h"
+#include "dedup.h"
+#include "relay.h"
+#include "filter.h"
+#include "aead.h"
+#include "spool.h"
+#include "tune.h"
+#include "serial.h"
+#include "radiostate.h"
 
 // group and user to run this program as
 #define RUNAS_GROUP "juul"
 #define RUNAS_USER "juul"
 
-#define TX_QUEUE_LENGTH (20)
-#define LORA_MTU (500)
-
 #define RECEIVE_TIME 100
 
 int debug;
 
-// drop root privileges
-int drop_privs(char* group_name, char* user_name) {
+int tun_fd; // interface fd, for the radio callbacks
+char tun_name[IFNAMSIZ]; // its name, for tuning it
+
+// a packet in no spool class read while the link was down, it is
+// staged before anything else is read
+uint8_t tun_held[TCP_STAGE_MAX_PACKET];
+size_t tun_held_len = 0;
+uint64_t tun_held_us;
+
+// drop root privileges, except CAP_NET_ADMIN if keep_net_admin
+int drop_privs(char* group_name, char* user_name, int keep_net_admin) {
+  struct __user_cap_header_struct cap_hdr;
+  struct __user_cap_data_struct cap_data[_LINUX_CAPABILITY_U32S_3];
   struct passwd *pwd;
   struct group *grp;
   gid_t group_id;
@@ -58,6 +90,12 @@ int drop_privs(char* group_name, char* user_name) {
   user_id = pwd->pw_uid;
   pwd = NULL;
 
+  // capabilities are cleared by setuid() otherwise
+  if(keep_net_admin && prctl(PR_SET_KEEPCAPS, 1, 0, 0, 0) < 0) {
+    perror("unable to keep capabilities");
+    return -1;
+  }
+
   if(setgid(group_id) != 0) {
     perror("unable to drop group privilege from root");
     return -1;
@@ -68,6 +106,17 @@ int drop_privs(char* group_name, char* user_name) {
     return -1;    
   }
 
+  if(keep_net_admin) {
+    memset(&cap_hdr, 0, sizeof(cap_hdr));
+    memset(cap_data, 0, sizeof(cap_data));
+    cap_hdr.version = _LINUX_CAPABILITY_VERSION_3;
+    cap_data[0].effective = cap_data[0].permitted = 1 << CAP_NET_ADMIN;
+    if(syscall(SYS_capset, &cap_hdr, cap_data) != 0) {
+      perror("unable to keep CAP_NET_ADMIN");
+      return -1;
+    }
+  }
+
   return 0;
 }
 
@@ -89,7 +138,8 @@ int create_tun(char* dev) {
 
   memset(&ifr, 0, sizeof(ifr));
 
-  ifr.ifr_flags = IFF_TUN;
+  // no packet information header, we only carry IP
+  ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
 
   if(dev) {
     strncpy(ifr.ifr_name, dev, IFNAMSIZ);
@@ -127,7 +177,7 @@ int get_txqueuelen(char* ifname) {
   ifr.ifr_addr.sa_family = AF_INET;
   strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
 
-  ioctl(fd, SIOCGIFTXQLEN, (caddr_t) &ifr);
+  ret = ioctl(fd, SIOCGIFTXQLEN, (caddr_t) &ifr);
   if(ret < 0) {
     perror("Error during SIOCGIFTXQLEN ioctl (get txqueuelen)");
     close(fd);
@@ -154,7 +204,7 @@ int set_txqueuelen(char* ifname, int num_packets) {
 
   ifr.ifr_qlen = num_packets;
 
-  ioctl(fd, SIOCSIFTXQLEN, (caddr_t) &ifr);
+  ret = ioctl(fd, SIOCSIFTXQLEN, (caddr_t) &ifr);
   if(ret < 0) {
     perror("Error during SIOCSIFTXQLEN ioctl (set txqueuelen)");
     close(fd);
@@ -179,7 +229,7 @@ int get_mtu(char* ifname) {
   ifr.ifr_addr.sa_family = AF_INET;
   strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
 
-  ioctl(fd, SIOCGIFMTU, (caddr_t) &ifr);
+  ret = ioctl(fd, SIOCGIFMTU, (caddr_t) &ifr);
   if(ret < 0) {
     perror("Error during SIOCGIFMTU ioctl (get mtu)");
     close(fd);
@@ -206,7 +256,7 @@ int set_mtu(char* ifname, int mtu) {
 
   ifr.ifr_mtu = mtu; 
 
-  ioctl(fd, SIOCSIFMTU, (caddr_t) &ifr);
+  ret = ioctl(fd, SIOCSIFMTU, (caddr_t) &ifr);
   if(ret < 0) {
     perror("Error during SIOCSIFMTU ioctl (set mtu)");
     close(fd);
@@ -217,82 +267,423 @@ int set_mtu(char* ifname, int mtu) {
   return 0;
 }
 
+// apply the values worked out by the tuning (see tune.h)
+int tune_interface_mtu(int mtu) {
+  if(set_mtu(tun_name, mtu) < 0) {
+    fprintf(stderr, "Unable to set the MTU of the %s interface\n", tun_name);
+    return -1;
+  }
+  return 0;
+}
 
-// baud is specified using macros
-// e.g. 9600 is B9600
-int open_serial(char* dev, speed_t baud) {
+int tune_interface_qlen(int qlen) {
+  if(set_txqueuelen(tun_name, qlen) < 0) {
+    fprintf(stderr, "Unable to set the txqueuelen of the %s interface\n", tun_name);
+    return -1;
+  }
+  return 0;
+}
 
-  int fd;
 
-  fd = open(dev, O_RDWR); /* connect to port */
-  if(fd < 0) {
-    fprintf(stderr, "Failed to open serial device %s: %s\n", dev, strerror(errno));
-    return fd;
+int receive_done(int fds, char* recvd, size_t size);
+
+int transmit_done(int fds, char* res, size_t size) {
+  if(!res && debug) {
+    printf("Transmission failed\n");
   }
-  
-  struct termios settings;
-  if(tcgetattr(fd, &settings) < 0) {
-    fprintf(stderr, "Failed to get serial device %s attributes: %s\n", dev, strerror(errno));
-    return -1;
+  link_tx_done(res != NULL, rn2903_tx_airtime_us());
+
+  return rn2903_rx(fds, RECEIVE_TIME, receive_done);
+}
+
+// the last frame received, captured once its SNR is known
+static uint8_t rx_frame[LINK_MAX_FRAME];
+static ssize_t rx_frame_len = 0;
+
+void capture_radio_frame(int dir, const uint8_t* frame, size_t len, int snr) {
+  struct capture_radio radio;
+
+  radio.freq = rn2903_settings.freq;
+  radio.bw = rn2903_settings.bw;
+  radio.sf = rn2903_settings.sf;
+  radio.snr = snr;
+  capture_frame(dir, frame, len, &radio);
+}
+
+// move staged packets on to the link layer while it takes them.
+// raw frames and IP packets take turns when both are waiting,
+// spooled packets go when there is nothing else
+void stage_to_link() {
+  static int raw_turn = 1;
+  uint8_t pkt[TCP_STAGE_MAX_PACKET];
+  uint64_t read_us;
+  uint8_t dst;
+  uint8_t flags;
+  ssize_t len;
+  int spooled;
+  int ret;
+
+  while(link_tx_ready()) {
+    if(raw_tx_pending() && (raw_turn || !tcp_stage_depth())) {
+      raw_turn = 0;
+      len = raw_tx_pop(&dst, &flags, pkt, sizeof(pkt));
+      if(len > 0 && link_raw_frame(dst, flags & RAW_TX_ARQ, pkt, len) < 0 && debug) {
+        printf("Dropping raw frame of %d bytes for node %u\n", (int) len, dst);
+      }
+      continue;
+    }
+    raw_turn = 1;
+
+    len = tcp_stage_pop(pkt, sizeof(pkt), &read_us);
+    spooled = (len == 0);
+    if(spooled) {
+      len = spool_peek(pkt, sizeof(pkt));
+      read_us = 0;
+    }
+    if(len <= 0) {
+      return;
+    }
+    ret = link_tun_packet(pkt, len, read_us);
+    if(ret == 0) {
+      tune_packet_taken(read_us, link_now_us());
+    }
+
+    // a spooled packet stays in the spool until the link layer has it
+    if(spooled) {
+      if(ret != 0) {
+        return;
+      }
+      spool_pop();
+    }
   }
-  
-  cfsetospeed(&settings, baud); /* baud rate */
-  settings.c_cflag &= ~PARENB; /* no parity */
-  settings.c_cflag &= ~CSTOPB; /* 1 stop bit */
-  settings.c_cflag &= ~CSIZE;
-  settings.c_cflag |= CS8 | CLOCAL; /* 8 bits */
-  settings.c_lflag = ICANON; /* canonical mode */
-  settings.c_oflag &= ~OPOST; /* raw output */
-  
-  if(tcsetattr(fd, TCSANOW, &settings) < 0) {
-    fprintf(stderr, "Failed to set serial device %s attributes: %s\n", dev, strerror(errno));
-    return -1;
+}
+
+int radio_next(int fds);
+
+int settings_done(int fds, char* res, size_t size) {
+  char buf[128];
+
+  if(!res) {
+    fprintf(stderr, "The RN2903 refused the new radio settings\n");
+  } else if(debug) {
+    rn2903_format_settings(&rn2903_settings, buf, sizeof(buf));
+    printf("Radio settings: %s\n", buf);
   }
-  
-  tcflush(fd, TCOFLUSH);
-  
-  return fd;
+  radiostate_save(&rn2903_settings);
+  return radio_next(fds);
 }
 
-int close_serial(int fd) {
-  close(fd);
+// send the next frame if there is one
+// otherwise listen for another rx window.
+// new radio settings go in first, queued frames just wait for them
+int radio_next(int fds) {
+  uint8_t frame[LINK_MAX_FRAME];
+  ssize_t len;
+
+  if(rn2903_settings_pending()) {
+    return rn2903_apply_settings(fds, settings_done);
+  }
+
+  stage_to_link();
+
+  len = link_next_frame(frame, sizeof(frame));
+  if(len < 0) {
+    return len;
+  }
+  if(len > 0) {
+    capture_radio_frame(CAPTURE_TX, frame, len, CAPTURE_SNR_UNKNOWN);
+    return rn2903_tx(fds, frame, len, transmit_done);
+  }
+
+  return rn2903_rx(fds, RECEIVE_TIME, receive_done);
 }
 
+// settings of the module from the radio state file, if it was the same one
+static struct rn2903_settings radio_saved;
+static int radio_saved_known = 0;
+
+int restore_done(int fds, char* res, size_t size) {
+  return radio_next(fds);
+}
+
+// start the radio loop, once what the module is set to is known
+int radio_start(int fds) {
+  if(radio_saved_known) {
+    radio_saved_known = 0;
+    return rn2903_restore_settings(fds, &radio_saved, restore_done);
+  }
+  return radio_next(fds);
+}
+
+// the SNR is recorded by the rn2903 driver.
+// a raw frame that came in goes to subscribers with it
+int snr_done(int fds, char* res, size_t size) {
+  raw_rx_done(res ? rn2903_stats.snr_last : RAW_SNR_UNKNOWN, rn2903_settings.freq,
+              rn2903_settings.bw, rn2903_settings.sf, rn2903_settings.cr);
+  if(rx_frame_len > 0) {
+    capture_radio_frame(CAPTURE_RX, rx_frame, rx_frame_len,
+                        res ? rn2903_stats.snr_last : CAPTURE_SNR_UNKNOWN);
+    rx_frame_len = 0;
+  }
+  return radio_next(fds);
+}
+
+// broadcasts without ARQ reach us once per path they take, so copies
+// are recognised by their hex before any of it is decoded. nothing in
+// the frame tells a copy from the same frame sent again, so a repeat
+// within the window (an ARP retry, the same beacon) is dropped too
+// unless a key makes every frame different. relayed floods are left
+// to the link layer, which counts their copies
+int rx_duplicate(const char* hex, size_t size, uint64_t now) {
+  uint8_t hdr[LINK_HDR_MIN_LEN];
+
+  if(!dedup_enabled() || size < LINK_HDR_MIN_LEN * 2
+     || rn2903_hex_decode(hex, LINK_HDR_MIN_LEN * 2, hdr, sizeof(hdr)) < 0) {
+    return 0;
+  }
+  if((hdr[0] & (LINK_F_ARQ | LINK_F_RELAY)) || hdr[2] != LINK_BROADCAST) {
+    return 0;
+  }
+  return dedup_seen(hex, size, now);
+}
 
 int receive_done(int fds, char* recvd, size_t size) {
+  uint8_t frame[LINK_MAX_FRAME];
+  const uint8_t* payload;
+  uint64_t start;
+  ssize_t len;
+  ssize_t ret;
+
+  if(recvd) {
+    start = link_now_us();
+    if(rx_duplicate(recvd, size, start)) {
+      if(capture_enabled()) {
+        rx_frame_len = rn2903_hex_decode(recvd, size, rx_frame, sizeof(rx_frame));
+      }
+      return rn2903_get_snr(fds, snr_done);
+    }
+
+    len = rn2903_hex_decode(recvd, size, frame, sizeof(frame));
+    if(len < 0) {
+      fprintf(stderr, "Received invalid data from rn2903\n");
+      link_stats.rx_invalid++;
+    } else {
+      if(capture_enabled()) {
+        memcpy(rx_frame, frame, len);
+        rx_frame_len = len;
+      }
+      len = link_rx_frame(frame, len, &payload);
+      if(len > 0) {
+        ret = write(tun_fd, payload, len);
+        if(ret < 0) {
+          perror("Error writing to TUN interface");
+        } else {
+          transcript_record(TRANSCRIPT_TUN_OUT, payload, len);
+          trace_since(TRACE_RX, start, link_now_us());
+        }
+      }
+    }
+
+    // ask how well it was heard before moving on
+    return rn2903_get_snr(fds, snr_done);
+  }
 
-  // TODO
-  // 
-  // 1. If recvd not NULL (something was received)
-  //    Send it to TUN interface (fdi)
-  // 2. Have another select call in here
-  //    to check if there is anything to transmit
-  //    Then transmit it. 
-  //    Then run rn2903_rx again once transmission is done.
+  return radio_next(fds);
+}
+
+// read one packet from the TUN interface and stage it for the link layer
+int tun_read(int fdi) {
+  uint8_t pkt[TCP_STAGE_MAX_PACKET];
+  ssize_t len;
+  int prio;
+
+  len = read(fdi, pkt, sizeof(pkt));
+  if(len < 0) {
+    if(errno == EAGAIN || errno == EINTR) {
+      return 0;
+    }
+    perror("Error reading from TUN interface");
+    return -1;
+  }
+  transcript_record(TRANSCRIPT_TUN_IN, pkt, len);
+  if(filter_packet(pkt, len) == FILTER_DROP) {
+    return 0;
+  }
+
+  // packets in a spool class wait there for the link
+  prio = spool_class(pkt, len);
+  if(prio >= 0) {
+    spool_push(pkt, len, prio, link_lookup(pkt, len));
+    stage_to_link();
+    return 0;
+  }
+  if(!tcp_stage_ready()) {
+    // read while the link is down, to get at the packets to spool.
+    // this one waits for the link and the interface isn't read until then
+    memcpy(tun_held, pkt, len);
+    tun_held_len = len;
+    tun_held_us = link_now_us();
+    spool_stats.held++;
+    return 0;
+  }
+
+  tcp_stage_push(pkt, len, link_now_us());
+  stage_to_link();
+  return 0;
+}
+
+// copy the counters of all modules to the shared memory stats page
+void publish_stats() {
+  struct shmstats_counters c;
+
+  memset(&c, 0, sizeof(c));
+  c.tx_packets = link_stats.tx_packets;
+  c.tx_frames = link_stats.tx_frames;
+  c.tx_bytes = link_stats.tx_bytes;
+  c.rx_packets = link_stats.rx_packets;
+  c.rx_frames = link_stats.rx_frames;
+  c.rx_bytes = link_stats.rx_bytes;
+
+  c.tx_failed = link_stats.tx_failed;
+  c.tx_too_big = link_stats.tx_too_big;
+  c.tx_arq_gave_up = arq_stats.dropped;
+  c.tx_acks_thinned = tcp_stage_stats.acks_thinned;
+  c.rx_invalid = link_stats.rx_invalid;
+  c.rx_not_for_us = link_stats.rx_not_for_us;
+  c.rx_duplicate = arq_stats.rx_dups;
+  c.rx_frag_expired = frag_stats.rx_expired;
+  c.rx_frag_invalid = frag_stats.rx_invalid;
+  c.rx_tcp_invalid = tcp_stage_stats.rx_invalid + tcp_stage_stats.rx_no_context
+    + tcp_stage_stats.rx_unknown_addr;
+  c.rx_lz_invalid = lz_stats.rx_invalid + lz_stats.rx_unknown_dict;
+
+  c.stage_depth = tcp_stage_depth();
+  c.arq_pending = arq_pending();
+
+  c.airtime_us = rn2903_stats.airtime_us;
+  c.arq_retransmits = arq_stats.retransmits;
+  c.serial_errors = rn2903_stats.serial_errors;
+  c.cmd_retries = rn2903_stats.cmd_retries;
+  c.rx_timeouts = rn2903_stats.rx_timeouts;
+  c.tx_timeouts = rn2903_stats.tx_timeouts;
+
+  c.snr_last = rn2903_stats.snr_last;
+  c.snr_min = rn2903_stats.snr_min;
+  c.snr_max = rn2903_stats.snr_max;
+  c.snr_sum = rn2903_stats.snr_sum;
+  c.snr_count = rn2903_stats.snr_count;
+
+  c.tx_raw = link_stats.tx_raw;
+  c.rx_raw = link_stats.rx_raw;
+
+  c.rx_flood_checked = dedup_stats.checked;
+  c.rx_flood_dropped = dedup_stats.dropped;
+  c.rx_flood_evicted = dedup_stats.evicted;
+
+  c.tx_sealed = aead_stats.tx_sealed;
+  c.rx_opened = aead_stats.rx_opened;
+  c.rx_unsealed = aead_stats.rx_unsealed;
+  c.rx_auth_failed = aead_stats.rx_auth_failed + aead_stats.rx_no_sync;
+  c.rx_replayed = aead_stats.rx_replayed;
+
+  c.spool_depth = spool_stats.depth;
+  c.spooled = spool_stats.spooled;
+  c.spool_sent = spool_stats.sent;
+  c.spool_full = spool_stats.full;
+  c.spool_held = spool_stats.held;
+
+  c.if_mtu = tune_stats.mtu;
+  c.if_txqueuelen = tune_stats.qlen;
+  c.if_tunings = tune_stats.changes;
+
+  c.radio_faults = rn2903_stats.faults;
+  c.radio_recovered = rn2903_stats.recovered_rxstop + rn2903_stats.recovered_reset
+    + rn2903_stats.recovered_hw;
+  c.radio_resets = rn2903_stats.recovered_reset + rn2903_stats.recovered_hw;
+  c.radio_down_us = rn2903_stats.down_us;
+
+  c.relay_heard = relay_stats.heard;
+  c.relay_copies = relay_stats.copies;
+  c.relay_queued = relay_stats.queued;
+  c.relay_skipped = relay_stats.skipped;
+  c.relay_cancelled = relay_stats.cancelled;
+  c.relay_sent = relay_stats.sent;
+  c.relay_neighbours = relay_neighbours(link_now_us());
+  c.lz_tx_packets = lz_stats.tx_packets;
+  c.lz_tx_compressed = lz_stats.tx_compressed;
+  c.lz_tx_bytes_in = lz_stats.tx_bytes_in;
+  c.lz_tx_bytes_out = lz_stats.tx_bytes_out;
+  c.lz_tx_cpu_ns = lz_stats.tx_cpu_ns;
+  c.lz_rx_packets = lz_stats.rx_packets;
+  c.lz_rx_cpu_ns = lz_stats.rx_cpu_ns;
+
+  shmstats_publish(&c, link_now_us());
 }
 
 int event_loop(int fds, int fdi) {
   int ret;
   int maxfd;
   fd_set fdset;
-
-  ret = rn2903_rx(fds, fdi, RECEIVE_TIME, receive_done);
-  if(ret < 0) {
-    return ret;
+  fd_set writefds;
+  struct timeval tv;
+  struct timeval spool_tv;
+  struct timeval radio_tv;
+  struct timeval* timeout = NULL;
+  uint64_t now;
+
+  tun_fd = fdi;
+
+  // when pinging the radio loop starts once the ping is answered
+  if(!rn2903_busy()) {
+    ret = radio_start(fds);
+    if(ret < 0) {
+      return ret;
+    }
   }
 
   while(1) {
-    
+    timeout = NULL;
     FD_ZERO(&fdset);
+    FD_ZERO(&writefds);
 
     FD_SET(fds, &fdset);
-    FD_SET(fdi, &fdset);
+    maxfd = fds;
+
+    // leave packets in the kernel queue until we can take them,
+    // unless the link is down and some are worth spooling. reading
+    // stops at the first one that isn't until the link takes it
+    now = link_now_us();
+    spool_link_ready(link_tx_ready(), now);
+    if(tun_held_len && tcp_stage_ready()) {
+      tcp_stage_push(tun_held, tun_held_len, tun_held_us);
+      tun_held_len = 0;
+      stage_to_link();
+    }
+    if(tcp_stage_ready() || (spool_absorbing(now) && !tun_held_len)) {
+      FD_SET(fdi, &fdset);
+      maxfd = MAX(maxfd, fdi);
+    }
 
-    maxfd = (fds > fdi) ? fds : fdi;
+    maxfd = add_uclients_to_fd_set(&fdset, &writefds, maxfd);
+    maxfd = raw_add_to_fd_set(&fdset, maxfd);
 
-    maxfd = add_uclients_to_fd_set(&fdset, maxfd);
+    // a replayed transcript stands in for the radio and the interface
+    if(transcript_replaying()) {
+      if(transcript_replay_step()) {
+        return 0;
+      }
+      maxfd = transcript_add_to_fd_set(&fdset, maxfd);
+      transcript_replay_timeout(&tv);
+      timeout = &tv;
+    }
+    if(spool_timeout(now, &spool_tv) && (!timeout || timercmp(&spool_tv, timeout, <))) {
+      timeout = &spool_tv;
+    }
+    if(rn2903_timeout(&radio_tv) && (!timeout || timercmp(&radio_tv, timeout, <))) {
+      timeout = &radio_tv;
+    }
 
-    ret = select(maxfd + 1, &fdset, NULL, NULL, NULL);
+    ret = select(maxfd + 1, &fdset, &writefds, NULL, timeout);
     if(ret < 0){
       if(errno == EINTR) {
         continue;
@@ -302,7 +693,8 @@ int event_loop(int fds, int fdi) {
       }
     }
 
-    handle_uclient_connections(&fdset);
+    handle_uclient_connections(&fdset, &writefds);
+    raw_handle(&fdset);
 
     // handle incoming data on serial device
     if(FD_ISSET(fds, &fdset)) {
@@ -315,49 +707,185 @@ int event_loop(int fds, int fdi) {
       }
     }
 
-    // handle incoming data on network interface
+    // handle incoming data on network interface.
+    // it goes out after the current rx window
     if(FD_ISSET(fdi, &fdset)) {
-
-      // TODO receive data from fdi
-      // TODO parse IP header and ensure that we send only whole packets
-
-      //      ret = rn2903_transmit(fds, fdi, data);
+      ret = tun_read(fdi);
       if(ret < 0) {
         return ret;
       }
     }
+
+    // a wedged module is brought back while packets wait for it
+    ret = rn2903_watchdog(fds);
+    if(ret < 0) {
+      return ret;
+    }
+
+    tune_update(link_now_us());
+    publish_stats();
+    transcript_flush();
+    spool_flush(link_now_us());
   }
 }
 
 
 void usage(FILE* out, char* name) {
-  fprintf(out, "Usage: %s\n", name);
+  fprintf(out, "Usage: %s [-p] [-d] [-s serial_dev] [-Z radio_state] [-W reset_lines] [-T fd] [-u ipc_socket] [-w raw_socket] [-S stats_file] [-k capture_file] [-K on|off] [-C radio_settings] [-o transcript] [-P transcript [-x]] [-i] [-m] [-l|-L] [-R radio_settings] [-t] [-c] [-z dict_file] [-n node_id] [-r arq_retries] [-f repair_fragments] [-D dedup_ms] [-G relay_hops] [-F filter_rules] [-H] [-e key_file [-E tag_bytes]] [-Q spool_file -q spool_classes] [-A] [-M mtu_min-mtu_max] [-N qlen_min-qlen_max]\n", name);
+  fprintf(out, "\n");
+  fprintf(out, "  -p: ping the RN2903 before starting\n");
+  fprintf(out, "  -d: print debug output\n");
+  fprintf(out, "  -s: serial device of the RN2903 (default: the first of /dev/ttyUSB* and /dev/ttyACM*\n");
+  fprintf(out, "      that answers as one)\n");
+  fprintf(out, "  -Z: keep the radio settings in this file and put them back on at startup,\n");
+  fprintf(out, "      only sending those the module doesn't have\n");
+  fprintf(out, "  -W: the module's reset pin is wired to these modem control lines, dtr, rts or dtr,rts.\n");
+  fprintf(out, "      pulled if neither \"radio rxstop\" nor \"sys reset\" bring back a wedged module\n");
+  fprintf(out, "  -T: use this open file descriptor instead of a TUN interface, e.g. a socketpair.\n");
+  fprintf(out, "      no root privileges are needed (for tests and benchmarks)\n");
+  fprintf(out, "  -u: unix socket for talking to the running daemon (default: %s)\n", socket_file);
+  fprintf(out, "  -k: capture sent and received frames to this pcapng file (%d MiB, written round and round)\n",
+          CAPTURE_DEFAULT_SIZE >> 20);
+  fprintf(out, "  -K: turn capture of the running instance \"on [file]\" or \"off\" and exit\n");
+  fprintf(out, "      (default file: %s)\n", CAPTURE_DEFAULT_FILE);
+  fprintf(out, "  -C: radio settings to start with, e.g. \"sf=9 bw=125 cr=4/5 pwr=14 freq=915000000\"\n");
+  fprintf(out, "      (default: leave the module as it is)\n");
+  fprintf(out, "  -o: record a transcript of everything exchanged with the RN2903 and the interface\n");
+  fprintf(out, "  -P: replay a transcript recorded with -o instead of using the RN2903 and an interface.\n");
+  fprintf(out, "      exits when it ends or the daemon does something else than it did, give the same\n");
+  fprintf(out, "      options as when it was recorded\n");
+  fprintf(out, "  -x: replay as fast as possible rather than at the recorded pace\n");
+  fprintf(out, "  -w: let applications send and receive raw frames on this SOCK_SEQPACKET socket\n");
+  fprintf(out, "      (e.g. %s, see raw.h)\n", RAW_DEFAULT_SOCKET);
+  fprintf(out, "  -i: print information about the running instance and exit\n");
+  fprintf(out, "  -m: print the address map of the running instance and exit\n");
+  fprintf(out, "  -S: publish counters in this shared memory file (default: %s)\n", SHMSTATS_DEFAULT_FILE);
+  fprintf(out, "  -l: print latency histograms of the running instance and exit\n");
+  fprintf(out, "  -L: same as -l but also reset the histograms\n");
+  fprintf(out, "  -R: change radio settings of the running instance (same format as -C) and exit.\n");
+  fprintf(out, "      queued frames are kept and go out with the new settings\n");
+  fprintf(out, "  -t: thin TCP ACKs and compress TCP/IP headers\n");
+  fprintf(out, "  -c: compress payloads\n");
+  fprintf(out, "  -z: load a compression dictionary, implies -c (can be given up to %d times)\n", LZ_MAX_DICTS);
+  fprintf(out, "  -n: link layer node id (0-254, default derived from hostname)\n");
+  fprintf(out, "  -r: send unicast frames with ARQ, giving up after this many tries (default: no ARQ)\n");
+  fprintf(out, "  -f: add this many FEC repair fragments to fragmented packets (default: 0)\n");
+  fprintf(out, "  -F: drop packets routed into the interface that match these rules (see filter.h),\n");
+  fprintf(out, "      in the kernel if it takes the eBPF program\n");
+  fprintf(out, "  -H: print the filter rules of the running instance with their hit counters and exit\n");
+  fprintf(out, "  -D: drop copies of a broadcast frame received within this many ms of the first\n");
+  fprintf(out, "      (e.g. %d, default: off). without -e a node sending the same frame again within\n",
+          DEDUP_DEFAULT_WINDOW_MS);
+  fprintf(out, "      that time looks like a copy and is dropped as well, keep it below the 1 s\n");
+  fprintf(out, "      between ARP retries\n");
+  fprintf(out, "  -G: flood broadcast frames over up to this many hops (1-%d, e.g. %d) and relay\n",
+          RELAY_MAX_HOPS, RELAY_DEFAULT_HOPS);
+  fprintf(out, "      those of other nodes, fewer the more neighbours there are (default: off)\n");
+  fprintf(out, "  -e: encrypt and authenticate frames with the AES-128 key in this file (32 hex digits),\n");
+  fprintf(out, "      frames without it are dropped, the frame counter is kept in <file>%s\n", AEAD_CTR_SUFFIX);
+  fprintf(out, "  -E: length of the authentication tag, %d, 6 or %d bytes (default: %d)\n",
+          AEAD_MIN_TAG, AEAD_MAX_TAG, AEAD_DEFAULT_TAG);
+  fprintf(out, "  -Q: keep packets in the classes given with -q in this file (%d MiB) until the link\n",
+          SPOOL_FILE_SIZE >> 20);
+  fprintf(out, "      takes them, also across restarts\n");
+  fprintf(out, "  -q: spool classes, a priority and a rule as for -F per line (see spool.h)\n");
+  fprintf(out, "  -A: adjust the MTU and txqueuelen of the interface to the link as it goes\n");
+  fprintf(out, "      (default: MTU %d and txqueuelen %d)\n", TUNE_DEFAULT_MTU, TUNE_DEFAULT_QLEN);
+  fprintf(out, "  -M: keep the MTU within these bounds, implies -A (default: %d-%d)\n",
+          TUNE_DEFAULT_MTU_MIN, TUNE_DEFAULT_MTU_MAX);
+  fprintf(out, "      the MTU stays on the side of %d it starts on, use -M %d-%d for IPv6\n",
+          TUNE_IPV6_MIN_MTU, TUNE_IPV6_MIN_MTU, TUNE_MAX_MTU);
+  fprintf(out, "  -N: keep the txqueuelen within these bounds, implies -A (default: %d-%d)\n",
+          TUNE_DEFAULT_QLEN_MIN, TUNE_DEFAULT_QLEN_MAX);
+}
+
+// modem control lines wired to the module's reset pin, 0 if none
+static int reset_lines = 0;
+
+int reset_module(int fds, int hold) {
+  return serial_set_lines(fds, reset_lines, hold);
 }
 
-void ping_report(int fds, char* buf, size_t len) {
+int ping_report(int fds, char* buf, size_t len) {
   if(!buf) {
     printf("Got invalid response from RN2903\n");
   } else {
     printf("RN2903 is connected and responsive!\n");
   }
+  return radio_start(fds);
+}
+
+// hash the hostname so nodes get a stable id without configuration
+int default_node_id() {
+  char hostname[256];
+  unsigned int hash = 2166136261u;
+  int i;
+
+  if(gethostname(hostname, sizeof(hostname)) < 0) {
+    return 0;
+  }
+  hostname[sizeof(hostname)-1] = '\0';
+
+  for(i=0; hostname[i]; i++) {
+    hash = (hash ^ (unsigned char) hostname[i]) * 16777619u;
+  }
+  return hash % LINK_BROADCAST;
 }
 
 int main(int argc, char* argv[]) {
   int opt;
 
-  char serial_dev[] = "/dev/ttyUSB0";
+  char* serial_dev = NULL;
+  char* state_path = NULL;
+  char* stats_file = SHMSTATS_DEFAULT_FILE;
+  char* raw_socket = NULL;
+  char* capture_path = NULL;
+  char* record_path = NULL;
+  char* replay_path = NULL;
+  char* key_path = NULL;
+  char* spool_path = NULL;
+  int tag_len = AEAD_DEFAULT_TAG;
+  int tune_opt = 0;
+  int mtu_min = TUNE_DEFAULT_MTU_MIN;
+  int mtu_max = TUNE_DEFAULT_MTU_MAX;
+  int qlen_min = TUNE_DEFAULT_QLEN_MIN;
+  int qlen_max = TUNE_DEFAULT_QLEN_MAX;
+  int mtu = TUNE_DEFAULT_MTU;
+  int qlen = TUNE_DEFAULT_QLEN;
+  int replay_fast = 0;
+  char args[256];
+  size_t args_len = 0;
   speed_t serial_speed = B57600;
   char iface_name[IFNAMSIZ] = "lora0";
+  char* devs[SERIAL_MAX_DEVICES];
+  int dev_count;
+  int dev;
+  char version[SERIAL_VERSION_SIZE] = "";
+  int same_module;
 
   int ret;
   int fds; // serial fd
-  int fdi; // interface fd
+  int fdi = -1; // interface fd
 
   int ping = 0;
+  int node_id = default_node_id();
+  int arq_retries = 0;
+  int fec_repair = 0;
+  int dedup_ms = 0;
+  int relay_opt = 0;
+  int tcp_opt = 0;
+  int lz_opt = 0;
+  char query = 0;
+  char* query_arg = NULL;
+  struct rn2903_settings settings;
+  int settings_opt = 0;
+  char* dict_files[LZ_MAX_DICTS];
+  int dict_count = 0;
+  int i;
 
   debug = 0;
 
-  while((opt = getopt(argc, argv, "pd")) > 0) {
+  while((opt = getopt(argc, argv, "pdtcimlLxHAs:T:u:w:S:k:K:C:R:o:P:z:n:r:f:D:F:e:E:Q:q:M:N:Z:W:G:")) > 0) {
     switch(opt) {
       case 'p':
         ping = 1;
@@ -365,53 +893,324 @@ int main(int argc, char* argv[]) {
       case 'd':
         debug = 1;
         break;
+      case 's':
+        serial_dev = optarg;
+        break;
+      case 'T':
+        fdi = atoi(optarg);
+        break;
+      case 'u':
+        socket_file = optarg;
+        break;
+      case 'w':
+        raw_socket = optarg;
+        break;
+      case 'S':
+        stats_file = optarg;
+        break;
+      case 'Z':
+        state_path = optarg;
+        break;
+      case 'W':
+        reset_lines = serial_parse_lines(optarg);
+        if(reset_lines < 0) {
+          fprintf(stderr, "Expected the reset lines as dtr, rts or dtr,rts\n");
+          return 1;
+        }
+        rn2903_hw_reset = reset_module;
+        break;
+      case 'k':
+        capture_path = optarg;
+        break;
+      case 'o':
+        record_path = optarg;
+        break;
+      case 'P':
+        replay_path = optarg;
+        break;
+      case 'x':
+        replay_fast = 1;
+        break;
+      case 'C':
+        if(rn2903_parse_settings(optarg, strlen(optarg), &settings) < 0) {
+          fprintf(stderr, "Invalid radio settings: %s\n", optarg);
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        settings_opt = 1;
+        break;
+      case 'i':
+      case 'm':
+      case 'l':
+      case 'L':
+      case 'H':
+        query = opt;
+        break;
+      case 'R':
+      case 'K':
+        query = opt;
+        query_arg = optarg;
+        break;
+      case 't':
+        tcp_opt = 1;
+        break;
+      case 'c':
+        lz_opt = 1;
+        break;
+      case 'z':
+        if(dict_count >= LZ_MAX_DICTS) {
+          fprintf(stderr, "At most %d dictionaries can be loaded\n", LZ_MAX_DICTS);
+          return 1;
+        }
+        dict_files[dict_count++] = optarg;
+        lz_opt = 1;
+        break;
+      case 'n':
+        node_id = atoi(optarg);
+        if(node_id < 0 || node_id >= LINK_BROADCAST) {
+          fprintf(stderr, "Node id must be between 0 and %d\n", LINK_BROADCAST - 1);
+          return 1;
+        }
+        break;
+      case 'r':
+        arq_retries = atoi(optarg);
+        if(arq_retries < 0) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'f':
+        fec_repair = atoi(optarg);
+        break;
+      case 'F':
+        if(filter_load(optarg) < 0) {
+          return 1;
+        }
+        break;
+      case 'e':
+        key_path = optarg;
+        break;
+      case 'E':
+        tag_len = atoi(optarg);
+        break;
+      case 'Q':
+        spool_path = optarg;
+        break;
+      case 'q':
+        if(spool_load_classes(optarg) < 0) {
+          return 1;
+        }
+        break;
+      case 'A':
+        tune_opt = 1;
+        break;
+      case 'M':
+        if(tune_parse_bounds(optarg, TUNE_MIN_MTU, TUNE_MAX_MTU, &mtu_min, &mtu_max) < 0) {
+          fprintf(stderr, "MTU bounds must be min-max within %d-%d\n", TUNE_MIN_MTU, TUNE_MAX_MTU);
+          return 1;
+        }
+        tune_opt = 1;
+        break;
+      case 'N':
+        if(tune_parse_bounds(optarg, 1, TUNE_MAX_QLEN, &qlen_min, &qlen_max) < 0) {
+          fprintf(stderr, "txqueuelen bounds must be min-max within 1-%d\n", TUNE_MAX_QLEN);
+          return 1;
+        }
+        tune_opt = 1;
+        break;
+      case 'G':
+        relay_opt = atoi(optarg);
+        if(relay_opt < 1 || relay_opt > RELAY_MAX_HOPS) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'D':
+        dedup_ms = atoi(optarg);
+        if(dedup_ms < 0) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
       default:
         usage(stderr, argv[0]);
         return 1;
     }
   }
 
+  // the command line goes in a transcript to replay it the same way
+  args[0] = '\0';
+  for(i=1; i < argc && args_len < sizeof(args); i++) {
+    args_len += snprintf(args + args_len, sizeof(args) - args_len, "%s%s", (i > 1) ? " " : "", argv[i]);
+  }
+
   argv += optind;
   argc -= optind;
 
-  // TODO check if we are simply talking to an existing uclient
-  // and call send_uclient_msg accordingly
-  //ret = send_uclient_msg('i', NULL, 1);
+  // talking to the running instance
+  if(query) {
+    if(query == 'R') {
+      query = 'r';
+    } else if(query == 'K') {
+      query = 'k';
+    } else if(query == 'H') {
+      query = 'f';
+    }
+    return (send_uclient_msg(query, query_arg, 1) < 0) ? 1 : 0;
+  }
+
+  // the key file may only be readable by root
+  if(key_path && aead_load_key(key_path, tag_len) < 0) {
+    return 1;
+  }
+  if(spool_path && spool_open(spool_path) < 0) {
+    return 1;
+  }
 
-  fds = open_serial(serial_dev, serial_speed);
-  if(fds < 0) {
-    return fds;
+  if(replay_path) {
+    if(transcript_replay_open(replay_path, replay_fast, &fds, &fdi) < 0) {
+      fprintf(stderr, "Failed to open transcript %s: %s\n", replay_path, strerror(errno));
+      return 1;
+    }
+    link_clock = transcript_now_us;
+    rn2903_clock = transcript_now_us;
+  } else {
+    // every candidate is asked at once unless a device is given
+    if(serial_dev) {
+      devs[0] = serial_dev;
+      dev_count = 1;
+    } else {
+      dev_count = serial_candidates(devs, SERIAL_MAX_DEVICES);
+    }
+    fds = serial_probe(devs, dev_count, serial_speed, SERIAL_PROBE_TIMEOUT_US, &dev, version, sizeof(version));
+    if(fds >= 0) {
+      if(debug) {
+        printf("Found %s on %s\n", version, devs[dev]);
+      }
+    } else if(serial_dev) {
+      fprintf(stderr, "No RN2903 answered on %s, using it anyway\n", serial_dev);
+      fds = open_serial(serial_dev, serial_speed);
+      if(fds < 0) {
+        return fds;
+      }
+    } else {
+      fprintf(stderr, "No RN2903 found on any of %d serial devices\n", dev_count);
+      return 1;
+    }
+
+    // the last settings go back on, and if it's the same module only
+    // those that it doesn't have any more are sent
+    if(state_path) {
+      ret = radiostate_open(state_path, version, &radio_saved, &same_module);
+      if(ret < 0) {
+        return 1;
+      }
+      if(ret > 0) {
+        rn2903_request_settings(&radio_saved);
+        radio_saved_known = same_module;
+      }
+    }
+  }
+  if(settings_opt) {
+    rn2903_request_settings(&settings);
   }
 
-  fdi = create_tun(iface_name);
-  if(fdi < 0) {
-    close(fds);
-    return fdi;
+  if(record_path) {
+    if(transcript_record_open(record_path, args) < 0) {
+      fprintf(stderr, "Failed to record to %s: %s\n", record_path, strerror(errno));
+      return 1;
+    }
+    rn2903_tap = transcript_record;
   }
 
-  // Set transmit queue length for TUN interface
-  ret = set_txqueuelen(iface_name, TX_QUEUE_LENGTH);
-  if(ret < 0) {
-    fprintf(stderr, "Unable to set txqueuelen (transmit queue length) for %s interface to %d\n", iface_name, TX_QUEUE_LENGTH);
-    return 1;
+  if(fdi >= 0) {
+    // not a real interface, nothing to set up
+    iface_name[0] = '\0';
+  } else {
+    fdi = create_tun(iface_name);
+    if(fdi < 0) {
+      close(fds);
+      return fdi;
+    }
+
+    // unwanted packets are best dropped before they reach us
+    filter_attach(fdi);
+
+    // tuning starts from the defaults, or the nearest bound
+    if(tune_opt) {
+      mtu = MIN(MAX(mtu, mtu_min), mtu_max);
+      qlen = MIN(MAX(qlen, qlen_min), qlen_max);
+    }
+
+    // Set transmit queue length for TUN interface
+    ret = set_txqueuelen(iface_name, qlen);
+    if(ret < 0) {
+      fprintf(stderr, "Unable to set txqueuelen (transmit queue length) for %s interface to %d\n", iface_name, qlen);
+      return 1;
+    }
+
+    // Set MTU for TUN interface
+    ret = set_mtu(iface_name, mtu);
+    if(ret < 0) {
+      fprintf(stderr, "Unable to set MTU for %s interface to %d\n", iface_name, mtu);
+      return 1;
+    }
+
+    // tuned from here on, within the bounds
+    if(tune_opt) {
+      strcpy(tun_name, iface_name);
+      tune_set_mtu = tune_interface_mtu;
+      tune_set_qlen = tune_interface_qlen;
+      if(tune_init(mtu_min, mtu_max, qlen_min, qlen_max, get_mtu(iface_name), get_txqueuelen(iface_name),
+                   link_now_us()) < 0) {
+        tune_opt = 0;
+      }
+    }
+
+    // drop root privileges, tuning still needs to change the interface
+    ret = drop_privs(RUNAS_GROUP, RUNAS_USER, tune_opt);
+    if(ret < 0) {
+      fprintf(stderr, "Failed to drop root privileges.\n");
+      return 1;
+    }
   }
 
-  // Set MTU for TUN interface
-  ret = set_mtu(iface_name, LORA_MTU);
+  // socket for talking to the running daemon
+  open_ipc_socket();
+
+  if(raw_socket) {
+    raw_set_max_payload(link_raw_max());
+    if(raw_open(raw_socket) < 0) {
+      return 1;
+    }
+    link_raw_handler = raw_rx_frame;
+  }
+
+  addrmap_init(iface_name[0] ? iface_name : NULL);
+  ret = link_init(node_id, arq_retries, fec_repair);
   if(ret < 0) {
-    fprintf(stderr, "Unable to set MTU for %s interface to %d\n", iface_name, LORA_MTU);
     return 1;
   }
+  tcp_stage_init(tcp_opt);
+  dedup_init(dedup_ms);
+  relay_init(relay_opt, node_id + 1);
+  lz_init(lz_opt);
+  for(i=0; i < dict_count; i++) {
+    if(lz_load_dict(dict_files[i]) < 0) {
+      return 1;
+    }
+  }
+  if(debug) {
+    printf("Using node id %d\n", node_id);
+  }
 
-  // drop root privileges
-  ret = drop_privs(RUNAS_GROUP, RUNAS_USER);
-  if(ret < 0) {
-    fprintf(stderr, "Failed to drop root privileges.\n");
+  if(capture_path && capture_start(capture_path, CAPTURE_DEFAULT_SIZE) < 0) {
+    fprintf(stderr, "Failed to capture to %s: %s\n", capture_path, strerror(errno));
     return 1;
   }
 
-  // socket for talking to the running daemon
-  open_ipc_socket();
+  // monitoring still works through the IPC socket without it
+  shmstats_create(stats_file, node_id, link_now_us());
 
   if(ping) {
     if(debug) {
@@ -421,6 +1220,9 @@ int main(int argc, char* argv[]) {
   }
 
   ret = event_loop(fds, fdi);
+  if(replay_path) {
+    return (transcript_replay_report(stdout) < 0 || ret < 0) ? 1 : 0;
+  }
   if(ret < 0) {
     return ret;
   }
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "radiostate.h"
+
+// Radio state file (see radiostate.h). It only saves time at startup,
+// so one that can't be read is ignored. It stays open to be written
+// after root privileges are dropped.
+
+static int radiostate_fd = -1;
+static char radiostate_version[RADIOSTATE_SIZE];
+
+// open the state file at path, creating it if needed, for the module
+// with this version. returns 1 if it has settings (in s, with
+// same_module set if they were written for this module), 0 if not and
+// -1 if it can't be opened
+int radiostate_open(const char* path, const char* version, struct rn2903_settings* s, int* same_module) {
+  char buf[RADIOSTATE_SIZE];
+  char* settings;
+  char* end;
+  ssize_t len;
+
+  radiostate_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(radiostate_fd < 0) {
+    fprintf(stderr, "Failed to open radio state %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  snprintf(radiostate_version, sizeof(radiostate_version), "%s", version);
+  *same_module = 0;
+
+  len = read(radiostate_fd, buf, sizeof(buf) - 1);
+  if(len <= 0) {
+    return 0;
+  }
+  buf[len] = '\0';
+
+  settings = strchr(buf, '\n');
+  if(!settings) {
+    return 0;
+  }
+  *settings++ = '\0';
+  end = strchr(settings, '\n');
+  if(!end || rn2903_parse_settings(settings, end - settings, s) < 0) {
+    fprintf(stderr, "Ignoring radio state %s, it isn't valid\n", path);
+    return 0;
+  }
+  *same_module = version[0] && !strcmp(buf, version);
+  return 1;
+}
+
+int radiostate_enabled() {
+  return radiostate_fd >= 0;
+}
+
+// write the settings the module has now
+void radiostate_save(const struct rn2903_settings* s) {
+  char buf[RADIOSTATE_SIZE];
+  int len;
+
+  if(radiostate_fd < 0) {
+    return;
+  }
+  len = snprintf(buf, sizeof(buf), "%s\n", radiostate_version);
+  len += rn2903_format_settings(s, buf + len, sizeof(buf) - len - 1);
+  buf[len++] = '\n';
+
+  if(pwrite(radiostate_fd, buf, len, 0) != len || ftruncate(radiostate_fd, len) < 0) {
+    perror("Failed to save the radio state");
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef RADIOSTATE_H
+#define RADIOSTATE_H
+
+#include "rn2903.h"
+
+// The radio state file keeps the settings of the module across
+// restarts, two lines:
+//
+//   RN2903 1.0.3 Aug  8 2017 15:11:09
+//   freq=915000000 sf=9 bw=125 cr=4/5 pwr=14
+//
+// the version of the module and its settings, as rn2903_parse_settings
+// takes them.
+
+#define RADIOSTATE_SIZE (256)
+
+int radiostate_open(const char* path, const char* version, struct rn2903_settings* s, int* same_module);
+int radiostate_enabled();
+void radiostate_save(const struct rn2903_settings* s);
+
+#endif
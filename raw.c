@@ -0,0 +1,535 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "raw.h"
+
+// Raw frames for applications that don't want IP.
+//
+// Clients connect to a SOCK_SEQPACKET unix socket where every message
+// is one frame or request. Frames they send are queued here and go out
+// through the link layer like IP packets do (with a LINK_F_RAW flag
+// instead of an IP payload).
+//
+// Received raw frames are written once to a ring in a memfd that every
+// subscriber maps read only; the fd is passed with SCM_RIGHTS when a
+// client subscribes. Subscribers then only get a small notification
+// with the new head, and one that doesn't keep up misses notifications
+// (the ring still has the frames) or, if it falls a whole ring behind,
+// frames. The daemon never blocks on a subscriber.
+
+extern int debug;
+
+struct raw_tx_entry {
+  uint8_t dst;
+  uint8_t flags;
+  size_t len;
+  uint8_t data[RAW_MAX_PAYLOAD];
+};
+
+static int raw_sock = -1;
+static int raw_clients[RAW_MAX_CLIENTS];
+static int raw_subscribed[RAW_MAX_CLIENTS];
+static int raw_client_count = 0;
+
+static struct raw_tx_entry raw_txq[RAW_TX_QUEUE];
+static int raw_txq_first = 0;
+static int raw_txq_len = 0;
+
+static struct raw_ring* raw_ring = NULL;
+static int raw_ring_fd = -1;
+
+// what the link layer takes, less than RAW_MAX_PAYLOAD with a key
+static size_t raw_max_payload = RAW_MAX_PAYLOAD;
+
+// the last frame received, published once its SNR is known
+static struct raw_rx_meta raw_pending_meta;
+static uint8_t raw_pending_data[RAW_MAX_PAYLOAD];
+static int raw_pending = 0;
+
+static uint64_t raw_now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int raw_create_ring() {
+  int fd;
+
+  fd = memfd_create("lora_iface_raw", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to create raw frame ring: %s\n", strerror(errno));
+    return -1;
+  }
+  if(ftruncate(fd, sizeof(struct raw_ring)) < 0) {
+    fprintf(stderr, "Failed to resize raw frame ring: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  raw_ring = (struct raw_ring*) mmap(NULL, sizeof(struct raw_ring),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(raw_ring == MAP_FAILED) {
+    fprintf(stderr, "Failed to map raw frame ring: %s\n", strerror(errno));
+    raw_ring = NULL;
+    close(fd);
+    return -1;
+  }
+
+  raw_ring->magic = RAW_MAGIC;
+  raw_ring->version = RAW_VERSION;
+  raw_ring->slots = RAW_RING_SLOTS;
+  raw_ring->slot_size = sizeof(struct raw_slot);
+  raw_ring->head = 0;
+  raw_ring->max_payload = raw_max_payload;
+
+  // subscribers can map it but not resize it or write to it
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#ifdef F_SEAL_FUTURE_WRITE
+  fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+
+  raw_ring_fd = fd;
+  return 0;
+}
+
+// listen for raw frame clients on path.
+// returns 0 or -1
+int raw_open(const char* path) {
+  struct sockaddr_un addr;
+
+  if(raw_create_ring() < 0) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_LOCAL;
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Raw frame socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  raw_sock = socket(AF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(raw_sock < 0) {
+    fprintf(stderr, "Failed to create raw frame socket: %s\n", strerror(errno));
+    return -1;
+  }
+  if(bind(raw_sock, (struct sockaddr*) &addr, sizeof(addr)) < 0
+     || listen(raw_sock, RAW_MAX_CLIENTS) < 0) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+    close(raw_sock);
+    raw_sock = -1;
+    return -1;
+  }
+  return 0;
+}
+
+static void raw_remove_client(int i) {
+  close(raw_clients[i]);
+  raw_client_count--;
+  raw_clients[i] = raw_clients[raw_client_count];
+  raw_subscribed[i] = raw_subscribed[raw_client_count];
+}
+
+static void raw_accept() {
+  int fd;
+
+  fd = accept4(raw_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if(fd < 0) {
+    return;
+  }
+  if(raw_client_count >= RAW_MAX_CLIENTS) {
+    fprintf(stderr, "Too many raw frame clients\n");
+    close(fd);
+    return;
+  }
+  raw_clients[raw_client_count] = fd;
+  raw_subscribed[raw_client_count] = 0;
+  raw_client_count++;
+}
+
+// the largest payload the link layer takes for a frame
+void raw_set_max_payload(size_t len) {
+  raw_max_payload = (len < RAW_MAX_PAYLOAD) ? len : RAW_MAX_PAYLOAD;
+  if(raw_ring) {
+    raw_ring->max_payload = raw_max_payload;
+  }
+}
+
+static void raw_send_error(int fd, uint8_t code) {
+  struct raw_error err;
+
+  memset(&err, 0, sizeof(err));
+  err.type = RAW_MSG_ERROR;
+  err.code = code;
+  err.max_len = raw_max_payload;
+  send(fd, &err, sizeof(err), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// returns -1 if the client should be dropped
+static int raw_send_ring(int fd) {
+  struct raw_ring_msg msg;
+  struct msghdr mh;
+  struct iovec iov;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct cmsghdr* cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.type = RAW_MSG_RING;
+  msg.size = sizeof(struct raw_ring);
+  iov.iov_base = &msg;
+  iov.iov_len = sizeof(msg);
+
+  memset(&mh, 0, sizeof(mh));
+  memset(&ctl, 0, sizeof(ctl));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctl.buf;
+  mh.msg_controllen = sizeof(ctl.buf);
+  cmsg = CMSG_FIRSTHDR(&mh);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &raw_ring_fd, sizeof(int));
+
+  return (sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
+
+// read messages from client i until it has none or the queue is full.
+// returns -1 if the client is gone
+static int raw_read_client(int i) {
+  uint8_t buf[sizeof(struct raw_tx) + RAW_MAX_PAYLOAD + 1];
+  struct raw_tx* tx = (struct raw_tx*) buf;
+  struct raw_tx_entry* e;
+  ssize_t len;
+
+  while(raw_txq_len < RAW_TX_QUEUE) {
+    len = recv(raw_clients[i], buf, sizeof(buf), MSG_DONTWAIT);
+    if(len < 0) {
+      return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    if(len == 0) {
+      return -1;
+    }
+
+    switch(buf[0]) {
+    case RAW_MSG_TX:
+      if((size_t) len <= sizeof(struct raw_tx)) {
+        raw_send_error(raw_clients[i], RAW_E_INVALID);
+        break;
+      }
+      if((size_t) len > sizeof(struct raw_tx) + raw_max_payload) {
+        raw_send_error(raw_clients[i], RAW_E_TOO_BIG);
+        break;
+      }
+      e = &raw_txq[(raw_txq_first + raw_txq_len) % RAW_TX_QUEUE];
+      e->dst = tx->dst;
+      e->flags = tx->flags;
+      e->len = len - sizeof(struct raw_tx);
+      memcpy(e->data, buf + sizeof(struct raw_tx), e->len);
+      raw_txq_len++;
+      break;
+
+    case RAW_MSG_SUBSCRIBE:
+      if(raw_send_ring(raw_clients[i]) < 0) {
+        return -1;
+      }
+      raw_subscribed[i] = 1;
+      break;
+
+    default:
+      raw_send_error(raw_clients[i], RAW_E_INVALID);
+      break;
+    }
+  }
+  return 0;
+}
+
+// clients aren't read while the queue is full,
+// so they block (or get EAGAIN) instead of losing frames
+int raw_add_to_fd_set(fd_set* readfds, int maxfd) {
+  int i;
+
+  if(raw_sock < 0) {
+    return maxfd;
+  }
+  FD_SET(raw_sock, readfds);
+  if(raw_sock > maxfd) {
+    maxfd = raw_sock;
+  }
+  if(raw_txq_len >= RAW_TX_QUEUE) {
+    return maxfd;
+  }
+  for(i=0; i < raw_client_count; i++) {
+    FD_SET(raw_clients[i], readfds);
+    if(raw_clients[i] > maxfd) {
+      maxfd = raw_clients[i];
+    }
+  }
+  return maxfd;
+}
+
+void raw_handle(fd_set* readfds) {
+  int i;
+
+  if(raw_sock < 0) {
+    return;
+  }
+  // from the end so removing doesn't skip anyone
+  for(i=raw_client_count-1; i >= 0; i--) {
+    if(FD_ISSET(raw_clients[i], readfds) && raw_read_client(i) < 0) {
+      raw_remove_client(i);
+    }
+  }
+  if(FD_ISSET(raw_sock, readfds)) {
+    raw_accept();
+  }
+}
+
+int raw_tx_pending() {
+  return raw_txq_len;
+}
+
+// take the next frame to send.
+// returns its length or 0 if there is none
+ssize_t raw_tx_pop(uint8_t* dst, uint8_t* flags, uint8_t* buf, size_t size) {
+  struct raw_tx_entry* e;
+
+  if(!raw_txq_len) {
+    return 0;
+  }
+  e = &raw_txq[raw_txq_first];
+  raw_txq_first = (raw_txq_first + 1) % RAW_TX_QUEUE;
+  raw_txq_len--;
+
+  if(e->len > size) {
+    return -1;
+  }
+  *dst = e->dst;
+  *flags = e->flags;
+  memcpy(buf, e->data, e->len);
+  return e->len;
+}
+
+static void raw_publish() {
+  struct raw_slot* slot;
+  uint32_t n;
+  struct raw_notify msg;
+  int i;
+
+  n = raw_ring->head;
+  slot = &raw_ring->slot[n % RAW_RING_SLOTS];
+
+  __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->meta = raw_pending_meta;
+  memcpy(slot->data, raw_pending_data, raw_pending_meta.len);
+  __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&raw_ring->head, n + 1, __ATOMIC_RELEASE);
+
+  memset(&msg, 0, sizeof(msg));
+  msg.type = RAW_MSG_NOTIFY;
+  msg.head = n + 1;
+  for(i=raw_client_count-1; i >= 0; i--) {
+    if(!raw_subscribed[i]) {
+      continue;
+    }
+    // a full socket just means an unread notification is already there
+    if(send(raw_clients[i], &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+       && errno != EAGAIN) {
+      raw_remove_client(i);
+    }
+  }
+}
+
+// a raw frame came in from the link layer.
+// it is published by raw_rx_done() when the radio has been asked about it
+void raw_rx_frame(uint8_t src, uint8_t dst, const uint8_t* data, size_t len) {
+  if(!raw_ring || len > RAW_MAX_PAYLOAD) {
+    return;
+  }
+  if(raw_pending) {
+    raw_publish();
+  }
+  memset(&raw_pending_meta, 0, sizeof(raw_pending_meta));
+  raw_pending_meta.time_us = raw_now_us();
+  raw_pending_meta.src = src;
+  raw_pending_meta.dst = dst;
+  raw_pending_meta.len = len;
+  raw_pending_meta.snr = RAW_SNR_UNKNOWN;
+  raw_pending_meta.rssi = RAW_RSSI_UNKNOWN;
+  memcpy(raw_pending_data, data, len);
+  raw_pending = 1;
+}
+
+void raw_rx_done(int snr, uint32_t freq, uint16_t bw, uint8_t sf, uint8_t cr) {
+  if(!raw_pending) {
+    return;
+  }
+  raw_pending_meta.snr = snr;
+  raw_pending_meta.freq = freq;
+  raw_pending_meta.bw = bw;
+  raw_pending_meta.sf = sf;
+  raw_pending_meta.cr = cr;
+  raw_publish();
+  raw_pending = 0;
+}
+
+// connect to the raw frame socket of a daemon.
+// returns the socket or -1
+int raw_connect(const char* path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_LOCAL;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  fd = socket(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// returns 0 or -1
+int raw_send(int fd, uint8_t dst, uint8_t flags, const uint8_t* data, size_t len) {
+  struct raw_tx tx;
+  struct iovec iov[2];
+  struct msghdr mh;
+
+  memset(&tx, 0, sizeof(tx));
+  tx.type = RAW_MSG_TX;
+  tx.dst = dst;
+  tx.flags = flags;
+  iov[0].iov_base = &tx;
+  iov[0].iov_len = sizeof(tx);
+  iov[1].iov_base = (void*) data;
+  iov[1].iov_len = len;
+
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = iov;
+  mh.msg_iovlen = 2;
+  return (sendmsg(fd, &mh, MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
+
+// subscribe to received frames and map the ring read only.
+// returns NULL on error, size is set to the mapped size.
+// notifications follow on fd, frames before the current head are
+// still in the ring
+const struct raw_ring* raw_subscribe(int fd, size_t* size) {
+  uint8_t req = RAW_MSG_SUBSCRIBE;
+  struct raw_ring_msg msg;
+  struct raw_ring* ring;
+  struct msghdr mh;
+  struct iovec iov;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct cmsghdr* cmsg;
+  ssize_t len;
+  int ring_fd = -1;
+
+  if(send(fd, &req, 1, MSG_NOSIGNAL) < 0) {
+    return NULL;
+  }
+
+  // skip anything that was sent before the ring
+  do {
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    len = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    if(len <= 0) {
+      return NULL;
+    }
+  } while(msg.type != RAW_MSG_RING);
+
+  for(cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  if(ring_fd < 0 || (size_t) len < sizeof(msg) || msg.size < sizeof(struct raw_ring)) {
+    if(ring_fd >= 0) {
+      close(ring_fd);
+    }
+    errno = EPROTO;
+    return NULL;
+  }
+
+  ring = (struct raw_ring*) mmap(NULL, msg.size, PROT_READ, MAP_SHARED, ring_fd, 0);
+  close(ring_fd);
+  if(ring == MAP_FAILED) {
+    return NULL;
+  }
+  if(ring->magic != RAW_MAGIC || ring->slots != RAW_RING_SLOTS
+     || ring->slot_size != sizeof(struct raw_slot)) {
+    munmap(ring, msg.size);
+    errno = EPROTO;
+    return NULL;
+  }
+  *size = msg.size;
+  return ring;
+}
+
+// copy received frame n (counting from 0) out of the ring.
+// returns its length or -1 with errno EAGAIN if it isn't there yet
+// and ENOBUFS if it has been overwritten: frames from
+// head - RAW_RING_SLOTS on are still there
+int raw_ring_read(const struct raw_ring* ring, uint32_t n, struct raw_rx_meta* meta, uint8_t* data) {
+  const struct raw_slot* slot = &ring->slot[n % RAW_RING_SLOTS];
+  uint32_t seq;
+  uint32_t head;
+  size_t len;
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if((int32_t) (n - head) >= 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  if(seq != 2 * n + 2) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  *meta = slot->meta;
+  len = meta->len;
+  if(len > RAW_MAX_PAYLOAD) {
+    len = RAW_MAX_PAYLOAD;
+  }
+  memcpy(data, slot->data, len);
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  return len;
+}
@@ -0,0 +1,114 @@
+#ifndef RAW_H
+#define RAW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#define RAW_DEFAULT_SOCKET "/tmp/lora_iface.raw"
+
+#define RAW_MAGIC (0x4c525257) // "LRRW"
+#define RAW_VERSION (1)
+
+// what fits in a frame after the largest link header. with a key the
+// daemon takes less, see raw_ring.max_payload and raw_error.max_len
+#define RAW_MAX_PAYLOAD (249)
+
+#define RAW_MAX_CLIENTS (16)
+#define RAW_TX_QUEUE (16)
+#define RAW_RING_SLOTS (256) // a power of 2
+
+#define RAW_SNR_UNKNOWN (-128)
+#define RAW_RSSI_UNKNOWN (-128)
+
+// messages on the SOCK_SEQPACKET socket, one per packet.
+// every message starts with its type
+#define RAW_MSG_TX ('t')        // client: send a frame, struct raw_tx + payload
+#define RAW_MSG_SUBSCRIBE ('s') // client: wants received frames
+#define RAW_MSG_RING ('r')      // daemon: struct raw_ring_msg, ring memfd attached
+#define RAW_MSG_NOTIFY ('n')    // daemon: struct raw_notify, new frames in the ring
+#define RAW_MSG_ERROR ('e')     // daemon: struct raw_error, a frame was not taken
+
+// raw_tx flags
+#define RAW_TX_ARQ (0x01) // retransmit until acked, if ARQ is enabled (unicast only)
+
+// raw_error codes
+#define RAW_E_INVALID (1) // bad message
+#define RAW_E_TOO_BIG (2) // payload over max_len
+
+struct raw_tx {
+  uint8_t type;  // RAW_MSG_TX
+  uint8_t dst;   // node id or LINK_BROADCAST
+  uint8_t flags;
+  uint8_t reserved;
+};
+
+struct raw_ring_msg {
+  uint8_t type;  // RAW_MSG_RING
+  uint8_t reserved[3];
+  uint32_t size; // of the memfd
+};
+
+struct raw_notify {
+  uint8_t type;  // RAW_MSG_NOTIFY
+  uint8_t reserved[3];
+  uint32_t head; // frames written so far
+};
+
+struct raw_error {
+  uint8_t type;  // RAW_MSG_ERROR
+  uint8_t code;
+  uint16_t max_len; // the largest payload the daemon takes
+};
+
+struct raw_rx_meta {
+  uint64_t time_us; // CLOCK_MONOTONIC when the frame came in
+  uint32_t freq;    // Hz, 0 if not known
+  uint16_t bw;      // kHz, 0 if not known
+  uint8_t sf;       // 0 if not known
+  uint8_t cr;       // 4/cr, 0 if not known
+  int8_t snr;       // dB or RAW_SNR_UNKNOWN
+  int8_t rssi;      // dBm, the RN2903 doesn't report it: RAW_RSSI_UNKNOWN
+  uint8_t src;
+  uint8_t dst;
+  uint16_t len;
+  uint8_t reserved[2];
+};
+
+// received frame n is in slot n % RAW_RING_SLOTS.
+// seq is 2n+1 while it is written and 2n+2 when done
+struct raw_slot {
+  uint32_t seq;
+  uint32_t reserved;
+  struct raw_rx_meta meta;
+  uint8_t data[RAW_MAX_PAYLOAD + 7]; // padded to 8 bytes
+};
+
+struct raw_ring {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slot_size;
+  uint32_t head;     // frames written so far
+  uint32_t max_payload; // the largest payload the daemon takes to send
+  struct raw_slot slot[RAW_RING_SLOTS];
+};
+
+// for the daemon
+int raw_open(const char* path);
+void raw_set_max_payload(size_t len);
+int raw_add_to_fd_set(fd_set* readfds, int maxfd);
+void raw_handle(fd_set* readfds);
+int raw_tx_pending();
+ssize_t raw_tx_pop(uint8_t* dst, uint8_t* flags, uint8_t* buf, size_t size);
+void raw_rx_frame(uint8_t src, uint8_t dst, const uint8_t* data, size_t len);
+void raw_rx_done(int snr, uint32_t freq, uint16_t bw, uint8_t sf, uint8_t cr);
+
+// for clients
+int raw_connect(const char* path);
+int raw_send(int fd, uint8_t dst, uint8_t flags, const uint8_t* data, size_t len);
+const struct raw_ring* raw_subscribe(int fd, size_t* size);
+int raw_ring_read(const struct raw_ring* ring, uint32_t n, struct raw_rx_meta* meta, uint8_t* data);
+
+#endif
@@ -0,0 +1,229 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "relay.h"
+#include "link.h"
+#include "arq.h"
+
+// Relaying broadcast frames over several hops without going through
+// the TUN interface and a routing daemon.
+//
+// A flood is recognised by its origin and flood sequence number, so a
+// frame the origin sends again with the same bytes is a new flood and
+// not a copy. Every node remembers the floods it heard, whether it
+// relays or not, so copies from other relays are dropped before they
+// are opened or delivered. The sequence number wraps after 256 floods
+// from the origin, long after RELAY_SLOTS newer ones have pushed out
+// the entry, so 8 bits are enough.
+//
+// The first copy of a flood with hops left is relayed with a
+// probability that shrinks as the number of neighbours grows, so that
+// about RELAY_TARGET of them relay it. The relay waits a random time
+// of up to RELAY_DELAY_FRAMES frames of airtime, and if it hears
+// RELAY_CANCEL_COPIES copies in the meantime the others have covered
+// its neighbourhood and it gives up. Neighbours are the nodes whose own
+// frames were heard recently.
+
+#define RELAY_FREE (0)
+#define RELAY_HEARD (1)
+#define RELAY_WAITING (2)
+
+struct relay_entry {
+  int state;
+  uint8_t origin;
+  uint8_t seq;
+  uint64_t heard_us; // first copy
+  uint64_t due_us;   // while waiting
+  int copies;
+  size_t len;
+  uint8_t frame[LINK_MAX_FRAME]; // while waiting, with the hop byte counted on
+};
+
+struct relay_stats relay_stats;
+
+static struct relay_entry relay_table[RELAY_SLOTS];
+static uint32_t relay_neighbour_ms[256]; // last heard plus one, 0 if never
+static int relay_max_hops = 0;
+static uint64_t relay_rand_state = 1;
+static int relay_seq_started = 0;
+static uint8_t relay_seq = 0;
+
+// hops is what floods we start get, 0 doesn't start or relay any
+void relay_init(int hops, unsigned int seed) {
+  memset(relay_table, 0, sizeof(relay_table));
+  memset(relay_neighbour_ms, 0, sizeof(relay_neighbour_ms));
+  memset(&relay_stats, 0, sizeof(relay_stats));
+  relay_max_hops = hops;
+  relay_rand_state = (uint64_t) seed * 0x9e3779b97f4a7c15ull + 1;
+  relay_seq_started = 0;
+}
+
+int relay_hops() {
+  return relay_max_hops;
+}
+
+static uint64_t relay_rand() {
+  relay_rand_state ^= relay_rand_state << 13;
+  relay_rand_state ^= relay_rand_state >> 7;
+  relay_rand_state ^= relay_rand_state << 17;
+  return relay_rand_state;
+}
+
+// the sequence number of the next flood we start. it starts somewhere
+// else after every restart, so the first floods aren't taken for copies
+// of the last ones before it
+uint8_t relay_flood_seq(uint64_t now_us) {
+  if(!relay_seq_started) {
+    relay_seq = (uint8_t) (relay_rand() ^ now_us);
+    relay_seq_started = 1;
+  }
+  return relay_seq++;
+}
+
+// the node sent a frame of its own that we heard
+void relay_neighbour(uint8_t node, uint64_t now_us) {
+  relay_neighbour_ms[node] = (uint32_t) (now_us / 1000) + 1;
+}
+
+int relay_neighbours(uint64_t now_us) {
+  uint32_t now_ms = (uint32_t) (now_us / 1000) + 1;
+  int count = 0;
+  int i;
+
+  for(i=0; i < 256; i++) {
+    if(relay_neighbour_ms[i] && (uint32_t) (now_ms - relay_neighbour_ms[i]) < RELAY_NEIGHBOUR_MS) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// of 256
+int relay_probability(uint64_t now_us) {
+  int n = relay_neighbours(now_us);
+  int p;
+
+  if(n <= RELAY_TARGET) {
+    return 256;
+  }
+  p = 256 * RELAY_TARGET / n;
+  return (p < RELAY_MIN_PROB) ? RELAY_MIN_PROB : p;
+}
+
+static struct relay_entry* relay_find(uint8_t origin, uint8_t seq, uint64_t now_us) {
+  struct relay_entry* e;
+  int i;
+
+  for(i=0; i < RELAY_SLOTS; i++) {
+    e = &relay_table[i];
+    if(e->state != RELAY_FREE && e->origin == origin && e->seq == seq
+       && (e->state == RELAY_WAITING || now_us - e->heard_us < RELAY_WINDOW_MS * 1000ull)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// a free or expired slot, otherwise the oldest that isn't waiting
+static struct relay_entry* relay_victim(uint64_t now_us) {
+  struct relay_entry* victim = NULL;
+  struct relay_entry* e;
+  int i;
+
+  for(i=0; i < RELAY_SLOTS; i++) {
+    e = &relay_table[i];
+    if(e->state == RELAY_WAITING) {
+      continue;
+    }
+    if(e->state == RELAY_FREE || now_us - e->heard_us >= RELAY_WINDOW_MS * 1000ull) {
+      return e;
+    }
+    if(!victim || e->heard_us < victim->heard_us) {
+      victim = e;
+    }
+  }
+  return victim;
+}
+
+// a relayed frame with its hop byte at pos, followed by the flood
+// sequence number, came in. returns 1 if the flood was heard before,
+// otherwise remembers it and returns 0
+int relay_seen(const uint8_t* frame, size_t len, size_t pos, uint64_t now_us) {
+  struct relay_entry* e;
+
+  if(pos + 1 >= len) {
+    return 0;
+  }
+  e = relay_find(frame[1], frame[pos + 1], now_us);
+  if(e) {
+    relay_stats.copies++;
+    e->copies++;
+    if(e->state == RELAY_WAITING && e->copies >= RELAY_CANCEL_COPIES) {
+      e->state = RELAY_HEARD;
+      relay_stats.cancelled++;
+    }
+    return 1;
+  }
+
+  relay_stats.heard++;
+  e = relay_victim(now_us);
+  if(!e) {
+    relay_stats.full++;
+    return 0;
+  }
+  e->state = RELAY_HEARD;
+  e->origin = frame[1];
+  e->seq = frame[pos + 1];
+  e->heard_us = now_us;
+  e->copies = 1;
+  return 0;
+}
+
+// the first copy of a flood turned out to be genuine, relay it or not.
+// returns 1 if it will be
+int relay_consider(const uint8_t* frame, size_t len, size_t pos, uint64_t now_us) {
+  struct relay_entry* e;
+  uint8_t b = frame[pos];
+
+  if(!relay_max_hops || len > LINK_MAX_FRAME || pos + 1 >= len) {
+    return 0;
+  }
+  e = relay_find(frame[1], frame[pos + 1], now_us);
+  if(!e || e->state != RELAY_HEARD || e->copies > 1) {
+    return 0;
+  }
+  if(!RELAY_LEFT(b) || (int) (relay_rand() & 0xff) >= relay_probability(now_us)) {
+    relay_stats.skipped++;
+    return 0;
+  }
+
+  memcpy(e->frame, frame, len);
+  e->frame[pos] = RELAY_BYTE(RELAY_DONE(b) + 1, RELAY_LEFT(b) - 1);
+  e->len = len;
+  e->due_us = now_us + relay_rand() % (RELAY_DELAY_FRAMES * arq_airtime_us(len) + 1);
+  e->state = RELAY_WAITING;
+  relay_stats.queued++;
+  return 1;
+}
+
+// the frame to relay that has waited long enough, the one due first.
+// returns its length or 0 if there is none
+ssize_t relay_next(uint8_t* buf, size_t size, uint64_t now_us) {
+  struct relay_entry* next = NULL;
+  struct relay_entry* e;
+  int i;
+
+  for(i=0; i < RELAY_SLOTS; i++) {
+    e = &relay_table[i];
+    if(e->state == RELAY_WAITING && e->due_us <= now_us && (!next || e->due_us < next->due_us)) {
+      next = e;
+    }
+  }
+  if(!next || next->len > size) {
+    return 0;
+  }
+  memcpy(buf, next->frame, next->len);
+  next->state = RELAY_HEARD;
+  relay_stats.sent++;
+  return next->len;
+}
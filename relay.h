@@ -0,0 +1,54 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Broadcast frames with LINK_F_RELAY carry two more header bytes. The
+// first has the hops done in the high and the hops left in the low
+// nibble. The sum is what the frame started with, so a relay can count
+// it down while the frame stays the same to the key (see link.c). The
+// second is the origin's flood sequence number, which tells a copy from
+// the same frame sent again
+#define RELAY_BYTE(done, left) ((uint8_t) (((done) << 4) | (left)))
+#define RELAY_DONE(b) ((b) >> 4)
+#define RELAY_LEFT(b) ((b) & 0x0f)
+#define RELAY_ORIGIN(b) RELAY_BYTE(0, RELAY_DONE(b) + RELAY_LEFT(b))
+
+#define RELAY_MAX_HOPS (15)
+#define RELAY_DEFAULT_HOPS (3)
+
+#define RELAY_SLOTS (32)             // floods remembered, with the frame while it waits
+#define RELAY_WINDOW_MS (10000)      // how long a flood is remembered
+#define RELAY_NEIGHBOUR_MS (120000)  // nodes heard directly since then are neighbours
+#define RELAY_TARGET (2)             // relays wanted among our neighbours
+#define RELAY_MIN_PROB (32)          // of 256, however many neighbours there are
+#define RELAY_DELAY_FRAMES (4)       // a relay waits up to this many frames of airtime
+#define RELAY_CANCEL_COPIES (3)      // copies heard that make ours unnecessary
+
+struct relay_stats {
+  unsigned long heard;     // floods heard for the first time
+  unsigned long copies;    // further copies, including our own coming back
+  unsigned long queued;    // picked to be relayed
+  unsigned long skipped;   // not picked, by chance or out of hops
+  unsigned long cancelled; // enough copies heard while waiting
+  unsigned long sent;
+  unsigned long full;      // all slots waiting to be relayed
+};
+
+extern struct relay_stats relay_stats;
+
+void relay_init(int hops, unsigned int seed);
+int relay_hops();
+uint8_t relay_flood_seq(uint64_t now_us);
+
+void relay_neighbour(uint8_t node, uint64_t now_us);
+int relay_neighbours(uint64_t now_us);
+int relay_probability(uint64_t now_us);
+
+int relay_seen(const uint8_t* frame, size_t len, size_t pos, uint64_t now_us);
+int relay_consider(const uint8_t* frame, size_t len, size_t pos, uint64_t now_us);
+ssize_t relay_next(uint8_t* buf, size_t size, uint64_t now_us);
+
+#endif
@@ -3,25 +3,41 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "rn2903.h"
+#include "trace.h"
 
 #define RECEIVE_BUFFER_SIZE 8192
 
 #define CMD_RESP_OK "ok"
-#define CMD_RESP_INVALID_PARAM "invalid_param"
-#define CMD_RESP_BUSY "busy"
+#define CMD_RESP_RADIO_RX "radio_rx"
+
+// responses are classified by their first word with a perfect hash of
+// its length, first and middle character. the multiplier was picked so
+// that no two tokens share a slot; every slot is a case label, so a
+// token added with a colliding hash doesn't compile
+#define TOKEN_HASH_SIZE (64)
+#define TOKEN_HASH(len, first, mid) (((len) + 5 * (first) + (mid)) & (TOKEN_HASH_SIZE - 1))
+
+// the characters are spelled out so the slot is a constant expression
+#define TOKEN(str, first, mid, tok, args)                                  \
+  case TOKEN_HASH(sizeof(str) - 1, first, mid):                            \
+    return (word_len == sizeof(str) - 1 && !memcmp(line, str, word_len)    \
+            && (args || word_len == len)) ? tok : RN2903_T_UNKNOWN
 
 typedef struct command {
   char* buf;
   size_t len;
   int (*cb)(int, char*, size_t);
-  struct timespec last_attempt;
+  uint64_t last_attempt_us;
 } command;
 
 extern int debug;
 
+struct rn2903_stats rn2903_stats;
+
 command* cmd = NULL; // cmd that has been sent but no response received yet
 
 char rbuf[RECEIVE_BUFFER_SIZE];
@@ -29,17 +45,40 @@ size_t rbuf_len = 0;
 
 int (*recv_cb)(int fds, char*, size_t) = NULL;
 
+// when the module has to have answered, 0 if it doesn't have to
+static uint64_t cmd_deadline_us = 0;
+
+// see rn2903.h
+uint64_t (*rn2903_clock)() = NULL;
+void (*rn2903_tap)(int out, const void* data, size_t len) = NULL;
+int (*rn2903_hw_reset)(int fds, int hold) = NULL;
+
+static int rn2903_fault(int fds);
+
+static uint64_t rn2903_now_us() {
+  struct timespec ts;
+
+  if(rn2903_clock) {
+    return rn2903_clock();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 int recv_cb_default(int fds, char* buf, size_t len) {
   fprintf(stdout, "Got unexpected data: %s\n", buf);
   return 0;
 }
 
+// time at which "radio tx" was acknowledged with "ok"
+static uint64_t tx_start_us;
+static uint64_t tx_airtime_us = 0;
+
 // send queued command if any
 ssize_t rn2903_transmit(int fds) {
-  command* cmd;
   char* to_send;
   size_t to_send_len;
-  ssize_t sent = 0;
+  size_t sent = 0;
   int ret;
   const char crlf[] = "\r\n\0";
 
@@ -47,7 +86,7 @@ ssize_t rn2903_transmit(int fds) {
     return 0; // nothing to do
   }
 
-  to_send = malloc(cmd->len + 3);
+  to_send = (char *)malloc(cmd->len + 3);
   if(!to_send) {
     return -1;
   }
@@ -60,7 +99,7 @@ ssize_t rn2903_transmit(int fds) {
   }
 
   while(sent < to_send_len) {
-    ret = write(fds, to_send + sent, cmd->len - sent);
+    ret = write(fds, to_send + sent, to_send_len - sent);
     if(ret < 0) {
       fprintf(stderr, "Error during send to serial: %s\n", strerror(errno));
       free(to_send);
@@ -68,21 +107,44 @@ ssize_t rn2903_transmit(int fds) {
     }
     sent += ret;
   }
-  
+  if(rn2903_tap) {
+    rn2903_tap(1, to_send, to_send_len);
+  }
+
+  cmd->last_attempt_us = rn2903_now_us();
+  cmd_deadline_us = cmd->last_attempt_us + RN2903_REPLY_US;
   free(to_send);
   return sent;
 }
 
 
 
+// is a command waiting for its response?
+int rn2903_busy() {
+  return (cmd != NULL);
+}
+
 int rn2903_cmd(int fds, char* buf, size_t len, int (*cb)(int, char*, size_t)) {
-  ssize_t sent = 0;
-  const char crlf[] = "\r\n\0";
-  char* cmd_str;
   ssize_t ret;
 
-  cmd = malloc(sizeof(command));
-  cmd_str = buf;
+  if(cmd) {
+    fprintf(stderr, "rn2903: can't send a command while waiting for a response\n");
+    return -1;
+  }
+
+  cmd = (command *)malloc(sizeof(command));
+  if(!cmd) {
+    return -1;
+  }
+  cmd->buf = (char *)malloc(len + 1);
+  if(!cmd->buf) {
+    free(cmd);
+    cmd = NULL;
+    return -1;
+  }
+  memcpy(cmd->buf, buf, len);
+  cmd->buf[len] = '\0';
+  cmd->len = len;
   cmd->cb = cb;
 
   ret = rn2903_transmit(fds);
@@ -100,73 +162,133 @@ int rn2903_sys_get_ver(int fds, int (*cb)(int, char*, size_t)) {
 }
 
 
-// run the command callback (if any)
-// and free the command
+// free the command and run its callback (if any).
+// the callback is free to send the next command
 int finalize_cmd(int fds, char* buf, size_t size) {
-  int ret = 0;
+  int (*cb)(int, char*, size_t);
   if(!cmd) return -1;
 
-  if(cmd->cb) {
-    ret = cmd->cb(fds, buf, size);
-  }
+  cb = cmd->cb;
 
+  free(cmd->buf);
   free(cmd);
   cmd = NULL;
+  cmd_deadline_us = 0;
 
-  return ret;
+  if(cb) {
+    return cb(fds, buf, size);
+  }
+  return 0;
 }
 
-// check if two strings are equal, 
-// disregarding the last character
-// and using the length of the second string
-int equals(char* a, const char* b) {
-  int ret;
+// the token a response line starts with. the whole first word has to
+// match, and only tokens that carry data may be followed by more
+enum rn2903_token rn2903_classify(const char* line, size_t len) {
+  size_t word_len;
 
-  ret = strncmp(a, b, sizeof(b)-1);
-  if(ret == 0) {
+  for(word_len=0; word_len < len && line[word_len] != ' '; word_len++);
+  if(word_len == 0) {
+    return RN2903_T_UNKNOWN;
+  }
+
+  switch(TOKEN_HASH(word_len, line[0], line[word_len / 2])) {
+  TOKEN("ok", 'o', 'k', RN2903_T_OK, 0);
+  TOKEN("busy", 'b', 's', RN2903_T_BUSY, 0);
+  TOKEN("invalid_param", 'i', 'd', RN2903_T_INVALID_PARAM, 0);
+  TOKEN("radio_err", 'r', 'o', RN2903_T_RADIO_ERR, 0);
+  TOKEN("radio_rx", 'r', 'o', RN2903_T_RADIO_RX, 1);
+  TOKEN("radio_tx_ok", 'r', '_', RN2903_T_RADIO_TX_OK, 0);
+  TOKEN("mac_paused", 'm', 'a', RN2903_T_MAC_PAUSED, 0);
+  TOKEN("RN2903", 'R', '9', RN2903_T_VERSION, 1);
+  TOKEN("mac_tx_ok", 'm', 't', RN2903_T_MAC_TX_OK, 0);
+  TOKEN("mac_rx", 'm', '_', RN2903_T_MAC_RX, 1);
+  TOKEN("mac_err", 'm', '_', RN2903_T_MAC_ERR, 0);
+  TOKEN("not_joined", 'n', 'o', RN2903_T_NOT_JOINED, 0);
+  TOKEN("no_free_ch", 'n', 'e', RN2903_T_NO_FREE_CH, 0);
+  TOKEN("silent", 's', 'e', RN2903_T_SILENT, 0);
+  TOKEN("frame_counter_err_rejoin_needed", 'f', 'r', RN2903_T_FRAME_COUNTER_ERR, 0);
+  TOKEN("denied", 'd', 'i', RN2903_T_DENIED, 0);
+  TOKEN("accepted", 'a', 'p', RN2903_T_ACCEPTED, 0);
+  TOKEN("keys_not_init", 'k', 'o', RN2903_T_KEYS_NOT_INIT, 0);
+  TOKEN("invalid_data_len", 'i', 'd', RN2903_T_INVALID_DATA_LEN, 0);
+  TOKEN("on", 'o', 'n', RN2903_T_ON, 0);
+  TOKEN("off", 'o', 'f', RN2903_T_OFF, 0);
+  TOKEN("lora", 'l', 'r', RN2903_T_LORA, 0);
+  TOKEN("fsk", 'f', 's', RN2903_T_FSK, 0);
+  default:
+    return RN2903_T_UNKNOWN;
+  }
+}
+
+// the first response to "radio rx" and "radio tx" is "ok" (command
+// accepted) and the second response says how it went.
+// returns 1 if "ok", 0 if the command was sent again or the watchdog
+// took over, which may set a new recv_cb, and -1 on error
+int rn2903_radio_result(int fds, char* buf, size_t size) {
+  switch(rn2903_classify(buf, size)) {
+  case RN2903_T_OK:
     return 1;
+  case RN2903_T_INVALID_PARAM:
+    fprintf(stderr, "rn2903 said: 'invalid_param'\n");
+    fprintf(stderr, "  in response to command: %s\n", cmd->buf);
+    return rn2903_fault(fds);
+  case RN2903_T_BUSY:
+    // TODO add a timeout before trying again
+    fprintf(stderr, "rn2903 is busy... retrying\n");
+    rn2903_stats.cmd_retries++;
+    if(rn2903_transmit(fds) < 0) {
+      return -1;
+    }
+    return 0;
+  default:
+    fprintf(stderr, "Invalid response from rn2903\n");
+    rn2903_stats.serial_errors++;
+    return rn2903_fault(fds);
   }
-  return 0;
 }
 
 int rn2903_rx_result2(int fds, char* buf, size_t size) {
+  size_t i;
 
-  if(equals(buf, "radio_err")) { // reception timeout
+  switch(rn2903_classify(buf, size)) {
+  case RN2903_T_RADIO_ERR: // reception timeout
+    rn2903_stats.rx_timeouts++;
     return finalize_cmd(fds, NULL, 0);
-  } else if (equals(buf, "radio_rx ")) {
-    return finalize_cmd(fds, buf + 9, size - 9);
-  } else {
+  case RN2903_T_RADIO_RX:
+    // the module pads with one or more spaces before the data
+    for(i = sizeof(CMD_RESP_RADIO_RX) - 1; i < size && buf[i] == ' '; i++);
+    return finalize_cmd(fds, buf + i, size - i);
+  default:
     fprintf(stderr, "Invalid response from rn2903\n");
-    return -1;
+    rn2903_stats.serial_errors++;
+    return rn2903_fault(fds);
   }
 }
 
 int rn2903_rx_result(int fds, char* buf, size_t size) {
+  int ret;
 
-  if(equals(buf, "ok")) {
-    recv_cb = rn2903_rx_result2;
-  } else if (equals(buf, "invalid_param")) {
-    fprintf(stderr, "rn2903 said: 'invalid_param'\n");
-    fprintf(stderr, "  in response to command: %s\n", cmd->buf);
-    return -1;
-  } else if (equals(buf, "busy")) {
-    // TODO add a timeout before trying again
-    fprintf(stderr, "rn2903 is busy... retrying\n");
-    rn2903_transmit(fds);
-  } else {
-    fprintf(stderr, "Invalid response from rn2903\n");
-    return -1;
+  recv_cb = rn2903_rx_result; // in case it is sent again
+  ret = rn2903_radio_result(fds, buf, size);
+  if(ret <= 0) {
+    return ret;
   }
+  // the window may be long, the module's own watchdog ends it
+  cmd_deadline_us = rn2903_now_us() + RN2903_RADIO_US;
+  recv_cb = rn2903_rx_result2;
+  return 0;
 }
 
 // send the "radio rx" command
+// the callback gets the received data as a hex string
+// or NULL if nothing was received before the window closed
 int rn2903_rx(int fds, unsigned int rx_window_size, int (*cb)(int, char*, size_t)) {
   char cmd[16];
   if(rx_window_size > 65535) {
     fprintf(stderr, "rx_windows_size must be between 0 and 65535\n");
     return -1;
   }
-  snprintf(cmd, 15, "radio rx %ud\n", rx_window_size);
+  snprintf(cmd, 15, "radio rx %u", rx_window_size);
   cmd[15] = '\0'; // just in case
 
   recv_cb = rn2903_rx_result;
@@ -174,15 +296,694 @@ int rn2903_rx(int fds, unsigned int rx_window_size, int (*cb)(int, char*, size_t
   return rn2903_cmd(fds, cmd, strlen(cmd), cb);
 }
 
+int rn2903_tx_result2(int fds, char* buf, size_t size) {
+  switch(rn2903_classify(buf, size)) {
+  case RN2903_T_RADIO_TX_OK:
+    tx_airtime_us = rn2903_now_us() - tx_start_us;
+    trace_record(TRACE_AIRTIME, tx_airtime_us);
+    rn2903_stats.airtime_us += tx_airtime_us;
+    return finalize_cmd(fds, buf, size);
+  case RN2903_T_RADIO_ERR: // transmission timeout
+    tx_airtime_us = 0;
+    rn2903_stats.tx_timeouts++;
+    return finalize_cmd(fds, NULL, 0);
+  default:
+    fprintf(stderr, "Invalid response from rn2903\n");
+    rn2903_stats.serial_errors++;
+    return rn2903_fault(fds);
+  }
+}
+
+int rn2903_tx_result(int fds, char* buf, size_t size) {
+  int ret;
+
+  recv_cb = rn2903_tx_result; // in case it is sent again
+  ret = rn2903_radio_result(fds, buf, size);
+  if(ret <= 0) {
+    return ret;
+  }
+  tx_start_us = rn2903_now_us();
+  trace_record(TRACE_SERIAL, tx_start_us - cmd->last_attempt_us);
+  cmd_deadline_us = tx_start_us + RN2903_RADIO_US;
+  recv_cb = rn2903_tx_result2;
+  return 0;
+}
+
+// time between the module accepting the last "radio tx"
+// and reporting it as sent
+uint64_t rn2903_tx_airtime_us() {
+  return tx_airtime_us;
+}
 
+size_t rn2903_hex_encode(const uint8_t* data, size_t len, char* out) {
+  const char digits[] = "0123456789ABCDEF";
+  size_t i;
 
-int rn2903_check_result(int fds, char* res, size_t len) {
+  for(i=0; i < len; i++) {
+    out[i*2] = digits[data[i] >> 4];
+    out[i*2+1] = digits[data[i] & 0x0f];
+  }
+  out[len*2] = '\0';
+  return len * 2;
+}
+
+static int hex_value(char c) {
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// returns the number of bytes decoded or -1 if not valid hex
+ssize_t rn2903_hex_decode(const char* hex, size_t len, uint8_t* out, size_t size) {
+  size_t i;
+  int hi, lo;
+
+  if(len % 2 || len / 2 > size) {
+    return -1;
+  }
+
+  for(i=0; i < len / 2; i++) {
+    hi = hex_value(hex[i*2]);
+    lo = hex_value(hex[i*2+1]);
+    if(hi < 0 || lo < 0) {
+      return -1;
+    }
+    out[i] = (hi << 4) | lo;
+  }
+  return len / 2;
+}
+
+// send the "radio tx" command
+// the callback gets NULL if the transmission failed
+int rn2903_tx(int fds, const uint8_t* data, size_t len, int (*cb)(int, char*, size_t)) {
+  char cmd[RN2903_TX_CMD_SIZE];
+  const char prefix[] = "radio tx ";
+  size_t cmd_len;
+
+  if(len == 0 || len > RN2903_MAX_PAYLOAD) {
+    fprintf(stderr, "rn2903 can't send a payload of %u bytes\n", (unsigned int) len);
+    return -1;
+  }
+
+  memcpy(cmd, prefix, sizeof(prefix) - 1);
+  cmd_len = sizeof(prefix) - 1;
+  cmd_len += rn2903_hex_encode(data, len, cmd + cmd_len);
+
+  recv_cb = rn2903_tx_result;
+
+  return rn2903_cmd(fds, cmd, cmd_len, cb);
+}
+
+
+
+int rn2903_snr_result(int fds, char* buf, size_t size) {
+  char* end;
+  long snr;
+
+  if(rn2903_classify(buf, size) == RN2903_T_INVALID_PARAM) {
+    return finalize_cmd(fds, NULL, 0);
+  }
+
+  snr = strtol(buf, &end, 10);
+  if(end == buf || *end != '\0' || snr < -128 || snr > 127) {
+    fprintf(stderr, "Invalid response from rn2903\n");
+    rn2903_stats.serial_errors++;
+    return finalize_cmd(fds, NULL, 0);
+  }
+
+  if(!rn2903_stats.snr_count || snr < rn2903_stats.snr_min) {
+    rn2903_stats.snr_min = snr;
+  }
+  if(!rn2903_stats.snr_count || snr > rn2903_stats.snr_max) {
+    rn2903_stats.snr_max = snr;
+  }
+  rn2903_stats.snr_last = snr;
+  rn2903_stats.snr_sum += snr;
+  rn2903_stats.snr_count++;
+
+  return finalize_cmd(fds, buf, size);
+}
+
+// ask for the signal to noise ratio of the last received frame.
+// the callback gets NULL if the module didn't give a number
+int rn2903_get_snr(int fds, int (*cb)(int, char*, size_t)) {
+  char cmd[] = "radio get snr";
+
+  recv_cb = rn2903_snr_result;
+  return rn2903_cmd(fds, cmd, sizeof(cmd)-1, cb);
+}
+
+// settings in the order they are sent
+#define SETTING_FREQ (0)
+#define SETTING_SF (1)
+#define SETTING_BW (2)
+#define SETTING_CR (3)
+#define SETTING_PWR (4)
+#define SETTINGS (5)
+
+struct rn2903_settings rn2903_settings;
+
+const struct rn2903_settings rn2903_factory_settings = { 923300000, 12, 125, 5, 2 };
+
+static struct rn2903_settings settings_requested; // not applied yet
+static struct rn2903_settings settings_target;    // being applied
+static struct rn2903_settings settings_before;    // to go back to if one is refused
+static int settings_rollback = 0;                 // going back
+static int settings_field = SETTINGS;
+static uint64_t settings_start_us;
+static int (*settings_cb)(int, char*, size_t) = NULL;
+
+static unsigned long setting_get(const struct rn2903_settings* s, int field) {
+  switch(field) {
+  case SETTING_FREQ: return s->freq;
+  case SETTING_SF: return s->sf;
+  case SETTING_BW: return s->bw;
+  case SETTING_CR: return s->cr;
+  case SETTING_PWR: return s->pwr;
+  }
+  return 0;
+}
+
+static void setting_put(struct rn2903_settings* s, int field, unsigned long v) {
+  switch(field) {
+  case SETTING_FREQ: s->freq = v; break;
+  case SETTING_SF: s->sf = v; break;
+  case SETTING_BW: s->bw = v; break;
+  case SETTING_CR: s->cr = v; break;
+  case SETTING_PWR: s->pwr = v; break;
+  }
+}
+
+// returns the value or 0 if out of range
+static unsigned long setting_check(int field, unsigned long v) {
+  switch(field) {
+  case SETTING_FREQ: return (v >= 902000000 && v <= 928000000) ? v : 0;
+  case SETTING_SF: return (v >= 7 && v <= 12) ? v : 0;
+  case SETTING_BW: return (v == 125 || v == 250 || v == 500) ? v : 0;
+  case SETTING_CR: return (v >= 5 && v <= 8) ? v : 0;
+  case SETTING_PWR: return (v >= 2 && v <= 20) ? v : 0;
+  }
+  return 0;
+}
+
+static const char* setting_names[SETTINGS] = { "freq", "sf", "bw", "cr", "pwr" };
+
+// parse space or comma separated name=value pairs, e.g.
+// "sf=9 bw=125 cr=4/5 pwr=14 freq=915000000".
+// sf and cr also take the module's own "sf9" and "4/5", "?" is not
+// known and leaves the setting at 0.
+// returns -1 if anything is unknown or out of range
+int rn2903_parse_settings(const char* str, size_t len, struct rn2903_settings* out) {
+  char buf[128];
+  char* tok;
+  char* save;
+  char* value;
+  char* end;
+  unsigned long v;
+  int field;
+  int found = 0;
+
+  if(len >= sizeof(buf)) {
+    return -1;
+  }
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  memset(out, 0, sizeof(struct rn2903_settings));
+
+  for(tok = strtok_r(buf, " ,\n", &save); tok; tok = strtok_r(NULL, " ,\n", &save)) {
+    value = strchr(tok, '=');
+    if(!value) {
+      return -1;
+    }
+    *value++ = '\0';
+
+    for(field = 0; field < SETTINGS; field++) {
+      if(!strcmp(tok, setting_names[field])) {
+        break;
+      }
+    }
+    if(field == SETTINGS) {
+      return -1;
+    }
+    found = 1;
+    if(!strcmp(value, "?")) {
+      continue;
+    }
+    if(field == SETTING_SF && !strncmp(value, "sf", 2)) {
+      value += 2;
+    } else if(field == SETTING_CR && !strncmp(value, "4/", 2)) {
+      value += 2;
+    }
+
+    v = strtoul(value, &end, 10);
+    if(end == value || *end != '\0' || !setting_check(field, v)) {
+      return -1;
+    }
+    setting_put(out, field, v);
+  }
+  return found ? 0 : -1;
+}
+
+// same format as rn2903_parse_settings takes, "?" if not known
+size_t rn2903_format_settings(const struct rn2903_settings* s, char* buf, size_t size) {
+  size_t len = 0;
+  int field;
+  int ret;
+
+  if(size == 0) {
+    return 0;
+  }
+  buf[0] = '\0';
+  for(field = 0; field < SETTINGS && len < size; field++) {
+    if(!setting_get(s, field)) {
+      ret = snprintf(buf + len, size - len, "%s%s=?", len ? " " : "", setting_names[field]);
+    } else {
+      ret = snprintf(buf + len, size - len, "%s%s=%s%lu", len ? " " : "", setting_names[field],
+                     (field == SETTING_CR) ? "4/" : "", setting_get(s, field));
+    }
+    if(ret < 0) {
+      break;
+    }
+    len += ret;
+  }
+  return (len < size) ? len : size - 1;
+}
+
+void rn2903_request_settings(const struct rn2903_settings* s) {
+  unsigned long v;
+  int field;
+
+  for(field = 0; field < SETTINGS; field++) {
+    v = setting_get(s, field);
+    if(v) {
+      setting_put(&settings_requested, field, v);
+    }
+  }
+}
+
+int rn2903_settings_pending() {
+  int field;
+
+  for(field = 0; field < SETTINGS; field++) {
+    if(setting_get(&settings_requested, field)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void rn2903_pending_settings(struct rn2903_settings* s) {
+  unsigned long v;
+  int field;
+
+  for(field = 0; field < SETTINGS; field++) {
+    v = setting_get(&settings_requested, field);
+    if(v) {
+      setting_put(s, field, v);
+    }
+  }
+}
+
+static int rn2903_settings_next(int fds);
+
+static int rn2903_settings_done(int fds, int ok) {
+  int (*cb)(int, char*, size_t) = settings_cb;
+  char res[] = CMD_RESP_OK;
+
+  rn2903_stats.settings_us = rn2903_now_us() - settings_start_us;
+  settings_field = SETTINGS;
+  settings_cb = NULL;
+  settings_rollback = 0;
+
+  if(!ok) {
+    rn2903_stats.settings_failed++;
+  }
+  if(cb) {
+    return ok ? cb(fds, res, sizeof(res) - 1) : cb(fds, NULL, 0);
+  }
+  return 0;
+}
+
+static int rn2903_set_done(int fds, char* res, size_t size) {
+  int field;
+
+  if(!res && !settings_rollback) {
+    // the module keeps its old value, so the cache is still right,
+    // but the ones set before it are put back to leave no mix
+    memset(&settings_target, 0, sizeof(settings_target));
+    for(field = 0; field < settings_field; field++) {
+      setting_put(&settings_target, field, setting_get(&settings_before, field));
+    }
+    settings_rollback = 1;
+    settings_field = 0;
+    return rn2903_settings_next(fds);
+  }
+  if(!res) {
+    return rn2903_settings_done(fds, 0);
+  }
+  setting_put(&rn2903_settings, settings_field, setting_get(&settings_target, settings_field));
+  settings_field++;
+  return rn2903_settings_next(fds);
+}
+
+static int rn2903_set_result(int fds, char* buf, size_t size) {
   int ret;
-  int i;
-  const char expected[] = "RN2903";
 
-  ret = strncmp(res, expected, sizeof(expected)-1);
-  if(ret != 0) {
+  if(rn2903_classify(buf, size) == RN2903_T_INVALID_PARAM) {
+    fprintf(stderr, "rn2903 refused: %s\n", cmd->buf);
+    return finalize_cmd(fds, NULL, 0);
+  }
+  recv_cb = rn2903_set_result; // in case it is sent again
+  ret = rn2903_radio_result(fds, buf, size);
+  if(ret <= 0) {
+    return ret;
+  }
+  recv_cb = NULL;
+  return finalize_cmd(fds, buf, size);
+}
+
+// send the next setting the module doesn't have yet
+static int rn2903_settings_next(int fds) {
+  char buf[32];
+  unsigned long v = 0;
+  int len;
+
+  for(; settings_field < SETTINGS; settings_field++) {
+    v = setting_get(&settings_target, settings_field);
+    if(!v) {
+      continue;
+    }
+    if(v != setting_get(&rn2903_settings, settings_field)) {
+      break;
+    }
+    rn2903_stats.settings_skipped++;
+  }
+  if(settings_field == SETTINGS) {
+    return rn2903_settings_done(fds, !settings_rollback);
+  }
+
+  len = snprintf(buf, sizeof(buf), "radio set %s %s%lu", setting_names[settings_field],
+                 (settings_field == SETTING_SF) ? "sf" : (settings_field == SETTING_CR) ? "4/" : "", v);
+  rn2903_stats.settings_sent++;
+  recv_cb = rn2903_set_result;
+  return rn2903_cmd(fds, buf, len, rn2903_set_done);
+}
+
+// only the settings that differ from what the module is known to
+// have are sent, so going back and forth between profiles is cheap.
+// the profile is applied whole or not at all: one out of range sends
+// nothing, and if the module refuses one the ones already changed are
+// set back to what they were
+int rn2903_apply_settings(int fds, int (*cb)(int, char*, size_t)) {
+  unsigned long v;
+  int field;
+
+  settings_target = settings_requested;
+  memset(&settings_requested, 0, sizeof(settings_requested));
+  settings_before = rn2903_settings;
+  settings_rollback = 0;
+  settings_field = 0;
+  settings_cb = cb;
+  settings_start_us = rn2903_now_us();
+
+  for(field = 0; field < SETTINGS; field++) {
+    v = setting_get(&settings_target, field);
+    if(v && !setting_check(field, v)) {
+      fprintf(stderr, "rn2903: %s %lu is out of range, radio settings left as they are\n",
+              setting_names[field], v);
+      return rn2903_settings_done(fds, 0);
+    }
+  }
+  return rn2903_settings_next(fds);
+}
+
+static struct rn2903_settings settings_restored;
+
+static int rn2903_restore_done(int fds, char* res, size_t size) {
+  int (*cb)(int, char*, size_t) = settings_cb;
+  struct rn2903_settings got;
+  char buf[64];
+  int len;
+
+  if(res) {
+    len = snprintf(buf, sizeof(buf), "%s=%s", setting_names[settings_field], res);
+    if(len >= (int) sizeof(buf) || rn2903_parse_settings(buf, len, &got) < 0
+       || setting_get(&got, settings_field) != setting_get(&settings_restored, settings_field)) {
+      res = NULL;
+    }
+  }
+  if(res) {
+    rn2903_settings = settings_restored;
+  } else if(debug) {
+    printf("rn2903: was reset, its settings aren't known\n");
+  }
+  settings_field = SETTINGS;
+  settings_cb = NULL;
+  return cb(fds, res, size);
+}
+
+static int rn2903_restore_result(int fds, char* buf, size_t size) {
+  return finalize_cmd(fds, buf, size);
+}
+
+// a setting that isn't what it is after a reset tells whether there
+// was one, nothing else needs to be asked
+int rn2903_restore_settings(int fds, const struct rn2903_settings* s, int (*cb)(int, char*, size_t)) {
+  char res[] = CMD_RESP_OK;
+  char buf[32];
+  unsigned long v;
+  int len;
+
+  settings_restored = *s;
+  settings_cb = cb;
+  for(settings_field = 0; settings_field < SETTINGS; settings_field++) {
+    v = setting_get(s, settings_field);
+    if(v && v != setting_get(&rn2903_factory_settings, settings_field)) {
+      break;
+    }
+  }
+  if(settings_field == SETTINGS) {
+    // same as after a reset, whether there was one or not
+    rn2903_settings = settings_restored;
+    settings_cb = NULL;
+    return cb(fds, res, sizeof(res) - 1);
+  }
+
+  len = snprintf(buf, sizeof(buf), "radio get %s", setting_names[settings_field]);
+  recv_cb = rn2903_restore_result;
+  return rn2903_cmd(fds, buf, len, rn2903_restore_done);
+}
+
+// Watchdog. A module that misses a deadline or answers nonsense is
+// brought back one step at a time: "radio rxstop" for one stuck in a
+// receive window, then "sys reset", then the reset line if there is a
+// hook for it. Rounds that get nowhere are repeated after a pause. The
+// command that was cut short gets NULL once the module is back, so the
+// loop above carries on as after a failed transmission.
+enum rn2903_wd_step {
+  WD_NONE,
+  WD_RXSTOP,
+  WD_VERIFY,    // asking whether it kept its settings
+  WD_SYS_RESET,
+  WD_PULSE,     // reset line held
+  WD_HW_RESET,  // waiting for the hello
+  WD_RETRY
+};
+
+static enum rn2903_wd_step wd_step = WD_NONE;
+static uint64_t wd_start_us;
+static struct rn2903_settings wd_profile; // what the module was set to
+static int (*wd_cb)(int, char*, size_t);  // of the command cut short
+static int wd_cb_ok;
+
+static int rn2903_wd_rxstop_result(int fds, char* buf, size_t size);
+static int rn2903_wd_hello(int fds, char* buf, size_t size);
+
+// forget the command without running its callback
+static void rn2903_drop_cmd() {
+  if(cmd) {
+    free(cmd->buf);
+    free(cmd);
+    cmd = NULL;
+  }
+  recv_cb = NULL;
+  cmd_deadline_us = 0;
+}
+
+// take the next step, returns -1 only if the serial port failed
+static int rn2903_escalate(int fds) {
+  char rxstop[] = "radio rxstop";
+  char reset[] = "sys reset";
+  uint64_t now = rn2903_now_us();
+
+  rn2903_drop_cmd();
+  if(wd_step == WD_VERIFY) {
+    settings_field = SETTINGS;
+    settings_cb = NULL;
+  }
+  switch(wd_step) {
+  case WD_NONE:
+  case WD_RETRY:
+    wd_step = WD_RXSTOP;
+    recv_cb = rn2903_wd_rxstop_result;
+    return rn2903_cmd(fds, rxstop, sizeof(rxstop) - 1, NULL);
+  case WD_RXSTOP:
+  case WD_VERIFY:
+    wd_step = WD_SYS_RESET;
+    recv_cb = rn2903_wd_hello;
+    if(rn2903_cmd(fds, reset, sizeof(reset) - 1, NULL) < 0) {
+      return -1;
+    }
+    cmd_deadline_us = now + RN2903_RESET_US;
+    return 0;
+  case WD_SYS_RESET:
+    if(rn2903_hw_reset && rn2903_hw_reset(fds, 1) == 0) {
+      if(debug) {
+        printf("rn2903: pulling the reset line\n");
+      }
+      wd_step = WD_PULSE;
+      cmd_deadline_us = now + RN2903_PULSE_US;
+      return 0;
+    }
+    break;
+  case WD_PULSE:
+    rn2903_hw_reset(fds, 0);
+    wd_step = WD_HW_RESET;
+    recv_cb = rn2903_wd_hello;
+    cmd_deadline_us = now + RN2903_RESET_US;
+    return 0;
+  case WD_HW_RESET:
+    break;
+  }
+
+  fprintf(stderr, "rn2903: doesn't answer, trying again in %d s\n", RN2903_RETRY_US / 1000000);
+  rn2903_stats.recover_failed++;
+  wd_step = WD_RETRY;
+  cmd_deadline_us = now + RN2903_RETRY_US;
+  return 0;
+}
+
+// the module missed a deadline or said something that makes no sense
+static int rn2903_fault(int fds) {
+  if(wd_step != WD_NONE) {
+    return rn2903_escalate(fds);
+  }
+
+  fprintf(stderr, "rn2903: wedged%s%s, recovering\n", cmd ? " during: " : "", cmd ? cmd->buf : "");
+  rn2903_stats.faults++;
+  wd_start_us = rn2903_now_us();
+  wd_profile = rn2903_settings;
+  wd_cb = cmd ? cmd->cb : NULL;
+  wd_cb_ok = 0;
+  tx_airtime_us = 0;
+
+  // a change of settings is tried again, a restore is given up
+  if(settings_field < SETTINGS) {
+    if(wd_cb == rn2903_set_done) {
+      rn2903_pending_settings(&settings_target);
+      settings_requested = settings_target;
+      wd_cb_ok = !settings_rollback; // going back still failed
+    }
+    wd_cb = settings_cb;
+    settings_field = SETTINGS;
+    settings_cb = NULL;
+    settings_rollback = 0;
+  }
+  return rn2903_escalate(fds);
+}
+
+// back, after a reset if reset is set
+static int rn2903_recovered(int fds, int reset) {
+  int (*cb)(int, char*, size_t) = wd_cb;
+  char res[] = CMD_RESP_OK;
+  struct rn2903_settings profile;
+  uint64_t down_us = rn2903_now_us() - wd_start_us;
+
+  switch(wd_step) {
+  case WD_SYS_RESET: rn2903_stats.recovered_reset++; break;
+  case WD_HW_RESET: rn2903_stats.recovered_hw++; break;
+  default: rn2903_stats.recovered_rxstop++; break;
+  }
+  rn2903_stats.down_us += down_us;
+  fprintf(stderr, "rn2903: back after %lu ms\n", (unsigned long) (down_us / 1000));
+
+  if(reset) {
+    // put back what it was set to, with anything asked for since
+    rn2903_settings = rn2903_factory_settings;
+    profile = wd_profile;
+    rn2903_pending_settings(&profile);
+    rn2903_request_settings(&profile);
+  }
+
+  wd_step = WD_NONE;
+  wd_cb = NULL;
+  cmd_deadline_us = 0;
+  if(!cb) {
+    return 0;
+  }
+  return wd_cb_ok ? cb(fds, res, sizeof(res) - 1) : cb(fds, NULL, 0);
+}
+
+static int rn2903_wd_verified(int fds, char* res, size_t size) {
+  return rn2903_recovered(fds, res == NULL);
+}
+
+static int rn2903_wd_rxstop_result(int fds, char* buf, size_t size) {
+  if(rn2903_classify(buf, size) != RN2903_T_OK) {
+    // e.g. the end of the window it was stuck in
+    recv_cb = rn2903_wd_rxstop_result;
+    return 0;
+  }
+  rn2903_drop_cmd();
+  // a brownout resets the module too, that needs to be known
+  wd_step = WD_VERIFY;
+  return rn2903_restore_settings(fds, &wd_profile, rn2903_wd_verified);
+}
+
+// after a reset the module says what it is, maybe after some noise
+static int rn2903_wd_hello(int fds, char* buf, size_t size) {
+  if(!strstr(buf, "RN2903")) {
+    recv_cb = rn2903_wd_hello;
+    return 0;
+  }
+  rn2903_drop_cmd();
+  return rn2903_recovered(fds, 1);
+}
+
+int rn2903_watchdog(int fds) {
+  if(!cmd_deadline_us || rn2903_now_us() < cmd_deadline_us) {
+    return 0;
+  }
+  if(wd_step == WD_NONE) {
+    fprintf(stderr, "rn2903: no response in time\n");
+  }
+  return rn2903_fault(fds);
+}
+
+int rn2903_timeout(struct timeval* tv) {
+  uint64_t now = rn2903_now_us();
+  uint64_t left;
+
+  if(!cmd_deadline_us) {
+    return 0;
+  }
+  left = (cmd_deadline_us > now) ? cmd_deadline_us - now : 0;
+  tv->tv_sec = left / 1000000;
+  tv->tv_usec = left % 1000000;
+  return 1;
+}
+
+int rn2903_recovering(uint64_t* down_us) {
+  if(wd_step == WD_NONE) {
+    return 0;
+  }
+  *down_us = rn2903_now_us() - wd_start_us;
+  return 1;
+}
+
+int rn2903_check_result(int fds, char* res, size_t len) {
+  if(rn2903_classify(res, len) != RN2903_T_VERSION) {
     fprintf(stderr, "Unexpected result from cmd \"sys get var\"\n");
     return finalize_cmd(fds, NULL, 0);
   }
@@ -202,67 +1003,90 @@ int rn2903_check(int fds, int (*cb)(int, char*, size_t)) {
 
 
 
-// check for CRLF
+// handle the first line in buf, if it is complete.
+// lines end in CRLF but the tty may have turned CR into LF.
+// returns the number of bytes consumed, 0 if no full line
+// or -1 if the response handler failed
 ssize_t rn2903_handle_received(int fds, char* buf, size_t len) {
-  int i;
-  int found = 0;
+  int (*cb)(int, char*, size_t);
+  size_t i;
+  size_t line_len;
+  int ret;
 
-  for(i=0; i < len - 1; i++) {
-    if(buf[i] == '\r' && buf[i+1] == '\n') {
-      found = i + 2;
+  for(i=0; i < len; i++) {
+    if(buf[i] == '\n') {
+      break;
     }
   }
-  if(!found) {
+  if(i == len) {
     return 0;
   }
 
-  // call callback if set
+  line_len = i;
+  while(line_len > 0 && (buf[line_len-1] == '\r' || buf[line_len-1] == '\n')) {
+    line_len--;
+  }
+  buf[line_len] = '\0';
+
+  if(line_len == 0) {
+    return i + 1;
+  }
+
+  // call callback if set. it may set a new one
   if(recv_cb) {
-    recv_cb(fds, rbuf, found);
+    cb = recv_cb;
     recv_cb = NULL;
+    ret = cb(fds, buf, line_len);
   } else { // or call default handler
-    recv_cb_default(fds, rbuf, found);
+    ret = recv_cb_default(fds, buf, line_len);
+  }
+  if(ret < 0) {
+    return ret;
   }
 
-  return found;
+  return i + 1;
 }
 
 // read received data from rn2903 via serial
+// and handle every complete line
 ssize_t rn2903_read(int fds, int fdi) {
 
   ssize_t ret;
   ssize_t parsed;
 
-  while(1) {
-    ret = read(fds, rbuf + rbuf_len, RECEIVE_BUFFER_SIZE - rbuf_len);
-    if(ret < 0) {
-      if(errno == EAGAIN) {
-        return 0;
-      }
-      return ret;
-    }
-
-    if(ret == 0) {
+  ret = read(fds, rbuf + rbuf_len, RECEIVE_BUFFER_SIZE - rbuf_len);
+  if(ret < 0) {
+    if(errno == EAGAIN || errno == EINTR) {
       return 0;
     }
+    rn2903_stats.serial_errors++;
+    return ret;
+  }
+  if(rn2903_tap && ret > 0) {
+    rn2903_tap(0, rbuf + rbuf_len, ret);
+  }
 
-    rbuf_len += ret;
+  rbuf_len += ret;
 
+  while(rbuf_len > 0) {
     parsed = rn2903_handle_received(fds, rbuf, rbuf_len);
-    if(parsed > 0) {
-
-      // move remaining buffer data to beginning of buffer
-      memmove(rbuf, rbuf + parsed, rbuf_len - parsed);
-      rbuf_len -= parsed;
+    if(parsed < 0) {
+      return parsed;
     }
-
-    if(rbuf_len >= RECEIVE_BUFFER_SIZE) {
-      fprintf(stderr, "FATAL: Ran out of buffer for rn2903 receive\n");
-      // TODO what do we do when we run out of buffer?
-      return -1;
+    if(parsed == 0) {
+      break;
     }
+
+    // move remaining buffer data to beginning of buffer
+    memmove(rbuf, rbuf + parsed, rbuf_len - parsed);
+    rbuf_len -= parsed;
   }
 
+  if(rbuf_len >= RECEIVE_BUFFER_SIZE) {
+    fprintf(stderr, "FATAL: Ran out of buffer for rn2903 receive\n");
+    // TODO what do we do when we run out of buffer?
+    return -1;
+  }
 
   return 0;
 }
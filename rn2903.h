@@ -1,11 +1,157 @@
+#ifndef RN2903_H
+#define RN2903_H
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
 
+// largest payload accepted by "radio tx"
+#define RN2903_MAX_PAYLOAD (255)
 
-int rn2903_check();
+// "radio tx " + two hex digits per byte + terminator
+#define RN2903_TX_CMD_SIZE (9 + RN2903_MAX_PAYLOAD * 2 + 1)
+
+// how long the module gets before it is taken to be wedged
+#define RN2903_REPLY_US (2000000)   // to answer a command
+#define RN2903_RADIO_US (20000000)  // to end "radio rx" or "radio tx", its own watchdog takes 15 s
+#define RN2903_RESET_US (3000000)   // to say hello after a reset
+#define RN2903_PULSE_US (100000)    // the reset line is held
+#define RN2903_RETRY_US (10000000)  // before trying again if nothing helped
+
+struct rn2903_stats {
+  unsigned long serial_errors; // unexpected responses and read errors
+  unsigned long cmd_retries;   // commands sent again after "busy"
+  unsigned long rx_timeouts;   // rx windows that closed without a frame
+  unsigned long tx_timeouts;
+  uint64_t airtime_us;
+  int snr_last;                // dB, of received frames
+  int snr_min;
+  int snr_max;
+  long snr_sum;
+  unsigned long snr_count;
+  unsigned long settings_sent;    // "radio set" commands
+  unsigned long settings_skipped; // not sent as the module already had the value
+  unsigned long settings_failed;  // changes refused by the module
+  uint64_t settings_us;           // time the last change took
+  unsigned long faults;           // missed deadlines and invalid responses
+  unsigned long recovered_rxstop; // by "radio rxstop"
+  unsigned long recovered_reset;  // by "sys reset"
+  unsigned long recovered_hw;     // by the reset line
+  unsigned long recover_failed;   // rounds of all of them that didn't help
+  uint64_t down_us;               // time spent recovering
+};
+
+// radio settings. in a request 0 leaves the setting as it is,
+// in rn2903_settings it means not known
+struct rn2903_settings {
+  unsigned long freq; // Hz, 902000000-928000000
+  int sf;             // spreading factor, 7-12
+  int bw;             // kHz, 125, 250 or 500
+  int cr;             // coding rate 4/cr, 5-8
+  int pwr;            // dBm, 2-20
+};
+
+// what the module has been set to
+extern struct rn2903_settings rn2903_settings;
+
+// what the module has after a reset
+extern const struct rn2903_settings rn2903_factory_settings;
+
+extern struct rn2903_stats rn2903_stats;
+
+// monotonic clock in us used to time commands, the system clock if
+// not set. replaying a transcript sets it to the recorded time
+extern uint64_t (*rn2903_clock)();
+
+// if set, sees everything written to (out = 1) and read from (out = 0)
+// the serial port
+extern void (*rn2903_tap)(int out, const void* data, size_t len);
+
+// if set, pulls (hold = 1) or releases the module's reset line
+extern int (*rn2903_hw_reset)(int fds, int hold);
+
+// the first word of a response line
+enum rn2903_token {
+  RN2903_T_UNKNOWN = 0,
+  RN2903_T_OK,
+  RN2903_T_BUSY,
+  RN2903_T_INVALID_PARAM,
+  RN2903_T_RADIO_ERR,
+  RN2903_T_RADIO_RX,        // followed by the received data
+  RN2903_T_RADIO_TX_OK,
+  RN2903_T_MAC_PAUSED,
+  RN2903_T_VERSION,         // "RN2903 1.0.5 ...", the reply to "sys get ver"
+  RN2903_T_MAC_TX_OK,
+  RN2903_T_MAC_RX,          // followed by port and data
+  RN2903_T_MAC_ERR,
+  RN2903_T_NOT_JOINED,
+  RN2903_T_NO_FREE_CH,
+  RN2903_T_SILENT,
+  RN2903_T_FRAME_COUNTER_ERR,
+  RN2903_T_DENIED,
+  RN2903_T_ACCEPTED,
+  RN2903_T_KEYS_NOT_INIT,
+  RN2903_T_INVALID_DATA_LEN,
+  RN2903_T_ON,
+  RN2903_T_OFF,
+  RN2903_T_LORA,
+  RN2903_T_FSK,
+  RN2903_TOKENS
+};
+
+enum rn2903_token rn2903_classify(const char* line, size_t len);
+
+int rn2903_check(int fds, int (*cb)(int, char*, size_t));
+
+int rn2903_busy();
 
 int rn2903_cmd(int fds, char* buf, size_t len, int (*cb)(int, char*, size_t));
 
+int rn2903_rx(int fds, unsigned int rx_window_size, int (*cb)(int, char*, size_t));
+
+int rn2903_tx(int fds, const uint8_t* data, size_t len, int (*cb)(int, char*, size_t));
+
+int rn2903_get_snr(int fds, int (*cb)(int, char*, size_t));
+
+uint64_t rn2903_tx_airtime_us();
+
+int rn2903_parse_settings(const char* str, size_t len, struct rn2903_settings* out);
+
+size_t rn2903_format_settings(const struct rn2903_settings* s, char* buf, size_t size);
+
+// ask for new settings, merged with any that haven't been applied yet
+void rn2903_request_settings(const struct rn2903_settings* s);
+
+int rn2903_settings_pending();
+
+// overlay the requested settings on s
+void rn2903_pending_settings(struct rn2903_settings* s);
+
+// send the "radio set" commands for the requested settings
+// the callback gets NULL if the module refused one of them
+int rn2903_apply_settings(int fds, int (*cb)(int, char*, size_t));
+
+// take what the module was last known to be set to, e.g. before a
+// restart, unless it has been reset since. the callback gets NULL if
+// it was
+int rn2903_restore_settings(int fds, const struct rn2903_settings* s, int (*cb)(int, char*, size_t));
+
+size_t rn2903_hex_encode(const uint8_t* data, size_t len, char* out);
+
+ssize_t rn2903_hex_decode(const char* hex, size_t len, uint8_t* out, size_t size);
+
+// call regularly, recovers a module that missed a deadline
+int rn2903_watchdog(int fds);
+
+// time until rn2903_watchdog() has something to do, returns 0 if nothing
+int rn2903_timeout(struct timeval* tv);
+
+// returns 1 while recovering, with how long it has taken so far
+int rn2903_recovering(uint64_t* down_us);
+
 // read received data from rn2903 via serial
 ssize_t rn2903_read(int fds, int fdi);
 
 ssize_t rn2903_transmit(int fds);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+
+#include "serial.h"
+#include "rn2903.h"
+
+// Serial devices, and finding the RN2903 among them.
+//
+// Boards often have more than one USB serial device and modules that
+// don't always answer right away, so every candidate is asked for its
+// version at once and the first (in the order given) that answers as
+// an RN2903 is used. Devices are given SERIAL_PROBE_TIMEOUT_US to
+// answer, but the probe ends as soon as the one picked is known.
+
+extern int debug;
+
+// the module takes one command at a time
+#define SERIAL_HELLO "sys get ver\r\n"
+
+struct serial_dev {
+  int fd;     // -1 once it's out of the running
+  int found;
+  int asked;  // times SERIAL_HELLO was sent
+  size_t len;
+  char line[SERIAL_VERSION_SIZE];
+};
+
+static char serial_paths[SERIAL_MAX_DEVICES][64];
+
+static uint64_t serial_now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int serial_setup(int fd, char* dev, speed_t baud) {
+  struct termios settings;
+
+  if(tcgetattr(fd, &settings) < 0) {
+    fprintf(stderr, "Failed to get serial device %s attributes: %s\n", dev, strerror(errno));
+    return -1;
+  }
+
+  cfsetospeed(&settings, baud); /* baud rate */
+  settings.c_cflag &= ~PARENB; /* no parity */
+  settings.c_cflag &= ~CSTOPB; /* 1 stop bit */
+  settings.c_cflag &= ~CSIZE;
+  settings.c_cflag |= CS8 | CLOCAL; /* 8 bits */
+  settings.c_lflag = ICANON; /* canonical mode */
+  settings.c_oflag &= ~OPOST; /* raw output */
+
+  if(tcsetattr(fd, TCSANOW, &settings) < 0) {
+    fprintf(stderr, "Failed to set serial device %s attributes: %s\n", dev, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int open_serial(char* dev, speed_t baud) {
+
+  int fd;
+
+  fd = open(dev, O_RDWR); /* connect to port */
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open serial device %s: %s\n", dev, strerror(errno));
+    return fd;
+  }
+
+  if(serial_setup(fd, dev, baud) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  tcflush(fd, TCOFLUSH);
+
+  return fd;
+}
+
+int close_serial(int fd) {
+  return close(fd);
+}
+
+int serial_parse_lines(const char* str) {
+  char buf[16];
+  char* tok;
+  char* save;
+  int lines = 0;
+
+  if(strlen(str) >= sizeof(buf)) {
+    return -1;
+  }
+  strcpy(buf, str);
+  for(tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if(!strcmp(tok, "dtr")) {
+      lines |= TIOCM_DTR;
+    } else if(!strcmp(tok, "rts")) {
+      lines |= TIOCM_RTS;
+    } else {
+      return -1;
+    }
+  }
+  return lines ? lines : -1;
+}
+
+// asserted lines are low on the TTL side, like an active low reset pin
+int serial_set_lines(int fd, int lines, int on) {
+  if(ioctl(fd, on ? TIOCMBIS : TIOCMBIC, &lines) < 0) {
+    fprintf(stderr, "Failed to %s the modem control lines: %s\n", on ? "assert" : "clear", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+// the devices matching SERIAL_PATTERNS, at most max.
+// returns how many were found
+int serial_candidates(char** devs, int max) {
+  const char* patterns[] = SERIAL_PATTERNS;
+  glob_t g;
+  size_t i;
+  int count = 0;
+  int p;
+
+  if(max > SERIAL_MAX_DEVICES) {
+    max = SERIAL_MAX_DEVICES;
+  }
+  for(p=0; p < (int) (sizeof(patterns) / sizeof(patterns[0])); p++) {
+    if(glob(patterns[p], 0, NULL, &g) != 0) {
+      continue;
+    }
+    for(i=0; i < g.gl_pathc && count < max; i++) {
+      snprintf(serial_paths[count], sizeof(serial_paths[count]), "%s", g.gl_pathv[i]);
+      devs[count] = serial_paths[count];
+      count++;
+    }
+    globfree(&g);
+  }
+  return count;
+}
+
+// take in what a device sent, one line at a time
+static void serial_probe_read(struct serial_dev* d) {
+  ssize_t ret;
+  size_t line_len;
+  char* eol;
+
+  ret = read(d->fd, d->line + d->len, sizeof(d->line) - 1 - d->len);
+  if(ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if(ret <= 0) {
+    close(d->fd);
+    d->fd = -1;
+    return;
+  }
+  d->len += ret;
+  d->line[d->len] = '\0';
+
+  while((eol = strchr(d->line, '\n'))) {
+    line_len = eol - d->line;
+    while(line_len > 0 && d->line[line_len-1] == '\r') {
+      line_len--;
+    }
+    if(rn2903_classify(d->line, line_len) == RN2903_T_VERSION) {
+      d->line[line_len] = '\0';
+      d->found = 1;
+      return;
+    }
+    // anything else, e.g. invalid_param for whatever was left in the
+    // module's buffer before the command. it gets one more try
+    if(line_len > 0 && d->asked < 2) {
+      d->asked++;
+      if(write(d->fd, SERIAL_HELLO, sizeof(SERIAL_HELLO) - 1) < 0) {
+        close(d->fd);
+        d->fd = -1;
+        return;
+      }
+    }
+    d->len -= eol + 1 - d->line;
+    memmove(d->line, eol + 1, d->len + 1);
+  }
+  if(d->len == sizeof(d->line) - 1) {
+    d->len = 0; // not a line we'd want
+  }
+}
+
+// ask all count devices for their version at once. returns the fd of
+// the first that answers as an RN2903 within timeout_us, with its
+// index in *which and its version, or -1 if none does
+int serial_probe(char** devs, int count, speed_t baud, uint64_t timeout_us,
+                 int* which, char* version, size_t size) {
+  struct serial_dev d[SERIAL_MAX_DEVICES];
+  struct timeval tv;
+  fd_set fdset;
+  uint64_t start = serial_now_us();
+  uint64_t now;
+  int best = -1;
+  int maxfd;
+  int i;
+
+  if(count > SERIAL_MAX_DEVICES) {
+    count = SERIAL_MAX_DEVICES;
+  }
+  for(i=0; i < count; i++) {
+    memset(&d[i], 0, sizeof(d[i]));
+    d[i].fd = open(devs[i], O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(d[i].fd < 0) {
+      if(debug) {
+        printf("Failed to open serial device %s: %s\n", devs[i], strerror(errno));
+      }
+      continue;
+    }
+    tcflush(d[i].fd, TCIOFLUSH);
+    d[i].asked = 1;
+    if(serial_setup(d[i].fd, devs[i], baud) < 0
+       || write(d[i].fd, SERIAL_HELLO, sizeof(SERIAL_HELLO) - 1) != sizeof(SERIAL_HELLO) - 1) {
+      close(d[i].fd);
+      d[i].fd = -1;
+    }
+  }
+
+  while(1) {
+    // done once the first device still in the running has answered
+    for(i=0; i < count && d[i].fd < 0; i++);
+    if(i == count || d[i].found) {
+      break;
+    }
+    now = serial_now_us();
+    if(now - start >= timeout_us) {
+      break;
+    }
+
+    FD_ZERO(&fdset);
+    maxfd = -1;
+    for(i=0; i < count; i++) {
+      if(d[i].fd >= 0 && !d[i].found) {
+        FD_SET(d[i].fd, &fdset);
+        if(d[i].fd > maxfd) {
+          maxfd = d[i].fd;
+        }
+      }
+    }
+    tv.tv_sec = (timeout_us - (now - start)) / 1000000;
+    tv.tv_usec = (timeout_us - (now - start)) % 1000000;
+    if(select(maxfd + 1, &fdset, NULL, NULL, &tv) < 0 && errno != EINTR) {
+      perror("Error during select()");
+      break;
+    }
+    for(i=0; i < count; i++) {
+      if(d[i].fd >= 0 && !d[i].found && FD_ISSET(d[i].fd, &fdset)) {
+        serial_probe_read(&d[i]);
+      }
+    }
+  }
+
+  for(i=0; i < count; i++) {
+    if(d[i].fd < 0) {
+      continue;
+    }
+    if(best < 0 && d[i].found) {
+      best = i;
+      continue;
+    }
+    close(d[i].fd);
+  }
+  if(debug) {
+    printf("Probed %d serial devices in %lu ms\n", count, (unsigned long) ((serial_now_us() - start) / 1000));
+  }
+  if(best < 0) {
+    return -1;
+  }
+
+  fcntl(d[best].fd, F_SETFL, fcntl(d[best].fd, F_GETFL) & ~O_NONBLOCK);
+  snprintf(version, size, "%s", d[best].line);
+  *which = best;
+  return d[best].fd;
+}
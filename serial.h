@@ -0,0 +1,34 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <termios.h>
+
+// where modules are looked for if no serial device is given
+#define SERIAL_PATTERNS { "/dev/ttyUSB*", "/dev/ttyACM*" }
+#define SERIAL_MAX_DEVICES (16)
+
+// how long devices get to answer "sys get ver"
+#define SERIAL_PROBE_TIMEOUT_US (300000)
+
+// "RN2903 1.0.3 Aug  8 2017 15:11:09"
+#define SERIAL_VERSION_SIZE (64)
+
+// baud is specified using macros
+// e.g. 9600 is B9600
+int open_serial(char* dev, speed_t baud);
+int close_serial(int fd);
+
+// modem control lines the module's reset pin can be wired to,
+// e.g. "dtr" or "dtr,rts". returns TIOCM_* bits or -1
+int serial_parse_lines(const char* str);
+
+// assert (on = 1) or clear the lines
+int serial_set_lines(int fd, int lines, int on);
+
+int serial_candidates(char** devs, int max);
+int serial_probe(char** devs, int count, speed_t baud, uint64_t timeout_us,
+                 int* which, char* version, size_t size);
+
+#endif
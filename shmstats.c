@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmstats.h"
+
+// Counters in a shared memory file for monitoring.
+//
+// The daemon maps a file (on /dev/shm by default) and copies its
+// counters into it once per event loop iteration. Readers map the same
+// file and never talk to the daemon, so polling it costs the daemon
+// nothing.
+//
+// The page is protected by a sequence lock: the daemon makes seq odd
+// while it writes and even again when done. A reader copies the page
+// and uses the copy if seq was the same even number before and after.
+
+static struct shmstats_page* shmstats_page = NULL;
+
+// returns 0 or -1 if the file couldn't be created
+int shmstats_create(const char* path, uint8_t node_id, uint64_t now) {
+  struct shmstats_page* page;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open stats file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if(ftruncate(fd, sizeof(struct shmstats_page)) < 0) {
+    fprintf(stderr, "Failed to resize stats file %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  page = (struct shmstats_page*) mmap(NULL, sizeof(struct shmstats_page),
+                                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(page == MAP_FAILED) {
+    fprintf(stderr, "Failed to map stats file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  // readers may still have the page of a previous run mapped
+  __atomic_store_n(&page->seq, page->seq | 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  page->magic = SHMSTATS_MAGIC;
+  page->version = SHMSTATS_VERSION;
+  page->size = sizeof(struct shmstats_page);
+  page->pid = getpid();
+  page->node_id = node_id;
+  page->started_us = now;
+  page->updated_us = now;
+  memset(&page->c, 0, sizeof(page->c));
+  __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+
+  shmstats_page = page;
+  return 0;
+}
+
+void shmstats_publish(const struct shmstats_counters* c, uint64_t now) {
+  uint32_t seq;
+
+  if(!shmstats_page) {
+    return;
+  }
+
+  seq = shmstats_page->seq;
+  __atomic_store_n(&shmstats_page->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  shmstats_page->c = *c;
+  shmstats_page->updated_us = now;
+
+  __atomic_store_n(&shmstats_page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// map the stats file of a daemon read only.
+// returns NULL on error, size is set to the mapped size
+const struct shmstats_page* shmstats_open(const char* path, size_t* size) {
+  struct shmstats_page* page;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return NULL;
+  }
+  if(fstat(fd, &st) < 0 || st.st_size < (off_t) offsetof(struct shmstats_page, c)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  page = (struct shmstats_page*) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(page == MAP_FAILED) {
+    return NULL;
+  }
+  if(page->magic != SHMSTATS_MAGIC) {
+    munmap(page, st.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  *size = st.st_size;
+  return page;
+}
+
+// copy a consistent snapshot of the page.
+// fields the daemon doesn't know about are zero.
+// returns 0 or -1 (errno EAGAIN) if the daemon was always writing
+int shmstats_snapshot(const struct shmstats_page* page, size_t size, struct shmstats_page* out) {
+  uint32_t seq;
+  size_t len;
+  int i;
+
+  for(i=0; i < SHMSTATS_MAX_TRIES; i++) {
+    seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1) {
+      continue;
+    }
+
+    len = page->size;
+    if(len > size) {
+      len = size;
+    }
+    if(len > sizeof(struct shmstats_page)) {
+      len = sizeof(struct shmstats_page);
+    }
+    memcpy(out, page, len);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+      memset((uint8_t*) out + len, 0, sizeof(struct shmstats_page) - len);
+      return 0;
+    }
+  }
+
+  errno = EAGAIN;
+  return -1;
+}
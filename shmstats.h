@@ -0,0 +1,132 @@
+#ifndef SHMSTATS_H
+#define SHMSTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHMSTATS_MAGIC (0x4c525354) // "LRST"
+#define SHMSTATS_VERSION (1)
+#define SHMSTATS_DEFAULT_FILE "/dev/shm/lora_iface.stats"
+
+// give up on a snapshot if the daemon keeps writing
+#define SHMSTATS_MAX_TRIES (1000)
+
+// counters published by lora_iface.
+// fields are only ever added at the end, so readers built against an
+// older version keep working and newer ones see zeros
+struct shmstats_counters {
+  // link layer
+  uint64_t tx_packets;       // taken from the TUN interface
+  uint64_t tx_frames;
+  uint64_t tx_bytes;
+  uint64_t rx_packets;       // delivered to the TUN interface
+  uint64_t rx_frames;
+  uint64_t rx_bytes;
+
+  // drops by reason
+  uint64_t tx_failed;        // the radio didn't send the frame
+  uint64_t tx_too_big;
+  uint64_t tx_arq_gave_up;
+  uint64_t tx_acks_thinned;
+  uint64_t rx_invalid;       // bad frame or link header
+  uint64_t rx_not_for_us;
+  uint64_t rx_duplicate;
+  uint64_t rx_frag_expired;
+  uint64_t rx_frag_invalid;
+  uint64_t rx_tcp_invalid;   // no context, unknown address or bad header
+  uint64_t rx_lz_invalid;
+
+  // queues, at the time of the update
+  uint32_t stage_depth;      // packets held between the TUN interface and the link
+  uint32_t arq_pending;      // frames in the ARQ windows
+
+  // radio
+  uint64_t airtime_us;
+  uint64_t arq_retransmits;
+  uint64_t serial_errors;
+  uint64_t cmd_retries;      // commands sent again after "busy"
+  uint64_t rx_timeouts;      // rx windows without a frame
+  uint64_t tx_timeouts;
+
+  // SNR of received frames in dB
+  int32_t snr_last;
+  int32_t snr_min;
+  int32_t snr_max;
+  int32_t snr_pad;
+  int64_t snr_sum;
+  uint64_t snr_count;
+
+  // raw frames (see raw.h)
+  uint64_t tx_raw;
+  uint64_t rx_raw;
+
+  // broadcast duplicate suppression (see dedup.h)
+  uint64_t rx_flood_checked;
+  uint64_t rx_flood_dropped;
+  uint64_t rx_flood_evicted;
+
+  // link encryption (see aead.h)
+  uint64_t tx_sealed;
+  uint64_t rx_opened;
+  uint64_t rx_unsealed;      // frames in the clear while a key is set
+  uint64_t rx_auth_failed;   // wrong key, tampered or no counter to go by
+  uint64_t rx_replayed;
+
+  // store-and-forward spool (see spool.h)
+  uint64_t spool_depth;      // packets waiting, at the time of the update
+  uint64_t spooled;
+  uint64_t spool_sent;
+  uint64_t spool_full;       // not spooled for lack of room
+  uint64_t spool_held;       // in no class, read while the link was down
+
+  // interface tuning (see tune.h)
+  uint64_t if_mtu;           // 0 unless tuned
+  uint64_t if_txqueuelen;
+  uint64_t if_tunings;       // changes applied
+
+  // module watchdog (see rn2903.h)
+  uint64_t radio_faults;     // missed deadlines and invalid responses
+  uint64_t radio_recovered;
+  uint64_t radio_resets;     // recoveries that needed "sys reset" or the reset line
+  uint64_t radio_down_us;    // spent recovering
+
+  // relayed floods (see relay.h)
+  uint64_t relay_heard;      // floods heard for the first time
+  uint64_t relay_copies;
+  uint64_t relay_queued;     // picked to be relayed
+  uint64_t relay_skipped;
+  uint64_t relay_cancelled;  // others relayed it first
+  uint64_t relay_sent;
+  uint64_t relay_neighbours; // at the time of the update
+
+  // compression (see lz.h)
+  uint64_t lz_tx_packets;
+  uint64_t lz_tx_compressed; // packets that got smaller
+  uint64_t lz_tx_bytes_in;
+  uint64_t lz_tx_bytes_out;
+  uint64_t lz_tx_cpu_ns;     // spent compressing
+  uint64_t lz_rx_packets;
+  uint64_t lz_rx_cpu_ns;     // spent decompressing
+};
+
+struct shmstats_page {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;        // of struct shmstats_page as written by the daemon
+  uint32_t pid;
+  uint32_t seq;         // odd while the daemon is writing
+  uint32_t node_id;
+  uint64_t started_us;  // CLOCK_MONOTONIC
+  uint64_t updated_us;
+  struct shmstats_counters c;
+};
+
+// for the daemon
+int shmstats_create(const char* path, uint8_t node_id, uint64_t now);
+void shmstats_publish(const struct shmstats_counters* c, uint64_t now);
+
+// for readers
+const struct shmstats_page* shmstats_open(const char* path, size_t* size);
+int shmstats_snapshot(const struct shmstats_page* page, size_t size, struct shmstats_page* out);
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include "rnsim.h"
+
+// Runs simulated RN2903 modules on pseudo-terminals so lora_iface
+// can be tested without hardware:
+//
+//   rn2903_sim -n 2 -p /tmp/rnsim
+//   lora_iface -s /tmp/rnsim0 -n 1
+//   lora_iface -s /tmp/rnsim1 -n 2
+//
+// See rnsim.c for what is modelled.
+
+int debug = 0;
+
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t wedge = 0; // a fault for every node, from SIGUSR1/2
+
+static void handle_signal(int sig) {
+  stop = 1;
+}
+
+static void handle_wedge(int sig) {
+  wedge = (sig == SIGUSR1) ? RNSIM_FAULT_MUTE : RNSIM_FAULT_STUCK_RX;
+}
+
+static uint64_t now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void print_stats() {
+  struct rnsim_node* n;
+  int i;
+
+  for(i=0; i < rnsim_node_count; i++) {
+    n = &rnsim_nodes[i];
+    printf("node %d: tx %lu frames, %lu ms airtime, rx %lu frames, %lu lost, %lu collided\n",
+           i, n->tx_frames, (unsigned long) (n->airtime_us / 1000),
+           n->rx_frames, n->rx_lost, n->rx_collided);
+  }
+}
+
+void usage(FILE* out, char* name) {
+  fprintf(out, "Usage: %s [-d] [-n nodes] [-p link_prefix] [-l loss] [-x speedup] [-b baud] [-c] [-s seed]\n", name);
+  fprintf(out, "\n");
+  fprintf(out, "  -d: print debug output\n");
+  fprintf(out, "  -n: number of simulated modules (default: 2, max: %d)\n", RNSIM_MAX_NODES);
+  fprintf(out, "  -p: create symlinks <link_prefix>0, <link_prefix>1, ... to the PTYs\n");
+  fprintf(out, "  -l: probability that a frame is lost at a receiver (default: 0)\n");
+  fprintf(out, "  -x: run time-on-air and serial delays this many times faster (default: 1)\n");
+  fprintf(out, "  -b: serial baud rate (default: 57600)\n");
+  fprintf(out, "  -c: the first of two colliding frames survives\n");
+  fprintf(out, "  -s: random seed (default: 1)\n");
+}
+
+int main(int argc, char* argv[]) {
+  struct rnsim_params params;
+  char names[RNSIM_MAX_NODES][64];
+  char link_name[256];
+  int slaves[RNSIM_MAX_NODES];
+  char* prefix = NULL;
+  unsigned int seed = 1;
+  int nodes = 2;
+  fd_set fdset;
+  struct timeval timeout;
+  uint64_t now, next;
+  int maxfd;
+  int opt;
+  int fd;
+  int ret;
+  int i;
+
+  memset(&params, 0, sizeof(params));
+  params.baud = 57600;
+  params.speedup = 1;
+
+  while((opt = getopt(argc, argv, "dn:p:l:x:b:cs:")) > 0) {
+    switch(opt) {
+      case 'd':
+        debug = 1;
+        break;
+      case 'n':
+        nodes = atoi(optarg);
+        if(nodes < 1 || nodes > RNSIM_MAX_NODES) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'p':
+        prefix = optarg;
+        break;
+      case 'l':
+        params.loss = atof(optarg);
+        break;
+      case 'x':
+        params.speedup = atof(optarg);
+        break;
+      case 'b':
+        params.baud = atoi(optarg);
+        break;
+      case 'c':
+        params.capture = 1;
+        break;
+      case 's':
+        seed = atoi(optarg);
+        break;
+      default:
+        usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+
+  rnsim_init(&params, seed);
+
+  for(i=0; i < nodes; i++) {
+    fd = rnsim_open_pty(names[i], sizeof(names[i]), &slaves[i]);
+    if(fd < 0) {
+      fprintf(stderr, "Failed to open a PTY: %s\n", strerror(errno));
+      return 1;
+    }
+    rnsim_add_node(fd);
+
+    if(prefix) {
+      snprintf(link_name, sizeof(link_name), "%s%d", prefix, i);
+      unlink(link_name);
+      if(symlink(names[i], link_name) < 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", link_name, strerror(errno));
+        return 1;
+      }
+      printf("node %d: %s -> %s\n", i, link_name, names[i]);
+    } else {
+      printf("node %d: %s\n", i, names[i]);
+    }
+  }
+  fflush(stdout);
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  signal(SIGUSR1, handle_wedge);
+  signal(SIGUSR2, handle_wedge);
+
+  while(!stop) {
+    if(wedge) {
+      for(i=0; i < nodes; i++) {
+        rnsim_nodes[i].fault = (enum rnsim_fault) wedge;
+      }
+      printf("Wedged all nodes: %s\n", wedge == RNSIM_FAULT_MUTE ? "mute" : "stuck in rx");
+      fflush(stdout);
+      wedge = 0;
+    }
+    FD_ZERO(&fdset);
+    maxfd = rnsim_fd_set(&fdset, -1);
+
+    now = now_us();
+    next = rnsim_next_event(now);
+    if(next == UINT64_MAX) {
+      next = now + 1000000;
+    }
+    timeout.tv_sec = (next - now) / 1000000;
+    timeout.tv_usec = (next - now) % 1000000;
+
+    ret = select(maxfd + 1, &fdset, NULL, NULL, &timeout);
+    if(ret < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "select failed: %s\n", strerror(errno));
+      break;
+    }
+    if(ret == 0) {
+      FD_ZERO(&fdset);
+    }
+
+    if(rnsim_handle_fds(&fdset, now_us()) < 0) {
+      fprintf(stderr, "Serial line error: %s\n", strerror(errno));
+      break;
+    }
+  }
+
+  print_stats();
+
+  for(i=0; i < nodes; i++) {
+    if(prefix) {
+      snprintf(link_name, sizeof(link_name), "%s%d", prefix, i);
+      unlink(link_name);
+    }
+    close(slaves[i]);
+    close(rnsim_nodes[i].fd);
+  }
+  return 0;
+}
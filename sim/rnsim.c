@@ -0,0 +1,737 @@
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600 // posix_openpt
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <math.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "rnsim.h"
+
+// Simulated RN2903 modules sharing a radio channel.
+//
+// Each node is the module end of a serial line (a PTY master or one end
+// of a socketpair) and speaks the subset of the RN2903 command set that
+// lora_iface uses. Commands and responses take as long as they would
+// on a serial line at the configured baud rate and frames are on the
+// air for the LoRa time-on-air of the node's radio settings.
+//
+// A node receives a frame if it is listening ("radio rx") on the same
+// frequency, spreading factor and bandwidth when the frame starts, or
+// starts listening early enough in the preamble to still sync to it.
+// Frames that overlap in time collide and are lost, unless capture is
+// enabled in which case the frame that started first survives. Every
+// reception can also be lost at random. There is no propagation model,
+// the SNR of received frames is drawn from 5 to 10 dB.
+//
+// Time is passed in by the caller (microseconds) so tests can run
+// the simulation without waiting.
+
+extern int debug;
+
+struct rnsim_node rnsim_nodes[RNSIM_MAX_NODES];
+int rnsim_node_count = 0;
+
+static struct rnsim_params rnsim_params;
+static struct rnsim_tx rnsim_txs[RNSIM_MAX_TX];
+static uint64_t rnsim_rand_state = 1;
+
+static uint64_t rnsim_rand() {
+  // xorshift64*
+  rnsim_rand_state ^= rnsim_rand_state >> 12;
+  rnsim_rand_state ^= rnsim_rand_state << 25;
+  rnsim_rand_state ^= rnsim_rand_state >> 27;
+  return rnsim_rand_state * 2685821657736338717ull;
+}
+
+static double rnsim_uniform() {
+  return (rnsim_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t rnsim_scale(double us) {
+  return us / rnsim_params.speedup;
+}
+
+void rnsim_init(const struct rnsim_params* params, unsigned int seed) {
+  rnsim_params = *params;
+  if(rnsim_params.baud == 0) {
+    rnsim_params.baud = 57600;
+  }
+  if(rnsim_params.speedup <= 0) {
+    rnsim_params.speedup = 1;
+  }
+  memset(rnsim_nodes, 0, sizeof(rnsim_nodes));
+  memset(rnsim_txs, 0, sizeof(rnsim_txs));
+  rnsim_node_count = 0;
+  rnsim_rand_state = (uint64_t) seed * 0x9e3779b97f4a7c15ull + 1;
+}
+
+static void rnsim_reset_node(struct rnsim_node* n) {
+  // factory defaults
+  n->sf = 12;
+  n->bw = 125;
+  n->cr = 1;
+  n->prlen = 8;
+  n->pwr = 2;
+  n->freq = 923300000;
+  n->snr = -128;
+
+  n->state = RNSIM_IDLE;
+  n->rx_tx = -1;
+  n->tx = -1;
+  n->cmd_pending = 0;
+  n->fault = RNSIM_FAULT_NONE;
+}
+
+// fd is the module end of the serial line.
+// returns the node index or -1
+int rnsim_add_node(int fd) {
+  struct rnsim_node* n;
+
+  if(rnsim_node_count >= RNSIM_MAX_NODES) {
+    return -1;
+  }
+  n = &rnsim_nodes[rnsim_node_count];
+  memset(n, 0, sizeof(struct rnsim_node));
+  n->fd = fd;
+  rnsim_reset_node(n);
+  return rnsim_node_count++;
+}
+
+uint64_t rnsim_symbol_us(const struct rnsim_node* n) {
+  return (1 << n->sf) * 1000 / n->bw;
+}
+
+// LoRa time-on-air (Semtech AN1200.13) with explicit header and CRC
+uint64_t rnsim_airtime_us(const struct rnsim_node* n, size_t len) {
+  double tsym = (double)(1 << n->sf) * 1000.0 / n->bw;
+  int de = (tsym > 16000.0); // low data rate optimization
+  double payload_symbols;
+
+  payload_symbols = ceil((8.0 * len - 4 * n->sf + 28 + 16) / (4.0 * (n->sf - 2 * de))) * (n->cr + 4);
+  if(payload_symbols < 0) {
+    payload_symbols = 0;
+  }
+  return (n->prlen + 4.25) * tsym + (8 + payload_symbols) * tsym;
+}
+
+static uint64_t rnsim_serial_us(size_t len) {
+  // 8N1
+  return rnsim_scale(len * 10 * 1000000.0 / rnsim_params.baud);
+}
+
+// queue a response line at time t
+static void rnsim_respond(struct rnsim_node* n, uint64_t t, const char* fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+
+static void rnsim_respond(struct rnsim_node* n, uint64_t t, const char* fmt, ...) {
+  struct rnsim_line* l;
+  va_list ap;
+  int len;
+
+  if(n->out_count >= RNSIM_MAX_OUT) {
+    fprintf(stderr, "rnsim: node %d output queue full\n", (int)(n - rnsim_nodes));
+    return;
+  }
+  l = &n->out[n->out_count];
+
+  va_start(ap, fmt);
+  len = vsnprintf(l->buf, RNSIM_MAX_LINE, fmt, ap);
+  va_end(ap);
+  if(len < 0 || len >= RNSIM_MAX_LINE) {
+    return;
+  }
+  memcpy(l->buf + len, "\r\n", 2);
+  l->len = len + 2;
+
+  if(n->serial_free < t) {
+    n->serial_free = t;
+  }
+  n->serial_free += rnsim_serial_us(l->len);
+  l->due = n->serial_free;
+  n->out_count++;
+}
+
+static int rnsim_hex_value(char c) {
+  if(c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if(c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if(c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static int rnsim_same_channel(const struct rnsim_node* a, const struct rnsim_node* b) {
+  return a->freq == b->freq && a->sf == b->sf && a->bw == b->bw;
+}
+
+static void rnsim_start_tx(struct rnsim_node* n, uint64_t t, const uint8_t* data, size_t len) {
+  struct rnsim_tx* tx = NULL;
+  struct rnsim_tx* other;
+  struct rnsim_node* r;
+  int idx = -1;
+  int i;
+
+  for(i=0; i < RNSIM_MAX_TX; i++) {
+    other = &rnsim_txs[i];
+    if(!other->used) {
+      if(!tx) {
+        tx = other;
+        idx = i;
+      }
+      continue;
+    }
+    if(other->end <= t) {
+      other->used = 0; // over, can't collide any more
+      if(!tx) {
+        tx = other;
+        idx = i;
+      }
+    }
+  }
+  if(!tx) {
+    fprintf(stderr, "rnsim: too many transmissions in the air\n");
+    return;
+  }
+
+  memset(tx, 0, sizeof(struct rnsim_tx));
+  tx->used = 1;
+  tx->node = n - rnsim_nodes;
+  tx->start = t;
+  tx->end = t + rnsim_scale(rnsim_airtime_us(n, len));
+  tx->len = len;
+  memcpy(tx->data, data, len);
+
+  // collisions with frames still in the air
+  for(i=0; i < RNSIM_MAX_TX; i++) {
+    other = &rnsim_txs[i];
+    if(i == idx || !other->used || other->end <= t
+       || !rnsim_same_channel(&rnsim_nodes[other->node], n)) {
+      continue;
+    }
+    tx->collided = 1;
+    if(!rnsim_params.capture) {
+      other->collided = 1;
+    }
+  }
+
+  n->state = RNSIM_TX;
+  n->tx = idx;
+  n->tx_frames++;
+  n->airtime_us += tx->end - tx->start;
+
+  // whoever is listening on this channel locks on to the frame
+  for(i=0; i < rnsim_node_count; i++) {
+    r = &rnsim_nodes[i];
+    if(r == n || r->state != RNSIM_RX || r->rx_tx >= 0 || !rnsim_same_channel(r, n)) {
+      continue;
+    }
+    r->rx_tx = idx;
+  }
+
+  if(debug) {
+    printf("rnsim: node %d transmits %u bytes for %lu us\n", tx->node,
+           (unsigned int) len, (unsigned long) (tx->end - tx->start));
+  }
+}
+
+static void rnsim_end_tx(int idx) {
+  struct rnsim_tx* tx = &rnsim_txs[idx];
+  struct rnsim_node* n = &rnsim_nodes[tx->node];
+  struct rnsim_node* r;
+  char hex[RNSIM_MAX_PAYLOAD * 2 + 1];
+  size_t i;
+  int j;
+
+  n->state = RNSIM_IDLE;
+  n->tx = -1;
+  rnsim_respond(n, tx->end, "radio_tx_ok");
+
+  for(i=0; i < tx->len; i++) {
+    sprintf(hex + i * 2, "%02X", tx->data[i]);
+  }
+  hex[tx->len * 2] = '\0';
+
+  for(j=0; j < rnsim_node_count; j++) {
+    r = &rnsim_nodes[j];
+    if(r->rx_tx != idx) {
+      continue;
+    }
+    r->state = RNSIM_IDLE;
+    r->rx_tx = -1;
+
+    if(tx->collided) {
+      r->rx_collided++;
+      rnsim_respond(r, tx->end, "radio_err");
+    } else if(rnsim_params.loss > 0 && rnsim_uniform() < rnsim_params.loss) {
+      r->rx_lost++;
+      rnsim_respond(r, tx->end, "radio_err");
+    } else {
+      r->rx_frames++;
+      r->snr = 5 + rnsim_rand() % 6;
+      rnsim_respond(r, tx->end, "radio_rx  %s", hex);
+    }
+  }
+}
+
+static void rnsim_abort_tx(int idx) {
+  int i;
+
+  for(i=0; i < rnsim_node_count; i++) {
+    if(rnsim_nodes[i].rx_tx == idx) {
+      rnsim_nodes[i].rx_tx = -1; // keeps listening
+    }
+  }
+  rnsim_txs[idx].used = 0;
+}
+
+static int rnsim_radio_set(struct rnsim_node* n, const char* param, const char* value) {
+  long v;
+
+  if(!strcmp(param, "sf")) {
+    if(strncmp(value, "sf", 2)) {
+      return -1;
+    }
+    v = atol(value + 2);
+    if(v < 7 || v > 12) {
+      return -1;
+    }
+    n->sf = v;
+  } else if(!strcmp(param, "bw")) {
+    v = atol(value);
+    if(v != 125 && v != 250 && v != 500) {
+      return -1;
+    }
+    n->bw = v;
+  } else if(!strcmp(param, "cr")) {
+    if(strncmp(value, "4/", 2)) {
+      return -1;
+    }
+    v = atol(value + 2);
+    if(v < 5 || v > 8) {
+      return -1;
+    }
+    n->cr = v - 4;
+  } else if(!strcmp(param, "prlen")) {
+    v = atol(value);
+    if(v < 0 || v > 65535) {
+      return -1;
+    }
+    n->prlen = v;
+  } else if(!strcmp(param, "pwr")) {
+    v = atol(value);
+    if(v < 2 || v > 20) {
+      return -1;
+    }
+    n->pwr = v;
+  } else if(!strcmp(param, "freq")) {
+    v = atol(value);
+    if(v < 902000000 || v > 928000000) {
+      return -1;
+    }
+    n->freq = v;
+  } else if(!strcmp(param, "mod") || !strcmp(param, "crc") || !strcmp(param, "iqi")
+            || !strcmp(param, "sync") || !strcmp(param, "wdt") || !strcmp(param, "rxbw")) {
+    // accepted but not modelled
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static void rnsim_radio_get(struct rnsim_node* n, uint64_t t, const char* param) {
+  if(!strcmp(param, "sf")) {
+    rnsim_respond(n, t, "sf%d", n->sf);
+  } else if(!strcmp(param, "bw")) {
+    rnsim_respond(n, t, "%d", n->bw);
+  } else if(!strcmp(param, "cr")) {
+    rnsim_respond(n, t, "4/%d", n->cr + 4);
+  } else if(!strcmp(param, "prlen")) {
+    rnsim_respond(n, t, "%d", n->prlen);
+  } else if(!strcmp(param, "pwr")) {
+    rnsim_respond(n, t, "%d", n->pwr);
+  } else if(!strcmp(param, "freq")) {
+    rnsim_respond(n, t, "%lu", n->freq);
+  } else if(!strcmp(param, "mod")) {
+    rnsim_respond(n, t, "lora");
+  } else if(!strcmp(param, "snr")) {
+    rnsim_respond(n, t, "%d", n->snr);
+  } else {
+    rnsim_respond(n, t, "invalid_param");
+  }
+}
+
+static void rnsim_radio_tx(struct rnsim_node* n, uint64_t t, const char* hex) {
+  uint8_t data[RNSIM_MAX_PAYLOAD];
+  size_t len = strlen(hex);
+  size_t i;
+  int hi, lo;
+
+  if(len == 0 || len % 2 || len / 2 > RNSIM_MAX_PAYLOAD) {
+    rnsim_respond(n, t, "invalid_param");
+    return;
+  }
+  for(i=0; i < len / 2; i++) {
+    hi = rnsim_hex_value(hex[i * 2]);
+    lo = rnsim_hex_value(hex[i * 2 + 1]);
+    if(hi < 0 || lo < 0) {
+      rnsim_respond(n, t, "invalid_param");
+      return;
+    }
+    data[i] = (hi << 4) | lo;
+  }
+  if(n->state != RNSIM_IDLE) {
+    rnsim_respond(n, t, "busy");
+    return;
+  }
+  rnsim_respond(n, t, "ok");
+  rnsim_start_tx(n, t, data, len / 2);
+}
+
+// a receiver that starts listening while a frame's preamble is still
+// on the air can sync to it if enough preamble symbols are left
+static int rnsim_catch_preamble(const struct rnsim_node* n, uint64_t t) {
+  const struct rnsim_tx* tx;
+  const struct rnsim_node* sender;
+  uint64_t sync_end;
+  int i;
+
+  for(i=0; i < RNSIM_MAX_TX; i++) {
+    tx = &rnsim_txs[i];
+    if(!tx->used || tx->end <= t) {
+      continue;
+    }
+    sender = &rnsim_nodes[tx->node];
+    if(sender == n || !rnsim_same_channel(sender, n) || sender->prlen <= RNSIM_SYNC_SYMBOLS) {
+      continue;
+    }
+    sync_end = tx->start + rnsim_scale((sender->prlen - RNSIM_SYNC_SYMBOLS) * rnsim_symbol_us(sender));
+    if(t <= sync_end) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void rnsim_radio_rx(struct rnsim_node* n, uint64_t t, const char* arg) {
+  char* end;
+  long win;
+
+  win = strtol(arg, &end, 10);
+  if(end == arg || *end || win < 0 || win > 65535) {
+    rnsim_respond(n, t, "invalid_param");
+    return;
+  }
+  if(n->state != RNSIM_IDLE) {
+    rnsim_respond(n, t, "busy");
+    return;
+  }
+  rnsim_respond(n, t, "ok");
+  n->state = RNSIM_RX;
+  n->rx_tx = -1;
+  n->rx_deadline = (win && n->fault != RNSIM_FAULT_STUCK_RX) ? t + rnsim_scale(win * rnsim_symbol_us(n)) : 0;
+  n->rx_tx = rnsim_catch_preamble(n, t);
+}
+
+// carry out a command that has fully arrived at time t
+static void rnsim_command(struct rnsim_node* n, uint64_t t, char* cmd) {
+  char* words[4];
+  int count = 0;
+  char* save;
+  char* w;
+
+  if(debug) {
+    printf("rnsim: node %d got: %s\n", (int)(n - rnsim_nodes), cmd);
+  }
+
+  for(w = strtok_r(cmd, " ", &save); w && count < 4; w = strtok_r(NULL, " ", &save)) {
+    words[count++] = w;
+  }
+  if(w) {
+    count++; // too many words
+  }
+
+  if(n->fault == RNSIM_FAULT_DEAD) {
+    return;
+  }
+  if(count == 2 && !strcmp(words[0], "sys") && !strcmp(words[1], "reset")) {
+    if(n->tx >= 0) {
+      rnsim_abort_tx(n->tx); // cut off mid air
+    }
+    rnsim_reset_node(n);
+    rnsim_respond(n, t, RNSIM_VERSION);
+  } else if(n->fault == RNSIM_FAULT_MUTE) {
+    return;
+  } else if(count == 3 && !strcmp(words[0], "sys") && !strcmp(words[1], "get") && !strcmp(words[2], "ver")) {
+    rnsim_respond(n, t, RNSIM_VERSION);
+  } else if(count == 2 && !strcmp(words[0], "mac") && !strcmp(words[1], "pause")) {
+    rnsim_respond(n, t, "4294967245");
+  } else if(count == 2 && !strcmp(words[0], "mac") && !strcmp(words[1], "resume")) {
+    rnsim_respond(n, t, "ok");
+  } else if(count == 4 && !strcmp(words[0], "radio") && !strcmp(words[1], "set")) {
+    rnsim_respond(n, t, rnsim_radio_set(n, words[2], words[3]) < 0 ? "invalid_param" : "ok");
+  } else if(count == 3 && !strcmp(words[0], "radio") && !strcmp(words[1], "get")) {
+    rnsim_radio_get(n, t, words[2]);
+  } else if(count == 3 && !strcmp(words[0], "radio") && !strcmp(words[1], "tx")) {
+    rnsim_radio_tx(n, t, words[2]);
+  } else if(count == 3 && !strcmp(words[0], "radio") && !strcmp(words[1], "rx")) {
+    rnsim_radio_rx(n, t, words[2]);
+  } else if(count == 2 && !strcmp(words[0], "radio") && !strcmp(words[1], "rxstop")) {
+    if(n->state == RNSIM_RX) {
+      n->state = RNSIM_IDLE;
+      n->rx_tx = -1;
+    }
+    if(n->fault == RNSIM_FAULT_STUCK_RX) {
+      n->fault = RNSIM_FAULT_NONE;
+    }
+    rnsim_respond(n, t, "ok");
+  } else {
+    rnsim_respond(n, t, "invalid_param");
+  }
+}
+
+// read what the host sent to a node.
+// returns -1 if the host closed the serial line
+int rnsim_read(int node, uint64_t now) {
+  struct rnsim_node* n = &rnsim_nodes[node];
+  ssize_t ret;
+  char* eol;
+  size_t len;
+
+  ret = read(n->fd, n->in + n->in_len, RNSIM_MAX_LINE - n->in_len);
+  if(ret < 0) {
+    if(errno == EAGAIN || errno == EINTR || errno == EIO) {
+      return 0; // EIO: nobody has the PTY open
+    }
+    return -1;
+  }
+  if(ret == 0) {
+    return -1;
+  }
+  n->in_len += ret;
+  n->in[n->in_len] = '\0';
+
+  while((eol = strchr(n->in, '\n'))) {
+    len = eol - n->in;
+    if(len && n->in[len - 1] == '\r') {
+      len--;
+    }
+
+    if(n->cmd_pending) {
+      fprintf(stderr, "rnsim: node %d got a command before answering the last one\n", node);
+    } else {
+      memcpy(n->cmd, n->in, len);
+      n->cmd[len] = '\0';
+      n->cmd_len = len;
+      // the command is carried out once its last byte is in
+      n->cmd_due = now + rnsim_serial_us(eol - n->in + 1);
+      n->cmd_pending = 1;
+    }
+
+    n->in_len -= eol - n->in + 1;
+    memmove(n->in, eol + 1, n->in_len);
+    n->in[n->in_len] = '\0';
+  }
+
+  if(n->in_len >= RNSIM_MAX_LINE) {
+    fprintf(stderr, "rnsim: node %d line too long\n", node);
+    n->in_len = 0;
+  }
+  return 0;
+}
+
+// earliest command, transmission end or rx timeout.
+// returns UINT64_MAX if there is none and sets *what and *node
+static uint64_t rnsim_next_internal(int* what, int* which) {
+  uint64_t next = UINT64_MAX;
+  struct rnsim_node* n;
+  int i;
+
+  for(i=0; i < rnsim_node_count; i++) {
+    n = &rnsim_nodes[i];
+    if(n->cmd_pending && n->cmd_due < next) {
+      next = n->cmd_due;
+      *what = 0;
+      *which = i;
+    }
+    if(n->state == RNSIM_RX && n->rx_tx < 0 && n->rx_deadline && n->rx_deadline < next) {
+      next = n->rx_deadline;
+      *what = 1;
+      *which = i;
+    }
+    if(n->state == RNSIM_TX && rnsim_txs[n->tx].end < next) {
+      next = rnsim_txs[n->tx].end;
+      *what = 2;
+      *which = n->tx;
+    }
+  }
+  return next;
+}
+
+static int rnsim_flush(struct rnsim_node* n, uint64_t now) {
+  struct rnsim_line* l;
+  ssize_t ret;
+
+  while(n->out_count && n->out[0].due <= now) {
+    l = &n->out[0];
+    ret = write(n->fd, l->buf, l->len);
+    if(ret < 0) {
+      if(errno == EAGAIN || errno == EINTR) {
+        return 0;
+      }
+      return -1;
+    }
+    if((size_t) ret < l->len) {
+      l->len -= ret;
+      memmove(l->buf, l->buf + ret, l->len);
+      return 0;
+    }
+    n->out_count--;
+    memmove(&n->out[0], &n->out[1], n->out_count * sizeof(struct rnsim_line));
+  }
+  return 0;
+}
+
+// advance the simulation to now and write any responses that are due
+int rnsim_run(uint64_t now) {
+  struct rnsim_node* n;
+  uint64_t t;
+  int what = 0;
+  int which = 0;
+  int i;
+
+  while((t = rnsim_next_internal(&what, &which)) <= now) {
+    switch(what) {
+    case 0:
+      n = &rnsim_nodes[which];
+      n->cmd_pending = 0;
+      rnsim_command(n, t, n->cmd);
+      break;
+    case 1:
+      n = &rnsim_nodes[which];
+      n->state = RNSIM_IDLE;
+      rnsim_respond(n, t, "radio_err");
+      break;
+    case 2:
+      rnsim_end_tx(which);
+      break;
+    }
+  }
+
+  for(i=0; i < rnsim_node_count; i++) {
+    if(rnsim_flush(&rnsim_nodes[i], now) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// when rnsim_run() next has something to do
+uint64_t rnsim_next_event(uint64_t now) {
+  uint64_t next;
+  int what, which;
+  int i;
+
+  next = rnsim_next_internal(&what, &which);
+  for(i=0; i < rnsim_node_count; i++) {
+    if(rnsim_nodes[i].out_count && rnsim_nodes[i].out[0].due < next) {
+      next = rnsim_nodes[i].out[0].due;
+    }
+  }
+  return (next < now) ? now : next;
+}
+
+int rnsim_fd_set(fd_set* readfds, int maxfd) {
+  int i;
+
+  for(i=0; i < rnsim_node_count; i++) {
+    FD_SET(rnsim_nodes[i].fd, readfds);
+    if(rnsim_nodes[i].fd > maxfd) {
+      maxfd = rnsim_nodes[i].fd;
+    }
+  }
+  return maxfd;
+}
+
+int rnsim_handle_fds(fd_set* readfds, uint64_t now) {
+  int i;
+
+  for(i=0; i < rnsim_node_count; i++) {
+    if(FD_ISSET(rnsim_nodes[i].fd, readfds) && rnsim_read(i, now) < 0) {
+      return -1;
+    }
+  }
+  return rnsim_run(now);
+}
+
+// the supply dips: the module prints some noise, restarts with its
+// factory settings and says hello like after "sys reset"
+void rnsim_brownout(int node, uint64_t now) {
+  struct rnsim_node* n = &rnsim_nodes[node];
+
+  if(n->tx >= 0) {
+    rnsim_abort_tx(n->tx);
+  }
+  rnsim_reset_node(n);
+  rnsim_respond(n, now, "\xfe\x80" RNSIM_VERSION);
+}
+
+// the reset pin was pulled, whatever state the module was in
+void rnsim_power_cycle(int node, uint64_t now) {
+  struct rnsim_node* n = &rnsim_nodes[node];
+
+  if(n->tx >= 0) {
+    rnsim_abort_tx(n->tx);
+  }
+  rnsim_reset_node(n);
+  rnsim_respond(n, now, RNSIM_VERSION);
+}
+
+// open a PTY for a node. returns the master fd and keeps the slave
+// open so the master doesn't see EIO while nobody else has it open
+int rnsim_open_pty(char* name, size_t size, int* slave) {
+  struct termios settings;
+  int fd;
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(fd < 0) {
+    return -1;
+  }
+  if(grantpt(fd) < 0 || unlockpt(fd) < 0 || !ptsname(fd)) {
+    close(fd);
+    return -1;
+  }
+  strncpy(name, ptsname(fd), size - 1);
+  name[size - 1] = '\0';
+
+  *slave = open(name, O_RDWR | O_NOCTTY);
+  if(*slave < 0) {
+    close(fd);
+    return -1;
+  }
+
+  // the same settings lora_iface uses, in case it starts talking
+  // before it has set them itself
+  if(tcgetattr(*slave, &settings) == 0) {
+    cfmakeraw(&settings);
+    settings.c_lflag = ICANON;
+    tcsetattr(*slave, TCSANOW, &settings);
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
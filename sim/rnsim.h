@@ -0,0 +1,110 @@
+#ifndef RNSIM_H
+#define RNSIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#define RNSIM_MAX_NODES (16)
+#define RNSIM_MAX_LINE (600)     // "radio tx " + 255 bytes of hex
+#define RNSIM_MAX_OUT (8)        // response lines waiting for the serial line
+#define RNSIM_MAX_TX (32)        // transmissions remembered for collisions
+#define RNSIM_MAX_PAYLOAD (255)
+#define RNSIM_SYNC_SYMBOLS (4)   // preamble symbols a receiver needs to sync
+
+#define RNSIM_VERSION "RN2903 1.0.3 Aug  8 2017 15:11:09"
+
+enum rnsim_state {
+  RNSIM_IDLE,
+  RNSIM_RX,
+  RNSIM_TX
+};
+
+// ways a module wedges, to test how the host recovers
+enum rnsim_fault {
+  RNSIM_FAULT_NONE,
+  RNSIM_FAULT_STUCK_RX, // rx windows don't close until "radio rxstop"
+  RNSIM_FAULT_MUTE,     // only "sys reset" is answered
+  RNSIM_FAULT_DEAD      // nothing is answered until rnsim_power_cycle()
+};
+
+// physical layer parameters shared by all nodes
+struct rnsim_params {
+  unsigned int baud;   // serial speed between host and module
+  double loss;         // probability that a frame is lost at a receiver
+  double speedup;      // divide all durations by this
+  int capture;         // a frame survives a collision if it started first
+};
+
+struct rnsim_line {
+  uint64_t due;        // when the last byte has crossed the serial line
+  size_t len;
+  char buf[RNSIM_MAX_LINE + 2];
+};
+
+struct rnsim_node {
+  int fd;              // module side of the serial line
+
+  // radio settings changed with "radio set"
+  int sf;              // spreading factor 7-12
+  int bw;              // kHz
+  int cr;              // coding rate 4/5 to 4/8 as 1-4
+  int prlen;           // preamble symbols
+  int pwr;
+  unsigned long freq;
+  int snr;              // of the last received frame, -128 if none
+
+  enum rnsim_state state;
+  enum rnsim_fault fault;
+  uint64_t rx_deadline; // 0 for continuous reception
+  int rx_tx;            // transmission being received or -1
+  int tx;               // our transmission or -1
+
+  // command waiting for its last byte to arrive
+  char cmd[RNSIM_MAX_LINE + 1];
+  size_t cmd_len;
+  uint64_t cmd_due;
+  int cmd_pending;
+
+  char in[RNSIM_MAX_LINE + 1];
+  size_t in_len;
+
+  struct rnsim_line out[RNSIM_MAX_OUT];
+  int out_count;
+  uint64_t serial_free; // when the serial line to the host is free again
+
+  unsigned long tx_frames;
+  unsigned long rx_frames;
+  unsigned long rx_lost;
+  unsigned long rx_collided;
+  uint64_t airtime_us;
+};
+
+struct rnsim_tx {
+  int used;
+  int node;
+  uint64_t start;
+  uint64_t end;
+  int collided;
+  size_t len;
+  uint8_t data[RNSIM_MAX_PAYLOAD];
+};
+
+extern struct rnsim_node rnsim_nodes[RNSIM_MAX_NODES];
+extern int rnsim_node_count;
+
+void rnsim_init(const struct rnsim_params* params, unsigned int seed);
+int rnsim_add_node(int fd);
+uint64_t rnsim_airtime_us(const struct rnsim_node* n, size_t len);
+uint64_t rnsim_symbol_us(const struct rnsim_node* n);
+int rnsim_read(int node, uint64_t now);
+int rnsim_run(uint64_t now);
+uint64_t rnsim_next_event(uint64_t now);
+int rnsim_fd_set(fd_set* readfds, int maxfd);
+int rnsim_handle_fds(fd_set* readfds, uint64_t now);
+void rnsim_brownout(int node, uint64_t now);
+void rnsim_power_cycle(int node, uint64_t now);
+int rnsim_open_pty(char* name, size_t size, int* slave);
+
+#endif
@@ -0,0 +1,556 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+#include "link.h"
+#include "arq.h"
+
+// Store-and-forward spool (see spool.h for the classes).
+//
+// The file is SPOOL_SEGMENTS segments, mapped once. A segment is a
+// header with a sequence number followed by records appended one after
+// the other, each a small header and the packet:
+//
+//   state | prio | dst | 0 | len (2) | 0 (2) | check (4) | packet | padding to 8
+//
+// A record is written queued and marked sent in place once the link
+// layer has taken the packet, nothing else is ever changed. A segment
+// is reused once none of its records are queued any more. Packets are appended to the newest segment and
+// there are no writes to disk of our own: the kernel writes the pages
+// back and they are synced at most every SPOOL_SYNC_US.
+//
+// At startup the segments are read in sequence order to rebuild the
+// index: a list of queued records for every priority and destination
+// node. The highest priority goes first, its destinations take turns
+// so one that is out of reach doesn't hold up the others.
+
+extern int debug;
+
+#define SPOOL_QUEUED (0x51)
+#define SPOOL_SENT (0x53)
+
+#define SPOOL_SEG_HDR_LEN (16)
+#define SPOOL_REC_HDR_LEN (12)
+#define SPOOL_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+struct spool_class_rule {
+  int prio;
+  struct filter_rule rule;
+};
+
+struct spool_ref {
+  uint32_t off; // of the record in the file
+  int32_t next;
+};
+
+struct spool_list {
+  int32_t head;
+  int32_t tail;
+};
+
+struct spool_stats spool_stats;
+
+static uint8_t* spool_map = NULL;
+
+static struct spool_class_rule spool_classes[SPOOL_MAX_CLASSES];
+static int spool_nclasses = 0;
+
+static struct spool_ref spool_refs[SPOOL_MAX_RECORDS];
+static int32_t spool_free_refs = -1;
+static struct spool_list spool_lists[SPOOL_PRIORITIES][LINK_BROADCAST + 1];
+static unsigned long spool_queued[SPOOL_PRIORITIES];
+static uint8_t spool_turn[SPOOL_PRIORITIES]; // destination served last
+
+static uint32_t spool_live[SPOOL_SEGMENTS]; // queued records
+static uint32_t spool_seq[SPOOL_SEGMENTS];  // 0 if unused
+static uint32_t spool_max_seq = 0;
+static int spool_cur = 0;
+static size_t spool_off = 0;                // of the next record in spool_cur
+
+static size_t spool_dirty_lo = SPOOL_FILE_SIZE;
+static size_t spool_dirty_hi = 0;
+static uint64_t spool_synced_us = 0;
+static uint64_t spool_ready_us = 0;
+static int spool_link_up = 1;
+
+static uint16_t spool_get16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t spool_get32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void spool_put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void spool_put32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+// FNV-1a, catches records cut short by a crash
+static uint32_t spool_check(const uint8_t* data, size_t len) {
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  for(i=0; i < len; i++) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void spool_dirty(size_t off, size_t len) {
+  if(off < spool_dirty_lo) {
+    spool_dirty_lo = off;
+  }
+  if(off + len > spool_dirty_hi) {
+    spool_dirty_hi = off + len;
+  }
+}
+
+static void spool_index_add(int prio, uint8_t dst, uint32_t off) {
+  struct spool_list* l = &spool_lists[prio][dst];
+  int32_t ref = spool_free_refs;
+
+  spool_free_refs = spool_refs[ref].next;
+  spool_refs[ref].off = off;
+  spool_refs[ref].next = -1;
+  if(l->tail >= 0) {
+    spool_refs[l->tail].next = ref;
+  } else {
+    l->head = ref;
+  }
+  l->tail = ref;
+  spool_queued[prio]++;
+  spool_live[off / SPOOL_SEGMENT_SIZE]++;
+  spool_stats.depth++;
+}
+
+static void spool_index_init() {
+  int i, j;
+
+  for(i=0; i < SPOOL_MAX_RECORDS; i++) {
+    spool_refs[i].next = (i + 1 < SPOOL_MAX_RECORDS) ? i + 1 : -1;
+  }
+  spool_free_refs = 0;
+  for(i=0; i < SPOOL_PRIORITIES; i++) {
+    for(j=0; j <= LINK_BROADCAST; j++) {
+      spool_lists[i][j].head = spool_lists[i][j].tail = -1;
+    }
+    spool_queued[i] = 0;
+  }
+  memset(spool_live, 0, sizeof(spool_live));
+  spool_stats.depth = 0;
+}
+
+static void spool_start_segment(int seg) {
+  uint8_t* p = spool_map + (size_t) seg * SPOOL_SEGMENT_SIZE;
+
+  memset(p, 0, SPOOL_SEG_HDR_LEN + SPOOL_REC_HDR_LEN);
+  spool_put32(p, SPOOL_MAGIC);
+  spool_put16(p + 4, SPOOL_VERSION);
+  spool_put32(p + 8, ++spool_max_seq);
+  spool_dirty((size_t) seg * SPOOL_SEGMENT_SIZE, SPOOL_SEG_HDR_LEN + SPOOL_REC_HDR_LEN);
+
+  spool_seq[seg] = spool_max_seq;
+  spool_cur = seg;
+  spool_off = SPOOL_SEG_HDR_LEN;
+}
+
+// index the queued records of a segment, returns where the next one goes
+static size_t spool_scan(int seg) {
+  const uint8_t* base = spool_map + (size_t) seg * SPOOL_SEGMENT_SIZE;
+  const uint8_t* r;
+  size_t off = SPOOL_SEG_HDR_LEN;
+  size_t len;
+
+  while(off + SPOOL_REC_HDR_LEN <= SPOOL_SEGMENT_SIZE) {
+    r = base + off;
+    len = spool_get16(r + 4);
+    if((r[0] != SPOOL_QUEUED && r[0] != SPOOL_SENT) || r[1] >= SPOOL_PRIORITIES
+       || len == 0 || off + SPOOL_REC_HDR_LEN + len > SPOOL_SEGMENT_SIZE) {
+      break;
+    }
+    if(r[0] == SPOOL_QUEUED) {
+      if(spool_get32(r + 8) != spool_check(r + SPOOL_REC_HDR_LEN, len)) {
+        break;
+      }
+      if(spool_free_refs < 0) {
+        break;
+      }
+      spool_index_add(r[1], r[2], seg * SPOOL_SEGMENT_SIZE + off);
+      spool_stats.recovered++;
+    }
+    off += SPOOL_ALIGN(SPOOL_REC_HDR_LEN + len);
+  }
+  return off;
+}
+
+// rebuild the index from the segments, oldest first
+static void spool_recover() {
+  const uint8_t* p;
+  int order[SPOOL_SEGMENTS];
+  int n = 0;
+  int i, j;
+  size_t end = 0;
+
+  spool_index_init();
+  spool_max_seq = 0;
+  for(i=0; i < SPOOL_SEGMENTS; i++) {
+    p = spool_map + (size_t) i * SPOOL_SEGMENT_SIZE;
+    spool_seq[i] = 0;
+    if(spool_get32(p) != SPOOL_MAGIC || spool_get16(p + 4) != SPOOL_VERSION || !spool_get32(p + 8)) {
+      continue;
+    }
+    spool_seq[i] = spool_get32(p + 8);
+    for(j=n; j > 0 && spool_seq[order[j-1]] > spool_seq[i]; j--) {
+      order[j] = order[j-1];
+    }
+    order[j] = i;
+    n++;
+  }
+
+  for(i=0; i < n; i++) {
+    end = spool_scan(order[i]);
+  }
+  if(n) {
+    spool_cur = order[n-1];
+    spool_off = end;
+    spool_max_seq = spool_seq[spool_cur];
+  } else {
+    spool_start_segment(0);
+  }
+}
+
+// map the spool file at path, creating it if needed, and pick up the
+// packets still queued in it. returns 0 or -1
+int spool_open(const char* path) {
+  struct stat st;
+  uint8_t* map;
+  int ret;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if(fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Failed to open spool %s: %s\n", path, strerror(errno));
+    if(fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  if(st.st_size != 0 && st.st_size != SPOOL_FILE_SIZE) {
+    fprintf(stderr, "%s isn't a spool file\n", path);
+    close(fd);
+    return -1;
+  }
+  // allocate it all now rather than getting SIGBUS when the disk is
+  // full. only a file system that can't allocate ahead gets a sparse file
+  if(st.st_size == 0) {
+    ret = posix_fallocate(fd, 0, SPOOL_FILE_SIZE);
+    if(ret == EOPNOTSUPP || ret == EINVAL) {
+      ret = (ftruncate(fd, SPOOL_FILE_SIZE) < 0) ? errno : 0;
+    }
+    if(ret != 0) {
+      fprintf(stderr, "Failed to create spool %s: %s\n", path, strerror(ret));
+      // so the next start tries again instead of calling it foreign
+      if(ftruncate(fd, 0) < 0) {
+        fprintf(stderr, "Failed to truncate spool %s: %s\n", path, strerror(errno));
+      }
+      close(fd);
+      return -1;
+    }
+  }
+  map = (uint8_t*) mmap(NULL, SPOOL_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    fprintf(stderr, "Failed to map spool %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if(spool_map) {
+    munmap(spool_map, SPOOL_FILE_SIZE);
+  }
+  spool_map = map;
+  memset(&spool_stats, 0, sizeof(spool_stats));
+  spool_dirty_lo = SPOOL_FILE_SIZE;
+  spool_dirty_hi = 0;
+  spool_recover();
+  if(debug) {
+    printf("Spool %s has %lu packets queued\n", path, spool_stats.recovered);
+  }
+  return 0;
+}
+
+// one class per line: priority and rule, '#' starts a comment.
+// returns 0 or -1 if a class is invalid
+int spool_load_classes(const char* path) {
+  char buf[SPOOL_MAX_CLASSES * FILTER_RULE_TEXT];
+  struct spool_class_rule* c;
+  char* save;
+  char* line;
+  char* end;
+  ssize_t len;
+  long prio;
+  int lineno = 0;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open spool classes %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(len < 0) {
+    fprintf(stderr, "Failed to read spool classes %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  buf[len] = '\0';
+
+  spool_nclasses = 0;
+  for(line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+    lineno++;
+    line[strcspn(line, "#\r")] = '\0';
+    line += strspn(line, " \t");
+    if(!*line) {
+      continue;
+    }
+    prio = strtol(line, &end, 10);
+    if(end == line || prio < 0 || prio >= SPOOL_PRIORITIES || spool_nclasses == SPOOL_MAX_CLASSES) {
+      fprintf(stderr, "Spool class %d needs a priority from 0 to %d first, at most %d classes\n",
+              lineno, SPOOL_PRIORITIES - 1, SPOOL_MAX_CLASSES);
+      return -1;
+    }
+    c = &spool_classes[spool_nclasses];
+    if(filter_parse_match(end, &c->rule) < 0) {
+      fprintf(stderr, "Spool class %d is invalid\n", lineno);
+      return -1;
+    }
+    c->prio = prio;
+    spool_nclasses++;
+  }
+  return 0;
+}
+
+int spool_enabled() {
+  return spool_map != NULL && spool_nclasses > 0;
+}
+
+// the priority of the first class the packet is in, or -1
+int spool_class(const uint8_t* pkt, size_t len) {
+  int i;
+
+  if(!spool_enabled()) {
+    return -1;
+  }
+  for(i=0; i < spool_nclasses; i++) {
+    if(filter_match(&spool_classes[i].rule, pkt, len)) {
+      return spool_classes[i].prio;
+    }
+  }
+  return -1;
+}
+
+// append a packet for dst (the link layer node). returns 0 or -1 if
+// there is no room
+int spool_push(const uint8_t* pkt, size_t len, int prio, uint8_t dst) {
+  size_t need = SPOOL_ALIGN(SPOOL_REC_HDR_LEN + len);
+  size_t off;
+  uint8_t* r;
+  int seg;
+
+  if(len == 0 || len > 0xffff || need > SPOOL_SEGMENT_SIZE - SPOOL_SEG_HDR_LEN || spool_free_refs < 0) {
+    spool_stats.full++;
+    return -1;
+  }
+
+  if(spool_off + need > SPOOL_SEGMENT_SIZE) {
+    for(seg=0; seg < SPOOL_SEGMENTS; seg++) {
+      if(seg != spool_cur && !spool_live[seg]) {
+        break;
+      }
+    }
+    if(seg == SPOOL_SEGMENTS) {
+      spool_stats.full++;
+      return -1;
+    }
+    spool_start_segment(seg);
+  }
+
+  off = (size_t) spool_cur * SPOOL_SEGMENT_SIZE + spool_off;
+  r = spool_map + off;
+  memcpy(r + SPOOL_REC_HDR_LEN, pkt, len);
+  r[1] = prio;
+  r[2] = dst;
+  r[3] = 0;
+  spool_put16(r + 4, len);
+  spool_put16(r + 6, 0);
+  spool_put32(r + 8, spool_check(pkt, len));
+  r[0] = SPOOL_QUEUED;
+
+  // whatever a reused segment had after this record is history
+  spool_off += need;
+  if(spool_off + SPOOL_REC_HDR_LEN <= SPOOL_SEGMENT_SIZE) {
+    memset(r + need, 0, SPOOL_REC_HDR_LEN);
+    spool_dirty(off, need + SPOOL_REC_HDR_LEN);
+  } else {
+    spool_dirty(off, need);
+  }
+
+  spool_index_add(prio, dst, off);
+  spool_stats.spooled++;
+  return 0;
+}
+
+// the list the next packet to send comes from: the highest priority,
+// destinations in turn. returns the priority or -1 if the spool is empty
+static int spool_next(uint8_t* dst) {
+  int prio;
+  int i;
+
+  for(prio=0; prio < SPOOL_PRIORITIES && !spool_queued[prio]; prio++);
+  if(prio == SPOOL_PRIORITIES) {
+    return -1;
+  }
+
+  *dst = spool_turn[prio];
+  for(i=0; i <= LINK_BROADCAST; i++) {
+    (*dst)++;
+    if(spool_lists[prio][*dst].head >= 0) {
+      break;
+    }
+  }
+  return prio;
+}
+
+// copy the next packet to send to buf, it stays queued until
+// spool_pop. returns its length, 0 if the spool is empty or -1 if it
+// doesn't fit
+ssize_t spool_peek(uint8_t* buf, size_t size) {
+  const uint8_t* r;
+  size_t len;
+  uint8_t dst;
+  int prio;
+
+  prio = spool_next(&dst);
+  if(prio < 0) {
+    return 0;
+  }
+  r = spool_map + spool_refs[spool_lists[prio][dst].head].off;
+  len = spool_get16(r + 4);
+  if(len > size) {
+    return -1;
+  }
+  memcpy(buf, r + SPOOL_REC_HDR_LEN, len);
+  return len;
+}
+
+// mark the packet spool_peek returned as sent, once the link layer has
+// taken it
+void spool_pop() {
+  struct spool_list* l;
+  uint8_t* r;
+  int32_t ref;
+  uint8_t dst;
+  int prio;
+
+  prio = spool_next(&dst);
+  if(prio < 0) {
+    return;
+  }
+  spool_turn[prio] = dst;
+
+  l = &spool_lists[prio][dst];
+  ref = l->head;
+  l->head = spool_refs[ref].next;
+  if(l->head < 0) {
+    l->tail = -1;
+  }
+  spool_refs[ref].next = spool_free_refs;
+  spool_free_refs = ref;
+  spool_queued[prio]--;
+  spool_live[spool_refs[ref].off / SPOOL_SEGMENT_SIZE]--;
+  spool_stats.depth--;
+
+  r = spool_map + spool_refs[ref].off;
+  r[0] = SPOOL_SENT;
+  spool_dirty(spool_refs[ref].off, 1);
+  spool_stats.sent++;
+}
+
+// how long the link layer can be busy with packets at the airtime
+// measured for frames
+static uint64_t spool_stall_us() {
+  uint64_t stall = SPOOL_STALL_FRAMES * arq_airtime_us(LINK_MAX_FRAME);
+
+  return (stall > SPOOL_STALL_US) ? stall : SPOOL_STALL_US;
+}
+
+// tell whether the link layer can take a packet now
+void spool_link_ready(int ready, uint64_t now) {
+  if(ready || !spool_ready_us) {
+    spool_ready_us = now;
+  }
+  spool_link_up = ready;
+}
+
+// should packets be read from the TUN interface whether the link
+// layer takes them or not? true while the link is down and there is room
+int spool_absorbing(uint64_t now) {
+  return spool_enabled() && spool_free_refs >= 0 && now - spool_ready_us >= spool_stall_us();
+}
+
+// how long until the next sync or the link counts as down.
+// returns 0 if there's nothing to wait for
+int spool_timeout(uint64_t now, struct timeval* tv) {
+  uint64_t stall = spool_stall_us();
+  uint64_t when = (uint64_t) -1;
+
+  if(!spool_enabled()) {
+    return 0;
+  }
+  if(spool_dirty_hi) {
+    when = spool_synced_us + SPOOL_SYNC_US;
+  }
+  if(!spool_link_up && spool_ready_us + stall > now && spool_ready_us + stall < when) {
+    when = spool_ready_us + stall;
+  }
+  if(when == (uint64_t) -1) {
+    return 0;
+  }
+  when = (when > now) ? when - now : 0;
+  tv->tv_sec = when / 1000000;
+  tv->tv_usec = when % 1000000;
+  return 1;
+}
+
+// get the pages written since the last sync to disk, at most once
+// every SPOOL_SYNC_US
+void spool_flush(uint64_t now) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t lo;
+
+  if(!spool_map || !spool_dirty_hi || now - spool_synced_us < SPOOL_SYNC_US) {
+    return;
+  }
+  lo = spool_dirty_lo & ~(page - 1);
+  if(msync(spool_map + lo, spool_dirty_hi - lo, MS_SYNC) < 0) {
+    perror("Failed to sync the spool");
+  }
+  spool_dirty_lo = SPOOL_FILE_SIZE;
+  spool_dirty_hi = 0;
+  spool_synced_us = now;
+  spool_stats.syncs++;
+}
@@ -0,0 +1,67 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "filter.h"
+#include "frag.h"
+
+// Store-and-forward spool for packets worth keeping while the link is
+// down, in a file that outlives lora_iface. Classes are rules as in
+// filter.h with a priority instead of the action, 0 goes first:
+//
+//   0 udp dport 5683   # CoAP telemetry
+//   1 udp port 1883
+//
+// Packets matching no class take the usual path.
+
+#define SPOOL_SEGMENTS (16)
+#define SPOOL_SEGMENT_SIZE (256 * 1024)
+#define SPOOL_FILE_SIZE (SPOOL_SEGMENTS * SPOOL_SEGMENT_SIZE)
+#define SPOOL_MAX_RECORDS (32768)
+
+#define SPOOL_PRIORITIES (4)
+#define SPOOL_MAX_CLASSES (16)
+
+// how often spooled packets are synced to disk at most
+#define SPOOL_SYNC_US (1000000)
+// the link counts as down once it hasn't taken a packet for this long,
+// or for the airtime of this many full frames if that is longer: all
+// the fragments of the largest packet and as many again for
+// retransmissions, so a slow link that is busy isn't taken for down
+#define SPOOL_STALL_US (2000000)
+#define SPOOL_STALL_FRAMES (2 * FRAG_MAX_FRAGMENTS)
+
+#define SPOOL_MAGIC (0x4c525351) // "LRSQ"
+#define SPOOL_VERSION (1)
+
+struct spool_stats {
+  unsigned long spooled;
+  unsigned long sent;      // handed to the link layer
+  unsigned long recovered; // found in the file at startup
+  unsigned long full;      // not spooled, no room
+  unsigned long held;      // in no class and read while the link was down
+  unsigned long syncs;
+  unsigned long depth;     // packets in the spool
+};
+
+extern struct spool_stats spool_stats;
+
+int spool_open(const char* path);
+int spool_load_classes(const char* path);
+int spool_enabled();
+
+int spool_class(const uint8_t* pkt, size_t len);
+int spool_push(const uint8_t* pkt, size_t len, int prio, uint8_t dst);
+ssize_t spool_peek(uint8_t* buf, size_t size);
+void spool_pop();
+
+void spool_link_ready(int ready, uint64_t now);
+int spool_absorbing(uint64_t now);
+int spool_timeout(uint64_t now, struct timeval* tv);
+void spool_flush(uint64_t now);
+
+#endif
@@ -0,0 +1,701 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "tcp_stage.h"
+#include "link.h"
+#include "addrmap.h"
+
+// TCP specific handling of packets read from the TUN interface.
+//
+// ACK thinning: a few packets are held here while the link is busy.
+// A pure cumulative ACK that is superseded by a newer one for the same
+// flow is dropped. Duplicate ACKs (same ack and window) and ACKs with
+// SACK blocks are never dropped so fast retransmit and SACK recovery
+// work as before.
+//
+// Header compression: IPv4 TCP headers are sent in full once per flow
+// and after that as deltas against that full header, in the spirit of
+// Van Jacobson (RFC 1144). Unlike VJ the deltas are not chained from
+// packet to packet, so losing a compressed packet only loses itself.
+// Losing a full header loses the packets after it until the next one,
+// so like VJ a retransmission or duplicate ACK (nothing advanced) goes
+// with a full header, and so does the first packet after a SYN, FIN or
+// RST, which go as they are. The full header is also resent when the
+// deltas grow too big, when something that can't be expressed as a
+// delta changes and every TCP_HC_REFRESH packets.
+// A 2 bit generation number tells the receiver which full header the
+// deltas are against. The TCP checksum is carried as is so the end
+// host still verifies the rebuilt packet.
+// A full header sent to the node that owns the destination address
+// (see addrmap.c) leaves it out. It is one of the receiver's own
+// addresses, and a check byte tells it which one. Addresses the node
+// only routes for are sent in full.
+
+#define TCP_FIN (0x01)
+#define TCP_SYN (0x02)
+#define TCP_RST (0x04)
+#define TCP_PSH (0x08)
+#define TCP_ACK (0x10)
+#define TCP_URG (0x20)
+
+#define TCP_OPT_END (0)
+#define TCP_OPT_NOP (1)
+#define TCP_OPT_SACK (5)
+
+#define TCP_HC_MAX_SEQ_DELTA (1 << 21) // 3 varint bytes
+#define TCP_HC_MAX_ID_DELTA (1 << 14)  // 2 varint bytes
+
+extern int debug;
+
+struct tcp_stage_stats tcp_stage_stats;
+
+struct tcp_pkt {
+  size_t ip_hlen;
+  size_t tcp_hlen;
+  size_t hdr_len;
+  uint8_t flags;
+  uint32_t seq;
+  uint32_t ack;
+  uint16_t win;
+  uint16_t id;
+  int sack;
+};
+
+struct tcp_stage_entry {
+  size_t len; // 0 if dropped
+  uint64_t read_us; // when it was read from the TUN interface
+  uint8_t data[TCP_STAGE_MAX_PACKET];
+};
+
+static int tcp_stage_on = 0;
+
+static struct tcp_stage_entry tcp_stage_queue[TCP_STAGE_DEPTH];
+static int tcp_stage_head = 0;
+static int tcp_stage_count = 0;
+
+static struct tcp_hc_flow tcp_hc_flows[TCP_HC_MAX_FLOWS];
+static struct tcp_hc_context tcp_hc_contexts[TCP_HC_MAX_CONTEXTS];
+static uint64_t tcp_hc_clock = 0;
+
+static uint8_t tcp_hc_out[TCP_STAGE_MAX_PACKET];
+
+static uint16_t tcp_get16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t tcp_get32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void tcp_put16(uint8_t* p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void tcp_put32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// parse the headers of an unfragmented IPv4 TCP packet.
+// len may cover just the headers.
+// returns 0 on success, -1 for anything else
+static int tcp_parse_hdr(const uint8_t* pkt, size_t len, struct tcp_pkt* t) {
+  const uint8_t* tcp;
+  const uint8_t* opt;
+  size_t i;
+
+  if(len < 40 || (pkt[0] >> 4) != 4 || pkt[9] != 6) {
+    return -1;
+  }
+  if(tcp_get16(pkt + 6) & 0x3fff) {
+    return -1; // a fragment
+  }
+
+  t->ip_hlen = (pkt[0] & 0x0f) * 4;
+  if(t->ip_hlen < 20 || t->ip_hlen + 20 > len) {
+    return -1;
+  }
+  tcp = pkt + t->ip_hlen;
+  t->tcp_hlen = (tcp[12] >> 4) * 4;
+  if(t->tcp_hlen < 20 || t->ip_hlen + t->tcp_hlen > len) {
+    return -1;
+  }
+  t->hdr_len = t->ip_hlen + t->tcp_hlen;
+
+  t->id = tcp_get16(pkt + 4);
+  t->seq = tcp_get32(tcp + 4);
+  t->ack = tcp_get32(tcp + 8);
+  t->flags = tcp[13];
+  t->win = tcp_get16(tcp + 14);
+
+  t->sack = 0;
+  opt = tcp + 20;
+  for(i=0; i < t->tcp_hlen - 20; ) {
+    if(opt[i] == TCP_OPT_END) {
+      break;
+    }
+    if(opt[i] == TCP_OPT_NOP) {
+      i++;
+      continue;
+    }
+    if(i + 1 >= t->tcp_hlen - 20 || opt[i+1] < 2) {
+      break;
+    }
+    if(opt[i] == TCP_OPT_SACK) {
+      t->sack = 1;
+    }
+    i += opt[i+1];
+  }
+
+  return 0;
+}
+
+// parse a whole IPv4 TCP packet
+static int tcp_parse(const uint8_t* pkt, size_t len, struct tcp_pkt* t) {
+  if(len < 40 || tcp_get16(pkt + 2) != len) {
+    return -1;
+  }
+  return tcp_parse_hdr(pkt, len, t);
+}
+
+// same addresses and ports
+static int tcp_same_flow(const uint8_t* a, const struct tcp_pkt* ta, const uint8_t* b, const struct tcp_pkt* tb) {
+  return (!memcmp(a + 12, b + 12, 8) && !memcmp(a + ta->ip_hlen, b + tb->ip_hlen, 4));
+}
+
+static int tcp_pure_ack(const uint8_t* pkt, size_t len, const struct tcp_pkt* t) {
+  if(len != t->hdr_len || t->sack) {
+    return 0;
+  }
+  return (t->flags == TCP_ACK || t->flags == (TCP_ACK | TCP_PSH));
+}
+
+void tcp_stage_init(int enabled) {
+  tcp_stage_on = enabled;
+  tcp_stage_head = 0;
+  tcp_stage_count = 0;
+  memset(&tcp_stage_stats, 0, sizeof(tcp_stage_stats));
+  memset(tcp_hc_flows, 0, sizeof(tcp_hc_flows));
+  memset(tcp_hc_contexts, 0, sizeof(tcp_hc_contexts));
+}
+
+int tcp_stage_enabled() {
+  return tcp_stage_on;
+}
+
+// can we take another packet from the TUN interface?
+// when disabled only one packet is held at a time
+int tcp_stage_ready() {
+  if(!tcp_stage_on) {
+    return (tcp_stage_count == 0);
+  }
+  return (tcp_stage_count < TCP_STAGE_DEPTH);
+}
+
+// packets held, including thinned ones not yet popped
+int tcp_stage_depth() {
+  return tcp_stage_count;
+}
+
+// drop queued ACKs that are made redundant by this one
+static void tcp_stage_thin(const uint8_t* pkt, size_t len) {
+  struct tcp_stage_entry* e;
+  struct tcp_pkt t, q;
+  int i;
+
+  if(tcp_parse(pkt, len, &t) < 0 || !tcp_pure_ack(pkt, len, &t)) {
+    return;
+  }
+
+  for(i=0; i < tcp_stage_count; i++) {
+    e = &tcp_stage_queue[(tcp_stage_head + i) % TCP_STAGE_DEPTH];
+    if(!e->len || tcp_parse(e->data, e->len, &q) < 0) {
+      continue;
+    }
+    if(!tcp_pure_ack(e->data, e->len, &q) || !tcp_same_flow(pkt, &t, e->data, &q)) {
+      continue;
+    }
+
+    // a newer cumulative ack or a window update for the same ack.
+    // same ack and window is a duplicate ack that must be kept
+    if((int32_t)(t.ack - q.ack) > 0 || (t.ack == q.ack && t.win != q.win)) {
+      e->len = 0;
+      tcp_stage_stats.acks_thinned++;
+    }
+  }
+}
+
+int tcp_stage_push(const uint8_t* pkt, size_t len, uint64_t read_us) {
+  struct tcp_stage_entry* e;
+
+  if(!tcp_stage_ready()) {
+    return 1;
+  }
+  if(len > TCP_STAGE_MAX_PACKET) {
+    return -1;
+  }
+
+  if(tcp_stage_on) {
+    tcp_stage_thin(pkt, len);
+  }
+
+  e = &tcp_stage_queue[(tcp_stage_head + tcp_stage_count) % TCP_STAGE_DEPTH];
+  memcpy(e->data, pkt, len);
+  e->len = len;
+  e->read_us = read_us;
+  tcp_stage_count++;
+  return 0;
+}
+
+// get the oldest packet still queued and when it was read (if read_us isn't NULL).
+// returns its length or 0 if the queue is empty
+ssize_t tcp_stage_pop(uint8_t* buf, size_t size, uint64_t* read_us) {
+  struct tcp_stage_entry* e;
+  size_t len;
+
+  while(tcp_stage_count > 0) {
+    e = &tcp_stage_queue[tcp_stage_head];
+    tcp_stage_head = (tcp_stage_head + 1) % TCP_STAGE_DEPTH;
+    tcp_stage_count--;
+
+    if(!e->len) {
+      continue; // thinned
+    }
+    len = e->len;
+    if(len > size) {
+      return -1;
+    }
+    memcpy(buf, e->data, len);
+    if(read_us) {
+      *read_us = e->read_us;
+    }
+    return len;
+  }
+  return 0;
+}
+
+static size_t tcp_varint_put(uint8_t* p, uint32_t v) {
+  size_t i = 0;
+
+  while(v >= 0x80) {
+    p[i++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[i++] = v;
+  return i;
+}
+
+static int tcp_varint_get(const uint8_t* p, size_t len, size_t* off, uint32_t* v) {
+  int shift = 0;
+
+  *v = 0;
+  while(*off < len && shift < 28) {
+    *v |= (uint32_t)(p[*off] & 0x7f) << shift;
+    if(!(p[(*off)++] & 0x80)) {
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+static struct tcp_hc_flow* tcp_hc_find_flow(const uint8_t* pkt, const struct tcp_pkt* t) {
+  struct tcp_hc_flow* f;
+  struct tcp_pkt ft;
+  int i;
+
+  for(i=0; i < TCP_HC_MAX_FLOWS; i++) {
+    f = &tcp_hc_flows[i];
+    if(!f->used || tcp_parse_hdr(f->hdr, f->hdr_len, &ft) < 0) {
+      continue;
+    }
+    if(tcp_same_flow(pkt, t, f->hdr, &ft)) {
+      return f;
+    }
+  }
+  return NULL;
+}
+
+static struct tcp_hc_flow* tcp_hc_new_flow() {
+  struct tcp_hc_flow* victim = NULL;
+  uint8_t gen;
+  int i;
+
+  for(i=0; i < TCP_HC_MAX_FLOWS; i++) {
+    if(!tcp_hc_flows[i].used) {
+      victim = &tcp_hc_flows[i];
+      break;
+    }
+    if(!victim || tcp_hc_flows[i].last_used < victim->last_used) {
+      victim = &tcp_hc_flows[i];
+    }
+  }
+
+  // keep bumping the generation so the receiver notices the new flow
+  gen = victim->gen;
+  memset(victim, 0, sizeof(struct tcp_hc_flow));
+  victim->gen = gen;
+  return victim;
+}
+
+// can pkt be expressed as deltas against the full header in f?
+static int tcp_hc_compressible(const struct tcp_hc_flow* f, const uint8_t* pkt, const struct tcp_pkt* t) {
+  const uint8_t* c = f->hdr;
+  struct tcp_pkt ct;
+
+  if(tcp_parse_hdr(c, f->hdr_len, &ct) < 0) {
+    return 0;
+  }
+  if(f->since_full >= TCP_HC_REFRESH) {
+    return 0;
+  }
+  // a retransmission or duplicate ACK, maybe because the full header
+  // this one would be against never arrived
+  if(t->seq == f->last_seq && t->ack == f->last_ack && t->win == f->last_win) {
+    return 0;
+  }
+  if(t->hdr_len < tcp_get16(pkt + 2) && (int32_t)(t->seq - f->snd_max) < 0) {
+    return 0;
+  }
+  if(t->ip_hlen != 20 || ct.ip_hlen != 20 || t->tcp_hlen != ct.tcp_hlen) {
+    return 0;
+  }
+  // tos, flags/fragment offset, ttl
+  if(pkt[1] != c[1] || pkt[6] != c[6] || pkt[7] != c[7] || pkt[8] != c[8]) {
+    return 0;
+  }
+  if(t->seq - ct.seq >= TCP_HC_MAX_SEQ_DELTA || t->ack - ct.ack >= TCP_HC_MAX_SEQ_DELTA) {
+    return 0;
+  }
+  if((uint16_t)(t->id - ct.id) >= TCP_HC_MAX_ID_DELTA) {
+    return 0;
+  }
+  // the urgent pointer is only carried along with URG
+  if(!(t->flags & TCP_URG) && tcp_get16(pkt + t->ip_hlen + 18)) {
+    return 0;
+  }
+  return 1;
+}
+
+// compress an IP packet.
+// returns the compressed length, or 0 if the packet should be sent as is
+ssize_t tcp_compress(const uint8_t* pkt, size_t len, uint8_t* out, size_t size) {
+  struct tcp_hc_flow* f;
+  struct tcp_pkt t, ct;
+  const uint8_t* tcp;
+  size_t i, opt_len;
+  uint8_t mask = 0;
+  int compressible;
+  int cid;
+
+  if(!tcp_stage_on || tcp_parse(pkt, len, &t) < 0) {
+    return 0;
+  }
+  if(!(t.flags & TCP_ACK) || (t.flags & ~(TCP_ACK | TCP_PSH | TCP_URG))) {
+    // connection setup and teardown go as they are. the flow may be
+    // over or start again, what comes next gets a full header
+    f = tcp_hc_find_flow(pkt, &t);
+    if(f) {
+      f->since_full = TCP_HC_REFRESH;
+    }
+    return 0;
+  }
+  if(t.hdr_len > TCP_HC_MAX_HDR || len + 2 > size) {
+    return 0;
+  }
+
+  f = tcp_hc_find_flow(pkt, &t);
+  if(!f) {
+    f = tcp_hc_new_flow();
+    f->snd_max = t.seq;
+  }
+  f->used = 1;
+  f->last_used = ++tcp_hc_clock;
+  cid = f - tcp_hc_flows;
+
+  compressible = tcp_hc_compressible(f, pkt, &t);
+  f->last_seq = t.seq;
+  f->last_ack = t.ack;
+  f->last_win = t.win;
+  if(len > t.hdr_len && (int32_t)(t.seq + (len - t.hdr_len) - f->snd_max) > 0) {
+    f->snd_max = t.seq + (len - t.hdr_len);
+  }
+
+  if(!compressible) {
+    f->gen = (f->gen + 1) & 0x03;
+    f->since_full = 0;
+    f->hdr_len = t.hdr_len;
+    memcpy(f->hdr, pkt, t.hdr_len);
+
+    tcp_stage_stats.tx_full++;
+    out[0] = TCP_HC_FULL | (f->gen << 1);
+    out[1] = cid;
+
+    if(addrmap_owner(pkt + 16, 4) < 0) {
+      memcpy(out + 2, pkt, len);
+      return len + 2;
+    }
+
+    out[0] |= TCP_HC_MAPPED;
+    out[2] = addrmap_check(pkt + 16, 4);
+    memcpy(out + 3, pkt, 16);
+    memcpy(out + 19, pkt + 20, len - 20);
+    tcp_stage_stats.tx_bytes_saved += 1;
+    return len - 1;
+  }
+
+  tcp_parse_hdr(f->hdr, f->hdr_len, &ct);
+  tcp = pkt + t.ip_hlen;
+  opt_len = t.tcp_hlen - 20;
+
+  out[0] = TCP_HC_COMPRESSED | (f->gen << 1);
+  out[1] = cid;
+  out[3] = tcp[16]; // checksum
+  out[4] = tcp[17];
+  i = 5;
+
+  if(t.seq != ct.seq) {
+    mask |= TCP_HC_SEQ;
+    i += tcp_varint_put(out + i, t.seq - ct.seq);
+  }
+  if(t.ack != ct.ack) {
+    mask |= TCP_HC_ACK;
+    i += tcp_varint_put(out + i, t.ack - ct.ack);
+  }
+  if(t.win != ct.win) {
+    mask |= TCP_HC_WIN;
+    tcp_put16(out + i, t.win);
+    i += 2;
+  }
+  if(t.id != ct.id) {
+    mask |= TCP_HC_ID;
+    i += tcp_varint_put(out + i, (uint16_t)(t.id - ct.id));
+  }
+  if(t.flags & TCP_URG) {
+    mask |= TCP_HC_URG;
+    out[i++] = tcp[18];
+    out[i++] = tcp[19];
+  }
+  if(t.flags & TCP_PSH) {
+    mask |= TCP_HC_PSH;
+  }
+  out[2] = mask;
+
+  if(i + opt_len + (len - t.hdr_len) > size) {
+    return 0;
+  }
+  memcpy(out + i, tcp + 20, opt_len);
+  i += opt_len;
+  memcpy(out + i, pkt + t.hdr_len, len - t.hdr_len);
+  i += len - t.hdr_len;
+
+  f->since_full++;
+  tcp_stage_stats.tx_compressed++;
+  tcp_stage_stats.tx_bytes_saved += len - i;
+  return i;
+}
+
+static struct tcp_hc_context* tcp_hc_find_context(uint8_t src, uint8_t cid, int create) {
+  struct tcp_hc_context* c;
+  struct tcp_hc_context* victim = NULL;
+  int i;
+
+  for(i=0; i < TCP_HC_MAX_CONTEXTS; i++) {
+    c = &tcp_hc_contexts[i];
+    if(c->used && c->src == src && c->cid == cid) {
+      c->last_used = ++tcp_hc_clock;
+      return c;
+    }
+    if(!victim || !c->used || (victim->used && c->last_used < victim->last_used)) {
+      victim = c;
+    }
+  }
+  if(!create) {
+    return NULL;
+  }
+
+  memset(victim, 0, sizeof(struct tcp_hc_context));
+  victim->used = 1;
+  victim->src = src;
+  victim->cid = cid;
+  victim->last_used = ++tcp_hc_clock;
+  return victim;
+}
+
+static uint16_t tcp_ip_checksum(const uint8_t* p, size_t len) {
+  uint32_t sum = 0;
+  size_t i;
+
+  for(i=0; i + 1 < len; i += 2) {
+    sum += tcp_get16(p + i);
+  }
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+// apply a compressed header to the full header in context c.
+// returns the packet length in tcp_hc_out or -1 if in is malformed
+static ssize_t tcp_hc_rebuild(const struct tcp_hc_context* c, const uint8_t* in, size_t len) {
+  struct tcp_pkt t;
+  uint8_t* tcp;
+  uint8_t mask;
+  uint32_t v;
+  size_t i, opt_len, data_len;
+
+  tcp_parse_hdr(c->hdr, c->hdr_len, &t);
+  opt_len = t.tcp_hlen - 20;
+
+  memcpy(tcp_hc_out, c->hdr, c->hdr_len);
+  tcp = tcp_hc_out + t.ip_hlen;
+  mask = in[2];
+  tcp[16] = in[3];
+  tcp[17] = in[4];
+  i = 5;
+
+  if(mask & TCP_HC_SEQ) {
+    if(tcp_varint_get(in, len, &i, &v) < 0) {
+      return -1;
+    }
+    tcp_put32(tcp + 4, t.seq + v);
+  }
+  if(mask & TCP_HC_ACK) {
+    if(tcp_varint_get(in, len, &i, &v) < 0) {
+      return -1;
+    }
+    tcp_put32(tcp + 8, t.ack + v);
+  }
+  if(mask & TCP_HC_WIN) {
+    if(i + 2 > len) {
+      return -1;
+    }
+    tcp[14] = in[i++];
+    tcp[15] = in[i++];
+  }
+  if(mask & TCP_HC_ID) {
+    if(tcp_varint_get(in, len, &i, &v) < 0) {
+      return -1;
+    }
+    tcp_put16(tcp_hc_out + 4, t.id + v);
+  }
+
+  tcp[13] = TCP_ACK;
+  tcp[18] = 0;
+  tcp[19] = 0;
+  if(mask & TCP_HC_URG) {
+    if(i + 2 > len) {
+      return -1;
+    }
+    tcp[18] = in[i++];
+    tcp[19] = in[i++];
+    tcp[13] |= TCP_URG;
+  }
+  if(mask & TCP_HC_PSH) {
+    tcp[13] |= TCP_PSH;
+  }
+
+  if(i + opt_len > len) {
+    return -1;
+  }
+  data_len = len - i - opt_len;
+  if(c->hdr_len + data_len > sizeof(tcp_hc_out)) {
+    return -1;
+  }
+
+  memcpy(tcp + 20, in + i, opt_len);
+  memcpy(tcp_hc_out + c->hdr_len, in + i + opt_len, data_len);
+
+  tcp_put16(tcp_hc_out + 2, c->hdr_len + data_len);
+  tcp_hc_out[10] = 0;
+  tcp_hc_out[11] = 0;
+  tcp_put16(tcp_hc_out + 10, tcp_ip_checksum(tcp_hc_out, t.ip_hlen));
+
+  return c->hdr_len + data_len;
+}
+
+// put our own address back into a full header that left it out.
+// returns the packet length in tcp_hc_out or -1
+static ssize_t tcp_hc_unmap(const uint8_t* in, size_t len) {
+  const uint8_t* addr;
+
+  if(len < 3 + 16 || len - 3 + 4 > sizeof(tcp_hc_out)) {
+    tcp_stage_stats.rx_invalid++;
+    return -1;
+  }
+  addr = addrmap_local(4, in[2]);
+  if(!addr) {
+    tcp_stage_stats.rx_unknown_addr++;
+    return -1;
+  }
+
+  memcpy(tcp_hc_out, in + 3, 16);
+  memcpy(tcp_hc_out + 16, addr, 4);
+  memcpy(tcp_hc_out + 20, in + 19, len - 19);
+  return len - 3 + 4;
+}
+
+// rebuild the IP packet from a payload produced by tcp_compress().
+// returns the packet length and sets pkt, or -1 if it can't be rebuilt
+ssize_t tcp_decompress(uint8_t src, const uint8_t* in, size_t len, const uint8_t** pkt) {
+  struct tcp_hc_context* c;
+  struct tcp_pkt t;
+  const uint8_t* full;
+  size_t full_len;
+  uint8_t gen;
+  ssize_t ret;
+
+  if(len < 2) {
+    tcp_stage_stats.rx_invalid++;
+    return -1;
+  }
+  gen = (in[0] >> 1) & 0x03;
+
+  if((in[0] & 0x01) == TCP_HC_FULL) {
+    full = in + 2;
+    full_len = len - 2;
+    if(in[0] & TCP_HC_MAPPED) {
+      ret = tcp_hc_unmap(in, len);
+      if(ret < 0) {
+        return -1;
+      }
+      full = tcp_hc_out;
+      full_len = ret;
+    }
+    if(tcp_parse(full, full_len, &t) < 0 || t.hdr_len > TCP_HC_MAX_HDR) {
+      tcp_stage_stats.rx_invalid++;
+      return -1;
+    }
+    c = tcp_hc_find_context(src, in[1], 1);
+    c->gen = gen;
+    c->hdr_len = t.hdr_len;
+    memcpy(c->hdr, full, t.hdr_len);
+    tcp_stage_stats.rx_full++;
+    *pkt = full;
+    return full_len;
+  }
+
+  c = tcp_hc_find_context(src, in[1], 0);
+  if(!c || c->gen != gen) {
+    // the full header was lost, TCP will retransmit
+    tcp_stage_stats.rx_no_context++;
+    return -1;
+  }
+
+  ret = -1;
+  if(len >= 5) {
+    ret = tcp_hc_rebuild(c, in, len);
+  }
+  if(ret < 0) {
+    tcp_stage_stats.rx_invalid++;
+    return -1;
+  }
+
+  tcp_stage_stats.rx_compressed++;
+  *pkt = tcp_hc_out;
+  return ret;
+}
@@ -0,0 +1,81 @@
+#ifndef TCP_STAGE_H
+#define TCP_STAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// packets held between the TUN interface and the link layer
+// so that queued ACKs can be thinned
+#define TCP_STAGE_DEPTH (8)
+#define TCP_STAGE_MAX_PACKET (1500)
+
+// header compression contexts
+#define TCP_HC_MAX_FLOWS (16)    // flows we send
+#define TCP_HC_MAX_CONTEXTS (32) // flows we receive, from all nodes
+#define TCP_HC_REFRESH (32)      // compressed packets between full headers
+
+// largest IP + TCP header kept in a context
+#define TCP_HC_MAX_HDR (20 + 60)
+
+// first byte of a compressed payload: type | generation << 1
+#define TCP_HC_FULL (0x00)
+#define TCP_HC_COMPRESSED (0x01)
+// full header without the destination address, followed by a check byte
+#define TCP_HC_MAPPED (0x08)
+
+// which fields follow a compressed header
+#define TCP_HC_SEQ (0x01)
+#define TCP_HC_ACK (0x02)
+#define TCP_HC_WIN (0x04)
+#define TCP_HC_ID (0x08)
+#define TCP_HC_URG (0x10)
+#define TCP_HC_PSH (0x20)
+
+struct tcp_stage_stats {
+  unsigned long acks_thinned;
+  unsigned long tx_full;
+  unsigned long tx_compressed;
+  unsigned long tx_bytes_saved;
+  unsigned long rx_full;
+  unsigned long rx_compressed;
+  unsigned long rx_no_context;
+  unsigned long rx_unknown_addr;
+  unsigned long rx_invalid;
+};
+
+extern struct tcp_stage_stats tcp_stage_stats;
+
+struct tcp_hc_flow {
+  uint8_t used;
+  uint8_t gen;
+  uint8_t since_full;
+  uint64_t last_used;
+  uint32_t last_seq; // of the last packet sent, full or not
+  uint32_t last_ack;
+  uint16_t last_win;
+  uint32_t snd_max;  // highest sequence number sent, plus one
+  size_t hdr_len;
+  uint8_t hdr[TCP_HC_MAX_HDR];
+};
+
+struct tcp_hc_context {
+  uint8_t used;
+  uint8_t src; // link node id of the compressor
+  uint8_t cid;
+  uint8_t gen;
+  uint64_t last_used;
+  size_t hdr_len;
+  uint8_t hdr[TCP_HC_MAX_HDR];
+};
+
+void tcp_stage_init(int enabled);
+int tcp_stage_enabled();
+int tcp_stage_ready();
+int tcp_stage_depth();
+int tcp_stage_push(const uint8_t* pkt, size_t len, uint64_t read_us);
+ssize_t tcp_stage_pop(uint8_t* buf, size_t size, uint64_t* read_us);
+ssize_t tcp_compress(const uint8_t* pkt, size_t len, uint8_t* out, size_t size);
+ssize_t tcp_decompress(uint8_t src, const uint8_t* in, size_t len, const uint8_t** pkt);
+
+#endif
@@ -0,0 +1,267 @@
+#include "../aead.c"
+#include <gtest/gtest.h>
+
+static const uint8_t aead_test_key[AEAD_KEY_LEN] = {
+  0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf
+};
+
+TEST(AEADTest, AESBlock) {
+  // FIPS-197 appendix C.1
+  uint8_t key[AEAD_KEY_LEN];
+  uint8_t a[16];
+  uint8_t b[16];
+  const uint8_t expected[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+  };
+  int aesni;
+  int i;
+
+  for(i=0; i < 16; i++) {
+    key[i] = i;
+  }
+  ASSERT_EQ(0, aead_set_key(key, AEAD_DEFAULT_TAG, 0));
+
+  for(aesni=0; aesni < 2; aesni++) {
+    if(aead_use_aesni(aesni) != aesni) {
+      continue;
+    }
+    for(i=0; i < 16; i++) {
+      a[i] = b[i] = i * 0x11;
+    }
+    aead_block2(a, b);
+    ASSERT_EQ(0, memcmp(expected, a, 16)) << "aesni " << aesni;
+    ASSERT_EQ(0, memcmp(expected, b, 16)) << "aesni " << aesni;
+  }
+}
+
+TEST(AEADTest, CCMVector) {
+  // RFC 3610 packet vector #1
+  const uint8_t nonce[AEAD_NONCE_LEN] = {
+    0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5
+  };
+  const uint8_t expected[31] = {
+    0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2, 0xf0, 0x66, 0xd0, 0xc2, 0xc0, 0xf9, 0x89, 0x80,
+    0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3, 0x84, 0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0
+  };
+  uint8_t aad[8];
+  uint8_t msg[23];
+  uint8_t out[31];
+  uint8_t plain[23];
+  uint8_t tag[8];
+  int aesni;
+  int i;
+
+  for(i=0; i < 8; i++) {
+    aad[i] = i;
+  }
+  for(i=0; i < 23; i++) {
+    msg[i] = i + 8;
+  }
+  ASSERT_EQ(0, aead_set_key(aead_test_key, 8, 0));
+
+  for(aesni=0; aesni < 2; aesni++) {
+    if(aead_use_aesni(aesni) != aesni) {
+      continue;
+    }
+    aead_ccm(1, nonce, aad, sizeof(aad), msg, sizeof(msg), out, out + sizeof(msg));
+    ASSERT_EQ(0, memcmp(expected, out, sizeof(expected))) << "aesni " << aesni;
+
+    aead_ccm(0, nonce, aad, sizeof(aad), out, sizeof(msg), plain, tag);
+    ASSERT_EQ(0, memcmp(msg, plain, sizeof(msg)));
+    ASSERT_EQ(0, memcmp(expected + sizeof(msg), tag, 8));
+  }
+}
+
+TEST(AEADTest, SealOpen) {
+  uint8_t hdr[LINK_HDR_MIN_LEN] = { LINK_F_SEC, 3, LINK_BROADCAST };
+  const uint8_t msg[] = "a packet for everyone";
+  uint8_t frame[LINK_MAX_FRAME];
+  const uint8_t* out;
+  ssize_t len;
+
+  ASSERT_EQ(-1, aead_set_key(aead_test_key, 5, 0));
+  ASSERT_EQ(0, aead_set_key(aead_test_key, AEAD_DEFAULT_TAG, 1000));
+  ASSERT_EQ(AEAD_CTR_FULL + AEAD_DEFAULT_TAG, (int) aead_overhead());
+
+  // the first frames carry the full counter
+  len = aead_seal(hdr, sizeof(hdr), msg, sizeof(msg), frame, sizeof(frame));
+  ASSERT_EQ((ssize_t) (AEAD_CTR_FULL + sizeof(msg) + AEAD_DEFAULT_TAG), len);
+  ASSERT_EQ(NULL, memmem(frame, len, "packet", 6));
+  ASSERT_EQ((ssize_t) sizeof(msg), aead_open(hdr, sizeof(hdr), frame, len, &out));
+  ASSERT_EQ(0, memcmp(msg, out, sizeof(msg)));
+
+  // once is enough
+  ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), frame, len, &out));
+  ASSERT_EQ(1u, aead_stats.rx_replayed);
+
+  // the header is authenticated, the payload too
+  len = aead_seal(hdr, sizeof(hdr), msg, sizeof(msg), frame, sizeof(frame));
+  hdr[2] = 7;
+  ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), frame, len, &out));
+  hdr[2] = LINK_BROADCAST;
+  frame[10] ^= 1;
+  ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), frame, len, &out));
+  ASSERT_EQ(2u, aead_stats.rx_auth_failed);
+  frame[10] ^= 1;
+  ASSERT_EQ((ssize_t) sizeof(msg), aead_open(hdr, sizeof(hdr), frame, len, &out));
+
+  // frames in the clear are refused
+  hdr[0] = 0;
+  ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), msg, sizeof(msg), &out));
+  ASSERT_EQ(1u, aead_stats.rx_unsealed);
+}
+
+TEST(AEADTest, Counters) {
+  const uint8_t hdr[LINK_HDR_MIN_LEN] = { LINK_F_SEC, 5, 1 };
+  uint8_t frames[AEAD_SYNC_INTERVAL * 5][32];
+  ssize_t lens[AEAD_SYNC_INTERVAL * 5];
+  const uint8_t* out;
+  int i;
+
+  // the short counter wraps in between
+  ASSERT_EQ(0, aead_set_key(aead_test_key, AEAD_DEFAULT_TAG, 0x7fff - AEAD_SYNC_INTERVAL * 2));
+  for(i=0; i < AEAD_SYNC_INTERVAL * 5; i++) {
+    lens[i] = aead_seal(hdr, sizeof(hdr), (const uint8_t*) "data", 4, frames[i], sizeof(frames[i]));
+    ASSERT_EQ((i < AEAD_SYNC_INTERVAL || i % AEAD_SYNC_INTERVAL == 0)
+              ? AEAD_CTR_FULL + 4 + AEAD_DEFAULT_TAG : AEAD_CTR_SHORT + 4 + AEAD_DEFAULT_TAG, lens[i]);
+  }
+
+  // a short counter needs a full one from the node first
+  ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), frames[AEAD_SYNC_INTERVAL + 1], lens[AEAD_SYNC_INTERVAL + 1], &out));
+  ASSERT_EQ(1u, aead_stats.rx_no_sync);
+  ASSERT_EQ(4, aead_open(hdr, sizeof(hdr), frames[AEAD_SYNC_INTERVAL], lens[AEAD_SYNC_INTERVAL], &out));
+
+  // out of order within the window is fine, across the wrap too
+  for(i=AEAD_SYNC_INTERVAL * 5 - 1; i > AEAD_SYNC_INTERVAL; i--) {
+    ASSERT_EQ(4, aead_open(hdr, sizeof(hdr), frames[i], lens[i], &out)) << i;
+  }
+  for(i=AEAD_SYNC_INTERVAL; i < AEAD_SYNC_INTERVAL * 5; i++) {
+    ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), frames[i], lens[i], &out)) << i;
+  }
+
+  // too far behind
+  ASSERT_EQ(-1, aead_open(hdr, sizeof(hdr), frames[0], lens[0], &out));
+  ASSERT_EQ(AEAD_SYNC_INTERVAL * 4 + 1, (int) aead_stats.rx_replayed);
+  ASSERT_EQ(0u, aead_stats.rx_auth_failed);
+}
+
+TEST(AEADTest, Link) {
+  uint8_t pkt[300];
+  uint8_t frame[LINK_MAX_FRAME];
+  const uint8_t* payload;
+  ssize_t len;
+  ssize_t ret = 0;
+  int frames = 0;
+  int i;
+
+  for(i=0; i < (int) sizeof(pkt); i++) {
+    pkt[i] = i;
+  }
+  pkt[0] = 0x45;
+
+  // node 1 sends a packet that needs two frames to node 2
+  ASSERT_EQ(0, aead_set_key(aead_test_key, AEAD_MAX_TAG, 1 << 20));
+  ASSERT_EQ(0, link_init(1, 0, 0));
+  lz_init(0);
+  ASSERT_EQ(0, link_tun_packet(pkt, sizeof(pkt), 0));
+  while((len = link_next_frame(frame, sizeof(frame))) > 0) {
+    ASSERT_LE(len, LINK_MAX_FRAME);
+    ASSERT_TRUE(frame[0] & LINK_F_SEC);
+    frames++;
+
+    link_node_id = 2;
+    ret = link_rx_frame(frame, len, &payload);
+    link_node_id = 1;
+  }
+  ASSERT_EQ(2, frames);
+  ASSERT_EQ((ssize_t) sizeof(pkt), ret);
+  ASSERT_EQ(0, memcmp(pkt, payload, sizeof(pkt)));
+
+  // a frame in the clear is dropped
+  frame[0] = 0;
+  frame[1] = 1;
+  frame[2] = 2;
+  link_node_id = 2;
+  ASSERT_EQ(-1, link_rx_frame(frame, 20, &payload));
+  ASSERT_EQ(1u, aead_stats.rx_unsealed);
+
+  aead_on = 0;
+  frag_reserve(0);
+}
+
+static uint64_t aead_test_now;
+
+static uint64_t aead_test_clock() {
+  return aead_test_now;
+}
+
+// the counter the next frame is sealed with
+static uint64_t aead_test_sealed_counter() {
+  const uint8_t hdr[2] = { LINK_F_SEC, 1 };
+  uint8_t out[64];
+  uint64_t counter = aead_counter;
+
+  if(aead_seal(hdr, sizeof(hdr), hdr, sizeof(hdr), out, sizeof(out)) < 0) {
+    return 0;
+  }
+  return counter;
+}
+
+TEST(AEADTest, CounterFile) {
+  const char* path = "/tmp/lora_iface_test.key";
+  const char* ctr_path = "/tmp/lora_iface_test.key" AEAD_CTR_SUFFIX;
+  uint64_t last = 0;
+  uint64_t mark = 0;
+  FILE* f;
+  int i;
+
+  unlink(ctr_path);
+  f = fopen(path, "w");
+  ASSERT_TRUE(f != NULL);
+  for(i=0; i < AEAD_KEY_LEN; i++) {
+    fprintf(f, "%02x", aead_test_key[i]);
+  }
+  fprintf(f, "\n");
+  fclose(f);
+  aead_clock = aead_test_clock;
+
+  // without a mark the counter starts at the time of day
+  aead_test_now = 1000000000;
+  ASSERT_EQ(0, aead_load_key(path, AEAD_DEFAULT_TAG));
+  ASSERT_EQ(aead_test_now, aead_test_sealed_counter());
+  ASSERT_EQ(aead_test_now + AEAD_CTR_RESERVE, aead_ctr_mark);
+
+  // more frames than were reserved move the mark on before they go out
+  for(i=0; i < AEAD_CTR_RESERVE + 10; i++) {
+    last = aead_test_sealed_counter();
+  }
+  ASSERT_EQ(aead_test_now + AEAD_CTR_RESERVE + 10, last);
+  ASSERT_EQ(aead_test_now + AEAD_CTR_RESERVE * 2, aead_ctr_mark);
+  f = fopen(ctr_path, "r");
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(1, fscanf(f, "%" SCNu64, &mark));
+  fclose(f);
+  ASSERT_EQ(aead_ctr_mark, mark);
+
+  // restarted with the clock an hour back, it doesn't go back
+  aead_test_now -= 3600000;
+  ASSERT_EQ(0, aead_load_key(path, AEAD_DEFAULT_TAG));
+  ASSERT_GT(aead_test_sealed_counter(), last);
+
+  // and with the clock ahead it follows the clock
+  aead_test_now += 7200000;
+  ASSERT_EQ(0, aead_load_key(path, AEAD_DEFAULT_TAG));
+  ASSERT_EQ(aead_test_now, aead_test_sealed_counter());
+
+  // a counter file that can't be read is refused
+  f = fopen(ctr_path, "w");
+  ASSERT_TRUE(f != NULL);
+  fprintf(f, "garbage\n");
+  fclose(f);
+  ASSERT_EQ(-1, aead_load_key(path, AEAD_DEFAULT_TAG));
+  ASSERT_FALSE(aead_enabled());
+
+  aead_clock = NULL;
+  unlink(ctr_path);
+  unlink(path);
+}
@@ -0,0 +1,138 @@
+#include "../link.c"
+#include "../arq.c"
+#include <gtest/gtest.h>
+
+TEST(ARQTest, HeaderRoundTrip) {
+  struct link_hdr hdr, out;
+  uint8_t buf[LINK_HDR_MAX_LEN];
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.flags = LINK_F_ARQ | LINK_F_ACK;
+  hdr.src = 3;
+  hdr.dst = 7;
+  hdr.seq = 200;
+  hdr.ack = 12;
+  hdr.sack = 0x05;
+
+  ASSERT_EQ(6, link_hdr_encode(&hdr, buf, sizeof(buf)));
+  ASSERT_EQ(6, link_hdr_decode(&out, buf, 6));
+  ASSERT_EQ(0, memcmp(&hdr, &out, sizeof(hdr)));
+
+  // truncated ack fields
+  ASSERT_EQ(-1, link_hdr_decode(&out, buf, 5));
+}
+
+TEST(ARQTest, AckFreesWindow) {
+  struct link_hdr hdr;
+  const uint8_t* data;
+  size_t len;
+  uint8_t payload[] = {1, 2, 3};
+  int i;
+
+  arq_init(3, 1000);
+
+  for(i=0; i < ARQ_WINDOW; i++) {
+    ASSERT_EQ(0, arq_enqueue(9, 0, payload, sizeof(payload), NULL));
+  }
+  ASSERT_EQ(1, arq_enqueue(9, 0, payload, sizeof(payload), NULL));
+  ASSERT_TRUE(arq_window_full(9));
+
+  for(i=0; i < ARQ_WINDOW; i++) {
+    ASSERT_EQ(1, arq_next_frame(0, &hdr, &data, &len));
+    ASSERT_EQ(LINK_F_ARQ, hdr.flags);
+    ASSERT_EQ(i, hdr.seq);
+    ASSERT_EQ(sizeof(payload), len);
+    arq_tx_done(1, 10, 0, 0);
+  }
+  // nothing due until the timeout
+  ASSERT_EQ(0, arq_next_frame(1, &hdr, &data, &len));
+
+  // cumulative ack for 0 and 1, selective for 3
+  arq_handle_ack(9, 2, 0x01);
+  ASSERT_EQ(3, arq_stats.acked);
+  ASSERT_FALSE(arq_window_full(9));
+
+  // only 2 and 4.. are retransmitted
+  ASSERT_EQ(1, arq_next_frame(ARQ_MAX_RTO_US, &hdr, &data, &len));
+  ASSERT_EQ(2, hdr.seq);
+  arq_tx_done(1, 10, 0, ARQ_MAX_RTO_US);
+  ASSERT_EQ(1, arq_next_frame(ARQ_MAX_RTO_US, &hdr, &data, &len));
+  ASSERT_EQ(4, hdr.seq);
+}
+
+TEST(ARQTest, RetryBudget) {
+  struct link_hdr hdr;
+  const uint8_t* data;
+  size_t len;
+  uint8_t payload[] = {1};
+  uint64_t now = 0;
+  int i;
+
+  arq_init(2, 1000);
+  ASSERT_EQ(0, arq_enqueue(4, 0, payload, sizeof(payload), NULL));
+
+  for(i=0; i < 2; i++) {
+    ASSERT_EQ(1, arq_next_frame(now, &hdr, &data, &len));
+    arq_tx_done(1, 10, 0, now);
+    now += ARQ_MAX_RTO_US;
+  }
+  ASSERT_EQ(0, arq_next_frame(now, &hdr, &data, &len));
+  ASSERT_EQ(1, arq_stats.dropped);
+  ASSERT_EQ(1, arq_stats.retransmits);
+}
+
+TEST(ARQTest, ReceiveOutOfOrder) {
+  struct link_hdr hdr;
+  const uint8_t* data;
+  size_t len;
+
+  arq_init(0, 1000);
+
+  ASSERT_EQ(1, arq_receive(5, 10));
+  ASSERT_EQ(1, arq_receive(5, 12));
+  ASSERT_EQ(0, arq_receive(5, 12));
+  ASSERT_EQ(0, arq_receive(5, 10));
+
+  // ack is sent even though our own ARQ is disabled
+  ASSERT_EQ(1, arq_next_frame(0, &hdr, &data, &len));
+  ASSERT_EQ(LINK_F_ACK, hdr.flags);
+  ASSERT_EQ(5, hdr.dst);
+  ASSERT_EQ(11, hdr.ack);
+  ASSERT_EQ(0x01, hdr.sack);
+  ASSERT_EQ(0, len);
+
+  ASSERT_EQ(1, arq_receive(5, 11));
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.dst = 5;
+  arq_fill_ack(&hdr);
+  ASSERT_EQ(13, hdr.ack);
+  ASSERT_EQ(0, hdr.sack);
+
+  // the sender gave up on 13..14
+  ASSERT_EQ(1, arq_receive(5, 23));
+  ASSERT_EQ(0, arq_receive(5, 23));
+}
+
+TEST(ARQTest, LearnNeighbourFromFrame) {
+  uint8_t frame[LINK_HDR_MIN_LEN + 20];
+  uint8_t pkt[20];
+  const uint8_t* payload;
+
+  link_init(1, 0, 0);
+
+  memset(frame, 0, sizeof(frame));
+  frame[1] = 42; // src
+  frame[2] = LINK_BROADCAST;
+  frame[3] = 0x45;
+  frame[3 + 12] = 10; frame[3 + 13] = 0; frame[3 + 14] = 0; frame[3 + 15] = 42;
+
+  ASSERT_EQ(20, link_rx_frame(frame, sizeof(frame), &payload));
+
+  memset(pkt, 0, sizeof(pkt));
+  pkt[0] = 0x45;
+  pkt[16] = 10; pkt[19] = 42;
+  ASSERT_EQ(42, link_lookup(pkt, sizeof(pkt)));
+
+  pkt[16] = 224; // multicast
+  ASSERT_EQ(LINK_BROADCAST, link_lookup(pkt, sizeof(pkt)));
+}
@@ -0,0 +1,116 @@
+#include "../addrmap.c"
+#include <gtest/gtest.h>
+
+static void addrmap_test_addr(uint8_t* addr, uint32_t n) {
+  addr[0] = 10;
+  addr[1] = n >> 16;
+  addr[2] = n >> 8;
+  addr[3] = n;
+}
+
+TEST(AddrMapTest, LearnAndLookup) {
+  uint8_t a[4], b[16];
+
+  addrmap_init(NULL);
+  addrmap_test_addr(a, 1);
+  memset(b, 0, sizeof(b));
+  b[0] = 0xfe; b[1] = 0x80; b[15] = 1;
+
+  ASSERT_EQ(-1, addrmap_lookup(a, 4));
+  addrmap_learn(a, 4, 7, 1, 1);
+  addrmap_learn(b, 16, 9, 1, 1);
+  ASSERT_EQ(7, addrmap_lookup(a, 4));
+  ASSERT_EQ(9, addrmap_lookup(b, 16));
+
+  // the same bytes as a shorter address are a different address
+  ASSERT_EQ(-1, addrmap_lookup(b, 4));
+
+  // moved to another node
+  addrmap_learn(a, 4, 8, 1, 2);
+  ASSERT_EQ(8, addrmap_lookup(a, 4));
+}
+
+TEST(AddrMapTest, EvictOldest) {
+  uint8_t a[4];
+  uint32_t n;
+
+  addrmap_init(NULL);
+  for(n=0; n < ADDRMAP_MAX_ENTRIES * 3; n++) {
+    addrmap_test_addr(a, n);
+    addrmap_learn(a, 4, n % 254, 1, n);
+  }
+  ASSERT_EQ(ADDRMAP_MAX_ENTRIES * 2, (int) addrmap_stats.evicted);
+
+  // removals must not have broken any probe sequence
+  for(n=0; n < ADDRMAP_MAX_ENTRIES * 3; n++) {
+    addrmap_test_addr(a, n);
+    if(n < ADDRMAP_MAX_ENTRIES * 2) {
+      ASSERT_EQ(-1, addrmap_lookup(a, 4));
+    } else {
+      ASSERT_EQ((int) (n % 254), addrmap_lookup(a, 4));
+    }
+  }
+}
+
+TEST(AddrMapTest, LocalAddress) {
+  uint8_t a[4], b[4];
+  char buf[256];
+
+  addrmap_init(NULL);
+  addrmap_test_addr(a, 1);
+  addrmap_test_addr(b, 2);
+  addrmap_learn_local(a, 4);
+  addrmap_learn_local(b, 4);
+  addrmap_learn_local(a, 4);
+
+  ASSERT_EQ(0, memcmp(a, addrmap_local(4, addrmap_check(a, 4)), 4));
+  ASSERT_EQ(0, memcmp(b, addrmap_local(4, addrmap_check(b, 4)), 4));
+  ASSERT_TRUE(addrmap_local(16, addrmap_check(a, 4)) == NULL);
+
+  addrmap_learn(b, 4, 3, 1, 0);
+  addrmap_dump(buf, sizeof(buf), 5000000);
+  ASSERT_TRUE(strstr(buf, "10.0.0.1") != NULL);
+  ASSERT_TRUE(strstr(buf, "node   3  seen 5s ago") != NULL);
+}
+
+TEST(AddrMapTest, Owner) {
+  uint8_t a[4], b[4];
+  uint32_t n;
+
+  addrmap_init(NULL);
+  addrmap_test_addr(a, 1);
+
+  // routed through node 3, then seen from it directly
+  addrmap_learn(a, 4, 3, 0, 1);
+  ASSERT_EQ(3, addrmap_lookup(a, 4));
+  ASSERT_EQ(-1, addrmap_owner(a, 4));
+  addrmap_learn(a, 4, 3, 1, 2);
+  ASSERT_EQ(3, addrmap_owner(a, 4));
+  addrmap_learn(a, 4, 3, 0, 3);
+  ASSERT_EQ(3, addrmap_owner(a, 4));
+
+  // moved behind another node
+  addrmap_learn(a, 4, 4, 0, 4);
+  ASSERT_EQ(4, addrmap_lookup(a, 4));
+  ASSERT_EQ(-1, addrmap_owner(a, 4));
+
+  // another address of the same node with the same check byte
+  addrmap_learn(a, 4, 4, 1, 5);
+  for(n=2; ; n++) {
+    addrmap_test_addr(b, n);
+    if(addrmap_check(b, 4) == addrmap_check(a, 4)) {
+      break;
+    }
+  }
+  addrmap_learn(b, 4, 5, 1, 6);
+  ASSERT_EQ(4, addrmap_owner(a, 4));
+  addrmap_learn(b, 4, 4, 1, 7);
+  ASSERT_EQ(-1, addrmap_owner(a, 4));
+  ASSERT_EQ(-1, addrmap_owner(b, 4));
+
+  // and ours can't be told apart either
+  addrmap_learn_local(a, 4);
+  ASSERT_EQ(0, memcmp(a, addrmap_local(4, addrmap_check(a, 4)), 4));
+  addrmap_learn_local(b, 4);
+  ASSERT_TRUE(addrmap_local(4, addrmap_check(a, 4)) == NULL);
+}
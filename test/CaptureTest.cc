@@ -0,0 +1,103 @@
+#include "../capture.c"
+#include <gtest/gtest.h>
+#include <vector>
+
+static const char* capture_test_path = "/tmp/lora_iface_test.pcapng";
+
+static uint32_t capture_test_u32(const std::vector<uint8_t>& f, size_t off) {
+  uint32_t v;
+
+  memcpy(&v, &f[off], 4);
+  return v;
+}
+
+static std::vector<uint8_t> capture_test_read() {
+  std::vector<uint8_t> f;
+  uint8_t buf[4096];
+  ssize_t len;
+  int fd;
+
+  fd = open(capture_test_path, O_RDONLY);
+  while(fd >= 0 && (len = read(fd, buf, sizeof(buf))) > 0) {
+    f.insert(f.end(), buf, buf + len);
+  }
+  close(fd);
+  return f;
+}
+
+TEST(CaptureTest, Ring) {
+  const uint8_t frame[] = { 0x20, 1, 2, 'a', 'b', 'c' };
+  struct capture_radio radio = { 915000000, 250, 9, -5 };
+  std::vector<uint8_t> f;
+  std::vector<uint8_t> payloads;
+  size_t off;
+  int epbs = 0;
+  int customs = 0;
+  int i;
+
+  ASSERT_EQ(0, capture_start(capture_test_path, CAPTURE_HDR_LEN + 3 * CAPTURE_SLOT_SIZE + 100));
+  ASSERT_EQ(3u, capture_slots());
+  ASSERT_TRUE(capture_enabled());
+
+  capture_frame(CAPTURE_RX, frame, sizeof(frame), &radio);
+  f = capture_test_read();
+  ASSERT_EQ((size_t) CAPTURE_HDR_LEN + 3 * CAPTURE_SLOT_SIZE, f.size());
+
+  // section header and interface description
+  ASSERT_EQ((uint32_t) PCAPNG_SHB, capture_test_u32(f, 0));
+  ASSERT_EQ(0x1a2b3c4du, capture_test_u32(f, 8));
+  ASSERT_EQ((uint32_t) PCAPNG_IDB, capture_test_u32(f, SHB_LEN));
+  ASSERT_EQ(CAPTURE_LINKTYPE_LORATAP, f[SHB_LEN + 8] | (f[SHB_LEN + 9] << 8));
+
+  off = CAPTURE_HDR_LEN;
+  ASSERT_EQ((uint32_t) PCAPNG_EPB, capture_test_u32(f, off));
+  ASSERT_EQ((uint32_t) CAPTURE_SLOT_SIZE, capture_test_u32(f, off + 4));
+  ASSERT_EQ(CAPTURE_LORATAP_LEN + sizeof(frame), capture_test_u32(f, off + 20));
+  ASSERT_EQ((uint32_t) CAPTURE_SLOT_SIZE, capture_test_u32(f, off + CAPTURE_SLOT_SIZE - 4));
+
+  // LoRaTap header
+  ASSERT_EQ(CAPTURE_LORATAP_LEN, f[off + 28 + 3]);
+  ASSERT_EQ(915000000u, (uint32_t) ((f[off + 32] << 24) | (f[off + 33] << 16) | (f[off + 34] << 8) | f[off + 35]));
+  ASSERT_EQ(2, f[off + 36]);  // 250 kHz
+  ASSERT_EQ(9, f[off + 37]);
+  ASSERT_EQ(-20, (int8_t) f[off + 41]);  // SNR * 4
+  ASSERT_EQ(0, memcmp(frame, &f[off + 28 + CAPTURE_LORATAP_LEN], sizeof(frame)));
+
+  // flags option says inbound
+  ASSERT_EQ(PCAPNG_OPT_FLAGS, f[off + 28 + 24] | (f[off + 28 + 25] << 8));
+  ASSERT_EQ((uint32_t) PCAPNG_FLAG_INBOUND, capture_test_u32(f, off + 28 + 24 + 4));
+
+  // slots not written yet are skipped by readers
+  ASSERT_EQ((uint32_t) PCAPNG_CB, capture_test_u32(f, off + CAPTURE_SLOT_SIZE));
+
+  // off: nothing is written
+  capture_stop();
+  capture_frame(CAPTURE_TX, frame, sizeof(frame), &radio);
+  ASSERT_EQ(1u, capture_stats.frames);
+
+  // on again with the same file keeps what is there and wraps around
+  ASSERT_EQ(0, capture_start(capture_test_path, CAPTURE_HDR_LEN + 3 * CAPTURE_SLOT_SIZE + 100));
+  for(i=0; i < 3; i++) {
+    radio.snr = CAPTURE_SNR_UNKNOWN;
+    capture_frame(CAPTURE_TX, frame, i + 1, &radio);
+  }
+  ASSERT_EQ(4u, capture_stats.frames);
+
+  f = capture_test_read();
+  for(off = CAPTURE_HDR_LEN; off < f.size(); off += capture_test_u32(f, off + 4)) {
+    if(capture_test_u32(f, off) == PCAPNG_EPB) {
+      epbs++;
+      payloads.push_back(capture_test_u32(f, off + 20) - CAPTURE_LORATAP_LEN);
+    } else {
+      customs++;
+    }
+  }
+  ASSERT_EQ(3, epbs);
+  ASSERT_EQ(0, customs);
+  ASSERT_EQ(3u, payloads[0]); // the first frame was overwritten
+  ASSERT_EQ(1u, payloads[1]);
+  ASSERT_EQ(2u, payloads[2]);
+
+  capture_stop();
+  unlink(capture_test_path);
+}
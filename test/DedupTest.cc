@@ -0,0 +1,46 @@
+#include "../dedup.c"
+#include <gtest/gtest.h>
+
+TEST(DedupTest, Window) {
+  const char a[] = "20FFFF0102";
+  const char b[] = "21FFFF0102";
+
+  dedup_init(0);
+  ASSERT_FALSE(dedup_enabled());
+
+  dedup_init(2000);
+  ASSERT_TRUE(dedup_enabled());
+  ASSERT_EQ(0, dedup_seen(a, sizeof(a) - 1, 1000000));
+  ASSERT_EQ(1, dedup_seen(a, sizeof(a) - 1, 1500000));
+  ASSERT_EQ(0, dedup_seen(b, sizeof(b) - 1, 1500000));
+
+  // the window runs from the first copy
+  ASSERT_EQ(0, dedup_seen(a, sizeof(a) - 1, 3000000));
+  ASSERT_EQ(1, dedup_seen(a, sizeof(a) - 1, 3100000));
+
+  ASSERT_EQ(5u, dedup_stats.checked);
+  ASSERT_EQ(2u, dedup_stats.dropped);
+}
+
+TEST(DedupTest, FixedMemory) {
+  uint32_t key;
+  uint32_t i;
+  int dups = 0;
+
+  // many more live keys than slots: old ones are pushed out and
+  // nothing new is taken for a duplicate
+  dedup_init(60000);
+  for(i=0; i < 10 * DEDUP_BUCKETS * DEDUP_SLOTS; i++) {
+    key = i;
+    dups += dedup_seen(&key, sizeof(key), 1000000);
+  }
+  ASSERT_EQ(0, dups);
+  ASSERT_GT(dedup_stats.evicted, 0u);
+
+  // the most recent ones are still there
+  for(i=10 * DEDUP_BUCKETS * DEDUP_SLOTS - 64; i < 10 * DEDUP_BUCKETS * DEDUP_SLOTS; i++) {
+    key = i;
+    dups += dedup_seen(&key, sizeof(key), 1000000);
+  }
+  ASSERT_EQ(64, dups);
+}
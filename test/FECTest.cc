@@ -0,0 +1,107 @@
+#include "../frag.c"
+#include "../fec.c"
+#include <gtest/gtest.h>
+
+TEST(FECTest, FieldInverse) {
+  int a;
+
+  fec_init();
+  for(a=1; a < 256; a++) {
+    ASSERT_EQ(1, gf_mul(a, gf_inv(a)));
+  }
+}
+
+// every combination of k present blocks out of k + r rebuilds the data
+TEST(FECTest, DecodeAnyK) {
+  const int k = 4, r = 3;
+  const size_t len = 37;
+  uint8_t orig[k][len];
+  uint8_t data[k + r][len];
+  uint8_t* blocks[k + r];
+  uint8_t present[k + r];
+  int mask, i, count;
+
+  fec_init();
+  for(i=0; i < k + r; i++) {
+    blocks[i] = data[i];
+  }
+  for(i=0; i < k; i++) {
+    memset(orig[i], i * 31 + 7, len);
+    orig[i][i] = 0;
+  }
+
+  for(mask=0; mask < (1 << (k + r)); mask++) {
+    count = 0;
+    for(i=0; i < k + r; i++) {
+      present[i] = (mask >> i) & 1;
+      count += present[i];
+    }
+    if(count < k) {
+      continue;
+    }
+
+    memcpy(data, orig, sizeof(orig));
+    fec_encode(blocks, k, r, len);
+    for(i=0; i < k + r; i++) {
+      if(!present[i]) {
+        memset(data[i], 0xaa, len);
+      }
+    }
+
+    ASSERT_EQ(0, fec_decode(blocks, present, k, r, len));
+    ASSERT_EQ(0, memcmp(data, orig, sizeof(orig)));
+  }
+
+  memset(present, 0, sizeof(present));
+  present[0] = present[5] = present[6] = 1;
+  ASSERT_EQ(-1, fec_decode(blocks, present, k, r, len));
+}
+
+TEST(FECTest, FragmentWithLoss) {
+  uint8_t frags[FRAG_MAX_FRAGMENTS][LINK_MAX_FRAME];
+  uint8_t pkt[500];
+  const uint8_t* out = NULL;
+  size_t frag_len;
+  int n, i;
+
+  frag_init(2);
+  for(i=0; i < (int) sizeof(pkt); i++) {
+    pkt[i] = i * 7;
+  }
+
+  n = frag_split(pkt, sizeof(pkt), frags, &frag_len);
+  ASSERT_EQ(5, n);
+
+  // lose the first two data fragments
+  ASSERT_EQ(0, frag_reassemble(3, frags[2], frag_len, 0, &out));
+  ASSERT_EQ(0, frag_reassemble(3, frags[3], frag_len, 0, &out));
+  ASSERT_EQ(500, frag_reassemble(3, frags[4], frag_len, 0, &out));
+  ASSERT_EQ(0, memcmp(pkt, out, sizeof(pkt)));
+  ASSERT_EQ(1, frag_stats.rx_recovered);
+
+  // late fragments of a finished packet are ignored
+  ASSERT_EQ(0, frag_reassemble(3, frags[0], frag_len, 0, &out));
+}
+
+TEST(FECTest, MostFragments) {
+  static uint8_t frags[FRAG_MAX_FRAGMENTS][LINK_MAX_FRAME];
+  static uint8_t pkt[FRAG_MAX_FRAGMENTS * FRAG_MAX_CHUNK];
+  const uint8_t* out = NULL;
+  size_t frag_len;
+  int n, i;
+
+  frag_init(0);
+  for(i=0; i < (int) sizeof(pkt); i++) {
+    pkt[i] = i * 3;
+  }
+
+  // k has to fit its 4 bits
+  ASSERT_EQ(-1, frag_split(pkt, FRAG_MAX_DATA * FRAG_MAX_CHUNK + 1, frags, &frag_len));
+  n = frag_split(pkt, FRAG_MAX_DATA * FRAG_MAX_CHUNK, frags, &frag_len);
+  ASSERT_EQ(FRAG_MAX_DATA, n);
+  for(i=0; i < n - 1; i++) {
+    ASSERT_EQ(0, frag_reassemble(3, frags[i], frag_len, 0, &out));
+  }
+  ASSERT_EQ(FRAG_MAX_DATA * FRAG_MAX_CHUNK, frag_reassemble(3, frags[i], frag_len, 0, &out));
+  ASSERT_EQ(0, memcmp(pkt, out, FRAG_MAX_DATA * FRAG_MAX_CHUNK));
+}
@@ -0,0 +1,191 @@
+#include "../filter.c"
+#include <gtest/gtest.h>
+
+static const char filter_test_rules[] =
+  "# local discovery stays local\n"
+  "drop udp port 5353\n"
+  "drop ip4 udp dport 1900   # SSDP\n"
+  "drop icmp6 dst ff02::/16\n"
+  "pass ip4 tcp sport 22; drop greater 400\n"
+  "drop ip4 dst 224.0.0.0/4\n";
+
+static size_t filter_test_ip4(uint8_t* pkt, int proto, const char* dst, int sport, int dport, size_t len) {
+  memset(pkt, 0, len);
+  pkt[0] = 0x45;
+  pkt[2] = len >> 8;
+  pkt[3] = len;
+  pkt[8] = 64;
+  pkt[9] = proto;
+  inet_pton(AF_INET, "10.0.0.1", pkt + 12);
+  inet_pton(AF_INET, dst, pkt + 16);
+  pkt[20] = sport >> 8;
+  pkt[21] = sport;
+  pkt[22] = dport >> 8;
+  pkt[23] = dport;
+  return len;
+}
+
+static size_t filter_test_ip6(uint8_t* pkt, int proto, const char* dst, int sport, int dport, size_t len) {
+  memset(pkt, 0, len);
+  pkt[0] = 0x60;
+  pkt[4] = (len - 40) >> 8;
+  pkt[5] = len - 40;
+  pkt[6] = proto;
+  pkt[7] = 64;
+  inet_pton(AF_INET6, "fe80::1", pkt + 8);
+  inet_pton(AF_INET6, dst, pkt + 24);
+  pkt[40] = sport >> 8;
+  pkt[41] = sport;
+  pkt[42] = dport >> 8;
+  pkt[43] = dport;
+  return len;
+}
+
+// packets with the verdict filter_test_rules should give them
+struct filter_test_packet {
+  uint8_t data[600];
+  size_t len;
+  int verdict;
+};
+
+static int filter_test_packets(struct filter_test_packet* p) {
+  int n = 0;
+
+  p[n].len = filter_test_ip4(p[n].data, 17, "224.0.0.251", 5353, 5353, 60);
+  p[n++].verdict = FILTER_DROP;
+  p[n].len = filter_test_ip6(p[n].data, 17, "ff02::fb", 5353, 5353, 80);
+  p[n++].verdict = FILTER_DROP;
+  p[n].len = filter_test_ip4(p[n].data, 17, "239.255.255.250", 40000, 1900, 100);
+  p[n++].verdict = FILTER_DROP;
+  p[n].len = filter_test_ip6(p[n].data, 17, "ff02::c", 40000, 1900, 100);
+  p[n++].verdict = FILTER_PASS; // the SSDP rule is IPv4 only
+  p[n].len = filter_test_ip6(p[n].data, 58, "ff02::2", 0, 0, 56);
+  p[n++].verdict = FILTER_DROP;
+  p[n].len = filter_test_ip6(p[n].data, 58, "fe80::2", 0, 0, 56);
+  p[n++].verdict = FILTER_PASS;
+  p[n].len = filter_test_ip4(p[n].data, 6, "10.0.0.2", 22, 50000, 500);
+  p[n++].verdict = FILTER_PASS;
+  p[n].len = filter_test_ip4(p[n].data, 6, "10.0.0.2", 50000, 22, 500);
+  p[n++].verdict = FILTER_DROP;
+  p[n].len = filter_test_ip4(p[n].data, 1, "224.0.0.1", 0, 0, 28);
+  p[n++].verdict = FILTER_DROP;
+  p[n].len = filter_test_ip4(p[n].data, 1, "10.0.0.2", 0, 0, 28);
+  p[n++].verdict = FILTER_PASS;
+
+  // a later fragment has no ports, "5353" is just payload
+  p[n].len = filter_test_ip4(p[n].data, 17, "10.0.0.2", 5353, 5353, 60);
+  p[n].data[7] = 0x10;
+  p[n++].verdict = FILTER_PASS;
+
+  // too short for the UDP header
+  p[n].len = filter_test_ip4(p[n].data, 17, "10.0.0.2", 5353, 5353, 22);
+  p[n++].verdict = FILTER_PASS;
+  return n;
+}
+
+TEST(FilterTest, Parse) {
+  const char* invalid[] = {
+    "reject udp",
+    "drop tcp port",
+    "drop port 70000",
+    "drop ip4 dst ff02::/16",
+    "drop dst 10.0.0.0/33",
+    "drop udp port 53 bogus",
+  };
+  size_t i;
+
+  ASSERT_EQ(0, filter_parse(filter_test_rules, sizeof(filter_test_rules) - 1));
+  ASSERT_EQ(6, filter_rule_count());
+  ASSERT_EQ(FILTER_DROP, filter_rules[0].action);
+  ASSERT_EQ(5353, filter_rules[0].port);
+  ASSERT_EQ(4, filter_rules[1].family);
+  ASSERT_EQ(1900, filter_rules[1].dport);
+  ASSERT_STREQ("drop ip4 udp dport 1900", filter_rules[1].text);
+  ASSERT_EQ(58, filter_rules[2].proto);
+  ASSERT_EQ(16, filter_rules[2].dst_bits);
+  ASSERT_EQ(FILTER_PASS, filter_rules[3].action);
+  ASSERT_EQ(400ul, filter_rules[4].greater);
+
+  // a bad rule leaves the old ones in place
+  for(i=0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    ASSERT_EQ(-1, filter_parse(invalid[i], strlen(invalid[i]))) << invalid[i];
+    ASSERT_EQ(6, filter_rule_count());
+  }
+
+  ASSERT_EQ(0, filter_parse("# nothing\n\n", 11));
+  ASSERT_EQ(0, filter_rule_count());
+}
+
+TEST(FilterTest, Userspace) {
+  struct filter_test_packet packets[16];
+  char buf[2048];
+  int n;
+  int i;
+
+  ASSERT_EQ(0, filter_parse(filter_test_rules, sizeof(filter_test_rules) - 1));
+  n = filter_test_packets(packets);
+  for(i=0; i < n; i++) {
+    ASSERT_EQ(packets[i].verdict, filter_packet(packets[i].data, packets[i].len)) << "packet " << i;
+  }
+  ASSERT_EQ(FILTER_PASS, filter_packet(packets[0].data, 0));
+
+  ASSERT_EQ(2ul, filter_hits[0]);
+  ASSERT_EQ(1ul, filter_hits[1]);
+  ASSERT_EQ(1ul, filter_hits[2]);
+  ASSERT_EQ(1ul, filter_hits[3]);
+  ASSERT_EQ(1ul, filter_hits[4]);
+  ASSERT_EQ(1ul, filter_hits[5]);
+  ASSERT_EQ(6ul, filter_hits[6]);
+
+  filter_format(buf, sizeof(buf));
+  ASSERT_TRUE(strstr(buf, "6 rules, filtering in userspace\n") == buf);
+  ASSERT_TRUE(strstr(buf, "         1 drop icmp6 dst ff02::/16\n") != NULL);
+  ASSERT_TRUE(strstr(buf, "         6 pass (no rule matched)\n") != NULL);
+}
+
+// the eBPF program has to agree with filter_packet, needs root
+TEST(FilterTest, Kernel) {
+  struct filter_test_packet packets[16];
+  union bpf_attr attr;
+  uint8_t frame[14 + 600];
+  uint64_t hits;
+  uint32_t key;
+  int prog_fd;
+  int map_fd;
+  int n;
+  int i;
+
+  ASSERT_EQ(0, filter_parse(filter_test_rules, sizeof(filter_test_rules) - 1));
+  prog_fd = filter_prog_load(&map_fd);
+  if(prog_fd < 0) {
+    GTEST_SKIP() << "no eBPF here";
+  }
+
+  n = filter_test_packets(packets);
+  for(i=0; i < n; i++) {
+    // the test run strips an ethernet header first
+    memset(frame, 0, 14);
+    frame[12] = (packets[i].data[0] >> 4 == 6) ? 0x86 : 0x08;
+    frame[13] = (packets[i].data[0] >> 4 == 6) ? 0xdd : 0x00;
+    memcpy(frame + 14, packets[i].data, packets[i].len);
+
+    memset(&attr, 0, sizeof(attr));
+    attr.test.prog_fd = prog_fd;
+    attr.test.data_in = (uint64_t) (uintptr_t) frame;
+    attr.test.data_size_in = 14 + packets[i].len;
+    attr.test.repeat = 1;
+    ASSERT_EQ(0, filter_bpf(BPF_PROG_TEST_RUN, &attr)) << strerror(errno);
+    ASSERT_EQ(packets[i].verdict, attr.test.retval ? FILTER_PASS : FILTER_DROP) << "packet " << i;
+  }
+
+  key = 6;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map_fd;
+  attr.key = (uint64_t) (uintptr_t) &key;
+  attr.value = (uint64_t) (uintptr_t) &hits;
+  ASSERT_EQ(0, filter_bpf(BPF_MAP_LOOKUP_ELEM, &attr));
+  ASSERT_EQ(5u, hits); // no empty packet here
+
+  close(prog_fd);
+  close(map_fd);
+}
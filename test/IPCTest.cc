@@ -4,3 +4,155 @@
 TEST(IPCTest, RemoveNonExistentClient) {
   ASSERT_EQ(-1, remove_uclient(0));
 }
+
+static void ipc_test_request(int fd, char cmd, const char* arg) {
+  uint8_t req[IPC_HDR_LEN + MAX_UCLIENT_MSG_SIZE];
+  size_t len = arg ? strlen(arg) : 0;
+
+  ipc_put_hdr(req, len, cmd, 0);
+  memcpy(req + IPC_HDR_LEN, arg, len);
+  ASSERT_EQ((ssize_t) (IPC_HDR_LEN + len), write(fd, req, IPC_HDR_LEN + len));
+}
+
+// returns the status and fills in cmd and the payload length
+static int ipc_test_response(int fd, char* cmd, size_t* len) {
+  uint8_t hdr[IPC_HDR_LEN];
+  char buf[MAX_UCLIENT_RESPONSE_SIZE];
+
+  if(read_full(fd, hdr, IPC_HDR_LEN) < 0) {
+    return -1;
+  }
+  *cmd = hdr[2];
+  *len = (hdr[0] << 8) | hdr[1];
+  if(read_full(fd, buf, *len) < 0) {
+    return -1;
+  }
+  return hdr[3];
+}
+
+TEST(IPCTest, PersistentConnection) {
+  struct uclient* ucl;
+  size_t len;
+  char cmd;
+  int sv[2];
+  int fd;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  fd = sv[0];
+  ucl = add_uclient(fd);
+  ASSERT_TRUE(ucl != NULL);
+  ASSERT_EQ(ucl, is_uclient_fd(fd));
+  ASSERT_TRUE(add_uclient(fd) == NULL);
+
+  // several requests in one read, answered in order
+  ipc_test_request(sv[1], 'p', NULL);
+  ipc_test_request(sv[1], 'a', "/dev/ttyUSB1");
+  ipc_test_request(sv[1], '?', NULL);
+  receive_uclient_msg(ucl);
+
+  ASSERT_EQ(IPC_OK, ipc_test_response(sv[1], &cmd, &len));
+  ASSERT_EQ('p', cmd);
+  ASSERT_EQ(0u, len);
+  ASSERT_EQ(IPC_E_UNSUPPORTED, ipc_test_response(sv[1], &cmd, &len));
+  ASSERT_EQ('a', cmd);
+  ASSERT_EQ(IPC_E_UNKNOWN, ipc_test_response(sv[1], &cmd, &len));
+
+  // still connected
+  ASSERT_EQ(ucl, is_uclient_fd(fd));
+  ipc_test_request(sv[1], 'l', NULL);
+  receive_uclient_msg(ucl);
+  ASSERT_EQ(IPC_OK, ipc_test_response(sv[1], &cmd, &len));
+  ASSERT_GT(len, 0u);
+
+  ipc_test_request(sv[1], 'r', "sf=13");
+  receive_uclient_msg(ucl);
+  ASSERT_EQ(IPC_E_INVALID, ipc_test_response(sv[1], &cmd, &len));
+  ASSERT_EQ(0, rn2903_settings_pending());
+
+  close(sv[1]);
+  receive_uclient_msg(ucl);
+  ASSERT_TRUE(is_uclient_fd(fd) == NULL);
+}
+
+TEST(IPCTest, SlowClient) {
+  struct uclient* ucl;
+  fd_set readfds, writefds;
+  uint8_t buf[8192];
+  size_t buf_len = 0;
+  size_t len;
+  ssize_t ret;
+  int loops = 0;
+  int sndbuf = 1;
+  int sv[2];
+  int fd;
+  int i;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  ASSERT_EQ(0, setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)));
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  fd = sv[0];
+  ucl = add_uclient(fd);
+
+  // more output than the socket takes, the rest is kept
+  for(i=0; i < 20; i++) {
+    ipc_test_request(sv[1], 'l', NULL);
+  }
+  receive_uclient_msg(ucl);
+  ASSERT_GT(ucl->out_len, 0u);
+  ASSERT_GT(ucl->in_len, 0u);
+
+  // not reading requests until it has been written
+  FD_ZERO(&readfds);
+  FD_ZERO(&writefds);
+  usock = sv[1]; // anything that isn't readable
+  add_uclients_to_fd_set(&readfds, &writefds, -1);
+  ASSERT_FALSE(FD_ISSET(fd, &readfds));
+  ASSERT_TRUE(FD_ISSET(fd, &writefds));
+
+  // read what is there, then let it write more
+  fcntl(sv[1], F_SETFL, O_NONBLOCK);
+  for(i=0; i < 20 && loops < 1000; loops++) {
+    ret = read(sv[1], buf + buf_len, sizeof(buf) - buf_len);
+    if(ret > 0) {
+      buf_len += ret;
+    }
+    while(buf_len >= IPC_HDR_LEN && buf_len >= IPC_HDR_LEN + ((buf[0] << 8) | buf[1])) {
+      ASSERT_EQ('l', buf[2]);
+      ASSERT_EQ(IPC_OK, buf[3]);
+      len = IPC_HDR_LEN + ((buf[0] << 8) | buf[1]);
+      memmove(buf, buf + len, buf_len - len);
+      buf_len -= len;
+      i++;
+    }
+
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_SET(fd, &writefds);
+    handle_uclient_connections(&readfds, &writefds);
+  }
+  ASSERT_EQ(20, i);
+  ASSERT_EQ(0u, ucl->out_len);
+  ASSERT_EQ(0u, ucl->in_len);
+
+  remove_uclient(ucl);
+  close(sv[1]);
+}
+
+TEST(IPCTest, Legacy) {
+  char buf[64];
+  int sv[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  add_uclient(sv[0]);
+
+  ASSERT_EQ(2, write(sv[1], "p", 2));
+  shutdown(sv[1], SHUT_WR);
+  receive_uclient_msg(is_uclient_fd(sv[0]));
+  ASSERT_TRUE(is_uclient_fd(sv[0]) != NULL);
+  receive_uclient_msg(is_uclient_fd(sv[0]));
+
+  // answered without a header, then closed
+  ASSERT_EQ(0, read(sv[1], buf, sizeof(buf)));
+  ASSERT_TRUE(is_uclient_fd(sv[0]) == NULL);
+  close(sv[1]);
+}
@@ -0,0 +1,86 @@
+#include "../lz.c"
+#include <gtest/gtest.h>
+
+static const char lz_test_dict[] =
+  "{\"node\":\"garden\",\"temperature\":21.5,\"humidity\":40,\"battery\":3.71}"
+  "{\"node\":\"roof\",\"temperature\":18.0,\"humidity\":55,\"battery\":3.65}";
+
+static const char lz_test_msg[] =
+  "{\"node\":\"shed\",\"temperature\":19.5,\"humidity\":51,\"battery\":3.69}";
+
+TEST(LZTest, RoundTrip) {
+  uint8_t in[1000];
+  uint8_t out[LZ_MAX_INPUT + 1];
+  const uint8_t* dec;
+  ssize_t len;
+  size_t i;
+
+  lz_init(1);
+  for(i=0; i < sizeof(in); i++) {
+    in[i] = "abcdefgh"[(i / 3) % 8];
+  }
+
+  len = lz_compress(in, sizeof(in), out, sizeof(out));
+  ASSERT_GT(len, 0);
+  ASSERT_LT(len, 100);
+  ASSERT_EQ(LZ_NO_DICT, out[0]);
+
+  ASSERT_EQ((ssize_t) sizeof(in), lz_decompress(out, len, &dec));
+  ASSERT_EQ(0, memcmp(in, dec, sizeof(in)));
+}
+
+TEST(LZTest, Dictionary) {
+  char path[] = "/tmp/lz_test_dictXXXXXX";
+  uint8_t out[LZ_MAX_INPUT + 1];
+  const uint8_t* dec;
+  ssize_t plain_len, len;
+  int fd;
+
+  lz_init(1);
+  plain_len = lz_compress((const uint8_t*) lz_test_msg, strlen(lz_test_msg), out, sizeof(out));
+
+  fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ((ssize_t) strlen(lz_test_dict), write(fd, lz_test_dict, strlen(lz_test_dict)));
+  close(fd);
+  ASSERT_EQ(0, lz_load_dict(path));
+  unlink(path);
+
+  len = lz_compress((const uint8_t*) lz_test_msg, strlen(lz_test_msg), out, sizeof(out));
+  ASSERT_GT(len, 0);
+  ASSERT_LT(len, (ssize_t) strlen(lz_test_msg) / 2);
+  if(plain_len > 0) {
+    ASSERT_LT(len, plain_len);
+  }
+  ASSERT_NE(LZ_NO_DICT, out[0]);
+
+  ASSERT_EQ((ssize_t) strlen(lz_test_msg), lz_decompress(out, len, &dec));
+  ASSERT_EQ(0, memcmp(lz_test_msg, dec, strlen(lz_test_msg)));
+
+  // a node without the dictionary can't decompress it
+  lz_init(1);
+  ASSERT_EQ(-1, lz_decompress(out, len, &dec));
+  ASSERT_EQ(1u, lz_stats.rx_unknown_dict);
+}
+
+TEST(LZTest, Incompressible) {
+  uint8_t in[200];
+  uint8_t out[LZ_MAX_INPUT + 1];
+  const uint8_t* dec;
+  uint32_t x = 12345;
+  size_t i;
+
+  lz_init(1);
+  for(i=0; i < sizeof(in); i++) {
+    x = x * 1103515245 + 12345;
+    in[i] = x >> 24;
+  }
+  ASSERT_EQ(0, lz_compress(in, sizeof(in), out, sizeof(out)));
+
+  // garbage must not decode
+  out[0] = LZ_NO_DICT;
+  out[1] = 0x0f; // no literals, match with nothing before it
+  out[2] = 0x01;
+  out[3] = 0x00;
+  ASSERT_EQ(-1, lz_decompress(out, 4, &dec));
+}
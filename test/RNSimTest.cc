@@ -0,0 +1,512 @@
+#include "../sim/rnsim.c"
+#include "../rn2903.c"
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+
+static int rnsim_test_fds[RNSIM_MAX_NODES];
+
+// socketpairs as serial lines, returns the host end of node i in fds
+static void rnsim_test_setup(int nodes, double loss, int capture) {
+  struct rnsim_params params;
+  int sv[2];
+  int i;
+
+  memset(&params, 0, sizeof(params));
+  params.loss = loss;
+  params.capture = capture;
+  rnsim_init(&params, 1);
+
+  for(i=0; i < nodes; i++) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    ASSERT_EQ(i, rnsim_add_node(sv[1]));
+    rnsim_test_fds[i] = sv[0];
+  }
+}
+
+static void rnsim_test_teardown(int nodes) {
+  int i;
+
+  for(i=0; i < nodes; i++) {
+    close(rnsim_test_fds[i]);
+    close(rnsim_nodes[i].fd);
+  }
+}
+
+static void rnsim_test_send(int node, const char* line, uint64_t now) {
+  char buf[RNSIM_MAX_LINE];
+  int len = snprintf(buf, sizeof(buf), "%s\r\n", line);
+
+  ASSERT_EQ(len, write(rnsim_test_fds[node], buf, len));
+  ASSERT_EQ(0, rnsim_read(node, now));
+}
+
+static std::string rnsim_test_recv(int node) {
+  char buf[2048];
+  ssize_t len = read(rnsim_test_fds[node], buf, sizeof(buf) - 1);
+
+  if(len <= 0) {
+    return "";
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+TEST(RNSimTest, Airtime) {
+  struct rnsim_node n;
+
+  memset(&n, 0, sizeof(n));
+  n.sf = 7;
+  n.bw = 125;
+  n.cr = 1;
+  n.prlen = 8;
+  ASSERT_EQ(41216u, rnsim_airtime_us(&n, 10));
+
+  n.sf = 12; // low data rate optimization kicks in
+  ASSERT_EQ(2465792u, rnsim_airtime_us(&n, 51));
+}
+
+TEST(RNSimTest, TransmitAndReceive) {
+  uint64_t airtime;
+
+  rnsim_test_setup(3, 0, 0);
+  rnsim_test_send(1, "radio rx 0", 0);
+  rnsim_test_send(2, "radio set sf sf7", 0); // different channel
+  rnsim_test_send(0, "radio tx 0102AB", 0);
+  ASSERT_EQ(0, rnsim_run(10000));
+  ASSERT_EQ("ok\r\n", rnsim_test_recv(0));
+  ASSERT_EQ("ok\r\n", rnsim_test_recv(1));
+  ASSERT_EQ("ok\r\n", rnsim_test_recv(2));
+
+  airtime = rnsim_airtime_us(&rnsim_nodes[0], 3);
+  ASSERT_EQ(0, rnsim_run(airtime));
+  ASSERT_EQ("", rnsim_test_recv(0));
+
+  ASSERT_EQ(0, rnsim_run(airtime + 100000));
+  ASSERT_EQ("radio_tx_ok\r\n", rnsim_test_recv(0));
+  ASSERT_EQ("radio_rx  0102AB\r\n", rnsim_test_recv(1));
+
+  // window runs out without a frame
+  rnsim_test_send(2, "radio rx 10", airtime + 100000);
+  ASSERT_EQ(0, rnsim_run(airtime + 200000));
+  ASSERT_EQ("ok\r\nradio_err\r\n", rnsim_test_recv(2));
+  ASSERT_EQ(0u, rnsim_nodes[2].rx_frames);
+
+  rnsim_test_teardown(3);
+}
+
+TEST(RNSimTest, Collision) {
+  rnsim_test_setup(3, 0, 0);
+  rnsim_test_send(2, "radio rx 0", 0);
+  rnsim_test_send(0, "radio tx 01", 0);
+  rnsim_test_send(1, "radio tx 02", 100000);
+  ASSERT_EQ(0, rnsim_run(10000000));
+
+  ASSERT_EQ("ok\r\nradio_tx_ok\r\n", rnsim_test_recv(0));
+  ASSERT_EQ("ok\r\nradio_tx_ok\r\n", rnsim_test_recv(1));
+  ASSERT_EQ("ok\r\nradio_err\r\n", rnsim_test_recv(2));
+  ASSERT_EQ(1u, rnsim_nodes[2].rx_collided);
+
+  rnsim_test_teardown(3);
+}
+
+TEST(RNSimTest, CatchPreamble) {
+  uint64_t sync_us;
+
+  rnsim_test_setup(3, 0, 0);
+  rnsim_test_send(0, "radio tx 01", 0);
+  ASSERT_EQ(0, rnsim_run(50000));
+  sync_us = (rnsim_nodes[0].prlen - RNSIM_SYNC_SYMBOLS) * rnsim_symbol_us(&rnsim_nodes[0]);
+
+  // node 1 starts listening with enough of the preamble left to sync,
+  // node 2 too late
+  rnsim_test_send(1, "radio rx 0", 50000);
+  ASSERT_EQ(0, rnsim_run(50000 + sync_us));
+  rnsim_test_send(2, "radio rx 0", 50000 + sync_us);
+  ASSERT_EQ(0, rnsim_run(10000000));
+
+  ASSERT_EQ("ok\r\nradio_tx_ok\r\n", rnsim_test_recv(0));
+  ASSERT_EQ("ok\r\nradio_rx  01\r\n", rnsim_test_recv(1));
+  ASSERT_EQ("ok\r\n", rnsim_test_recv(2));
+  ASSERT_EQ(1u, rnsim_nodes[1].rx_frames);
+  ASSERT_EQ(0u, rnsim_nodes[2].rx_frames);
+
+  rnsim_test_teardown(3);
+}
+
+TEST(RNSimTest, Capture) {
+  // the frame that started first survives the collision
+  rnsim_test_setup(3, 0, 1);
+  rnsim_test_send(2, "radio rx 0", 0);
+  rnsim_test_send(0, "radio tx 01", 0);
+  rnsim_test_send(1, "radio tx 02", 100000);
+  ASSERT_EQ(0, rnsim_run(10000000));
+
+  ASSERT_EQ("ok\r\nradio_rx  01\r\n", rnsim_test_recv(2));
+  ASSERT_EQ(0u, rnsim_nodes[2].rx_collided);
+
+  rnsim_test_teardown(3);
+}
+
+TEST(RNSimTest, RandomLoss) {
+  uint64_t now = 0;
+  int i;
+
+  // every reception is lost with the given probability
+  rnsim_test_setup(2, 0.5, 0);
+  for(i=0; i < 40; i++) {
+    rnsim_test_send(1, "radio rx 0", now);
+    ASSERT_EQ(0, rnsim_run(now + 10000));
+    rnsim_test_send(0, "radio tx 01", now + 10000);
+    now += 3000000;
+    ASSERT_EQ(0, rnsim_run(now));
+    rnsim_test_recv(0);
+    rnsim_test_recv(1);
+  }
+  ASSERT_EQ(40u, rnsim_nodes[1].rx_frames + rnsim_nodes[1].rx_lost);
+  ASSERT_GT(rnsim_nodes[1].rx_lost, 5u);
+  ASSERT_GT(rnsim_nodes[1].rx_frames, 5u);
+  ASSERT_EQ(0u, rnsim_nodes[1].rx_collided);
+
+  rnsim_test_teardown(2);
+}
+
+static int rnsim_test_tx_result = 0;
+
+static int rnsim_test_tx_done(int fds, char* buf, size_t len) {
+  rnsim_test_tx_result = buf ? 1 : -1;
+  return 0;
+}
+
+// the driver against a simulated module
+TEST(RNSimTest, Driver) {
+  const uint8_t data[] = { 0xde, 0xad };
+
+  rnsim_test_setup(2, 0, 0);
+  rnsim_test_send(1, "radio set cr 4/9", 0);
+  ASSERT_EQ(0, rnsim_run(10000));
+  ASSERT_EQ("invalid_param\r\n", rnsim_test_recv(1));
+
+  ASSERT_EQ(0, rn2903_tx(rnsim_test_fds[0], data, sizeof(data), rnsim_test_tx_done));
+  ASSERT_EQ(1, rn2903_busy());
+  ASSERT_EQ(0, rnsim_read(0, 0));
+  ASSERT_EQ(0, rnsim_run(10000000));
+
+  ASSERT_GE(rn2903_read(rnsim_test_fds[0], -1), 0);
+  ASSERT_EQ(1, rnsim_test_tx_result);
+  ASSERT_EQ(0, rn2903_busy());
+
+  rnsim_test_teardown(2);
+}
+
+static int rnsim_test_settings_result = 0;
+
+static int rnsim_test_settings_done(int fds, char* buf, size_t len) {
+  rnsim_test_settings_result = buf ? 1 : -1;
+  return 0;
+}
+
+// run the driver and module until the driver is idle
+static void rnsim_test_settle(int node) {
+  uint64_t now = 0;
+  int i;
+
+  for(i=0; i < 100 && rn2903_busy(); i++) {
+    now += 100000;
+    ASSERT_EQ(0, rnsim_read(node, now));
+    ASSERT_EQ(0, rnsim_run(now));
+    ASSERT_GE(rn2903_read(rnsim_test_fds[node], -1), 0);
+  }
+  ASSERT_EQ(0, rn2903_busy());
+}
+
+TEST(RNSimTest, Settings) {
+  struct rn2903_settings s;
+  char buf[128];
+  unsigned long sent;
+
+  ASSERT_EQ(0, rn2903_parse_settings("sf=sf9 bw=250,cr=4/6 pwr=14", 27, &s));
+  ASSERT_EQ(9, s.sf);
+  ASSERT_EQ(250, s.bw);
+  ASSERT_EQ(6, s.cr);
+  ASSERT_EQ(14, s.pwr);
+  ASSERT_EQ(0u, s.freq);
+  ASSERT_EQ(-1, rn2903_parse_settings("sf=13", 5, &s));
+  ASSERT_EQ(-1, rn2903_parse_settings("bw=200", 6, &s));
+  ASSERT_EQ(-1, rn2903_parse_settings("sf", 2, &s));
+  ASSERT_EQ(-1, rn2903_parse_settings("", 0, &s));
+
+  rnsim_test_setup(1, 0, 0);
+  memset(&rn2903_settings, 0, sizeof(rn2903_settings));
+
+  ASSERT_EQ(0, rn2903_parse_settings("sf=9 bw=250 pwr=14", 18, &s));
+  rn2903_request_settings(&s);
+  ASSERT_EQ(1, rn2903_settings_pending());
+  sent = rn2903_stats.settings_sent;
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  ASSERT_EQ(0, rn2903_settings_pending());
+  rnsim_test_settle(0);
+  ASSERT_EQ(1, rnsim_test_settings_result);
+  ASSERT_EQ(3u, rn2903_stats.settings_sent - sent);
+  ASSERT_EQ(9, rnsim_nodes[0].sf);
+  ASSERT_EQ(250, rnsim_nodes[0].bw);
+  ASSERT_EQ(14, rnsim_nodes[0].pwr);
+
+  rn2903_format_settings(&rn2903_settings, buf, sizeof(buf));
+  ASSERT_STREQ("freq=? sf=9 bw=250 cr=? pwr=14", buf);
+
+  // only what changed is sent
+  ASSERT_EQ(0, rn2903_parse_settings("sf=7 bw=250 pwr=14", 18, &s));
+  rn2903_request_settings(&s);
+  sent = rn2903_stats.settings_sent;
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  rnsim_test_settle(0);
+  ASSERT_EQ(1u, rn2903_stats.settings_sent - sent);
+  ASSERT_EQ(7, rnsim_nodes[0].sf);
+
+  // nothing to send, done right away
+  rn2903_request_settings(&s);
+  rnsim_test_settings_result = 0;
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  ASSERT_EQ(0, rn2903_busy());
+  ASSERT_EQ(1, rnsim_test_settings_result);
+
+  rnsim_test_teardown(1);
+}
+
+TEST(RNSimTest, SettingsRefused) {
+  struct rn2903_settings s;
+  char buf[RNSIM_MAX_LINE];
+  unsigned long failed;
+  ssize_t len;
+
+  rnsim_test_setup(1, 0, 0);
+  rn2903_settings = rn2903_factory_settings;
+  failed = rn2903_stats.settings_failed;
+
+  // out of range, nothing is sent
+  memset(&s, 0, sizeof(s));
+  s.sf = 9;
+  s.pwr = 30;
+  rn2903_request_settings(&s);
+  rnsim_test_settings_result = 0;
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  ASSERT_EQ(0, rn2903_busy());
+  ASSERT_EQ(-1, rnsim_test_settings_result);
+  ASSERT_EQ(12, rnsim_nodes[0].sf);
+
+  // the module takes sf but refuses pwr
+  s.pwr = 20;
+  rn2903_request_settings(&s);
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  ASSERT_EQ(0, rnsim_read(0, 0));
+  ASSERT_EQ(0, rnsim_run(100000));
+  ASSERT_GE(rn2903_read(rnsim_test_fds[0], -1), 0);
+  ASSERT_EQ(9, rnsim_nodes[0].sf);
+  len = read(rnsim_nodes[0].fd, buf, sizeof(buf) - 1);
+  ASSERT_GT(len, 0);
+  buf[len] = '\0';
+  ASSERT_STREQ("radio set pwr 20\r\n", buf);
+  ASSERT_EQ(15, write(rnsim_nodes[0].fd, "invalid_param\r\n", 15));
+  ASSERT_GE(rn2903_read(rnsim_test_fds[0], -1), 0);
+
+  // and sf goes back to what it was
+  rnsim_test_settle(0);
+  ASSERT_EQ(-1, rnsim_test_settings_result);
+  ASSERT_EQ(12, rnsim_nodes[0].sf);
+  ASSERT_EQ(12, rn2903_settings.sf);
+  ASSERT_EQ(2, rn2903_settings.pwr);
+  ASSERT_EQ(failed + 2, rn2903_stats.settings_failed);
+
+  rnsim_test_teardown(1);
+}
+
+TEST(RNSimTest, Restore) {
+  struct rn2903_settings s;
+  unsigned long sent;
+
+  rnsim_test_setup(1, 0, 0);
+  memset(&rn2903_settings, 0, sizeof(rn2903_settings));
+
+  // as rn2903_format_settings writes them
+  ASSERT_EQ(0, rn2903_parse_settings("freq=? sf=9 bw=? cr=? pwr=14", 28, &s));
+  ASSERT_EQ(0u, s.freq);
+  ASSERT_EQ(9, s.sf);
+
+  // the module still has them, one question is enough
+  rnsim_nodes[0].sf = 9;
+  rnsim_nodes[0].pwr = 14;
+  rnsim_test_settings_result = 0;
+  ASSERT_EQ(0, rn2903_restore_settings(rnsim_test_fds[0], &s, rnsim_test_settings_done));
+  ASSERT_EQ(1, rn2903_busy());
+  rnsim_test_settle(0);
+  ASSERT_EQ(1, rnsim_test_settings_result);
+  ASSERT_EQ(14, rn2903_settings.pwr);
+
+  rn2903_request_settings(&s);
+  sent = rn2903_stats.settings_sent;
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  ASSERT_EQ(0, rn2903_busy());
+  ASSERT_EQ(sent, rn2903_stats.settings_sent);
+
+  // after a reset they all go out again
+  rnsim_reset_node(&rnsim_nodes[0]);
+  memset(&rn2903_settings, 0, sizeof(rn2903_settings));
+  ASSERT_EQ(0, rn2903_restore_settings(rnsim_test_fds[0], &s, rnsim_test_settings_done));
+  rnsim_test_settle(0);
+  ASSERT_EQ(-1, rnsim_test_settings_result);
+  ASSERT_EQ(0, rn2903_settings.pwr);
+
+  rn2903_request_settings(&s);
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  rnsim_test_settle(0);
+  ASSERT_EQ(sent + 2, rn2903_stats.settings_sent);
+  ASSERT_EQ(9, rnsim_nodes[0].sf);
+
+  // what a reset leaves is right either way
+  memset(&rn2903_settings, 0, sizeof(rn2903_settings));
+  ASSERT_EQ(0, rn2903_parse_settings("sf=12 bw=125", 12, &s));
+  ASSERT_EQ(0, rn2903_restore_settings(rnsim_test_fds[0], &s, rnsim_test_settings_done));
+  ASSERT_EQ(0, rn2903_busy());
+  ASSERT_EQ(1, rnsim_test_settings_result);
+  ASSERT_EQ(12, rn2903_settings.sf);
+
+  rnsim_test_teardown(1);
+}
+
+static uint64_t rnsim_test_now;
+
+static uint64_t rnsim_test_clock() {
+  return rnsim_test_now;
+}
+
+static int rnsim_test_reset_line(int fds, int hold) {
+  if(!hold) {
+    rnsim_power_cycle(0, rnsim_test_now);
+  }
+  return 0;
+}
+
+// run module, driver and watchdog on the test clock for us
+static void rnsim_test_watch(uint64_t us) {
+  uint64_t end = rnsim_test_now + us;
+
+  while(rnsim_test_now < end) {
+    rnsim_test_now += 10000;
+    ASSERT_EQ(0, rnsim_read(0, rnsim_test_now));
+    ASSERT_EQ(0, rnsim_run(rnsim_test_now));
+    ASSERT_GE(rn2903_read(rnsim_test_fds[0], -1), 0);
+    ASSERT_EQ(0, rn2903_watchdog(rnsim_test_fds[0]));
+  }
+}
+
+// a wedged module is brought back with as little as it takes
+// and gets its settings back if it lost them
+TEST(RNSimTest, Watchdog) {
+  const uint8_t data[] = { 0xde, 0xad };
+  struct rn2903_settings s;
+  uint64_t down_us;
+
+  rnsim_test_setup(1, 0, 0);
+  rn2903_clock = rnsim_test_clock;
+  rnsim_test_now = 0;
+  memset(&rn2903_stats, 0, sizeof(rn2903_stats));
+  memset(&rn2903_settings, 0, sizeof(rn2903_settings));
+  ASSERT_EQ(0, rn2903_parse_settings("sf=7 pwr=14", 11, &s));
+  rn2903_request_settings(&s);
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  rnsim_test_watch(1000000);
+  ASSERT_EQ(0, rn2903_busy());
+
+  // stuck in rx: "radio rxstop" and one question are enough
+  rnsim_nodes[0].fault = RNSIM_FAULT_STUCK_RX;
+  rnsim_test_tx_result = 0;
+  ASSERT_EQ(0, rn2903_rx(rnsim_test_fds[0], 100, rnsim_test_tx_done));
+  rnsim_test_watch(RN2903_RADIO_US - 1000000);
+  ASSERT_EQ(0, rnsim_test_tx_result);
+  ASSERT_FALSE(rn2903_recovering(&down_us));
+  rnsim_test_watch(2000000);
+  ASSERT_EQ(-1, rnsim_test_tx_result);
+  ASSERT_EQ(1u, rn2903_stats.faults);
+  ASSERT_EQ(1u, rn2903_stats.recovered_rxstop);
+  ASSERT_EQ(0, rn2903_settings_pending());
+  ASSERT_EQ(7, rn2903_settings.sf);
+
+  // only answers "sys reset", which loses the settings
+  rnsim_nodes[0].fault = RNSIM_FAULT_MUTE;
+  rnsim_test_tx_result = 0;
+  ASSERT_EQ(0, rn2903_tx(rnsim_test_fds[0], data, sizeof(data), rnsim_test_tx_done));
+  rnsim_test_watch(RN2903_REPLY_US + 100000);
+  ASSERT_TRUE(rn2903_recovering(&down_us));
+  ASSERT_LE(100000u, down_us);
+  rnsim_test_watch(RN2903_REPLY_US + 500000);
+  ASSERT_FALSE(rn2903_recovering(&down_us));
+  ASSERT_EQ(-1, rnsim_test_tx_result);
+  ASSERT_EQ(1u, rn2903_stats.recovered_reset);
+  ASSERT_EQ(12, rn2903_settings.sf);
+  ASSERT_EQ(1, rn2903_settings_pending());
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  rnsim_test_watch(1000000);
+  ASSERT_EQ(7, rnsim_nodes[0].sf);
+  ASSERT_EQ(14, rnsim_nodes[0].pwr);
+
+  // a brownout in the middle of a window
+  rnsim_test_tx_result = 0;
+  ASSERT_EQ(0, rn2903_rx(rnsim_test_fds[0], 1000, rnsim_test_tx_done));
+  rnsim_test_watch(100000);
+  rnsim_brownout(0, rnsim_test_now);
+  rnsim_test_watch(500000);
+  ASSERT_EQ(-1, rnsim_test_tx_result);
+  ASSERT_EQ(3u, rn2903_stats.faults);
+  ASSERT_EQ(2u, rn2903_stats.recovered_rxstop);
+  ASSERT_EQ(1, rn2903_settings_pending());
+  ASSERT_EQ(0, rn2903_apply_settings(rnsim_test_fds[0], rnsim_test_settings_done));
+  rnsim_test_watch(1000000);
+  ASSERT_EQ(7, rnsim_nodes[0].sf);
+
+  // nothing but the reset line helps, and without it nothing does
+  rnsim_nodes[0].fault = RNSIM_FAULT_DEAD;
+  ASSERT_EQ(0, rn2903_get_snr(rnsim_test_fds[0], rnsim_test_tx_done));
+  rnsim_test_watch(RN2903_REPLY_US * 2 + RN2903_RESET_US + 100000);
+  ASSERT_EQ(1u, rn2903_stats.recover_failed);
+  rn2903_hw_reset = rnsim_test_reset_line;
+  rnsim_test_watch(RN2903_RETRY_US + RN2903_REPLY_US * 2 + RN2903_RESET_US + RN2903_PULSE_US);
+  ASSERT_EQ(1u, rn2903_stats.recovered_hw);
+  ASSERT_FALSE(rn2903_recovering(&down_us));
+  ASSERT_LT((uint64_t) RN2903_RETRY_US, rn2903_stats.down_us);
+  ASSERT_EQ(4u, rn2903_stats.faults);
+
+  rn2903_hw_reset = NULL;
+  rn2903_clock = NULL;
+  rnsim_test_teardown(1);
+}
+
+TEST(RNSimTest, Classify) {
+  const struct { const char* str; int token; } good[] = {
+    { "ok", RN2903_T_OK }, { "busy", RN2903_T_BUSY }, { "invalid_param", RN2903_T_INVALID_PARAM },
+    { "radio_err", RN2903_T_RADIO_ERR }, { "radio_rx", RN2903_T_RADIO_RX },
+    { "radio_tx_ok", RN2903_T_RADIO_TX_OK }, { "mac_paused", RN2903_T_MAC_PAUSED },
+    { "RN2903", RN2903_T_VERSION }, { "mac_tx_ok", RN2903_T_MAC_TX_OK }, { "mac_rx", RN2903_T_MAC_RX },
+    { "mac_err", RN2903_T_MAC_ERR }, { "not_joined", RN2903_T_NOT_JOINED },
+    { "no_free_ch", RN2903_T_NO_FREE_CH }, { "silent", RN2903_T_SILENT },
+    { "frame_counter_err_rejoin_needed", RN2903_T_FRAME_COUNTER_ERR }, { "denied", RN2903_T_DENIED },
+    { "accepted", RN2903_T_ACCEPTED }, { "keys_not_init", RN2903_T_KEYS_NOT_INIT },
+    { "invalid_data_len", RN2903_T_INVALID_DATA_LEN }, { "on", RN2903_T_ON }, { "off", RN2903_T_OFF },
+    { "lora", RN2903_T_LORA }, { "fsk", RN2903_T_FSK },
+  };
+  const char* bad[] = { "", "o", "okay", "ok ", "radio_tx", "radio_tx_okay", "radio_err 1",
+                        "RN2902 1.0.5", "rn2903", "Ok", "invalid_para", " ok" };
+  size_t i;
+
+  ASSERT_EQ((size_t) RN2903_TOKENS - 1, sizeof(good) / sizeof(good[0]));
+  for(i=0; i < sizeof(good) / sizeof(good[0]); i++) {
+    ASSERT_EQ(good[i].token, rn2903_classify(good[i].str, strlen(good[i].str))) << good[i].str;
+  }
+
+  ASSERT_EQ(RN2903_T_RADIO_RX, rn2903_classify("radio_rx  0A0B", 14));
+  ASSERT_EQ(RN2903_T_VERSION, rn2903_classify("RN2903 1.0.5 Nov 06 2018 10:45:27", 33));
+  for(i=0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    ASSERT_EQ(RN2903_T_UNKNOWN, rn2903_classify(bad[i], strlen(bad[i]))) << bad[i];
+  }
+}
@@ -0,0 +1,43 @@
+#include "../radiostate.c"
+#include <gtest/gtest.h>
+
+TEST(RadioStateTest, SaveAndLoad) {
+  const char* path = "/tmp/lora_iface_test.radio";
+  const char* version = "RN2903 1.0.3 Aug  8 2017 15:11:09";
+  struct rn2903_settings s;
+  int same;
+  int fd;
+
+  unlink(path);
+  ASSERT_EQ(0, radiostate_open(path, version, &s, &same));
+  ASSERT_TRUE(radiostate_enabled());
+  ASSERT_EQ(0, rn2903_parse_settings("sf=10 bw=125 pwr=14", 19, &s));
+  radiostate_save(&s);
+  s.sf = 7;
+  radiostate_save(&s);
+  close(radiostate_fd);
+
+  memset(&s, 0, sizeof(s));
+  ASSERT_EQ(1, radiostate_open(path, version, &s, &same));
+  ASSERT_EQ(1, same);
+  ASSERT_EQ(7, s.sf);
+  ASSERT_EQ(14, s.pwr);
+  ASSERT_EQ(0u, s.freq);
+  close(radiostate_fd);
+
+  // another module, or one that didn't say what it was
+  ASSERT_EQ(1, radiostate_open(path, "RN2903 1.0.5 Nov 06 2018 10:45:27", &s, &same));
+  ASSERT_EQ(0, same);
+  close(radiostate_fd);
+  ASSERT_EQ(1, radiostate_open(path, "", &s, &same));
+  ASSERT_EQ(0, same);
+  close(radiostate_fd);
+
+  fd = open(path, O_WRONLY | O_TRUNC);
+  ASSERT_EQ(18, write(fd, "RN2903\nsf=99 bw=1\n", 18));
+  close(fd);
+  ASSERT_EQ(0, radiostate_open(path, version, &s, &same));
+  close(radiostate_fd);
+  radiostate_fd = -1;
+  unlink(path);
+}
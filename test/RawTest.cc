@@ -0,0 +1,177 @@
+#include "../raw.c"
+#include <gtest/gtest.h>
+#include <thread>
+
+static const char* raw_test_path = "/tmp/lora_iface_test.raw";
+
+// run the daemon side once, waiting up to timeout_ms for something to do
+static void raw_test_poll(int timeout_ms) {
+  struct timeval tv;
+  fd_set readfds;
+  int maxfd;
+
+  FD_ZERO(&readfds);
+  maxfd = raw_add_to_fd_set(&readfds, -1);
+  tv.tv_sec = 0;
+  tv.tv_usec = timeout_ms * 1000;
+  if(select(maxfd + 1, &readfds, NULL, NULL, &tv) > 0) {
+    raw_handle(&readfds);
+  }
+}
+
+static uint8_t raw_test_src;
+static uint8_t raw_test_data[RAW_MAX_PAYLOAD];
+static size_t raw_test_len;
+
+static void raw_test_handler(uint8_t src, uint8_t dst, const uint8_t* data, size_t len) {
+  raw_test_src = src;
+  memcpy(raw_test_data, data, len);
+  raw_test_len = len;
+}
+
+TEST(RawTest, Link) {
+  const uint8_t data[] = { 'h', 'i' };
+  uint8_t frame[LINK_MAX_FRAME];
+  uint8_t big[LINK_MAX_FRAME];
+  const uint8_t* payload;
+  ssize_t len;
+
+  link_init(1, 0, 0);
+  ASSERT_EQ((size_t) RAW_MAX_PAYLOAD, link_raw_max());
+  ASSERT_EQ(-1, link_raw_frame(2, 0, big, sizeof(big)));
+  ASSERT_EQ(0, link_raw_frame(2, 0, data, sizeof(data)));
+  ASSERT_FALSE(link_tx_ready());
+  len = link_next_frame(frame, sizeof(frame));
+  ASSERT_EQ((ssize_t) (LINK_HDR_MIN_LEN + sizeof(data)), len);
+  ASSERT_EQ(LINK_F_RAW, frame[0]);
+  link_tx_done(1, 0);
+  ASSERT_TRUE(link_tx_ready());
+
+  // goes to the handler, not the TUN interface
+  link_init(2, 0, 0);
+  link_raw_handler = raw_test_handler;
+  ASSERT_EQ(0, link_rx_frame(frame, len, &payload));
+  link_raw_handler = NULL;
+  ASSERT_EQ(1u, link_stats.rx_raw);
+  ASSERT_EQ(1, raw_test_src);
+  ASSERT_EQ(sizeof(data), raw_test_len);
+  ASSERT_EQ(0, memcmp(data, raw_test_data, sizeof(data)));
+}
+
+TEST(RawTest, TxQueue) {
+  uint8_t big[RAW_MAX_PAYLOAD + 1];
+  uint8_t buf[RAW_MAX_PAYLOAD];
+  struct raw_error err;
+  uint8_t dst, flags;
+  int fd;
+  int i;
+
+  ASSERT_EQ(0, raw_open(raw_test_path));
+  fd = raw_connect(raw_test_path);
+  ASSERT_GE(fd, 0);
+  raw_test_poll(100); // accept
+
+  ASSERT_EQ(0, raw_send(fd, 7, RAW_TX_ARQ, (const uint8_t*) "abc", 3));
+  ASSERT_EQ(0, raw_send(fd, 8, 0, big, sizeof(big)));
+  raw_test_poll(100);
+
+  ASSERT_EQ(sizeof(err), (size_t) recv(fd, &err, sizeof(err), MSG_DONTWAIT));
+  ASSERT_EQ(RAW_MSG_ERROR, err.type);
+  ASSERT_EQ(RAW_E_TOO_BIG, err.code);
+  ASSERT_EQ(RAW_MAX_PAYLOAD, err.max_len);
+
+  ASSERT_EQ(1, raw_tx_pending());
+  ASSERT_EQ(3, raw_tx_pop(&dst, &flags, buf, sizeof(buf)));
+  ASSERT_EQ(7, dst);
+  ASSERT_EQ(RAW_TX_ARQ, flags);
+  ASSERT_EQ(0, memcmp("abc", buf, 3));
+  ASSERT_EQ(0, raw_tx_pending());
+
+  // less fits with a key, the client is told how much
+  raw_set_max_payload(RAW_MAX_PAYLOAD - 10);
+  ASSERT_EQ(0, raw_send(fd, 8, 0, big, RAW_MAX_PAYLOAD - 9));
+  ASSERT_EQ(0, raw_send(fd, 8, 0, big, RAW_MAX_PAYLOAD - 10));
+  raw_test_poll(100);
+  ASSERT_EQ(sizeof(err), (size_t) recv(fd, &err, sizeof(err), MSG_DONTWAIT));
+  ASSERT_EQ(RAW_E_TOO_BIG, err.code);
+  ASSERT_EQ(RAW_MAX_PAYLOAD - 10, err.max_len);
+  ASSERT_EQ(RAW_MAX_PAYLOAD - 10, raw_tx_pop(&dst, &flags, buf, sizeof(buf)));
+  raw_set_max_payload(RAW_MAX_PAYLOAD);
+
+  // a full queue stops reading clients
+  for(i=0; i < RAW_TX_QUEUE + 1; i++) {
+    ASSERT_EQ(0, raw_send(fd, 1, 0, buf, 1));
+  }
+  raw_test_poll(100);
+  ASSERT_EQ(RAW_TX_QUEUE, raw_tx_pending());
+  raw_tx_pop(&dst, &flags, buf, sizeof(buf));
+  raw_test_poll(100);
+  ASSERT_EQ(RAW_TX_QUEUE, raw_tx_pending());
+  while(raw_tx_pending()) {
+    raw_tx_pop(&dst, &flags, buf, sizeof(buf));
+  }
+
+  close(fd);
+  raw_test_poll(100);
+  ASSERT_EQ(0, raw_client_count);
+}
+
+TEST(RawTest, Ring) {
+  const struct raw_ring* ring = NULL;
+  struct raw_rx_meta meta;
+  struct raw_notify msg;
+  uint8_t data[RAW_MAX_PAYLOAD];
+  size_t size = 0;
+  uint32_t head;
+  int fd;
+  int i;
+
+  fd = raw_connect(raw_test_path);
+  ASSERT_GE(fd, 0);
+  raw_test_poll(100); // accept
+
+  std::thread subscriber([&]() { ring = raw_subscribe(fd, &size); });
+  for(i=0; i < 10 && raw_subscribed[raw_client_count - 1] == 0; i++) {
+    raw_test_poll(100);
+  }
+  subscriber.join();
+  ASSERT_TRUE(ring != NULL);
+  ASSERT_EQ(sizeof(struct raw_ring), size);
+  ASSERT_EQ((uint32_t) RAW_MAX_PAYLOAD, ring->max_payload);
+
+  head = ring->head;
+  ASSERT_EQ(-1, raw_ring_read(ring, head, &meta, data));
+  ASSERT_EQ(EAGAIN, errno);
+
+  raw_rx_frame(3, 255, (const uint8_t*) "hello", 5);
+  ASSERT_EQ(-1, raw_ring_read(ring, head, &meta, data)); // waits for the SNR
+  raw_rx_done(7, 915000000, 125, 9, 5);
+
+  ASSERT_EQ(sizeof(msg), (size_t) recv(fd, &msg, sizeof(msg), MSG_DONTWAIT));
+  ASSERT_EQ(RAW_MSG_NOTIFY, msg.type);
+  ASSERT_EQ(head + 1, msg.head);
+
+  ASSERT_EQ(5, raw_ring_read(ring, head, &meta, data));
+  ASSERT_EQ(0, memcmp("hello", data, 5));
+  ASSERT_EQ(3, meta.src);
+  ASSERT_EQ(255, meta.dst);
+  ASSERT_EQ(7, meta.snr);
+  ASSERT_EQ(RAW_RSSI_UNKNOWN, meta.rssi);
+  ASSERT_EQ(915000000u, meta.freq);
+  ASSERT_EQ(9, meta.sf);
+
+  // a reader that falls a whole ring behind loses frames
+  for(i=0; i < RAW_RING_SLOTS; i++) {
+    raw_rx_frame(3, 255, (const uint8_t*) "x", 1);
+    raw_rx_done(RAW_SNR_UNKNOWN, 0, 0, 0, 0);
+  }
+  ASSERT_EQ(-1, raw_ring_read(ring, head, &meta, data));
+  ASSERT_EQ(ENOBUFS, errno);
+  ASSERT_EQ(1, raw_ring_read(ring, head + 1, &meta, data));
+  ASSERT_EQ(RAW_SNR_UNKNOWN, meta.snr);
+
+  munmap((void*) ring, size);
+  close(fd);
+  raw_test_poll(100);
+  unlink(raw_test_path);
+}
@@ -0,0 +1,197 @@
+#include "../relay.c"
+#include <gtest/gtest.h>
+
+static uint64_t relay_test_now;
+
+static uint64_t relay_test_clock() {
+  return relay_test_now;
+}
+
+TEST(RelayTest, Probability) {
+  int i;
+
+  relay_init(3, 1);
+  ASSERT_EQ(256, relay_probability(0));
+
+  // about RELAY_TARGET of the neighbours relay, never less than the floor
+  for(i=1; i <= 4; i++) {
+    relay_neighbour(i, 1000000);
+  }
+  ASSERT_EQ(4, relay_neighbours(1000000));
+  ASSERT_EQ(256 * RELAY_TARGET / 4, relay_probability(1000000));
+  for(i=5; i <= 100; i++) {
+    relay_neighbour(i, 1000000);
+  }
+  ASSERT_EQ(RELAY_MIN_PROB, relay_probability(1000000));
+
+  // neighbours not heard from in a while don't count
+  ASSERT_EQ(0, relay_neighbours(1000000 + RELAY_NEIGHBOUR_MS * 1000ull));
+  relay_init(0, 1);
+}
+
+TEST(RelayTest, Flood) {
+  const uint8_t data[] = { 'h', 'i' };
+  uint8_t frame[LINK_MAX_FRAME];
+  uint8_t relayed[LINK_MAX_FRAME];
+  const uint8_t* payload;
+  ssize_t len;
+  int i;
+
+  link_clock = relay_test_clock;
+  relay_test_now = 1000000;
+
+  // node 1 starts a flood
+  relay_init(3, 1);
+  link_init(1, 0, 0);
+  ASSERT_EQ(0, link_raw_frame(LINK_BROADCAST, 0, data, sizeof(data)));
+  len = link_next_frame(frame, sizeof(frame));
+  ASSERT_EQ((ssize_t) (LINK_HDR_MIN_LEN + 2 + sizeof(data)), len);
+  ASSERT_EQ(LINK_F_RAW | LINK_F_RELAY, frame[0]);
+  ASSERT_EQ(RELAY_BYTE(0, 3), frame[LINK_HDR_MIN_LEN]);
+  link_tx_done(1, 0);
+
+  // node 2 has no other neighbours, so it relays it after a while
+  relay_init(3, 2);
+  link_init(2, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(frame, len, &payload));
+  ASSERT_EQ(1u, link_stats.rx_raw);
+  ASSERT_EQ(1u, relay_stats.queued);
+  relay_test_now += RELAY_DELAY_FRAMES * arq_airtime_us(len) + 1;
+  ASSERT_EQ(len, link_next_frame(relayed, sizeof(relayed)));
+  ASSERT_EQ(1u, relay_stats.sent);
+  ASSERT_EQ(RELAY_BYTE(1, 2), relayed[LINK_HDR_MIN_LEN]);
+  ASSERT_EQ(0, memcmp(frame, relayed, LINK_HDR_MIN_LEN));
+  ASSERT_EQ(0, memcmp(frame + LINK_HDR_MIN_LEN + 1, relayed + LINK_HDR_MIN_LEN + 1, 1 + sizeof(data)));
+  ASSERT_EQ(0, link_next_frame(relayed, sizeof(relayed)));
+
+  // copies of it are dropped, not delivered again
+  ASSERT_EQ(0, link_rx_frame(relayed, len, &payload));
+  ASSERT_EQ(1u, link_stats.rx_raw);
+  ASSERT_EQ(1u, relay_stats.copies);
+
+  // node 1 hears its own flood come back
+  relay_init(3, 1);
+  link_init(1, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(relayed, len, &payload));
+  ASSERT_EQ(1u, relay_stats.copies);
+  ASSERT_EQ(0u, link_stats.rx_raw);
+
+  // enough copies while waiting and there's no need to relay it
+  relay_init(3, 3);
+  link_init(3, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(frame, len, &payload));
+  ASSERT_EQ(1u, relay_stats.queued);
+  for(i=1; i < RELAY_CANCEL_COPIES; i++) {
+    ASSERT_EQ(0, link_rx_frame(relayed, len, &payload));
+  }
+  ASSERT_EQ(1u, relay_stats.cancelled);
+  relay_test_now += 60000000;
+  ASSERT_EQ(0, link_next_frame(relayed, sizeof(relayed)));
+
+  // out of hops
+  relay_init(3, 3);
+  frame[LINK_HDR_MIN_LEN] = RELAY_BYTE(3, 0);
+  ASSERT_EQ(0, link_rx_frame(frame, len, &payload));
+  ASSERT_EQ(0u, relay_stats.queued);
+  ASSERT_EQ(1u, relay_stats.skipped);
+
+  // more hops than there can be
+  frame[LINK_HDR_MIN_LEN] = RELAY_BYTE(8, 8);
+  ASSERT_EQ(-1, link_rx_frame(frame, len, &payload));
+
+  relay_init(0, 1);
+  link_clock = NULL;
+}
+
+TEST(RelayTest, Repeated) {
+  const uint8_t data[] = { 'a', 'r', 'p' };
+  uint8_t first[LINK_MAX_FRAME];
+  uint8_t again[LINK_MAX_FRAME];
+  uint8_t relayed[LINK_MAX_FRAME];
+  const uint8_t* payload;
+  ssize_t len;
+
+  link_clock = relay_test_clock;
+  relay_test_now = 1000000;
+
+  // node 1 sends the same broadcast twice, as a retry would
+  relay_init(3, 1);
+  link_init(1, 0, 0);
+  ASSERT_EQ(0, link_raw_frame(LINK_BROADCAST, 0, data, sizeof(data)));
+  len = link_next_frame(first, sizeof(first));
+  link_tx_done(1, 0);
+  ASSERT_EQ(0, link_raw_frame(LINK_BROADCAST, 0, data, sizeof(data)));
+  ASSERT_EQ(len, link_next_frame(again, sizeof(again)));
+  link_tx_done(1, 0);
+  ASSERT_NE(0, memcmp(first, again, len));
+
+  // node 2 relays, both are delivered
+  relay_init(3, 2);
+  link_init(2, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(first, len, &payload));
+  relay_test_now += RELAY_DELAY_FRAMES * arq_airtime_us(len) + 1;
+  ASSERT_EQ(len, link_next_frame(relayed, sizeof(relayed)));
+  ASSERT_EQ(0, link_rx_frame(again, len, &payload));
+  ASSERT_EQ(2u, link_stats.rx_raw);
+  ASSERT_EQ(2u, relay_stats.heard);
+  ASSERT_EQ(0u, relay_stats.copies);
+
+  // so are they at node 3, which doesn't relay, but the copy isn't
+  relay_init(0, 3);
+  link_init(3, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(first, len, &payload));
+  ASSERT_EQ(0, link_rx_frame(relayed, len, &payload));
+  ASSERT_EQ(0, link_rx_frame(again, len, &payload));
+  ASSERT_EQ(2u, link_stats.rx_raw);
+  ASSERT_EQ(1u, relay_stats.copies);
+
+  relay_init(0, 1);
+  link_clock = NULL;
+}
+
+TEST(RelayTest, Sealed) {
+  const uint8_t data[] = { 's', 'e', 'c', 'r', 'e', 't' };
+  uint8_t frame[LINK_MAX_FRAME];
+  uint8_t relayed[LINK_MAX_FRAME];
+  const uint8_t* payload;
+  ssize_t len;
+
+  link_clock = relay_test_clock;
+  relay_test_now = 1000000;
+
+  ASSERT_EQ(0, aead_set_key(aead_test_key, AEAD_DEFAULT_TAG, 0));
+  relay_init(2, 1);
+  link_init(1, 0, 0);
+  ASSERT_EQ(0, link_raw_frame(LINK_BROADCAST, 0, data, sizeof(data)));
+  len = link_next_frame(frame, sizeof(frame));
+  ASSERT_GT(len, 0);
+  ASSERT_TRUE(frame[0] & LINK_F_SEC);
+  link_tx_done(1, 0);
+
+  relay_init(2, 2);
+  link_init(2, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(frame, len, &payload));
+  ASSERT_EQ(1u, relay_stats.queued);
+  relay_test_now += RELAY_DELAY_FRAMES * arq_airtime_us(len) + 1;
+  ASSERT_EQ(len, link_next_frame(relayed, sizeof(relayed)));
+
+  // node 3 only hears the relay, the changed hop byte still opens.
+  // one key state stands in for both nodes, so it starts over
+  ASSERT_EQ(0, aead_set_key(aead_test_key, AEAD_DEFAULT_TAG, 0));
+  relay_init(2, 3);
+  link_init(3, 0, 0);
+  ASSERT_EQ(0, link_rx_frame(relayed, len, &payload));
+  ASSERT_EQ(1u, link_stats.rx_raw);
+  ASSERT_EQ(1u, relay_stats.queued);
+
+  // but one tampered with doesn't
+  ASSERT_EQ(0, aead_set_key(aead_test_key, AEAD_DEFAULT_TAG, 0));
+  relay_init(2, 3);
+  relayed[LINK_HDR_MIN_LEN] = RELAY_BYTE(0, 1);
+  ASSERT_EQ(-1, link_rx_frame(relayed, len, &payload));
+
+  aead_on = 0;
+  frag_reserve(0);
+  relay_init(0, 1);
+  link_clock = NULL;
+}
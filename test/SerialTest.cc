@@ -0,0 +1,129 @@
+#include "../serial.c"
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define SERIAL_TEST_VERSION "RN2903 1.0.3 Aug  8 2017 15:11:09"
+
+enum { SERIAL_TEST_SILENT, SERIAL_TEST_ANSWER, SERIAL_TEST_LATE, SERIAL_TEST_GARBAGE };
+
+static int serial_test_masters[3];
+static int serial_test_slaves[3];
+static char serial_test_names[3][64];
+
+// modules behind PTYs, each answering the way modes says until killed
+static pid_t serial_test_modules(const int* modes, int count) {
+  struct pollfd p[3];
+  char buf[128];
+  int m[3];
+  pid_t pid;
+  ssize_t len;
+  int i;
+
+  memcpy(m, modes, count * sizeof(m[0]));
+  for(i=0; i < count; i++) {
+    serial_test_masters[i] = rnsim_open_pty(serial_test_names[i], sizeof(serial_test_names[i]),
+                                            &serial_test_slaves[i]);
+    if(serial_test_masters[i] < 0) {
+      return -1;
+    }
+  }
+  pid = fork();
+  if(pid != 0) {
+    return pid;
+  }
+
+  while(1) {
+    for(i=0; i < count; i++) {
+      p[i].fd = serial_test_masters[i];
+      p[i].events = POLLIN;
+    }
+    if(poll(p, count, 1000) <= 0) {
+      _exit(0);
+    }
+    for(i=0; i < count; i++) {
+      if(!(p[i].revents & POLLIN) || (len = read(p[i].fd, buf, sizeof(buf) - 1)) <= 0) {
+        continue;
+      }
+      buf[len] = '\0';
+      if(!strstr(buf, "sys get ver")) {
+        continue;
+      }
+      switch(m[i]) {
+      case SERIAL_TEST_LATE:
+        usleep(50000);
+        // fall through
+      case SERIAL_TEST_ANSWER:
+        dprintf(p[i].fd, SERIAL_TEST_VERSION "\r\n");
+        break;
+      case SERIAL_TEST_GARBAGE:
+        dprintf(p[i].fd, "invalid_param\r\n");
+        m[i] = SERIAL_TEST_ANSWER;
+        break;
+      }
+    }
+  }
+}
+
+static void serial_test_done(pid_t pid, int count) {
+  int i;
+
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  for(i=0; i < count; i++) {
+    close(serial_test_masters[i]);
+    close(serial_test_slaves[i]);
+  }
+}
+
+static int serial_test_probe(const int* modes, int count, uint64_t timeout_us, int* which, char* version) {
+  char* devs[3];
+  pid_t pid;
+  int fd;
+  int i;
+
+  pid = serial_test_modules(modes, count);
+  if(pid < 0) {
+    return -2;
+  }
+  for(i=0; i < count; i++) {
+    devs[i] = serial_test_names[i];
+  }
+  *which = -1;
+  fd = serial_probe(devs, count, B57600, timeout_us, which, version, SERIAL_VERSION_SIZE);
+  if(fd >= 0) {
+    close(fd);
+  }
+  serial_test_done(pid, count);
+  return fd;
+}
+
+TEST(SerialTest, Probe) {
+  char version[SERIAL_VERSION_SIZE];
+  struct timespec start, end;
+  int which;
+
+  // the first device to answer wins if those before it can't
+  const int first_silent[] = { SERIAL_TEST_SILENT, SERIAL_TEST_ANSWER };
+  ASSERT_LE(0, serial_test_probe(first_silent, 2, 200000, &which, version));
+  ASSERT_EQ(1, which);
+  ASSERT_STREQ(SERIAL_TEST_VERSION, version);
+
+  // order decides between two that answer, without waiting out the timeout
+  const int both[] = { SERIAL_TEST_LATE, SERIAL_TEST_ANSWER };
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ASSERT_LE(0, serial_test_probe(both, 2, 5000000, &which, version));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ASSERT_EQ(0, which);
+  ASSERT_GT(2, end.tv_sec - start.tv_sec);
+
+  // a module that answers something else is asked again
+  const int garbage[] = { SERIAL_TEST_SILENT, SERIAL_TEST_SILENT, SERIAL_TEST_GARBAGE };
+  ASSERT_LE(0, serial_test_probe(garbage, 3, 200000, &which, version));
+  ASSERT_EQ(2, which);
+
+  const int none[] = { SERIAL_TEST_SILENT };
+  ASSERT_EQ(-1, serial_test_probe(none, 1, 50000, &which, version));
+  ASSERT_EQ(-1, which);
+}
@@ -0,0 +1,47 @@
+#include "../shmstats.c"
+#include <gtest/gtest.h>
+
+TEST(ShmStatsTest, Snapshot) {
+  char path[] = "/tmp/shmstats_test.XXXXXX";
+  const struct shmstats_page* page;
+  struct shmstats_page snap;
+  struct shmstats_counters c;
+  size_t size;
+  int fd;
+
+  fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  ASSERT_EQ(0, shmstats_create(path, 7, 1000));
+  page = shmstats_open(path, &size);
+  ASSERT_TRUE(page != NULL);
+  ASSERT_EQ(sizeof(struct shmstats_page), size);
+
+  memset(&c, 0, sizeof(c));
+  c.tx_frames = 42;
+  c.snr_min = -3;
+  shmstats_publish(&c, 2000);
+
+  ASSERT_EQ(0, shmstats_snapshot(page, size, &snap));
+  ASSERT_EQ((uint32_t) SHMSTATS_VERSION, snap.version);
+  ASSERT_EQ(7u, snap.node_id);
+  ASSERT_EQ(0u, snap.seq & 1);
+  ASSERT_EQ(42u, snap.c.tx_frames);
+  ASSERT_EQ(-3, snap.c.snr_min);
+  ASSERT_EQ(1000u, snap.updated_us - snap.started_us);
+
+  // a daemon that wrote fewer fields
+  memset(&snap, 0xff, sizeof(snap));
+  ASSERT_EQ(0, shmstats_snapshot(page, offsetof(struct shmstats_page, c.tx_bytes), &snap));
+  ASSERT_EQ(42u, snap.c.tx_frames);
+  ASSERT_EQ(0u, snap.c.tx_bytes);
+  ASSERT_EQ(0u, snap.c.snr_count);
+
+  // never finishes writing
+  __atomic_store_n(&shmstats_page->seq, shmstats_page->seq + 1, __ATOMIC_RELAXED);
+  ASSERT_EQ(-1, shmstats_snapshot(page, size, &snap));
+  ASSERT_EQ(EAGAIN, errno);
+
+  unlink(path);
+}
@@ -0,0 +1,194 @@
+#include "../spool.c"
+#include <gtest/gtest.h>
+
+static const char* spool_test_path = "/tmp/lora_iface_test.spool";
+static const char* spool_test_classes = "/tmp/lora_iface_test.classes";
+
+static size_t spool_test_packet(uint8_t* pkt, int dport, int n, size_t len) {
+  memset(pkt, 0, len);
+  pkt[0] = 0x45;
+  pkt[2] = len >> 8;
+  pkt[3] = len;
+  pkt[9] = 17;
+  pkt[22] = dport >> 8;
+  pkt[23] = dport;
+  pkt[24] = n >> 8;
+  pkt[25] = n;
+  return len;
+}
+
+static ssize_t spool_test_pop(uint8_t* buf, size_t size) {
+  ssize_t len = spool_peek(buf, size);
+
+  if(len > 0) {
+    spool_pop();
+  }
+  return len;
+}
+
+static void spool_test_setup() {
+  const char classes[] =
+    "# telemetry first\n"
+    "0 udp dport 5683\n"
+    "\n"
+    "1 udp port 1883   # MQTT-SN\n";
+  int fd;
+
+  unlink(spool_test_path);
+  fd = open(spool_test_classes, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_EQ((ssize_t) sizeof(classes) - 1, write(fd, classes, sizeof(classes) - 1));
+  close(fd);
+  ASSERT_EQ(0, spool_load_classes(spool_test_classes));
+  ASSERT_EQ(0, spool_open(spool_test_path));
+  ASSERT_TRUE(spool_enabled());
+}
+
+TEST(SpoolTest, Classes) {
+  uint8_t pkt[64];
+  int fd;
+
+  spool_test_setup();
+  ASSERT_EQ(0, spool_class(pkt, spool_test_packet(pkt, 5683, 0, 40)));
+  ASSERT_EQ(1, spool_class(pkt, spool_test_packet(pkt, 1883, 0, 40)));
+  ASSERT_EQ(-1, spool_class(pkt, spool_test_packet(pkt, 53, 0, 40)));
+
+  fd = open(spool_test_classes, O_WRONLY | O_TRUNC);
+  ASSERT_EQ(13, write(fd, "9 udp port 53", 13));
+  close(fd);
+  ASSERT_EQ(-1, spool_load_classes(spool_test_classes));
+
+  fd = open(spool_test_classes, O_WRONLY | O_TRUNC);
+  ASSERT_EQ(7, write(fd, "2 bogus", 7));
+  close(fd);
+  ASSERT_EQ(-1, spool_load_classes(spool_test_classes));
+  unlink(spool_test_classes);
+}
+
+TEST(SpoolTest, Order) {
+  uint8_t pkt[64];
+  uint8_t out[64];
+  int i;
+
+  spool_test_setup();
+
+  // two destinations at priority 1, then one packet at priority 0
+  for(i=0; i < 3; i++) {
+    ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 1883, i, 40), 1, 7));
+  }
+  ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 1883, 10, 40), 1, 9));
+  ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 5683, 20, 40), 0, 7));
+  ASSERT_EQ(5u, spool_stats.depth);
+
+  // priority first, then the destinations take turns
+  const int expected[] = { 20, 0, 10, 1, 2 };
+  for(i=0; i < 5; i++) {
+    ASSERT_EQ(40, spool_test_pop(out, sizeof(out)));
+    ASSERT_EQ(expected[i], (out[24] << 8) | out[25]) << i;
+  }
+  ASSERT_EQ(0, spool_test_pop(out, sizeof(out)));
+  ASSERT_EQ(0u, spool_stats.depth);
+  ASSERT_EQ(5u, spool_stats.sent);
+}
+
+TEST(SpoolTest, Restart) {
+  uint8_t pkt[600];
+  uint8_t out[600];
+  int i;
+
+  spool_test_setup();
+  for(i=0; i < 10; i++) {
+    ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 5683, i, 100 + i), 0, 3));
+  }
+  ASSERT_EQ(100, spool_test_pop(out, sizeof(out)));
+
+  // one the link layer didn't take isn't sent
+  ASSERT_EQ(-1, spool_peek(out, 100));
+  ASSERT_EQ(101, spool_peek(out, sizeof(out)));
+  ASSERT_EQ(9u, spool_stats.depth);
+
+  // what wasn't sent is still there, in order
+  ASSERT_EQ(0, spool_open(spool_test_path));
+  ASSERT_EQ(9u, spool_stats.recovered);
+  for(i=1; i < 10; i++) {
+    ASSERT_EQ(100 + i, spool_test_pop(out, sizeof(out)));
+    ASSERT_EQ(i, (out[24] << 8) | out[25]);
+  }
+
+  // a record cut short by a crash is left out, along with what follows
+  for(i=0; i < 3; i++) {
+    ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 5683, i, 100), 0, 3));
+  }
+  spool_map[(size_t) spool_cur * SPOOL_SEGMENT_SIZE + spool_off - 8] ^= 0xff;
+  ASSERT_EQ(0, spool_open(spool_test_path));
+  ASSERT_EQ(2u, spool_stats.recovered);
+
+  // and its space is used again
+  ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 5683, 3, 100), 0, 3));
+  ASSERT_EQ(0, spool_open(spool_test_path));
+  ASSERT_EQ(3u, spool_stats.recovered);
+}
+
+TEST(SpoolTest, Full) {
+  uint8_t pkt[1500];
+  uint8_t out[1500];
+  unsigned long pushed = 0;
+  int i;
+
+  spool_test_setup();
+  while(spool_push(pkt, spool_test_packet(pkt, 5683, pushed, sizeof(pkt)), 0, 1) == 0) {
+    pushed++;
+  }
+  ASSERT_EQ(1u, spool_stats.full);
+  ASSERT_GT(pushed, (unsigned long) (SPOOL_SEGMENTS - 1) * (SPOOL_SEGMENT_SIZE / 1512));
+
+  // a segment is reused once all of it has been sent
+  for(i=0; i < SPOOL_SEGMENT_SIZE / 1512; i++) {
+    ASSERT_EQ(1500, spool_test_pop(out, sizeof(out)));
+  }
+  ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 5683, 1, sizeof(pkt)), 0, 1));
+
+  ASSERT_EQ(0, spool_open(spool_test_path));
+  ASSERT_EQ(pushed - SPOOL_SEGMENT_SIZE / 1512 + 1, spool_stats.recovered);
+  ASSERT_EQ(1500, spool_test_pop(out, sizeof(out)));
+  ASSERT_EQ(SPOOL_SEGMENT_SIZE / 1512, (out[24] << 8) | out[25]);
+  unlink(spool_test_path);
+}
+
+TEST(SpoolTest, LinkDown) {
+  struct timeval tv;
+  uint8_t pkt[64];
+
+  // at SF7 a full frame takes a fraction of the stall time
+  spool_test_setup();
+  arq_us_per_byte = 100;
+  spool_link_ready(1, 1000000);
+  ASSERT_FALSE(spool_absorbing(1000000));
+
+  // not taking packets for a while is down
+  spool_link_ready(0, 1500000);
+  ASSERT_FALSE(spool_absorbing(1500000));
+  ASSERT_EQ(0, spool_push(pkt, spool_test_packet(pkt, 5683, 0, 40), 0, 1));
+  spool_synced_us = 1000000;
+  ASSERT_EQ(1, spool_timeout(1500000, &tv));
+  ASSERT_EQ(0, tv.tv_sec);
+  ASSERT_EQ(500000, tv.tv_usec);
+
+  // the sync is due first, then the stall
+  spool_flush(2000000);
+  ASSERT_EQ(1u, spool_stats.syncs);
+  ASSERT_EQ(1, spool_timeout(2000000, &tv));
+  ASSERT_EQ(1, tv.tv_sec);
+  ASSERT_TRUE(spool_absorbing(1000000 + SPOOL_STALL_US));
+  ASSERT_EQ(0, spool_timeout(1000000 + SPOOL_STALL_US, &tv));
+
+  spool_link_ready(1, 4000000);
+  ASSERT_FALSE(spool_absorbing(4000000));
+
+  // at SF12 sending the fragments of one packet takes longer than that
+  arq_us_per_byte = ARQ_DEFAULT_US_PER_BYTE;
+  spool_link_ready(0, 4000000);
+  ASSERT_FALSE(spool_absorbing(4000000 + SPOOL_STALL_US));
+  ASSERT_FALSE(spool_absorbing(4000000 + FRAG_MAX_FRAGMENTS * arq_airtime_us(LINK_MAX_FRAME)));
+  ASSERT_TRUE(spool_absorbing(4000000 + SPOOL_STALL_FRAMES * arq_airtime_us(LINK_MAX_FRAME)));
+  unlink(spool_test_path);
+}
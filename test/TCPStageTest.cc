@@ -0,0 +1,220 @@
+#include "../tcp_stage.c"
+#include <gtest/gtest.h>
+
+// build an IPv4 TCP packet with a timestamp option
+static size_t make_tcp(uint8_t* p, uint32_t seq, uint32_t ack, uint16_t win,
+                       uint16_t id, uint8_t flags, size_t data_len) {
+  size_t len = 20 + 32 + data_len;
+  size_t i;
+
+  memset(p, 0, len);
+  p[0] = 0x45;
+  tcp_put16(p + 2, len);
+  tcp_put16(p + 4, id);
+  p[6] = 0x40; // DF
+  p[8] = 64;
+  p[9] = 6;
+  p[12] = 10; p[15] = 1;
+  p[16] = 10; p[19] = 2;
+  tcp_put16(p + 10, tcp_ip_checksum(p, 20));
+
+  tcp_put16(p + 20, 40000);
+  tcp_put16(p + 22, 22);
+  tcp_put32(p + 24, seq);
+  tcp_put32(p + 28, ack);
+  p[32] = 8 << 4;
+  p[33] = flags;
+  tcp_put16(p + 34, win);
+  tcp_put16(p + 36, 0xbeef); // checksum is carried as is
+  p[40] = 1; p[41] = 1; p[42] = 8; p[43] = 10;
+  tcp_put32(p + 44, seq * 3);
+  tcp_put32(p + 48, ack * 5);
+
+  for(i=0; i < data_len; i++) {
+    p[52 + i] = i;
+  }
+  return len;
+}
+
+TEST(TCPStageTest, ThinAcks) {
+  uint8_t pkt[200];
+  uint8_t out[200];
+  size_t len;
+
+  tcp_stage_init(1);
+
+  len = make_tcp(pkt, 1, 1000, 500, 1, TCP_ACK, 0);
+  ASSERT_EQ(0, tcp_stage_push(pkt, len, 0));
+  // duplicate ack is kept
+  ASSERT_EQ(0, tcp_stage_push(pkt, len, 0));
+  len = make_tcp(pkt, 1, 1000, 500, 2, TCP_ACK, 10);
+  ASSERT_EQ(0, tcp_stage_push(pkt, len, 0));
+  len = make_tcp(pkt, 1, 2000, 500, 3, TCP_ACK, 0);
+  ASSERT_EQ(0, tcp_stage_push(pkt, len, 0));
+  ASSERT_EQ(2, tcp_stage_stats.acks_thinned);
+
+  // data packet first, then the newest ack
+  ASSERT_EQ(62, tcp_stage_pop(out, sizeof(out), NULL));
+  ASSERT_EQ(52, tcp_stage_pop(out, sizeof(out), NULL));
+  ASSERT_EQ(2000, tcp_get32(out + 28));
+  ASSERT_EQ(0, tcp_stage_pop(out, sizeof(out), NULL));
+}
+
+TEST(TCPStageTest, CompressRoundTrip) {
+  uint8_t pkt[200];
+  uint8_t hc[200];
+  const uint8_t* out;
+  size_t len;
+  ssize_t hc_len;
+  int i;
+
+  tcp_stage_init(1);
+
+  len = make_tcp(pkt, 100, 5000, 1000, 7, TCP_ACK, 20);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ(len + 2, hc_len);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(9, hc, hc_len, &out));
+  ASSERT_EQ(0, memcmp(pkt, out, len));
+
+  for(i=1; i < 5; i++) {
+    len = make_tcp(pkt, 100 + i * 20, 5000, 1000 + (i == 3), 7 + i, TCP_ACK | TCP_PSH, 20);
+    hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+    ASSERT_GT(hc_len, 0);
+    ASSERT_LT(hc_len, (ssize_t) len - 30);
+
+    // losing a compressed packet doesn't affect the next one
+    if(i == 2) {
+      continue;
+    }
+    ASSERT_EQ((ssize_t) len, tcp_decompress(9, hc, hc_len, &out));
+    ASSERT_EQ(0, memcmp(pkt, out, len));
+  }
+}
+
+TEST(TCPStageTest, LostFullHeader) {
+  uint8_t pkt[200];
+  uint8_t hc[200];
+  const uint8_t* out;
+  size_t len;
+  ssize_t hc_len;
+
+  tcp_stage_init(1);
+
+  len = make_tcp(pkt, 100, 5000, 1000, 7, TCP_ACK, 0);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ((ssize_t) len, tcp_decompress(9, hc, hc_len, &out));
+
+  // retransmission goes back in sequence space: new full header, lost
+  len = make_tcp(pkt, 50, 5000, 1000, 8, TCP_ACK, 0);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ(len + 2, hc_len);
+
+  len = make_tcp(pkt, 60, 5000, 1000, 9, TCP_ACK, 0);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ(-1, tcp_decompress(9, hc, hc_len, &out));
+  ASSERT_EQ(1, tcp_stage_stats.rx_no_context);
+}
+
+TEST(TCPStageTest, RetransmitFullHeader) {
+  uint8_t pkt[200];
+  uint8_t hc[200];
+  const uint8_t* out;
+  size_t len;
+  ssize_t hc_len;
+
+  tcp_stage_init(1);
+
+  // the first data packet and its full header are lost
+  len = make_tcp(pkt, 1000, 5000, 1000, 1, TCP_ACK, 20);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ((ssize_t) len + 2, hc_len);
+  len = make_tcp(pkt, 1020, 5000, 1000, 2, TCP_ACK, 20);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ(-1, tcp_decompress(9, hc, hc_len, &out));
+
+  // the retransmission of either has a full header again
+  len = make_tcp(pkt, 1000, 5000, 1000, 3, TCP_ACK, 20);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ((ssize_t) len + 2, hc_len);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(9, hc, hc_len, &out));
+  len = make_tcp(pkt, 1020, 5000, 1000, 4, TCP_ACK, 20);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_EQ((ssize_t) len + 2, hc_len);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(9, hc, hc_len, &out));
+
+  // new data is compressed again
+  len = make_tcp(pkt, 1040, 5000, 1000, 5, TCP_ACK, 20);
+  hc_len = tcp_compress(pkt, len, hc, sizeof(hc));
+  ASSERT_LT(hc_len, (ssize_t) len);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(9, hc, hc_len, &out));
+  ASSERT_EQ(0, memcmp(pkt, out, len));
+
+  // so is a window update, but not a duplicate ACK
+  len = make_tcp(pkt, 1060, 6000, 1000, 6, TCP_ACK, 0);
+  ASSERT_LT(tcp_compress(pkt, len, hc, sizeof(hc)), (ssize_t) len);
+  len = make_tcp(pkt, 1060, 6000, 2000, 7, TCP_ACK, 0);
+  ASSERT_LT(tcp_compress(pkt, len, hc, sizeof(hc)), (ssize_t) len);
+  len = make_tcp(pkt, 1060, 6000, 2000, 8, TCP_ACK, 0);
+  ASSERT_EQ((ssize_t) len + 2, tcp_compress(pkt, len, hc, sizeof(hc)));
+
+  // nor the first packet after a FIN
+  len = make_tcp(pkt, 1060, 6000, 2000, 9, TCP_ACK | TCP_FIN, 0);
+  ASSERT_EQ(0, tcp_compress(pkt, len, hc, sizeof(hc)));
+  len = make_tcp(pkt, 1061, 6001, 2000, 10, TCP_ACK, 0);
+  ASSERT_EQ((ssize_t) len + 2, tcp_compress(pkt, len, hc, sizeof(hc)));
+}
+
+TEST(TCPStageTest, MappedDestination) {
+  uint8_t pkt[200], out[300];
+  const uint8_t* dec;
+  size_t len;
+  ssize_t clen;
+
+  tcp_stage_init(1);
+  addrmap_init(NULL);
+  len = make_tcp(pkt, 1000, 2000, 500, 1, TCP_ACK, 10);
+  addrmap_learn(pkt + 16, 4, 5, 1, 0);
+
+  clen = tcp_compress(pkt, len, out, sizeof(out));
+  ASSERT_EQ((ssize_t) len - 1, clen);
+  ASSERT_TRUE(out[0] & TCP_HC_MAPPED);
+
+  // the receiver doesn't know its address yet
+  ASSERT_EQ(-1, tcp_decompress(1, out, clen, &dec));
+  ASSERT_EQ(1u, tcp_stage_stats.rx_unknown_addr);
+
+  addrmap_learn_local(pkt + 12, 4);
+  addrmap_learn_local(pkt + 16, 4);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(1, out, clen, &dec));
+  ASSERT_EQ(0, memcmp(pkt, dec, len));
+}
+
+TEST(TCPStageTest, RoutedDestination) {
+  uint8_t pkt[200], out[300];
+  const uint8_t* dec;
+  size_t len;
+  ssize_t clen;
+
+  // the destination is a host behind node 5, which only routes for it
+  tcp_stage_init(1);
+  addrmap_init(NULL);
+  len = make_tcp(pkt, 1000, 2000, 500, 1, TCP_ACK, 10);
+  addrmap_learn(pkt + 16, 4, 5, 0, 0);
+
+  clen = tcp_compress(pkt, len, out, sizeof(out));
+  ASSERT_EQ((ssize_t) len + 2, clen);
+  ASSERT_FALSE(out[0] & TCP_HC_MAPPED);
+
+  // node 5 has addresses of its own, and rebuilds it as it was
+  addrmap_init(NULL);
+  addrmap_learn_local(pkt + 12, 4);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(1, out, clen, &dec));
+  ASSERT_EQ(0, memcmp(pkt, dec, len));
+
+  len = make_tcp(pkt, 1010, 2000, 500, 2, TCP_ACK, 10);
+  clen = tcp_compress(pkt, len, out, sizeof(out));
+  ASSERT_LT(clen, (ssize_t) len);
+  ASSERT_EQ((ssize_t) len, tcp_decompress(1, out, clen, &dec));
+  ASSERT_EQ(0, memcmp(pkt, dec, len));
+  ASSERT_EQ(0u, tcp_stage_stats.rx_unknown_addr);
+}
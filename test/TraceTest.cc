@@ -0,0 +1,66 @@
+#include "../trace.c"
+#include <gtest/gtest.h>
+
+TEST(TraceTest, Buckets) {
+  uint64_t v;
+  uint64_t low;
+  int b;
+  int prev = -1;
+
+  for(v=0; v < TRACE_SUB_COUNT; v++) {
+    ASSERT_EQ((int) v, trace_bucket(v));
+  }
+
+  // buckets are ordered and within 1/64 of the value
+  for(v=1; v < ((uint64_t) 1 << TRACE_MAX_BITS); v = v * 3 / 2 + 1) {
+    b = trace_bucket(v);
+    ASSERT_GE(b, prev);
+    ASSERT_LT(b, TRACE_BUCKETS);
+    low = trace_bucket_value(b);
+    ASSERT_LE(low, v);
+    ASSERT_LE(v - low, v / (TRACE_SUB_COUNT / 2));
+    ASSERT_EQ(b, trace_bucket(low));
+    prev = b;
+  }
+
+  ASSERT_EQ(TRACE_BUCKETS - 1, trace_bucket(((uint64_t) 1 << TRACE_MAX_BITS) - 1));
+  ASSERT_EQ(TRACE_BUCKETS - 1, trace_bucket(UINT64_MAX));
+}
+
+TEST(TraceTest, Percentiles) {
+  struct trace_hist* h = &trace_hists[TRACE_AIRTIME];
+  char buf[2048];
+  uint64_t p;
+  int i;
+
+  trace_reset();
+  ASSERT_EQ(0u, trace_percentile(h, 0.5));
+
+  // 1 ms to 1 s
+  for(i=1; i <= 1000; i++) {
+    trace_record(TRACE_AIRTIME, i * 1000);
+  }
+  ASSERT_EQ(1000u, h->count);
+  ASSERT_EQ(1000u, h->min);
+  ASSERT_EQ(1000000u, h->max);
+
+  p = trace_percentile(h, 0.5);
+  ASSERT_GE(p, 500000u);
+  ASSERT_LE(p, 500000u + 500000u / 64);
+  p = trace_percentile(h, 0.99);
+  ASSERT_GE(p, 990000u);
+  ASSERT_LE(p, 990000u + 990000u / 64);
+  ASSERT_EQ(1000000u, trace_percentile(h, 1.0));
+
+  trace_since(TRACE_RX, 0, 100); // not traced
+  trace_since(TRACE_RX, 100, 50);
+  ASSERT_EQ(0u, trace_hists[TRACE_RX].count);
+  trace_since(TRACE_RX, 100, 150);
+  ASSERT_EQ(50u, trace_hists[TRACE_RX].max);
+
+  ASSERT_GT(trace_dump(buf, sizeof(buf)), 0u);
+  ASSERT_TRUE(strstr(buf, "airtime") != NULL);
+
+  trace_reset();
+  ASSERT_EQ(0u, h->count);
+}
@@ -0,0 +1,93 @@
+#include "../transcript.c"
+#include <gtest/gtest.h>
+
+static const char* transcript_test_path = "/tmp/lora_iface_test.transcript";
+
+static void transcript_test_record() {
+  const char pkt_in[] = "\x45packet in";
+  const char pkt_out[] = "\x45packet out";
+
+  ASSERT_EQ(0, transcript_record_open(transcript_test_path, "-n 1 -r 3"));
+  transcript_record(TRANSCRIPT_SERIAL_OUT, "sys get ver\r\n", 13);
+  transcript_record(TRANSCRIPT_SERIAL_IN, "RN2903 1.0.5\r\n", 14);
+  transcript_flush();
+  transcript_record(TRANSCRIPT_TUN_IN, pkt_in, sizeof(pkt_in));
+  transcript_record(TRANSCRIPT_TUN_OUT, pkt_out, sizeof(pkt_out));
+  transcript_flush();
+  ASSERT_EQ(4u, transcript_stats.records);
+}
+
+TEST(TranscriptTest, Varint) {
+  const uint64_t values[] = { 0, 1, 127, 128, 300, 1ull << 35, (uint64_t) -1 };
+  uint8_t buf[10];
+  uint64_t v;
+  size_t len;
+  size_t pos;
+  size_t i;
+
+  for(i=0; i < sizeof(values) / sizeof(values[0]); i++) {
+    len = put_varint(buf, values[i]);
+    pos = 0;
+    ASSERT_EQ(0, get_varint(buf, len, &pos, &v));
+    ASSERT_EQ(values[i], v);
+    ASSERT_EQ(len, pos);
+
+    // cut short
+    pos = 0;
+    ASSERT_EQ(-1, get_varint(buf, len - 1, &pos, &v));
+  }
+}
+
+TEST(TranscriptTest, Replay) {
+  char buf[64];
+  int fds;
+  int fdi;
+
+  transcript_test_record();
+  ASSERT_EQ(0, transcript_replay_open(transcript_test_path, 1, &fds, &fdi));
+  ASSERT_TRUE(transcript_replaying());
+  ASSERT_STREQ("-n 1 -r 3", tr_args);
+
+  // waits for the daemon to send the command
+  ASSERT_EQ(0, transcript_replay_step());
+  ASSERT_EQ(13, write(fds, "sys get ver\r\n", 13));
+
+  // then answers it, with the clock at the time of the answer
+  ASSERT_EQ(0, transcript_replay_step());
+  ASSERT_GE(transcript_now_us(), tr_start_us);
+  ASSERT_EQ(14, read(fds, buf, sizeof(buf)));
+  ASSERT_EQ(0, memcmp("RN2903 1.0.5\r\n", buf, 14));
+
+  // the packet comes in once the answer has been read
+  ASSERT_EQ(0, transcript_replay_step());
+  ASSERT_EQ(11, recv(fdi, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp("\x45packet in", buf, 11));
+
+  ASSERT_EQ(0, transcript_replay_step());
+  ASSERT_EQ(12, send(fdi, "\x45packet out", 12, 0));
+  ASSERT_EQ(1, transcript_replay_step());
+
+  ASSERT_EQ(4u, transcript_stats.records);
+  ASSERT_EQ(14u, transcript_stats.serial_in_bytes);
+  ASSERT_EQ(1u, transcript_stats.tun_out);
+  ASSERT_EQ(0, transcript_replay_report(stderr));
+  close(fds);
+  close(fdi);
+}
+
+TEST(TranscriptTest, Diverged) {
+  int fds;
+  int fdi;
+
+  transcript_test_record();
+  ASSERT_EQ(0, transcript_replay_open(transcript_test_path, 1, &fds, &fdi));
+
+  ASSERT_EQ(13, write(fds, "sys get ver\n\n", 13));
+  ASSERT_EQ(1, transcript_replay_step());
+  ASSERT_EQ(0u, transcript_stats.records);
+  ASSERT_EQ(-1, transcript_replay_report(stderr));
+
+  close(fds);
+  close(fdi);
+  unlink(transcript_test_path);
+}
@@ -0,0 +1,158 @@
+#include "../tune.c"
+#include <gtest/gtest.h>
+
+static int tune_test_mtu;
+static int tune_test_qlen;
+static int tune_test_fail; // TUNE_TEST_MTU and TUNE_TEST_QLEN
+
+#define TUNE_TEST_MTU (1)
+#define TUNE_TEST_QLEN (2)
+
+static int tune_test_set_mtu(int mtu) {
+  if(tune_test_fail & TUNE_TEST_MTU) {
+    return -1;
+  }
+  tune_test_mtu = mtu;
+  return 0;
+}
+
+static int tune_test_set_qlen(int qlen) {
+  if(tune_test_fail & TUNE_TEST_QLEN) {
+    return -1;
+  }
+  tune_test_qlen = qlen;
+  return 0;
+}
+
+// packets read as soon as there is room, taken every packet_us
+static uint64_t tune_test_busy(uint64_t now, int packets, uint64_t packet_us) {
+  int i;
+
+  for(i=0; i < packets; i++) {
+    tune_packet_taken(now + 1000, now + packet_us);
+    now += packet_us;
+  }
+  return now;
+}
+
+TEST(TuneTest, Bounds) {
+  int min, max;
+
+  ASSERT_EQ(0, tune_parse_bounds("300-1500", TUNE_MIN_MTU, TUNE_MAX_MTU, &min, &max));
+  ASSERT_EQ(300, min);
+  ASSERT_EQ(1500, max);
+  ASSERT_EQ(0, tune_parse_bounds("5-5", 1, TUNE_MAX_QLEN, &min, &max));
+  ASSERT_EQ(-1, tune_parse_bounds("300", TUNE_MIN_MTU, TUNE_MAX_MTU, &min, &max));
+  ASSERT_EQ(-1, tune_parse_bounds("300-", TUNE_MIN_MTU, TUNE_MAX_MTU, &min, &max));
+  ASSERT_EQ(-1, tune_parse_bounds("300-9000", TUNE_MIN_MTU, TUNE_MAX_MTU, &min, &max));
+  ASSERT_EQ(-1, tune_parse_bounds("1500-300", TUNE_MIN_MTU, TUNE_MAX_MTU, &min, &max));
+  ASSERT_EQ(-1, tune_parse_bounds("0-10", 1, TUNE_MAX_QLEN, &min, &max));
+}
+
+TEST(TuneTest, Targets) {
+  uint64_t now = 1000000;
+
+  tune_set_mtu = tune_test_set_mtu;
+  tune_set_qlen = tune_test_set_qlen;
+  tune_test_fail = 0;
+  ASSERT_EQ(0, tune_init(TUNE_DEFAULT_MTU_MIN, TUNE_DEFAULT_MTU_MAX, TUNE_DEFAULT_QLEN_MIN, TUNE_DEFAULT_QLEN_MAX,
+                         TUNE_DEFAULT_MTU, TUNE_DEFAULT_QLEN, now));
+  ASSERT_TRUE(tune_enabled());
+
+  // nothing happens until frames have gone out
+  now = tune_test_busy(now, 10, 2000000);
+  ASSERT_EQ(0, tune_update(now));
+  ASSERT_EQ(0, tune_update(now + TUNE_INTERVAL_US));
+
+  // SF12: a frame takes 7 s, so one per packet and 10 packets in 20 s
+  arq_us_per_byte = 27000;
+  link_stats.tx_frames += 20;
+  now += TUNE_INTERVAL_US * 2;
+  ASSERT_EQ(1, tune_update(now));
+  ASSERT_EQ(TUNE_DEFAULT_MTU_MIN, tune_test_mtu);
+  ASSERT_EQ(10, tune_test_qlen);
+  ASSERT_EQ(10u, tune_stats.qlen);
+  ASSERT_EQ(1u, tune_stats.changes);
+
+  // not every interval, and not for small differences
+  link_stats.tx_frames += 20;
+  now = tune_test_busy(now, 3, 1800000);
+  ASSERT_EQ(0, tune_update(now));
+  ASSERT_EQ(0, tune_update(now + TUNE_INTERVAL_US));
+  now += TUNE_INTERVAL_US;
+
+  // SF7: frames of 0.3 s, as many as fit, and packets drain fast.
+  // it started without IPv6, so it stays below where that comes in
+  arq_us_per_byte = 1000;
+  link_stats.tx_frames += 100;
+  now = tune_test_busy(now, 40, 100000);
+  now += TUNE_INTERVAL_US;
+  ASSERT_EQ(1, tune_update(now));
+  ASSERT_EQ(TUNE_IPV6_MIN_MTU - 1, tune_test_mtu);
+  ASSERT_EQ(TUNE_DEFAULT_QLEN_MAX, tune_test_qlen);
+
+  // a packet only gets through 90% of the time in 3 frames at 3% loss
+  for(int i=0; i < 20 && tune_stats.loss < 29; i++) {
+    link_stats.tx_frames += 1000;
+    arq_stats.retransmits += 30;
+    tune_update(now);
+    now += TUNE_INTERVAL_US;
+  }
+  ASSERT_EQ(3 * (FRAG_MAX_CHUNK - (int) aead_overhead()), (int) tune_stats.mtu);
+
+  // a failure leaves the values as they were
+  tune_test_fail = TUNE_TEST_MTU | TUNE_TEST_QLEN;
+  arq_stats.retransmits += 500;
+  link_stats.tx_frames += 1000;
+  ASSERT_EQ(-1, tune_update(now));
+  ASSERT_EQ(1u, tune_stats.failed);
+  ASSERT_EQ(3 * (FRAG_MAX_CHUNK - (int) aead_overhead()), (int) tune_stats.mtu);
+
+  // but one that fails doesn't keep the other from being recorded
+  tune_test_fail = TUNE_TEST_QLEN;
+  now = tune_test_busy(now, 10, 2000000);
+  now += TUNE_INTERVAL_US;
+  link_stats.tx_frames += 1000;
+  ASSERT_EQ(-1, tune_update(now));
+  ASSERT_EQ(2u, tune_stats.failed);
+  ASSERT_EQ(TUNE_DEFAULT_MTU_MIN, tune_test_mtu);
+  ASSERT_EQ(TUNE_DEFAULT_MTU_MIN, (int) tune_stats.mtu);
+  ASSERT_EQ(TUNE_DEFAULT_QLEN_MAX, (int) tune_stats.qlen);
+
+  arq_us_per_byte = ARQ_DEFAULT_US_PER_BYTE;
+  tune_set_mtu = NULL;
+  tune_set_qlen = NULL;
+  tune_on = 0;
+}
+
+TEST(TuneTest, Unreadable) {
+  // without the values the interface has there is nothing to tune from
+  ASSERT_EQ(-1, tune_init(TUNE_DEFAULT_MTU_MIN, TUNE_DEFAULT_MTU_MAX, TUNE_DEFAULT_QLEN_MIN, TUNE_DEFAULT_QLEN_MAX,
+                          -1, TUNE_DEFAULT_QLEN, 1000000));
+  ASSERT_FALSE(tune_enabled());
+  ASSERT_EQ(-1, tune_init(TUNE_DEFAULT_MTU_MIN, TUNE_DEFAULT_MTU_MAX, TUNE_DEFAULT_QLEN_MIN, TUNE_DEFAULT_QLEN_MAX,
+                          TUNE_DEFAULT_MTU, -1, 1000000));
+  ASSERT_FALSE(tune_enabled());
+}
+
+TEST(TuneTest, KeepIPv6) {
+  uint64_t now = 1000000;
+
+  // an interface that has IPv6 keeps an MTU it works with, even at SF12
+  tune_set_mtu = tune_test_set_mtu;
+  tune_set_qlen = tune_test_set_qlen;
+  tune_test_fail = 0;
+  ASSERT_EQ(0, tune_init(TUNE_DEFAULT_MTU_MIN, TUNE_DEFAULT_MTU_MAX, TUNE_DEFAULT_QLEN_MIN, TUNE_DEFAULT_QLEN_MAX,
+                         1500, TUNE_DEFAULT_QLEN, now));
+  arq_us_per_byte = 27000;
+  link_stats.tx_frames += 20;
+  now = tune_test_busy(now, 10, 2000000);
+  now += TUNE_INTERVAL_US;
+  ASSERT_EQ(1, tune_update(now));
+  ASSERT_EQ(TUNE_IPV6_MIN_MTU, tune_test_mtu);
+
+  arq_us_per_byte = ARQ_DEFAULT_US_PER_BYTE;
+  tune_set_mtu = NULL;
+  tune_set_qlen = NULL;
+  tune_on = 0;
+}
@@ -1,5 +1,26 @@
 #include "IPCTest.cc"
 #include "IPPacketTest.cc"
+#include "ARQTest.cc"
+#include "FECTest.cc"
+#include "TCPStageTest.cc"
+#include "LZTest.cc"
+#include "AddrMapTest.cc"
+#include "RNSimTest.cc"
+#include "TraceTest.cc"
+#include "ShmStatsTest.cc"
+#include "RawTest.cc"
+#include "CaptureTest.cc"
+#include "TranscriptTest.cc"
+#include "DedupTest.cc"
+#include "FilterTest.cc"
+#include "AEADTest.cc"
+#include "SpoolTest.cc"
+#include "TuneTest.cc"
+#include "SerialTest.cc"
+#include "RadioStateTest.cc"
+#include "RelayTest.cc"
+
+int debug = 0;
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
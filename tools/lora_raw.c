@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "raw.h"
+
+// Sends and receives raw frames through a lora_iface instance started
+// with -w (see raw.c):
+//
+//   lora_raw -s 7 hello     # send "hello" to node 7
+//   lora_raw -l             # print received frames
+
+#define RAW_BROADCAST (0xff)
+
+// how long to wait for the daemon to refuse a frame
+#define LORA_RAW_ERROR_WAIT_MS (200)
+
+static void print_frame(uint32_t n, const struct raw_rx_meta* m, const uint8_t* data, int len) {
+  int i;
+
+  printf("%u %lu.%06lu src %u dst %u", n, (unsigned long) (m->time_us / 1000000),
+         (unsigned long) (m->time_us % 1000000), m->src, m->dst);
+  if(m->snr != RAW_SNR_UNKNOWN) {
+    printf(" snr %d", m->snr);
+  }
+  if(m->freq) {
+    printf(" freq %u", m->freq);
+  }
+  if(m->sf) {
+    printf(" sf %u", m->sf);
+  }
+  if(m->bw) {
+    printf(" bw %u", m->bw);
+  }
+  printf(" len %d ", len);
+  for(i=0; i < len; i++) {
+    printf("%02x", data[i]);
+  }
+  printf("\n");
+}
+
+static int listen_frames(int fd) {
+  const struct raw_ring* ring;
+  struct raw_rx_meta meta;
+  struct raw_notify msg;
+  uint8_t data[RAW_MAX_PAYLOAD];
+  uint32_t next;
+  size_t size;
+  ssize_t len;
+  int ret;
+
+  ring = raw_subscribe(fd, &size);
+  if(!ring) {
+    fprintf(stderr, "Failed to subscribe: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // only what comes in from now on
+  next = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  while(1) {
+    len = recv(fd, &msg, sizeof(msg), 0);
+    if(len <= 0) {
+      return (len < 0) ? 1 : 0;
+    }
+    if(msg.type != RAW_MSG_NOTIFY) {
+      continue;
+    }
+    while(1) {
+      ret = raw_ring_read(ring, next, &meta, data);
+      if(ret < 0 && errno == ENOBUFS) {
+        fprintf(stderr, "Missed frames, catching up\n");
+        next = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - RAW_RING_SLOTS / 2;
+        continue;
+      }
+      if(ret < 0) {
+        break;
+      }
+      print_frame(next, &meta, data, ret);
+      next++;
+    }
+    fflush(stdout);
+  }
+}
+
+void usage(FILE* out, char* name) {
+  fprintf(out, "Usage: %s [-w raw_socket] -l | -s node_id [-a] data\n", name);
+  fprintf(out, "\n");
+  fprintf(out, "  -w: raw frame socket of the lora_iface instance (default: %s)\n", RAW_DEFAULT_SOCKET);
+  fprintf(out, "  -l: print received frames\n");
+  fprintf(out, "  -s: send data to this node id (%d for broadcast)\n", RAW_BROADCAST);
+  fprintf(out, "  -a: retransmit until acknowledged if lora_iface runs with ARQ\n");
+}
+
+int main(int argc, char* argv[]) {
+  const char* path = RAW_DEFAULT_SOCKET;
+  int listen_opt = 0;
+  int dst = -1;
+  uint8_t flags = 0;
+  struct raw_error err;
+  struct pollfd pfd;
+  int opt;
+  int fd;
+
+  while((opt = getopt(argc, argv, "w:ls:a")) > 0) {
+    switch(opt) {
+      case 'w':
+        path = optarg;
+        break;
+      case 'l':
+        listen_opt = 1;
+        break;
+      case 's':
+        dst = atoi(optarg);
+        if(dst < 0 || dst > RAW_BROADCAST) {
+          usage(stderr, argv[0]);
+          return 1;
+        }
+        break;
+      case 'a':
+        flags |= RAW_TX_ARQ;
+        break;
+      default:
+        usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+  if(listen_opt == (dst >= 0) || (dst >= 0 && optind != argc - 1)) {
+    usage(stderr, argv[0]);
+    return 1;
+  }
+
+  fd = raw_connect(path);
+  if(fd < 0) {
+    fprintf(stderr, "Connect failed to %s: %s\n", path, strerror(errno));
+    fprintf(stderr, "Are you sure you have a lora_iface instance running with -w?\n");
+    return 1;
+  }
+
+  if(listen_opt) {
+    return listen_frames(fd);
+  }
+
+  if(strlen(argv[optind]) > RAW_MAX_PAYLOAD) {
+    fprintf(stderr, "At most %d bytes fit in a frame\n", RAW_MAX_PAYLOAD);
+    return 1;
+  }
+  if(raw_send(fd, dst, flags, (const uint8_t*) argv[optind], strlen(argv[optind])) < 0) {
+    fprintf(stderr, "Send failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // a frame that isn't taken is answered right away
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  if(poll(&pfd, 1, LORA_RAW_ERROR_WAIT_MS) > 0
+     && recv(fd, &err, sizeof(err), MSG_DONTWAIT) == sizeof(err) && err.type == RAW_MSG_ERROR) {
+    if(err.code == RAW_E_TOO_BIG) {
+      fprintf(stderr, "At most %u bytes fit in a frame\n", err.max_len);
+    } else {
+      fprintf(stderr, "The frame was not taken\n");
+    }
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  return 0;
+}
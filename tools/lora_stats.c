@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "shmstats.h"
+
+// Prints the counters lora_iface publishes in its shared memory stats
+// file without talking to it (see shmstats.c):
+//
+//   lora_stats             # once
+//   lora_stats -i 1 -j     # every second, one JSON object per line
+
+static uint64_t now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define COUNTER(name) { #name, offsetof(struct shmstats_counters, name) }
+
+static const struct {
+  const char* name;
+  size_t offset;
+} counters[] = {
+  COUNTER(tx_packets),
+  COUNTER(tx_frames),
+  COUNTER(tx_bytes),
+  COUNTER(rx_packets),
+  COUNTER(rx_frames),
+  COUNTER(rx_bytes),
+  COUNTER(tx_failed),
+  COUNTER(tx_too_big),
+  COUNTER(tx_arq_gave_up),
+  COUNTER(tx_acks_thinned),
+  COUNTER(rx_invalid),
+  COUNTER(rx_not_for_us),
+  COUNTER(rx_duplicate),
+  COUNTER(rx_frag_expired),
+  COUNTER(rx_frag_invalid),
+  COUNTER(rx_tcp_invalid),
+  COUNTER(rx_lz_invalid),
+  COUNTER(airtime_us),
+  COUNTER(arq_retransmits),
+  COUNTER(serial_errors),
+  COUNTER(cmd_retries),
+  COUNTER(rx_timeouts),
+  COUNTER(tx_timeouts),
+  COUNTER(snr_count),
+  COUNTER(tx_raw),
+  COUNTER(rx_raw),
+  COUNTER(rx_flood_checked),
+  COUNTER(rx_flood_dropped),
+  COUNTER(rx_flood_evicted),
+  COUNTER(tx_sealed),
+  COUNTER(rx_opened),
+  COUNTER(rx_unsealed),
+  COUNTER(rx_auth_failed),
+  COUNTER(rx_replayed),
+  COUNTER(spool_depth),
+  COUNTER(spooled),
+  COUNTER(spool_sent),
+  COUNTER(spool_full),
+  COUNTER(spool_held),
+  COUNTER(if_mtu),
+  COUNTER(if_txqueuelen),
+  COUNTER(if_tunings),
+  COUNTER(radio_faults),
+  COUNTER(radio_recovered),
+  COUNTER(radio_resets),
+  COUNTER(radio_down_us),
+  COUNTER(relay_heard),
+  COUNTER(relay_copies),
+  COUNTER(relay_queued),
+  COUNTER(relay_skipped),
+  COUNTER(relay_cancelled),
+  COUNTER(relay_sent),
+  COUNTER(relay_neighbours),
+  COUNTER(lz_tx_packets),
+  COUNTER(lz_tx_compressed),
+  COUNTER(lz_tx_bytes_in),
+  COUNTER(lz_tx_bytes_out),
+  COUNTER(lz_tx_cpu_ns),
+  COUNTER(lz_rx_packets),
+  COUNTER(lz_rx_cpu_ns)
+};
+
+static void print_text(const struct shmstats_page* s) {
+  const struct shmstats_counters* c = &s->c;
+  size_t i;
+
+  printf("pid %u, node %u, up %lus, updated %lums ago%s\n",
+         s->pid, s->node_id,
+         (unsigned long) ((s->updated_us - s->started_us) / 1000000),
+         (unsigned long) ((now_us() - s->updated_us) / 1000),
+         kill(s->pid, 0) < 0 && errno == ESRCH ? " (not running)" : "");
+
+  for(i=0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+    printf("%-18s %lu\n", counters[i].name,
+           (unsigned long) *(const uint64_t*) ((const uint8_t*) c + counters[i].offset));
+  }
+  printf("%-18s %u\n", "stage_depth", c->stage_depth);
+  printf("%-18s %u\n", "arq_pending", c->arq_pending);
+  if(c->snr_count) {
+    printf("%-18s %d dB (min %d, mean %.1f, max %d)\n", "snr", c->snr_last,
+           c->snr_min, (double) c->snr_sum / c->snr_count, c->snr_max);
+  }
+  if(c->rx_flood_checked) {
+    printf("%-18s %.1f%% of broadcasts\n", "flood_dup_rate",
+           100.0 * c->rx_flood_dropped / c->rx_flood_checked);
+  }
+  if(c->lz_tx_bytes_in) {
+    printf("%-18s %.1f%% of the bytes, %.1f us per packet\n", "lz_ratio",
+           100.0 * c->lz_tx_bytes_out / c->lz_tx_bytes_in, c->lz_tx_cpu_ns / 1000.0 / c->lz_tx_packets);
+  }
+}
+
+static void print_json(const struct shmstats_page* s) {
+  const struct shmstats_counters* c = &s->c;
+  size_t i;
+
+  printf("{\"pid\":%u,\"node\":%u,\"uptime_us\":%lu",
+         s->pid, s->node_id, (unsigned long) (s->updated_us - s->started_us));
+  for(i=0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+    printf(",\"%s\":%lu", counters[i].name,
+           (unsigned long) *(const uint64_t*) ((const uint8_t*) c + counters[i].offset));
+  }
+  printf(",\"stage_depth\":%u,\"arq_pending\":%u", c->stage_depth, c->arq_pending);
+  printf(",\"snr_last\":%d,\"snr_min\":%d,\"snr_max\":%d,\"snr_sum\":%ld}\n",
+         c->snr_last, c->snr_min, c->snr_max, (long) c->snr_sum);
+}
+
+void usage(FILE* out, char* name) {
+  fprintf(out, "Usage: %s [-f stats_file] [-i seconds] [-j]\n", name);
+  fprintf(out, "\n");
+  fprintf(out, "  -f: stats file of the lora_iface instance (default: %s)\n", SHMSTATS_DEFAULT_FILE);
+  fprintf(out, "  -i: print again every this many seconds\n");
+  fprintf(out, "  -j: print JSON\n");
+}
+
+int main(int argc, char* argv[]) {
+  const struct shmstats_page* page;
+  struct shmstats_page snap;
+  const char* path = SHMSTATS_DEFAULT_FILE;
+  double interval = 0;
+  int json = 0;
+  size_t size;
+  int opt;
+
+  while((opt = getopt(argc, argv, "f:i:j")) > 0) {
+    switch(opt) {
+      case 'f':
+        path = optarg;
+        break;
+      case 'i':
+        interval = atof(optarg);
+        break;
+      case 'j':
+        json = 1;
+        break;
+      default:
+        usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+
+  page = shmstats_open(path, &size);
+  if(!page) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    fprintf(stderr, "Are you sure you have a running lora_iface instance?\n");
+    return 1;
+  }
+
+  while(1) {
+    if(shmstats_snapshot(page, size, &snap) < 0) {
+      fprintf(stderr, "No consistent snapshot of %s\n", path);
+      return 1;
+    }
+    if(snap.version > SHMSTATS_VERSION && !json) {
+      printf("(lora_iface is newer, showing the counters known to this version)\n");
+    }
+
+    if(json) {
+      print_json(&snap);
+    } else {
+      print_text(&snap);
+    }
+    fflush(stdout);
+
+    if(interval <= 0) {
+      break;
+    }
+    usleep(interval * 1000000);
+    if(!json) {
+      printf("\n");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+// Latency of packets through each stage between the TUN interface
+// and the radio.
+//
+// Every stage has a histogram in the style of HdrHistogram: values
+// are bucketed by their highest bits so the relative error is the same
+// from microseconds to minutes. Recording a value is a few
+// instructions and the histograms never allocate, so they are always
+// on. They can be read (and reset) with lora_iface -l (-L).
+//
+// Time spent in the kernel's transmit queue is not visible from the
+// TUN file descriptor. Packets are only read when the link layer can
+// take them, so that wait is the kernel's and happens before
+// TRACE_STAGED starts.
+
+struct trace_hist trace_hists[TRACE_STAGES];
+
+static const char* trace_names[TRACE_STAGES] = {
+  "staged",
+  "link_queue",
+  "serial",
+  "airtime",
+  "tx_total",
+  "rx"
+};
+
+void trace_reset() {
+  memset(trace_hists, 0, sizeof(trace_hists));
+}
+
+int trace_bucket(uint64_t us) {
+  int shift;
+
+  if(us < TRACE_SUB_COUNT) {
+    return us;
+  }
+  if(us >> TRACE_MAX_BITS) {
+    return TRACE_BUCKETS - 1;
+  }
+
+  // keep the top TRACE_SUB_BITS - 1 bits below the leading one
+  shift = 63 - __builtin_clzll(us) - (TRACE_SUB_BITS - 1);
+  return TRACE_SUB_COUNT + (shift - 1) * (TRACE_SUB_COUNT / 2)
+    + (int) (us >> shift) - TRACE_SUB_COUNT / 2;
+}
+
+// lowest value that goes in this bucket
+uint64_t trace_bucket_value(int bucket) {
+  int shift;
+
+  if(bucket < TRACE_SUB_COUNT) {
+    return bucket;
+  }
+  bucket -= TRACE_SUB_COUNT;
+  shift = bucket / (TRACE_SUB_COUNT / 2) + 1;
+  return (uint64_t) (bucket % (TRACE_SUB_COUNT / 2) + TRACE_SUB_COUNT / 2) << shift;
+}
+
+void trace_record(enum trace_stage stage, uint64_t us) {
+  struct trace_hist* h = &trace_hists[stage];
+
+  if(!h->count || us < h->min) {
+    h->min = us;
+  }
+  if(us > h->max) {
+    h->max = us;
+  }
+  h->count++;
+  h->sum += us;
+  h->buckets[trace_bucket(us)]++;
+}
+
+// record the time from start until now, if start was set
+void trace_since(enum trace_stage stage, uint64_t start, uint64_t now) {
+  if(!start || now < start) {
+    return;
+  }
+  trace_record(stage, now - start);
+}
+
+// smallest value that p (0-1) of the recorded values are at or below,
+// rounded up to the end of its bucket
+uint64_t trace_percentile(const struct trace_hist* h, double p) {
+  uint64_t want;
+  uint64_t seen = 0;
+  uint64_t value;
+  int i;
+
+  if(!h->count) {
+    return 0;
+  }
+
+  want = p * h->count + 0.999999;
+  if(want < 1) {
+    want = 1;
+  }
+
+  for(i=0; i < TRACE_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if(seen >= want) {
+      break;
+    }
+  }
+  if(i >= TRACE_BUCKETS - 1) {
+    return h->max;
+  }
+
+  value = trace_bucket_value(i + 1) - 1;
+  if(value > h->max) {
+    value = h->max;
+  }
+  if(value < h->min) {
+    value = h->min;
+  }
+  return value;
+}
+
+// write the histograms as a table, in microseconds.
+// returns the length written, whole lines only
+size_t trace_dump(char* buf, size_t size) {
+  struct trace_hist* h;
+  char line[160];
+  size_t len = 0;
+  int n;
+  int i;
+
+  if(!size) {
+    return 0;
+  }
+  buf[0] = '\0';
+
+  for(i=-1; i < TRACE_STAGES; i++) {
+    if(i < 0) {
+      n = snprintf(line, sizeof(line), "%-10s %8s %10s %10s %10s %10s %10s %10s %10s\n",
+                   "stage (us)", "count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+    } else {
+      h = &trace_hists[i];
+      n = snprintf(line, sizeof(line), "%-10s %8lu %10lu %10lu %10lu %10lu %10lu %10lu %10lu\n",
+                   trace_names[i], (unsigned long) h->count, (unsigned long) h->min,
+                   (unsigned long) (h->count ? h->sum / h->count : 0),
+                   (unsigned long) trace_percentile(h, 0.5),
+                   (unsigned long) trace_percentile(h, 0.9),
+                   (unsigned long) trace_percentile(h, 0.99),
+                   (unsigned long) trace_percentile(h, 0.999),
+                   (unsigned long) h->max);
+    }
+    if(n < 0 || len + n >= size) {
+      break;
+    }
+    memcpy(buf + len, line, n + 1);
+    len += n;
+  }
+  return len;
+}
@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// histogram resolution: values below TRACE_SUB_COUNT microseconds are
+// exact, above that every power of two is split into TRACE_SUB_COUNT / 2
+// buckets, which keeps the error below 1.6%
+#define TRACE_SUB_BITS (7)
+#define TRACE_SUB_COUNT (1 << TRACE_SUB_BITS)
+#define TRACE_MAX_BITS (32) // larger values (over 71 minutes) are clamped
+#define TRACE_BUCKETS (TRACE_SUB_COUNT + (TRACE_MAX_BITS - TRACE_SUB_BITS) * (TRACE_SUB_COUNT / 2))
+
+enum trace_stage {
+  TRACE_STAGED,   // read from the TUN interface -> taken by the link layer
+  TRACE_QUEUED,   // taken by the link layer -> its first "radio tx" written
+  TRACE_SERIAL,   // "radio tx" written -> "ok"
+  TRACE_AIRTIME,  // "ok" -> "radio_tx_ok"
+  TRACE_TX_TOTAL, // read from the TUN interface -> "radio_tx_ok" of its last frame
+  TRACE_RX,       // "radio_rx" line -> written to the TUN interface
+  TRACE_STAGES
+};
+
+struct trace_hist {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint32_t buckets[TRACE_BUCKETS];
+};
+
+// timestamps of a packet on its way to the radio,
+// carried along with each of its frames
+struct trace_tag {
+  uint64_t read;   // read from the TUN interface, 0 if not traced
+  uint64_t queued; // taken by the link layer
+  uint8_t first;   // first frame of the packet
+  uint8_t last;    // last frame of the packet
+};
+
+extern struct trace_hist trace_hists[TRACE_STAGES];
+
+void trace_reset();
+int trace_bucket(uint64_t us);
+uint64_t trace_bucket_value(int bucket);
+void trace_record(enum trace_stage stage, uint64_t us);
+void trace_since(enum trace_stage stage, uint64_t start, uint64_t now);
+uint64_t trace_percentile(const struct trace_hist* h, double p);
+size_t trace_dump(char* buf, size_t size);
+
+#endif
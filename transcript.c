@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "transcript.h"
+
+// Transcripts of everything lora_iface exchanged with the RN2903 and
+// the TUN interface, for replaying a field run against a new build.
+//
+// A transcript starts with TRANSCRIPT_MAGIC, a version byte, the start
+// time and the command line it was recorded with. Then come records of
+//
+//   type (1 byte) | time since the previous record in us | length | data
+//
+// with the time, the length and the start time as LEB128 varints.
+// Recording appends to a buffer that is written out once per event
+// loop iteration, so it adds no system calls to handling a line.
+//
+// On replay the serial port and the TUN interface are socketpairs held
+// by this module. Inputs are fed one at a time in recorded order and
+// every input waits until the daemon has read the one before it and
+// written everything it wrote at that point, which it must do with the
+// same bytes. The daemon clocks (link_clock, rn2903_clock) run on the
+// time of the last input, so ARQ timeouts and airtime come out as
+// recorded however fast the replay goes.
+
+#define TRANSCRIPT_BUF_SIZE (64 * 1024)
+#define TRANSCRIPT_REC_HDR_MAX (1 + 10 + 10)
+#define TRANSCRIPT_MAX_PACKET (64 * 1024)
+
+struct transcript_rec {
+  int type;
+  uint64_t time_us;
+  const uint8_t* data;
+  size_t len;
+};
+
+struct transcript_stats transcript_stats;
+
+// recording
+static int tr_fd = -1;
+static uint8_t tr_buf[TRANSCRIPT_BUF_SIZE];
+static size_t tr_buf_len = 0;
+static uint64_t tr_last_us = 0;
+
+// replaying
+static uint8_t* tr_map = NULL;
+static size_t tr_map_size = 0;
+static size_t tr_pos = 0;
+static int tr_fast = 0;
+static int tr_serial = -1;        // our ends of the socketpairs
+static int tr_tun = -1;
+static int tr_daemon_serial = -1; // and the daemon's
+static int tr_daemon_tun = -1;
+static struct transcript_rec tr_rec;
+static int tr_have_rec = 0;
+static size_t tr_serial_got = 0;  // bytes of tr_rec matched so far
+static uint64_t tr_start_us = 0;  // recorded start time
+static uint64_t tr_now = 0;       // virtual clock
+static uint64_t tr_real_start = 0;
+static uint64_t tr_real_progress = 0;
+static uint64_t tr_real_end = 0;
+static int tr_done = 0;
+static int tr_failed = 0;
+static char tr_args[256];
+
+static uint64_t real_now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static size_t put_varint(uint8_t* p, uint64_t v) {
+  size_t i = 0;
+
+  while(v >= 0x80) {
+    p[i++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[i++] = v;
+  return i;
+}
+
+// returns 0 or -1 if the varint doesn't end before len
+static int get_varint(const uint8_t* p, size_t len, size_t* pos, uint64_t* v) {
+  int shift = 0;
+
+  *v = 0;
+  while(*pos < len && shift < 64) {
+    *v |= (uint64_t) (p[*pos] & 0x7f) << shift;
+    if(!(p[(*pos)++] & 0x80)) {
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+static int write_all(int fd, const uint8_t* buf, size_t len) {
+  ssize_t ret;
+
+  while(len > 0) {
+    ret = write(fd, buf, len);
+    if(ret < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+static void record_failed() {
+  fprintf(stderr, "Failed to write transcript, recording stopped: %s\n", strerror(errno));
+  close(tr_fd);
+  tr_fd = -1;
+}
+
+int transcript_record_open(const char* path, const char* args) {
+  size_t args_len = strlen(args);
+
+  tr_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(tr_fd < 0) {
+    return -1;
+  }
+  if(args_len > sizeof(tr_args) - 1) {
+    args_len = sizeof(tr_args) - 1;
+  }
+  tr_last_us = real_now_us();
+
+  memcpy(tr_buf, TRANSCRIPT_MAGIC, 4);
+  tr_buf_len = 4;
+  tr_buf[tr_buf_len++] = TRANSCRIPT_VERSION;
+  tr_buf_len += put_varint(tr_buf + tr_buf_len, tr_last_us);
+  tr_buf_len += put_varint(tr_buf + tr_buf_len, args_len);
+  memcpy(tr_buf + tr_buf_len, args, args_len);
+  tr_buf_len += args_len;
+  memset(&transcript_stats, 0, sizeof(transcript_stats));
+  return 0;
+}
+
+void transcript_flush() {
+  if(tr_fd < 0 || tr_buf_len == 0) {
+    return;
+  }
+  if(write_all(tr_fd, tr_buf, tr_buf_len) < 0) {
+    record_failed();
+  }
+  tr_buf_len = 0;
+}
+
+void transcript_record(int type, const void* data, size_t len) {
+  uint64_t now;
+
+  if(tr_fd < 0) {
+    return;
+  }
+  if(tr_buf_len + TRANSCRIPT_REC_HDR_MAX + len > sizeof(tr_buf)) {
+    transcript_flush();
+    if(tr_fd < 0) {
+      return;
+    }
+  }
+
+  now = real_now_us();
+  tr_buf[tr_buf_len++] = type;
+  tr_buf_len += put_varint(tr_buf + tr_buf_len, now - tr_last_us);
+  tr_buf_len += put_varint(tr_buf + tr_buf_len, len);
+  tr_last_us = now;
+  transcript_stats.records++;
+
+  if(len > sizeof(tr_buf) - tr_buf_len) {
+    // bigger than the whole buffer, goes out directly
+    transcript_flush();
+    if(tr_fd >= 0 && write_all(tr_fd, (const uint8_t*) data, len) < 0) {
+      record_failed();
+    }
+    return;
+  }
+  memcpy(tr_buf + tr_buf_len, data, len);
+  tr_buf_len += len;
+}
+
+// returns 1 if there is another record, 0 at the end and -1 if the
+// transcript is cut short
+static int next_record(struct transcript_rec* rec) {
+  uint64_t delta;
+  uint64_t len;
+
+  if(tr_pos == tr_map_size) {
+    return 0;
+  }
+  rec->type = tr_map[tr_pos++];
+  if(rec->type > TRANSCRIPT_TUN_OUT
+     || get_varint(tr_map, tr_map_size, &tr_pos, &delta) < 0
+     || get_varint(tr_map, tr_map_size, &tr_pos, &len) < 0
+     || len > tr_map_size - tr_pos) {
+    return -1;
+  }
+  rec->time_us += delta;
+  rec->data = tr_map + tr_pos;
+  rec->len = len;
+  tr_pos += len;
+  return 1;
+}
+
+static int nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// drop the mapping of a transcript that can't be replayed, keeping errno
+static void tr_unmap() {
+  int err = errno;
+
+  munmap(tr_map, tr_map_size);
+  tr_map = NULL;
+  errno = err;
+}
+
+int transcript_replay_open(const char* path, int fast, int* serial_fd, int* tun_fd) {
+  struct stat st;
+  uint64_t args_len;
+  int sv[2];
+  int tv[2];
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    return -1;
+  }
+  if(fstat(fd, &st) < 0 || st.st_size < 5) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  tr_map = (uint8_t*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(tr_map == MAP_FAILED) {
+    tr_map = NULL;
+    return -1;
+  }
+  tr_map_size = st.st_size;
+
+  tr_pos = 5;
+  if(memcmp(tr_map, TRANSCRIPT_MAGIC, 4) || tr_map[4] != TRANSCRIPT_VERSION
+     || get_varint(tr_map, tr_map_size, &tr_pos, &tr_start_us) < 0
+     || get_varint(tr_map, tr_map_size, &tr_pos, &args_len) < 0
+     || args_len > tr_map_size - tr_pos || args_len >= sizeof(tr_args)) {
+    tr_unmap();
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(tr_args, tr_map + tr_pos, args_len);
+  tr_args[args_len] = '\0';
+  tr_pos += args_len;
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    tr_unmap();
+    return -1;
+  }
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tv) < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    tr_unmap();
+    return -1;
+  }
+  tr_daemon_serial = *serial_fd = sv[0];
+  tr_serial = sv[1];
+  tr_daemon_tun = *tun_fd = tv[0];
+  tr_tun = tv[1];
+  nonblocking(tr_serial);
+  nonblocking(tr_tun);
+
+  memset(&tr_rec, 0, sizeof(tr_rec));
+  tr_rec.time_us = tr_start_us;
+  tr_have_rec = 0;
+  tr_serial_got = 0;
+  tr_now = tr_start_us;
+  tr_fast = fast;
+  tr_done = 0;
+  tr_failed = 0;
+  tr_real_start = tr_real_progress = real_now_us();
+  memset(&transcript_stats, 0, sizeof(transcript_stats));
+  return 0;
+}
+
+int transcript_replaying() {
+  return tr_map != NULL;
+}
+
+uint64_t transcript_now_us() {
+  return tr_now;
+}
+
+// print data as text with anything unprintable escaped
+static void print_data(FILE* out, const uint8_t* data, size_t len) {
+  size_t i;
+
+  for(i=0; i < len && i < 80; i++) {
+    if(data[i] >= 0x20 && data[i] < 0x7f && data[i] != '\\') {
+      fputc(data[i], out);
+    } else {
+      fprintf(out, "\\x%02x", data[i]);
+    }
+  }
+  if(len > 80) {
+    fprintf(out, "...");
+  }
+  fprintf(out, " (%zu bytes)\n", len);
+}
+
+static int replay_failed(const char* what, const uint8_t* got, size_t got_len) {
+  const char* names[] = { "serial input", "serial output", "TUN input", "TUN output" };
+
+  fprintf(stderr, "Replay diverged at record %lu (%s, %.6f s in): %s\n",
+          transcript_stats.records + 1, names[tr_rec.type],
+          (tr_rec.time_us - tr_start_us) / 1e6, what);
+  fprintf(stderr, "  expected: ");
+  print_data(stderr, tr_rec.data, tr_rec.len);
+  if(got) {
+    fprintf(stderr, "  got:      ");
+    print_data(stderr, got, got_len);
+  }
+  fprintf(stderr, "  recorded with: %s\n", tr_args);
+  tr_failed = 1;
+  tr_done = 1;
+  tr_real_end = real_now_us();
+  return 1;
+}
+
+static int pending_input(int fd) {
+  int n = 0;
+
+  if(ioctl(fd, FIONREAD, &n) < 0) {
+    return 0;
+  }
+  return n > 0;
+}
+
+// match what the daemon wrote against the current output record.
+// returns 1 if it matched, 0 if more is to come and -1 if it differs
+static int replay_output() {
+  static uint8_t pkt[TRANSCRIPT_MAX_PACKET];
+  uint8_t buf[1024];
+  size_t want;
+  ssize_t len;
+
+  if(tr_rec.type == TRANSCRIPT_TUN_OUT) {
+    len = recv(tr_tun, pkt, sizeof(pkt), MSG_DONTWAIT);
+    if(len < 0) {
+      return 0;
+    }
+    if((size_t) len != tr_rec.len || memcmp(pkt, tr_rec.data, len)) {
+      replay_failed("the daemon wrote a different packet", pkt, len);
+      return -1;
+    }
+    transcript_stats.tun_out++;
+    return 1;
+  }
+
+  // the serial port is a byte stream, a record may come in pieces
+  while(tr_serial_got < tr_rec.len) {
+    want = tr_rec.len - tr_serial_got;
+    if(want > sizeof(buf)) {
+      want = sizeof(buf);
+    }
+    len = recv(tr_serial, buf, want, MSG_DONTWAIT);
+    if(len <= 0) {
+      return 0;
+    }
+    if(memcmp(buf, tr_rec.data + tr_serial_got, len)) {
+      replay_failed("the daemon sent something else to the RN2903", buf, len);
+      return -1;
+    }
+    tr_serial_got += len;
+  }
+  tr_serial_got = 0;
+  transcript_stats.serial_out_bytes += tr_rec.len;
+  return 1;
+}
+
+// returns 1 if it was fed, 0 if it has to wait
+static int replay_input(uint64_t real_now) {
+  ssize_t ret;
+
+  // one input at a time, the daemon reads it before the next one
+  if(pending_input(tr_daemon_serial) || pending_input(tr_daemon_tun)) {
+    return 0;
+  }
+  if(!tr_fast && real_now < tr_real_start + (tr_rec.time_us - tr_start_us)) {
+    return 0;
+  }
+
+  tr_now = tr_rec.time_us;
+  if(tr_rec.type == TRANSCRIPT_TUN_IN) {
+    ret = send(tr_tun, tr_rec.data, tr_rec.len, 0);
+    transcript_stats.tun_in++;
+  } else {
+    ret = write_all(tr_serial, tr_rec.data, tr_rec.len);
+    transcript_stats.serial_in_bytes += tr_rec.len;
+  }
+  if(ret < 0) {
+    replay_failed(strerror(errno), NULL, 0);
+    return -1;
+  }
+  return 1;
+}
+
+// do whatever can be done now.
+// returns 1 when the replay is over and 0 otherwise
+int transcript_replay_step() {
+  uint64_t real_now;
+  uint64_t since;
+  uint64_t due;
+  int ret;
+
+  if(tr_done) {
+    return 1;
+  }
+
+  real_now = real_now_us();
+  while(1) {
+    if(!tr_have_rec) {
+      ret = next_record(&tr_rec);
+      if(ret < 0) {
+        fprintf(stderr, "Transcript is cut short after record %lu\n", transcript_stats.records);
+      }
+      if(ret <= 0) {
+        tr_done = 1;
+        tr_real_end = real_now;
+        return 1;
+      }
+      tr_have_rec = 1;
+    }
+
+    if(tr_rec.type == TRANSCRIPT_SERIAL_OUT || tr_rec.type == TRANSCRIPT_TUN_OUT) {
+      ret = replay_output();
+    } else {
+      ret = replay_input(real_now);
+    }
+    if(ret < 0) {
+      return 1;
+    }
+    if(ret == 0) {
+      break;
+    }
+    tr_have_rec = 0;
+    tr_real_progress = real_now;
+    transcript_stats.records++;
+  }
+
+  // waiting on the daemon, it should always answer right away
+  since = tr_real_progress;
+  if(!tr_fast && (tr_rec.type == TRANSCRIPT_SERIAL_IN || tr_rec.type == TRANSCRIPT_TUN_IN)) {
+    due = tr_real_start + (tr_rec.time_us - tr_start_us);
+    if(due > since) {
+      since = due;
+    }
+  }
+  if(real_now > since + TRANSCRIPT_STALL_US) {
+    return replay_failed("the daemon stalled", NULL, 0);
+  }
+  return 0;
+}
+
+int transcript_add_to_fd_set(fd_set* readfds, int maxfd) {
+  FD_SET(tr_serial, readfds);
+  FD_SET(tr_tun, readfds);
+  if(tr_serial > maxfd) {
+    maxfd = tr_serial;
+  }
+  return (tr_tun > maxfd) ? tr_tun : maxfd;
+}
+
+// how long the event loop may wait for something to happen
+void transcript_replay_timeout(struct timeval* tv) {
+  uint64_t real_now = real_now_us();
+  uint64_t wait = TRANSCRIPT_STALL_US / 4;
+  uint64_t due;
+
+  if(!tr_fast && tr_have_rec
+     && (tr_rec.type == TRANSCRIPT_SERIAL_IN || tr_rec.type == TRANSCRIPT_TUN_IN)) {
+    due = tr_real_start + (tr_rec.time_us - tr_start_us);
+    if(due <= real_now) {
+      wait = 1000; // the daemon hasn't read the last input yet
+    } else if(due - real_now < wait) {
+      wait = due - real_now;
+    }
+  }
+  tv->tv_sec = wait / 1000000;
+  tv->tv_usec = wait % 1000000;
+}
+
+// print a summary as JSON, returns 0 if the daemon did what the
+// transcript says and -1 otherwise
+int transcript_replay_report(FILE* out) {
+  double recorded_s = (tr_rec.time_us - tr_start_us) / 1e6;
+  double replay_s = (tr_real_end - tr_real_start) / 1e6;
+
+  fprintf(out, "{\"result\":\"%s\",\"records\":%lu,\"serial_in_bytes\":%lu,\"serial_out_bytes\":%lu,"
+          "\"tun_in\":%lu,\"tun_out\":%lu,\"recorded_s\":%.3f,\"replay_s\":%.3f,"
+          "\"records_per_s\":%.0f,\"speedup\":%.1f}\n",
+          tr_failed ? "diverged" : "identical", transcript_stats.records,
+          transcript_stats.serial_in_bytes, transcript_stats.serial_out_bytes,
+          transcript_stats.tun_in, transcript_stats.tun_out, recorded_s, replay_s,
+          replay_s > 0 ? transcript_stats.records / replay_s : 0,
+          replay_s > 0 ? recorded_s / replay_s : 0);
+  return tr_failed ? -1 : 0;
+}
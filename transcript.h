@@ -0,0 +1,46 @@
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/select.h>
+
+// record types, TRANSCRIPT_SERIAL_IN and TRANSCRIPT_SERIAL_OUT match
+// the direction argument of rn2903_tap
+#define TRANSCRIPT_SERIAL_IN (0)  // read from the RN2903
+#define TRANSCRIPT_SERIAL_OUT (1) // written to the RN2903
+#define TRANSCRIPT_TUN_IN (2)     // packet read from the TUN interface
+#define TRANSCRIPT_TUN_OUT (3)    // packet written to the TUN interface
+
+#define TRANSCRIPT_MAGIC "LRTR"
+#define TRANSCRIPT_VERSION (1)
+
+// replay gives up when the daemon does nothing for this long
+#define TRANSCRIPT_STALL_US (2000000)
+
+struct transcript_stats {
+  unsigned long records;
+  unsigned long serial_in_bytes;
+  unsigned long serial_out_bytes;
+  unsigned long tun_in;
+  unsigned long tun_out;
+};
+
+extern struct transcript_stats transcript_stats;
+
+// recording
+int transcript_record_open(const char* path, const char* args);
+void transcript_record(int type, const void* data, size_t len);
+void transcript_flush();
+
+// replaying, the daemon gets serial_fd and tun_fd to use
+int transcript_replay_open(const char* path, int fast, int* serial_fd, int* tun_fd);
+int transcript_replaying();
+uint64_t transcript_now_us();
+int transcript_replay_step();
+int transcript_add_to_fd_set(fd_set* readfds, int maxfd);
+void transcript_replay_timeout(struct timeval* tv);
+int transcript_replay_report(FILE* out);
+
+#endif
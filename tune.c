@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "tune.h"
+#include "link.h"
+#include "arq.h"
+#include "frag.h"
+#include "aead.h"
+
+// Interface tuning (see tune.h).
+//
+// The kernel's queue in front of the TUN interface should hold about
+// TUNE_QUEUE_DELAY_US worth of packets: a few at SF12, where a packet
+// can take seconds, and many more at SF7. The time per packet is
+// measured where it matters, between the link layer taking one packet
+// and the next while packets are waiting for it, so it includes
+// fragments, retransmissions, rx windows and raw frames in between.
+//
+// The MTU is as many fragments as fit in TUNE_PACKET_AIRTIME_US of
+// airtime at the rate ARQ has measured, and as few as get through with
+// the loss seen by ARQ (retransmissions per frame sent) TUNE_DELIVERY
+// of the time. Without ARQ there is no loss to go by.
+//
+// Every TUNE_INTERVAL_US the targets are worked out again and applied
+// if they differ by more than 1/TUNE_HYSTERESIS from what is set.
+//
+// The MTU never crosses TUNE_IPV6_MIN_MTU: it stays on the side the
+// interface started on, so IPv6 is kept if it was there and an
+// interface without it doesn't come and go.
+
+struct tune_stats tune_stats;
+
+int (*tune_set_mtu)(int mtu) = NULL;
+int (*tune_set_qlen)(int qlen) = NULL;
+
+static int tune_on = 0;
+static int tune_mtu_min, tune_mtu_max;
+static int tune_qlen_min, tune_qlen_max;
+
+static uint64_t tune_last_us;       // of the last update
+static uint64_t tune_taken_us = 0;  // the link took the last packet
+static unsigned long tune_packets;  // time per packet samples
+static unsigned long tune_frames;   // link_stats.tx_frames at the last update
+static unsigned long tune_retransmits;
+static unsigned long tune_frames_seen;
+
+// "min-max" within lo and hi. returns 0 or -1
+int tune_parse_bounds(const char* s, int lo, int hi, int* min, int* max) {
+  char* end;
+
+  *min = strtol(s, &end, 10);
+  if(end == s || *end != '-') {
+    return -1;
+  }
+  s = end + 1;
+  *max = strtol(s, &end, 10);
+  if(end == s || *end) {
+    return -1;
+  }
+  if(*min < lo || *max > hi || *min > *max) {
+    return -1;
+  }
+  return 0;
+}
+
+// mtu and qlen are what the interface has now
+int tune_init(int mtu_min, int mtu_max, int qlen_min, int qlen_max, int mtu, int qlen, uint64_t now) {
+  tune_on = 0;
+  if(mtu < 0 || qlen < 0) {
+    fprintf(stderr, "Not tuning the interface, its MTU and txqueuelen can't be read\n");
+    return -1;
+  }
+
+  memset(&tune_stats, 0, sizeof(tune_stats));
+  tune_stats.mtu = mtu;
+  tune_stats.qlen = qlen;
+  tune_mtu_min = mtu_min;
+  tune_mtu_max = mtu_max;
+  if(mtu >= TUNE_IPV6_MIN_MTU && tune_mtu_min < TUNE_IPV6_MIN_MTU) {
+    tune_mtu_min = TUNE_IPV6_MIN_MTU;
+  } else if(mtu < TUNE_IPV6_MIN_MTU && tune_mtu_max >= TUNE_IPV6_MIN_MTU) {
+    tune_mtu_max = TUNE_IPV6_MIN_MTU - 1;
+  }
+  tune_qlen_min = qlen_min;
+  tune_qlen_max = qlen_max;
+
+  tune_last_us = now;
+  tune_taken_us = 0;
+  tune_packets = 0;
+  tune_frames = link_stats.tx_frames;
+  tune_retransmits = arq_stats.retransmits;
+  tune_frames_seen = 0;
+  tune_on = 1;
+  return 0;
+}
+
+int tune_enabled() {
+  return tune_on;
+}
+
+// the link layer took a packet read from the interface at read_us (0
+// if it didn't come from there)
+void tune_packet_taken(uint64_t read_us, uint64_t now) {
+  uint64_t sample;
+
+  if(!tune_on) {
+    return;
+  }
+  // the interface is read as soon as there is room, so if it was read
+  // right after the last one was taken (or before) it was waiting and
+  // the link was busy all the time in between
+  if(tune_taken_us && read_us && read_us <= tune_taken_us + TUNE_QUEUED_US) {
+    sample = now - tune_taken_us;
+    if(!tune_packets) {
+      tune_stats.packet_us = sample;
+    } else {
+      // EWMA with a weight of 1/8 for the new sample, as in arq.c
+      tune_stats.packet_us = (tune_stats.packet_us * 7 + sample) / 8;
+    }
+    tune_packets++;
+  }
+  tune_taken_us = now;
+}
+
+static int tune_clamp(long v, int min, int max) {
+  if(v < min) {
+    return min;
+  }
+  if(v > max) {
+    return max;
+  }
+  return v;
+}
+
+// far enough from cur to be worth a change
+static int tune_differs(int target, int cur) {
+  return abs(target - cur) * TUNE_HYSTERESIS > cur;
+}
+
+static int tune_target_mtu() {
+  uint64_t frame_us = arq_airtime_us(LINK_MAX_FRAME);
+  unsigned long delivered = 1000;
+  long frames;
+  long n;
+
+  frames = (frame_us > 0) ? TUNE_PACKET_AIRTIME_US / frame_us : FRAG_MAX_FRAGMENTS;
+  if(frames > FRAG_MAX_FRAGMENTS) {
+    frames = FRAG_MAX_FRAGMENTS;
+  }
+  for(n=1; n <= frames; n++) {
+    delivered = delivered * (1000 - tune_stats.loss) / 1000;
+    if(delivered < TUNE_DELIVERY) {
+      break;
+    }
+  }
+  frames = (n > 1) ? n - 1 : 1;
+  return tune_clamp(frames * (long) (FRAG_MAX_CHUNK - aead_overhead()), tune_mtu_min, tune_mtu_max);
+}
+
+static int tune_target_qlen() {
+  if(tune_packets < TUNE_MIN_PACKETS || !tune_stats.packet_us) {
+    return tune_stats.qlen;
+  }
+  return tune_clamp(TUNE_QUEUE_DELAY_US / tune_stats.packet_us, tune_qlen_min, tune_qlen_max);
+}
+
+// work out the targets and apply them if they changed enough.
+// returns 1 if they were applied, 0 if not and -1 if setting one failed
+int tune_update(uint64_t now) {
+  unsigned long frames;
+  unsigned long retransmits;
+  unsigned long sample;
+  int mtu, qlen;
+  int changed = 0;
+  int failed = 0;
+
+  if(!tune_on || now - tune_last_us < TUNE_INTERVAL_US) {
+    return 0;
+  }
+  tune_last_us = now;
+
+  frames = link_stats.tx_frames - tune_frames;
+  retransmits = arq_stats.retransmits - tune_retransmits;
+  tune_frames = link_stats.tx_frames;
+  tune_retransmits = arq_stats.retransmits;
+  if(frames) {
+    sample = (retransmits >= frames) ? 1000 : retransmits * 1000 / frames;
+    tune_stats.loss = tune_frames_seen ? (tune_stats.loss * 3 + sample + 2) / 4 : sample;
+    tune_frames_seen += frames;
+  }
+  if(tune_frames_seen < TUNE_MIN_FRAMES) {
+    return 0;
+  }
+
+  mtu = tune_target_mtu();
+  qlen = tune_target_qlen();
+  if(!tune_differs(mtu, tune_stats.mtu)) {
+    mtu = tune_stats.mtu;
+  }
+  if(!tune_differs(qlen, tune_stats.qlen)) {
+    qlen = tune_stats.qlen;
+  }
+  if(mtu == (int) tune_stats.mtu && qlen == (int) tune_stats.qlen) {
+    return 0;
+  }
+
+  printf("Tuning the interface: mtu %lu -> %d, txqueuelen %lu -> %d "
+         "(%lu ms per frame, %lu ms per packet, %lu.%lu%% frames lost)\n",
+         tune_stats.mtu, mtu, tune_stats.qlen, qlen,
+         (unsigned long) (arq_airtime_us(LINK_MAX_FRAME) / 1000),
+         (unsigned long) (tune_stats.packet_us / 1000), tune_stats.loss / 10, tune_stats.loss % 10);
+
+  // each is recorded once it is set, so a failure of one doesn't
+  // leave the other wrong
+  if(mtu != (int) tune_stats.mtu) {
+    if(tune_set_mtu && tune_set_mtu(mtu) < 0) {
+      failed = 1;
+    } else {
+      tune_stats.mtu = mtu;
+      changed = 1;
+    }
+  }
+  if(qlen != (int) tune_stats.qlen) {
+    if(tune_set_qlen && tune_set_qlen(qlen) < 0) {
+      failed = 1;
+    } else {
+      tune_stats.qlen = qlen;
+      changed = 1;
+    }
+  }
+  tune_stats.changes += changed;
+  if(failed) {
+    tune_stats.failed++;
+    return -1;
+  }
+  return 1;
+}
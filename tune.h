@@ -0,0 +1,68 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Interface tuning: the MTU and txqueuelen of the TUN interface follow
+// what the link manages, within bounds given on the command line.
+
+// what lora_iface always used to set
+#define TUNE_DEFAULT_MTU (500)
+#define TUNE_DEFAULT_QLEN (20)
+
+#define TUNE_MIN_MTU (68)      // IPv4 minimum
+#define TUNE_MAX_MTU (1500)    // TCP_STAGE_MAX_PACKET
+// below this the kernel takes IPv6 off the interface, and its
+// addresses don't come back when the MTU goes up again
+#define TUNE_IPV6_MIN_MTU (1280)
+#define TUNE_MAX_QLEN (1000)
+
+// bounds used unless others are given
+#define TUNE_DEFAULT_MTU_MIN (256)
+#define TUNE_DEFAULT_MTU_MAX (1500)
+#define TUNE_DEFAULT_QLEN_MIN (2)
+#define TUNE_DEFAULT_QLEN_MAX (100)
+
+// a full kernel queue should drain in this long
+#define TUNE_QUEUE_DELAY_US (20000000)
+// a packet shouldn't take longer than this on air
+#define TUNE_PACKET_AIRTIME_US (4000000)
+// and should get through in one try at least this often (per mille)
+#define TUNE_DELIVERY (900)
+
+// how often the targets are worked out, and how much they must differ
+// from the current values (1/n) to be applied
+#define TUNE_INTERVAL_US (10000000)
+#define TUNE_HYSTERESIS (8)
+// measurements needed first
+#define TUNE_MIN_FRAMES (8)
+#define TUNE_MIN_PACKETS (4)
+
+// a packet read within this long of the link taking the one before
+// was already waiting for it
+#define TUNE_QUEUED_US (10000)
+
+struct tune_stats {
+  unsigned long mtu;          // as set on the interface
+  unsigned long qlen;
+  unsigned long changes;
+  unsigned long failed;       // couldn't be applied
+  unsigned long loss;         // frames retransmitted, per mille
+  uint64_t packet_us;         // time the link takes per packet when busy
+};
+
+extern struct tune_stats tune_stats;
+
+// apply a value to the interface, return 0 or -1
+extern int (*tune_set_mtu)(int mtu);
+extern int (*tune_set_qlen)(int qlen);
+
+int tune_parse_bounds(const char* s, int lo, int hi, int* min, int* max);
+int tune_init(int mtu_min, int mtu_max, int qlen_min, int qlen_max, int mtu, int qlen, uint64_t now);
+int tune_enabled();
+
+void tune_packet_taken(uint64_t read_us, uint64_t now);
+int tune_update(uint64_t now);
+
+#endif